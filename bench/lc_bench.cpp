@@ -0,0 +1,1117 @@
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "../include/async_client.h"
+#include "../include/attach.h"
+#include "../include/cassette.h"
+#include "../include/config.h"
+#include "../include/docs.h"
+#include "../include/history.h"
+#include "../include/openai.h"
+#include "../include/output.h"
+#include "../include/stream.h"
+#include "mock_server.h"
+
+extern char** environ;
+
+// 统计堆分配次数与字节数，供memory基准测试使用
+static std::atomic<uint64_t> g_allocations{0};
+static std::atomic<uint64_t> g_allocated_bytes{0};
+
+void* operator new(std::size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+// pmr arena等带对齐要求的分配走这一组重载
+void* operator new(std::size_t size, std::align_val_t align) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    g_allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    void* p = nullptr;
+    if (posix_memalign(&p, std::max(static_cast<std::size_t>(align), sizeof(void*)), size ? size : 1) == 0) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// 延迟样本统计
+struct LatencyStats {
+    std::vector<double> samples_ms;
+
+    void add(Clock::duration d) {
+        samples_ms.push_back(std::chrono::duration<double, std::milli>(d).count());
+    }
+
+    double percentile(double p) const {
+        if (samples_ms.empty()) {
+            return 0.0;
+        }
+        std::vector<double> sorted = samples_ms;
+        std::sort(sorted.begin(), sorted.end());
+        size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    double mean() const {
+        double sum = 0.0;
+        for (double v : samples_ms) {
+            sum += v;
+        }
+        return samples_ms.empty() ? 0.0 : sum / samples_ms.size();
+    }
+};
+
+void print_stats(const std::string& name, const LatencyStats& stats) {
+    std::printf("  %-24s n=%-5zu mean=%8.3fms p50=%8.3fms p99=%8.3fms\n",
+                name.c_str(), stats.samples_ms.size(), stats.mean(),
+                stats.percentile(50), stats.percentile(99));
+}
+
+void print_throughput(const std::string& name, const LatencyStats& stats, size_t bytes, size_t items) {
+    double seconds = stats.mean() / 1000.0;
+    std::printf("  %-24s %8.1f MB/s %10.1f ns/event\n",
+                name.c_str(), seconds > 0 ? bytes / seconds / 1e6 : 0.0,
+                items > 0 ? stats.mean() * 1e6 / items : 0.0);
+}
+
+lc::Config bench_config(const std::string& base_url) {
+    lc::Config config = lc::Config::default_config();
+    config.openai_base_url = base_url;
+    config.openai_api_key = "bench";
+    return config;
+}
+
+// 一次完整请求的首token延迟与总耗时
+struct CompletionTimes {
+    LatencyStats ttft;
+    LatencyStats total;
+    size_t failures = 0;
+};
+
+// 通过完整的chat_completion_stream路径发送请求并计时
+CompletionTimes measure_completions(const lc::Config& config, int iterations,
+                                    lc::openai::AsyncEngine* engine = nullptr) {
+    std::vector<lc::openai::Message> messages;
+    messages.emplace_back(lc::openai::Role::User, "ping");
+    lc::openai::StreamOptions options;
+    options.engine = engine;
+    CompletionTimes times;
+
+    for (int i = 0; i < iterations; ++i) {
+        auto start = Clock::now();
+        Clock::time_point first_token;
+        auto result = lc::openai::chat_completion_stream(
+            config, messages, [&first_token](const std::string& delta, bool) {
+                if (!delta.empty() && first_token == Clock::time_point()) {
+                    first_token = Clock::now();
+                }
+            }, "", false, options);
+        auto elapsed = Clock::now() - start;
+
+        if (!result.success) {
+            if (times.failures++ == 0) {
+                std::cerr << "  request failed: " << result.error_message << std::endl;
+            }
+            continue;
+        }
+        times.ttft.add(first_token - start);
+        times.total.add(elapsed);
+    }
+
+    return times;
+}
+
+const char* const DIALECTS[] = {"openai", "ollama", "anthropic"};
+
+// 构造一段按dialect格式、包含events个增量事件的流式响应体
+std::string make_stream(const std::string& dialect, size_t events, const std::string& token) {
+    std::string stream = lc::bench::stream_prologue(dialect, 1);
+    for (size_t i = 0; i < events; ++i) {
+        stream += lc::bench::stream_delta(dialect, token);
+    }
+    stream += lc::bench::stream_epilogue(dialect, 1, events, false);
+    return stream;
+}
+
+// 各方言流式解析与增量处理的吞吐量，按不同的网络读块大小喂入
+int bench_sse_parse(int iterations) {
+    const size_t events = 2000;
+    std::printf("sse_parse: %zu events per stream (%d iterations)\n", events, iterations);
+
+    for (const char* name : DIALECTS) {
+        lc::openai::Dialect dialect;
+        lc::openai::parse_dialect(name, dialect);
+        std::string stream = make_stream(name, events, "tok ");
+
+        for (size_t block : {16, 256, 4096, 65536}) {
+            lc::openai::StreamOptions options;
+            lc::openai::StreamCallback callback = [](const std::string&, bool) {};
+            LatencyStats stats;
+
+            for (int i = 0; i < iterations; ++i) {
+                lc::openai::StreamProcessor processor(callback, options, false);
+                processor.begin_attempt(dialect);
+
+                auto start = Clock::now();
+                for (size_t offset = 0; offset < stream.size(); offset += block) {
+                    processor.feed(stream.data() + offset, std::min(block, stream.size() - offset));
+                }
+                stats.add(Clock::now() - start);
+
+                if (!processor.done() || processor.accumulated().size() != events * 4) {
+                    std::cerr << "  " << name << " stream did not complete" << std::endl;
+                    return 1;
+                }
+            }
+
+            print_throughput(std::string(name) + " block " + std::to_string(block) + "B", stats,
+                             stream.size(), events);
+        }
+    }
+    return 0;
+}
+
+std::vector<lc::openai::Message> make_history(size_t count, size_t message_bytes) {
+    std::vector<lc::openai::Message> messages;
+    messages.emplace_back(lc::openai::Role::System, "You are a benchmark.");
+    for (size_t i = 0; i < count; ++i) {
+        auto role = i % 2 == 0 ? lc::openai::Role::User : lc::openai::Role::Assistant;
+        messages.emplace_back(role, std::string(message_bytes, 'x'));
+    }
+    return messages;
+}
+
+// 请求构造：消息序列化为JSON并组装请求头
+int bench_serialize(int iterations) {
+    std::printf("serialize: prepare_chat_request (%d iterations)\n", iterations);
+
+    lc::Config config = bench_config("https://api.openai.com/v1");
+    for (bool prefix_cache : {false, true}) {
+        // 开启prefix_cache后，除第一次外前缀都来自缓存，只序列化最后一条消息
+        config.prefix_cache = prefix_cache;
+        for (size_t count : {2, 20, 200}) {
+            auto messages = make_history(count, 1024);
+            LatencyStats stats;
+
+            for (int i = 0; i < iterations; ++i) {
+                lc::openai::PreparedRequest request;
+                std::string error;
+                auto start = Clock::now();
+                lc::openai::prepare_chat_request(config, messages, "", true, "", request, error, false);
+                stats.add(Clock::now() - start);
+            }
+
+            print_stats(std::to_string(count) + " messages x 1KB" + (prefix_cache ? " cached" : ""), stats);
+        }
+    }
+    return 0;
+}
+
+// 对话历史的读写
+int bench_history(int iterations) {
+    std::printf("history: save_messages / load_messages (%d iterations)\n", iterations);
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+        ("lc-bench-" + std::to_string(getpid()));
+    std::filesystem::path path = dir / "conversation_memory.json";
+
+    for (size_t count : {20, 1000}) {
+        auto messages = make_history(count, 512);
+        LatencyStats save_stats;
+        LatencyStats load_stats;
+
+        for (int i = 0; i < iterations; ++i) {
+            auto start = Clock::now();
+            lc::openai::save_messages(messages, path, static_cast<int>(count));
+            save_stats.add(Clock::now() - start);
+
+            start = Clock::now();
+            auto loaded = lc::openai::load_messages(path);
+            load_stats.add(Clock::now() - start);
+
+            if (!loaded || loaded->size() != count) {
+                std::cerr << "  history roundtrip failed" << std::endl;
+                std::filesystem::remove_all(dir);
+                return 1;
+            }
+        }
+
+        print_stats("save " + std::to_string(count) + " messages", save_stats);
+        print_stats("load " + std::to_string(count) + " messages", load_stats);
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// 历史全文检索：约100MB的归档分多次写入索引，测量每次保存的增量索引与查询延迟
+int bench_search(int iterations) {
+    constexpr size_t MESSAGES = 50000;
+    constexpr size_t MESSAGE_BYTES = 2048;
+    constexpr size_t BATCH = 2500;
+    std::printf("search: history index over %zu MB (%d iterations)\n", MESSAGES * MESSAGE_BYTES >> 20, iterations);
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+        ("lc-bench-search-" + std::to_string(getpid()));
+    std::filesystem::remove_all(dir);
+
+    // 词频近似Zipf分布的合成文本，另有一条消息含有只出现一次的词
+    uint64_t state = 88172645463325252ULL;
+    auto next = [&state]() {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    };
+    auto make_text = [&](size_t i) {
+        std::string text = "message " + std::to_string(i);
+        while (text.size() < MESSAGE_BYTES) {
+            uint64_t r = next();
+            text += " w" + std::to_string((r & 0xFFFF) % ((r >> 16) % 20000 + 1));
+        }
+        if (i == MESSAGES / 3) {
+            text += " iptables -A INPUT -p tcp --dport 2222 -j ACCEPT";
+        }
+        return text;
+    };
+
+    std::string error;
+    auto start = Clock::now();
+    for (size_t i = 0; i < MESSAGES; i += BATCH) {
+        std::vector<lc::openai::Message> batch;
+        for (size_t j = i; j < i + BATCH; ++j) {
+            batch.emplace_back(j % 2 == 0 ? lc::openai::Role::User : lc::openai::Role::Assistant, make_text(j));
+        }
+        if (!lc::history::index_messages(dir, batch, error)) {
+            std::cerr << "  indexing failed: " << error << std::endl;
+            std::filesystem::remove_all(dir);
+            return 1;
+        }
+    }
+    std::printf("  %-24s %.1fs\n", "build", std::chrono::duration<double>(Clock::now() - start).count());
+
+    // 一次保存：记忆窗口内的旧消息加上新的一轮
+    LatencyStats save_stats;
+    for (int i = 0; i < iterations; ++i) {
+        std::vector<lc::openai::Message> turn;
+        for (size_t j = 0; j < 2; ++j) {
+            turn.emplace_back(j == 0 ? lc::openai::Role::User : lc::openai::Role::Assistant,
+                              make_text(MESSAGES + i * 2 + j));
+        }
+        start = Clock::now();
+        if (!lc::history::index_messages(dir, turn, error)) {
+            std::cerr << "  indexing failed: " << error << std::endl;
+            std::filesystem::remove_all(dir);
+            return 1;
+        }
+        save_stats.add(Clock::now() - start);
+    }
+    print_stats("index one turn", save_stats);
+
+    const std::pair<const char*, const char*> queries[] = {
+        {"rare term", "iptables"},
+        {"rare phrase", "iptables dport 2222"},
+        {"common term", "w1"},
+        {"common terms", "w1 w2 w3"},
+    };
+    for (const auto& query : queries) {
+        LatencyStats stats;
+        size_t total = 0;
+        for (int i = 0; i < iterations; ++i) {
+            lc::history::Page page;
+            start = Clock::now();
+            if (!lc::history::search(dir, query.second, 1, 10, page, error)) {
+                std::cerr << "  search failed: " << error << std::endl;
+                std::filesystem::remove_all(dir);
+                return 1;
+            }
+            stats.add(Clock::now() - start);
+            total = page.total;
+        }
+        print_stats(std::string(query.first) + " (" + std::to_string(total) + ")", stats);
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// 本地文档索引：解析本机的man与tldr页面建立索引，测量打开索引与检索片段的延迟
+int bench_docs(int iterations) {
+    std::printf("docs: local man/tldr index (%d iterations)\n", iterations);
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+        ("lc-bench-docs-" + std::to_string(getpid()));
+    std::filesystem::remove_all(dir);
+
+    lc::docs::BuildStats build_stats;
+    std::string error;
+    if (!lc::docs::build(dir, lc::docs::default_man_dirs(), lc::docs::default_tldr_dirs(), 0, build_stats, error)) {
+        std::cerr << "  build failed: " << error << std::endl;
+        std::filesystem::remove_all(dir);
+        return 1;
+    }
+    std::printf("  %-24s %.2fs (%zu pages, %zu snippets, %.1f MB, %u threads)\n", "build", build_stats.seconds,
+                build_stats.files, build_stats.snippets, static_cast<double>(build_stats.bytes) / (1 << 20),
+                build_stats.threads);
+    if (build_stats.snippets == 0) {
+        std::printf("  no man or tldr pages found, skipping queries\n");
+        std::filesystem::remove_all(dir);
+        return 0;
+    }
+
+    LatencyStats open_stats;
+    for (int i = 0; i < iterations; ++i) {
+        lc::docs::Index index;
+        auto start = Clock::now();
+        if (!index.open(dir, error)) {
+            std::cerr << "  open failed: " << error << std::endl;
+            std::filesystem::remove_all(dir);
+            return 1;
+        }
+        open_stats.add(Clock::now() - start);
+    }
+    print_stats("open", open_stats);
+
+    lc::docs::Index index;
+    index.open(dir, error);
+    const std::pair<const char*, const char*> queries[] = {
+        {"command", "tar extract gzip archive"},
+        {"option", "find files modified in the last day"},
+        {"common term", "the file"},
+    };
+    for (const auto& query : queries) {
+        LatencyStats stats;
+        size_t matches = 0;
+        for (int i = 0; i < iterations; ++i) {
+            auto start = Clock::now();
+            matches = index.search(query.second, lc::docs::GROUNDING_SNIPPETS).size();
+            stats.add(Clock::now() - start);
+        }
+        print_stats(std::string(query.first) + " (" + std::to_string(matches) + ")", stats);
+    }
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+// --file附件：对比逐个顺序读入字符串（相当于cat a b c | lc）与并发映射后直接成帧写入消息存储
+int bench_attach(int iterations) {
+    constexpr size_t FILES = 256;
+    constexpr size_t FILE_BYTES = 256 << 10;
+    std::printf("attach: %zu files, %zu MB (%d iterations)\n", FILES, FILES * FILE_BYTES >> 20, iterations);
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+        ("lc-bench-attach-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir);
+    // 大小各不相同的文本文件，另有一个重复文件与一个二进制文件
+    std::vector<std::string> paths;
+    for (size_t i = 0; i < FILES; ++i) {
+        std::string line = "line of file " + std::to_string(i) + " with some log text\n";
+        std::string content;
+        while (content.size() < FILE_BYTES + i) {
+            content += line;
+        }
+        paths.push_back((dir / ("file-" + std::to_string(i) + ".log")).string());
+        std::ofstream(paths.back(), std::ios::binary) << content;
+    }
+    std::filesystem::copy_file(paths.front(), dir / "copy.log");
+    std::ofstream(dir / "image.bin", std::ios::binary) << std::string("\x89PNG\0\0", 6) << std::string(FILE_BYTES, 'x');
+    std::string pattern = (dir / "*").string();
+
+    LatencyStats sequential, attached;
+    size_t bytes = 0;
+    for (int i = 0; i < iterations; ++i) {
+        auto start = Clock::now();
+        std::string content;
+        for (const std::string& path : paths) {
+            std::ifstream file(path, std::ios::binary);
+            content.append(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        sequential.add(Clock::now() - start);
+
+        start = Clock::now();
+        std::vector<std::string> matched;
+        std::string error;
+        lc::attach::Attachments attachments;
+        if (!lc::attach::expand({pattern}, matched, error) || !attachments.open(matched, error)) {
+            std::cerr << "  attach failed: " << error << std::endl;
+            std::filesystem::remove_all(dir);
+            return 1;
+        }
+        std::unique_ptr<char[]> buffer(new char[attachments.size()]);
+        attachments.write(buffer.get());
+        attached.add(Clock::now() - start);
+        bytes = attachments.size();
+    }
+    print_stats("sequential read", sequential);
+    print_stats("attach", attached);
+    print_throughput("attach throughput", attached, bytes, FILES);
+
+    std::filesystem::remove_all(dir);
+    return 0;
+}
+
+struct MemoryUsage {
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+// 从此刻开始统计分配，场景中的准备工作可以放在调用之前
+void begin_counting() {
+    g_allocations = 0;
+    g_allocated_bytes = 0;
+}
+
+// 在子进程中运行场景，峰值RSS只反映该场景本身
+bool measure_memory(const std::string& name, const std::function<void()>& scenario) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        begin_counting();
+        scenario();
+        MemoryUsage usage{g_allocations.load(), g_allocated_bytes.load()};
+        _exit(write(fds[1], &usage, sizeof(usage)) == sizeof(usage) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    MemoryUsage usage;
+    ssize_t n = read(fds[0], &usage, sizeof(usage));
+    close(fds[0]);
+
+    int status = 0;
+    struct rusage rusage {};
+    wait4(pid, &status, 0, &rusage);
+    if (n != static_cast<ssize_t>(sizeof(usage)) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        std::printf("  %-24s failed\n", name.c_str());
+        return false;
+    }
+
+    // Linux上ru_maxrss以KB为单位
+    std::printf("  %-24s allocs %9llu  allocated %8.1f MB  peak rss %8.1f MB\n", name.c_str(),
+                static_cast<unsigned long long>(usage.allocations), usage.bytes / 1048576.0,
+                rusage.ru_maxrss / 1024.0);
+    return true;
+}
+
+// 长对话与大输入的分配次数和峰值内存：加载与保存1000轮历史、按lc的方式组装请求，以及100MB管道输入
+int bench_memory(int) {
+    std::printf("memory: allocations and peak RSS per scenario (forked)\n");
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+        ("lc-bench-memory-" + std::to_string(getpid()));
+    std::filesystem::path path = dir / "conversation_memory.json";
+    constexpr size_t turns = 1000;
+    if (!lc::openai::save_messages(make_history(turns * 2, 512), path, static_cast<int>(turns))) {
+        std::cerr << "  failed to write history" << std::endl;
+        return 1;
+    }
+
+    lc::Config config = bench_config("https://api.openai.com/v1");
+    auto prepare = [&config](const std::vector<lc::openai::Message>& messages) {
+        lc::openai::PreparedRequest request;
+        std::string error;
+        lc::openai::prepare_chat_request(config, messages, "", true, "", request, error, false);
+    };
+
+    bool ok = true;
+    ok &= measure_memory("baseline", [] {});
+    ok &= measure_memory("load 1k turns", [&path] {
+        auto loaded = lc::openai::load_messages(path);
+        if (!loaded || loaded->size() != turns * 2) {
+            _exit(1);
+        }
+    });
+    ok &= measure_memory("save 1k turns", [&path] {
+        auto loaded = lc::openai::load_messages(path);
+        begin_counting();
+        lc::openai::save_messages(*loaded, path, static_cast<int>(turns));
+    });
+    ok &= measure_memory("request 1k turns", [&path, &config, &prepare] {
+        // 与lc -m相同：系统提示、移入的历史、当前问题
+        std::vector<lc::openai::Message> messages;
+        messages.emplace_back(lc::openai::Role::System, config.system_prompt);
+        auto loaded = lc::openai::load_messages(path);
+        messages.insert(messages.end(), std::make_move_iterator(loaded->begin()),
+                        std::make_move_iterator(loaded->end()));
+        messages.emplace_back(lc::openai::Role::User, "Query: ping");
+        prepare(messages);
+    });
+    ok &= measure_memory("request 100MB input", [&prepare] {
+        std::string input;
+        input.reserve(100 << 20);
+        while (input.size() + 80 <= (100 << 20)) {
+            input.append(79, 'x');
+            input += '\n';
+        }
+        begin_counting();
+        std::vector<lc::openai::Message> messages;
+        messages.emplace_back(lc::openai::Role::User, std::move(input));
+        prepare(messages);
+    });
+
+    // 100MB的回答：默认在内存中累积，--output时直接写入文件，只保留开头的摘录
+    auto stream_response = [](lc::openai::StreamOptions& options, const lc::openai::StreamCallback& callback) {
+        const std::string event = lc::bench::stream_delta("openai", std::string(1023, 'x') + "\n");
+        std::string block;
+        while (block.size() + event.size() <= 65536) {
+            block += event;
+        }
+        size_t per_block = block.size() / event.size();
+
+        begin_counting();
+        lc::openai::StreamProcessor processor(callback, options, false);
+        processor.begin_attempt();
+        for (size_t events = 0; events < (100 << 10); events += per_block) {
+            processor.feed(block.data(), block.size());
+        }
+        if (processor.received_bytes() < (100 << 20)) {
+            _exit(1);
+        }
+    };
+    ok &= measure_memory("stream 100MB response", [&stream_response] {
+        lc::openai::StreamOptions options;
+        stream_response(options, [](const std::string&, bool) {});
+    });
+    ok &= measure_memory("stream 100MB to --output", [&stream_response, &dir] {
+        lc::output::FileWriter writer;
+        std::string error;
+        if (!writer.open(dir / "response.txt", false, error)) {
+            _exit(1);
+        }
+        lc::openai::StreamOptions options;
+        options.retain_bytes = lc::output::HISTORY_EXCERPT_BYTES;
+        options.reload_response = [&writer]() { return writer.read_back(); };
+        stream_response(options, [&writer](const std::string& delta, bool) { writer.write(delta); });
+        if (!writer.close()) {
+            _exit(1);
+        }
+    });
+
+    std::filesystem::remove_all(dir);
+    return ok ? 0 : 1;
+}
+
+// 对模拟服务的端到端首token延迟，对比阻塞客户端与异步引擎
+int bench_ttft(int iterations) {
+    lc::bench::MockOptions mock;
+    mock.tokens = 64;
+    mock.tokens_per_second = 2000;
+    mock.split_events = true;
+    std::printf("ttft: %zu tokens at %.0f tokens/s, split events (%d requests each)\n",
+                mock.tokens, mock.tokens_per_second, iterations);
+
+    lc::bench::MockServer server(mock);
+    if (!server.start()) {
+        std::cerr << "  failed to start mock server" << std::endl;
+        return 1;
+    }
+
+    lc::Config config = bench_config(server.base_url());
+    lc::openai::AsyncEngine engine;
+
+    for (bool async : {false, true}) {
+        CompletionTimes times = measure_completions(config, iterations, async ? &engine : nullptr);
+        std::string engine_name = async ? "async" : "blocking";
+        print_stats(engine_name + " ttft", times.ttft);
+        print_stats(engine_name + " total", times.total);
+        if (times.failures > 0) {
+            std::printf("  %-24s %zu\n", (engine_name + " failures").c_str(), times.failures);
+        }
+    }
+    return 0;
+}
+
+// 各方言的协议一致性：阻塞客户端与异步引擎分别对按该方言说话的模拟服务发请求，
+// 检查内容、token用量与非流式回答，再录制一次并回放，确认录制文件不含密钥；任何不符都使返回值非零
+int bench_dialects(int iterations) {
+    std::printf("dialects: streaming and non-streaming conformance (%d requests each)\n", iterations);
+
+    lc::openai::AsyncEngine engine;
+    bool ok = true;
+    for (const char* name : DIALECTS) {
+        lc::bench::MockOptions mock;
+        mock.tokens = 32;
+        mock.split_events = true;
+        mock.dialect = name;
+        lc::bench::MockServer server(mock);
+        if (!server.start()) {
+            std::cerr << "  failed to start mock server" << std::endl;
+            return 1;
+        }
+
+        lc::Config config = bench_config(server.base_url());
+        config.dialect = name;
+        config.prefix_cache = true;  // OpenAI方言因此请求usage事件
+        std::vector<lc::openai::Message> messages;
+        messages.emplace_back(lc::openai::Role::System, "You are a benchmark.");
+        messages.emplace_back(lc::openai::Role::User, "ping");
+        std::string expected;
+        for (size_t i = 0; i < mock.tokens; ++i) {
+            expected += mock.token;
+        }
+        expected = lc::openai::trim(expected);  // 与full_response一样去掉首尾空白
+
+        auto check = [&](const std::string& label, const lc::openai::ChatCompletionResult& result, size_t deltas) {
+            std::string problem;
+            if (!result.success) {
+                problem = result.error_message;
+            } else if (result.full_response != expected) {
+                problem = "content mismatch";
+            } else if (result.usage.completion_tokens != static_cast<long>(mock.tokens) ||
+                       result.usage.prompt_tokens <= 0) {
+                problem = "usage " + std::to_string(result.usage.prompt_tokens) + "/" +
+                          std::to_string(result.usage.completion_tokens);
+            } else if (deltas == 0) {
+                problem = "no deltas delivered";
+            }
+            if (!problem.empty()) {
+                std::printf("  %-24s FAIL %s\n", (std::string(name) + " " + label).c_str(), problem.c_str());
+                ok = false;
+            }
+            return problem.empty();
+        };
+
+        for (bool async : {false, true}) {
+            lc::openai::StreamOptions options;
+            options.engine = async ? &engine : nullptr;
+            LatencyStats stats;
+            bool passed = true;
+            for (int i = 0; i < iterations && passed; ++i) {
+                size_t deltas = 0;
+                auto start = Clock::now();
+                auto result = lc::openai::chat_completion_stream(
+                    config, messages, [&deltas](const std::string& delta, bool) {
+                        deltas += !delta.empty();
+                    }, "", false, options);
+                stats.add(Clock::now() - start);
+                passed = check(async ? "async" : "blocking", result, deltas);
+            }
+            if (passed) {
+                print_stats(std::string(name) + (async ? " async" : " blocking"), stats);
+            }
+        }
+
+        check("non-stream", lc::openai::chat_completion(config, messages, "", false), 1);
+
+        // 录制再回放：录制文件中不得出现密钥，回放得到与直接请求相同的回答
+        config.openai_api_key = "bench-secret-" + std::string(name);
+        lc::cassette::Recorder recorder;
+        lc::openai::StreamOptions record_options;
+        record_options.recorder = &recorder;
+        size_t deltas = 0;
+        auto counter = [&deltas](const std::string& delta, bool) { deltas += !delta.empty(); };
+        if (!check("record", lc::openai::chat_completion_stream(config, messages, counter, "", false, record_options),
+                   deltas)) {
+            continue;
+        }
+        std::filesystem::path path = std::filesystem::temp_directory_path() /
+            ("lc-bench-" + std::to_string(getpid()) + "-" + name + ".json");
+        std::string error_message;
+        auto cassette = std::make_shared<lc::cassette::Cassette>();
+        bool saved = lc::cassette::save(path, recorder.cassette(), error_message) &&
+            lc::cassette::load(path, *cassette, error_message);
+        std::ifstream file(path);
+        std::string recorded((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::filesystem::remove(path);
+        if (!saved) {
+            std::printf("  %-24s FAIL %s\n", (std::string(name) + " record").c_str(), error_message.c_str());
+            ok = false;
+            continue;
+        }
+        if (recorded.find(config.openai_api_key) != std::string::npos) {
+            std::printf("  %-24s FAIL api key written to cassette\n", (std::string(name) + " record").c_str());
+            ok = false;
+            continue;
+        }
+
+        lc::bench::MockOptions replay_mock;
+        replay_mock.cassette = cassette;
+        replay_mock.replay_speed = 0;
+        lc::bench::MockServer replay_server(replay_mock);
+        if (!replay_server.start()) {
+            std::cerr << "  failed to start mock server" << std::endl;
+            return 1;
+        }
+        lc::Config replay_config = config;
+        replay_config.openai_base_url = replay_server.base_url();
+        deltas = 0;
+        check("replay", lc::openai::chat_completion_stream(replay_config, messages, counter, "", false), deltas);
+    }
+    return ok ? 0 : 1;
+}
+
+// 对比TCP回环与unix domain socket的请求延迟
+int bench_transport(int iterations) {
+    std::printf("transport: loopback TCP vs unix domain socket (%d requests each)\n", iterations);
+
+    lc::bench::MockOptions mock;
+    mock.tokens = 8;
+
+    lc::bench::MockServer tcp_server(mock);
+    lc::bench::MockServer unix_server(mock);
+    std::string socket_path = "/tmp/lc-bench-" + std::to_string(getpid()) + ".sock";
+    if (!tcp_server.start() || !unix_server.start_unix(socket_path)) {
+        std::cerr << "  failed to start mock server" << std::endl;
+        return 1;
+    }
+
+    print_stats("tcp 127.0.0.1", measure_completions(bench_config(tcp_server.base_url()), iterations).total);
+    print_stats("unix socket", measure_completions(bench_config(unix_server.base_url()), iterations).total);
+    return 0;
+}
+
+#ifdef LC_BINARY_PATH
+// 接受一个连接，记录收到第一个字节的时间，再读完请求并返回最短的SSE回答
+bool serve_one(int listener, Clock::time_point start, LatencyStats& stats) {
+    pollfd pfd{listener, POLLIN, 0};
+    if (poll(&pfd, 1, 5000) != 1) {
+        return false;
+    }
+    int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+
+    std::string request;
+    char buffer[4096];
+    ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+    if (n <= 0) {
+        close(fd);
+        return false;
+    }
+    stats.add(Clock::now() - start);
+    request.append(buffer, static_cast<size_t>(n));
+
+    // 读完请求头与Content-Length声明的请求体，避免客户端在写入时收到RST
+    size_t header_end;
+    while ((header_end = request.find("\r\n\r\n")) == std::string::npos &&
+           (n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        request.append(buffer, static_cast<size_t>(n));
+    }
+    size_t length_pos = request.find("Content-Length: ");
+    size_t body_length = length_pos != std::string::npos && length_pos < header_end
+        ? std::stoul(request.substr(length_pos + 16)) : 0;
+    while (header_end != std::string::npos && request.size() < header_end + 4 + body_length &&
+           (n = recv(fd, buffer, sizeof(buffer), 0)) > 0) {
+        request.append(buffer, static_cast<size_t>(n));
+    }
+
+    std::string body = make_stream("openai", 1, "pong");
+    std::string response = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nContent-Length: " +
+        std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+    bool sent = send(fd, response.data(), response.size(), MSG_NOSIGNAL) == static_cast<ssize_t>(response.size());
+    close(fd);
+    return sent;
+}
+
+// startup与cpu基准测量的lc：本次构建的lc，以及环境变量LC_BENCH_BASELINE指定的对照版本
+// （例如未启用PGO的构建），对照版本的结果以baseline开头
+std::vector<std::pair<std::string, std::string>> lc_binaries() {
+    std::vector<std::pair<std::string, std::string>> binaries = {{"", LC_BINARY_PATH}};
+    if (const char* baseline = std::getenv("LC_BENCH_BASELINE")) {
+        binaries.emplace_back("baseline ", baseline);
+    }
+    return binaries;
+}
+
+// lc子进程的环境变量：XDG_CONFIG_HOME指向独立的配置目录，不影响本机的lc配置
+class LcEnvironment {
+public:
+    explicit LcEnvironment(const std::filesystem::path& config_home)
+        : xdg_("XDG_CONFIG_HOME=" + config_home.string()) {
+        for (char** var = environ; *var; ++var) {
+            if (std::strncmp(*var, "XDG_CONFIG_HOME=", 16) != 0) {
+                vars_.push_back(*var);
+            }
+        }
+        vars_.push_back(xdg_.data());
+        vars_.push_back(nullptr);
+    }
+    LcEnvironment(const LcEnvironment&) = delete;
+    LcEnvironment& operator=(const LcEnvironment&) = delete;
+
+    char** get() { return vars_.data(); }
+
+private:
+    std::string xdg_;
+    std::vector<char*> vars_;
+};
+
+// 从exec到lc在套接字上发出请求第一个字节的耗时，对比解析YAML与读取二进制配置快照
+int bench_startup(int iterations) {
+    std::printf("startup: exec to first request byte, %s (%d runs each)\n", LC_BINARY_PATH, iterations);
+
+    int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t addr_len = sizeof(addr);
+    if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        listen(listener, 16) != 0 || getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &addr_len) != 0) {
+        std::cerr << "  failed to listen on loopback" << std::endl;
+        if (listener >= 0) {
+            close(listener);
+        }
+        return 1;
+    }
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+        ("lc-bench-startup-" + std::to_string(getpid()));
+    std::filesystem::create_directories(dir / "lc");
+    YAML::Node node(bench_config("http://127.0.0.1:" + std::to_string(ntohs(addr.sin_port)) + "/v1"));
+    std::ofstream(dir / "lc" / "config.yaml") << YAML::Dump(node);
+    LcEnvironment env(dir);
+
+    std::string arg0 = "lc", arg1 = "ping";
+    char* args[] = {arg0.data(), arg1.data(), nullptr};
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+
+    int status = 0;
+    for (const auto& binary : lc_binaries()) {
+        for (bool cached : {false, true}) {
+            LatencyStats stats;
+            size_t failures = 0;
+
+            for (int i = 0; i < iterations; ++i) {
+                if (!cached) {
+                    std::filesystem::remove(dir / "lc" / "config.cache");
+                }
+
+                auto start = Clock::now();
+                pid_t pid;
+                if (posix_spawn(&pid, binary.second.c_str(), &actions, nullptr, args, env.get()) != 0) {
+                    ++failures;
+                    continue;
+                }
+                if (!serve_one(listener, start, stats)) {
+                    ++failures;
+                }
+                int child_status;
+                waitpid(pid, &child_status, 0);
+            }
+
+            print_stats(binary.first + (cached ? "config snapshot" : "yaml parse"), stats);
+            if (failures > 0) {
+                std::printf("  %-24s %zu\n", (binary.first + "failures").c_str(), failures);
+                status = 1;
+            }
+        }
+    }
+
+    posix_spawn_file_actions_destroy(&actions);
+    close(listener);
+    std::filesystem::remove_all(dir);
+    return status;
+}
+
+// 运行一次lc并取其用户态与内核态CPU时间之和，退出状态非零时返回false
+bool run_for_cpu(const std::string& binary, char** env, LatencyStats& stats) {
+    std::string arg0 = "lc", arg1 = "ping";
+    char* args[] = {arg0.data(), arg1.data(), nullptr};
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    int spawned = posix_spawn(&pid, binary.c_str(), &actions, nullptr, args, env);
+    posix_spawn_file_actions_destroy(&actions);
+    if (spawned != 0) {
+        return false;
+    }
+
+    int child_status = 0;
+    rusage usage{};
+    if (wait4(pid, &child_status, 0, &usage) != pid || !WIFEXITED(child_status) || WEXITSTATUS(child_status) != 0) {
+        return false;
+    }
+    auto cpu = std::chrono::seconds(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+        std::chrono::microseconds(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+    stats.add(std::chrono::duration_cast<Clock::duration>(cpu));
+    return true;
+}
+
+// lc进程消耗的CPU时间：只有一个token的回答反映启动与请求构造的开销，
+// 长回答与之相减再除以多出的token数，得到流式接收与输出每个token的开销
+int bench_cpu(int iterations) {
+    constexpr size_t LONG_TOKENS = 20000;
+    std::printf("cpu: lc process CPU time, 1 and %zu token answers (%d runs each)\n", LONG_TOKENS, iterations);
+
+    lc::bench::MockOptions short_mock;
+    short_mock.tokens = 1;
+    lc::bench::MockOptions long_mock;
+    long_mock.tokens = LONG_TOKENS;
+    lc::bench::MockServer short_server(short_mock);
+    lc::bench::MockServer long_server(long_mock);
+    if (!short_server.start() || !long_server.start()) {
+        std::cerr << "  failed to start mock server" << std::endl;
+        return 1;
+    }
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+        ("lc-bench-cpu-" + std::to_string(getpid()));
+    for (const auto* server : {&short_server, &long_server}) {
+        std::filesystem::path home = dir / (server == &short_server ? "short" : "long");
+        std::filesystem::create_directories(home / "lc");
+        YAML::Node node(bench_config(server->base_url()));
+        std::ofstream(home / "lc" / "config.yaml") << YAML::Dump(node);
+    }
+    LcEnvironment short_env(dir / "short");
+    LcEnvironment long_env(dir / "long");
+
+    int status = 0;
+    for (const auto& binary : lc_binaries()) {
+        LatencyStats short_cpu, long_cpu, warmup;
+        size_t failures = 0;
+        // 第一次运行生成配置快照，不计入结果
+        run_for_cpu(binary.second, short_env.get(), warmup);
+        run_for_cpu(binary.second, long_env.get(), warmup);
+        for (int i = 0; i < iterations; ++i) {
+            failures += !run_for_cpu(binary.second, short_env.get(), short_cpu);
+            failures += !run_for_cpu(binary.second, long_env.get(), long_cpu);
+        }
+
+        print_stats(binary.first + "startup", short_cpu);
+        print_stats(binary.first + std::to_string(LONG_TOKENS) + " tokens", long_cpu);
+        double per_token = (long_cpu.mean() - short_cpu.mean()) * 1e6 / (LONG_TOKENS - 1);
+        std::printf("  %-24s %8.1f ns/token\n", (binary.first + "per token").c_str(), per_token);
+        if (failures > 0) {
+            std::printf("  %-24s %zu\n", (binary.first + "failures").c_str(), failures);
+            status = 1;
+        }
+    }
+
+    std::filesystem::remove_all(dir);
+    return status;
+}
+#endif
+
+struct Benchmark {
+    const char* name;
+    std::function<int(int)> run;
+    int default_iterations;
+};
+
+const std::vector<Benchmark>& benchmarks() {
+    static const std::vector<Benchmark> all = {
+        {"sse_parse", bench_sse_parse, 200},
+        {"serialize", bench_serialize, 2000},
+        {"history", bench_history, 100},
+        {"search", bench_search, 50},
+        {"docs", bench_docs, 200},
+        {"attach", bench_attach, 20},
+        {"memory", bench_memory, 1},
+        {"ttft", bench_ttft, 200},
+        {"dialects", bench_dialects, 20},
+        {"transport", bench_transport, 500},
+#ifdef LC_BINARY_PATH
+        {"startup", bench_startup, 100},
+        {"cpu", bench_cpu, 20},
+#endif
+    };
+    return all;
+}
+
+} // namespace
+
+// 用法: lc_bench [benchmark...]，不带参数时运行全部
+int main(int argc, char** argv) {
+    std::vector<std::string> selected(argv + 1, argv + argc);
+    int status = 0;
+
+    for (const auto& benchmark : benchmarks()) {
+        if (!selected.empty() &&
+            std::find(selected.begin(), selected.end(), benchmark.name) == selected.end()) {
+            continue;
+        }
+        status |= benchmark.run(benchmark.default_iterations);
+    }
+
+    return status;
+}
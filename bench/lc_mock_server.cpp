@@ -0,0 +1,101 @@
+#include <pthread.h>
+
+#include <csignal>
+#include <cxxopts.hpp>
+#include <iostream>
+
+#include "mock_server.h"
+
+// 本地模拟的OpenAI服务，用于在没有付费API的情况下测量流式性能
+// 例如: lc_mock_server --port 8080 --rate 50 --first-byte-delay 300
+//       lc_mock_server --port 8080 --replay slow.json --speed 4
+//       lc_mock_server --port 11434 --dialect ollama
+//       lc --set openai_base_url=http://127.0.0.1:8080/v1
+int main(int argc, char** argv) {
+    cxxopts::Options options("lc_mock_server", "Local OpenAI, Ollama or Anthropic compatible streaming server for benchmarking lc");
+
+    options.add_options()
+        ("host", "Address to listen on", cxxopts::value<std::string>()->default_value("127.0.0.1"))
+        ("port", "Port to listen on (0 picks a free port)", cxxopts::value<int>()->default_value("8080"))
+        ("unix", "Listen on a unix domain socket instead of TCP", cxxopts::value<std::string>())
+        ("tokens", "Tokens per response", cxxopts::value<size_t>()->default_value("64"))
+        ("rate", "Tokens per second (0 = unlimited)", cxxopts::value<double>()->default_value("0"))
+        ("chunk-tokens", "Tokens per SSE event", cxxopts::value<size_t>()->default_value("1"))
+        ("split-events", "Split every SSE event across two writes")
+        ("first-byte-delay", "Delay before the first byte in milliseconds", cxxopts::value<int>()->default_value("0"))
+        ("error-every", "Answer every Nth request with HTTP 500", cxxopts::value<size_t>()->default_value("0"))
+        ("rate-limit-every", "Answer every Nth request with HTTP 429", cxxopts::value<size_t>()->default_value("0"))
+        ("retry-after", "Retry-After seconds for 429 responses", cxxopts::value<int>()->default_value("1"))
+        ("drop-after", "Drop the connection after N tokens", cxxopts::value<size_t>()->default_value("0"))
+        ("token", "Content of each token", cxxopts::value<std::string>()->default_value("tok "))
+        ("dialect", "Protocol to speak: openai, ollama or anthropic", cxxopts::value<std::string>()->default_value("openai"))
+        ("replay", "Replay a cassette recorded with lc --record", cxxopts::value<std::string>())
+        ("speed", "Replay speed multiplier (0 = no delays)", cxxopts::value<double>()->default_value("1"))
+        ("h,help", "Print usage")
+    ;
+
+    cxxopts::ParseResult args;
+    try {
+        args = options.parse(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing arguments: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (args.count("help")) {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    lc::bench::MockOptions mock;
+    mock.tokens = args["tokens"].as<size_t>();
+    mock.tokens_per_second = args["rate"].as<double>();
+    mock.chunk_tokens = args["chunk-tokens"].as<size_t>();
+    mock.split_events = args.count("split-events") > 0;
+    mock.first_byte_delay_ms = args["first-byte-delay"].as<int>();
+    mock.error_every = args["error-every"].as<size_t>();
+    mock.rate_limit_every = args["rate-limit-every"].as<size_t>();
+    mock.retry_after = args["retry-after"].as<int>();
+    mock.drop_after = args["drop-after"].as<size_t>();
+    mock.token = args["token"].as<std::string>();
+    mock.dialect = args["dialect"].as<std::string>();
+    if (mock.dialect != "openai" && mock.dialect != "ollama" && mock.dialect != "anthropic") {
+        std::cerr << "Error: --dialect must be openai, ollama or anthropic" << std::endl;
+        return 1;
+    }
+
+    if (args.count("replay")) {
+        auto cassette = std::make_shared<lc::cassette::Cassette>();
+        std::string error_message;
+        if (!lc::cassette::load(args["replay"].as<std::string>(), *cassette, error_message)) {
+            std::cerr << "Error: " << error_message << std::endl;
+            return 1;
+        }
+        mock.cassette = cassette;
+        mock.replay_speed = args["speed"].as<double>();
+    }
+
+    // 屏蔽退出信号，服务线程继承该掩码，由主线程同步等待
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    lc::bench::MockServer server(mock);
+    bool started = args.count("unix")
+        ? server.start_unix(args["unix"].as<std::string>())
+        : server.start(args["host"].as<std::string>(), args["port"].as<int>());
+    if (!started) {
+        std::cerr << "Error: failed to listen" << std::endl;
+        return 1;
+    }
+
+    std::cout << "Listening on " << server.base_url() << std::endl;
+
+    int received = 0;
+    sigwait(&signals, &received);
+    server.stop();
+    std::cout << "Served " << server.requests() << " requests" << std::endl;
+    return 0;
+}
@@ -0,0 +1,209 @@
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "../include/config.h"
+#include "mock_server.h"
+
+extern char** environ;
+
+// PGO训练：对进程内的模拟服务按日常使用的方式反复调用插桩构建的lc，
+// 每次运行退出时把分支与调用计数写入profile目录，供LC_PGO=USE的重新构建使用
+// 用法: lc_pgo_train [lc路径]，默认为同一构建中的lc
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Workload {
+    const char* name;
+    const char* home;                         // 配置目录，共用同一目录的负载共享记忆与索引
+    const lc::bench::MockServer* server;
+    std::vector<std::string> args;            // {i}替换为运行序号，{home}替换为配置目录
+    std::string input;                        // 非空时作为标准输入（管道输入或交互模式的问题）
+    int runs = 1;
+    bool fresh_config = false;                // 每次运行前删除配置快照，覆盖解析YAML的路径
+    bool required = true;                     // 依赖本机环境的负载（如man页面）失败时不中止训练
+    std::string dialect = "openai";
+    std::string http_engine = "blocking";
+};
+
+std::string expand(std::string arg, int run, const std::filesystem::path& home) {
+    for (const auto& [key, value] : {std::pair<std::string, std::string>{"{i}", std::to_string(run)},
+                                     std::pair<std::string, std::string>{"{home}", home.string()}}) {
+        size_t pos;
+        while ((pos = arg.find(key)) != std::string::npos) {
+            arg.replace(pos, key.size(), value);
+        }
+    }
+    return arg;
+}
+
+// 运行一次lc，退出状态为0时返回true
+bool run_lc(const std::string& binary, const std::vector<std::string>& args, const std::filesystem::path& input,
+            char** env) {
+    std::vector<std::string> argv_strings = {"lc"};
+    argv_strings.insert(argv_strings.end(), args.begin(), args.end());
+    std::vector<char*> argv;
+    for (std::string& arg : argv_strings) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, input.empty() ? "/dev/null" : input.c_str(),
+                                     O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0);
+    pid_t pid;
+    int spawned = posix_spawn(&pid, binary.c_str(), &actions, nullptr, argv.data(), env);
+    posix_spawn_file_actions_destroy(&actions);
+    if (spawned != 0) {
+        return false;
+    }
+    int status = 0;
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// 运行一组负载，返回失败次数
+size_t train(const std::string& binary, const std::filesystem::path& dir, const Workload& workload) {
+    std::filesystem::path home = dir / workload.home;
+    std::filesystem::create_directories(home / "lc");
+
+    lc::Config config = lc::Config::default_config();
+    config.openai_base_url = workload.server->base_url();
+    config.openai_api_key = "train";
+    config.dialect = workload.dialect;
+    config.http_engine = workload.http_engine;
+    YAML::Node node(config);
+    std::ofstream(home / "lc" / "config.yaml") << YAML::Dump(node);
+    std::filesystem::remove(home / "lc" / "config.cache");
+
+    std::filesystem::path input;
+    if (!workload.input.empty()) {
+        input = home / (std::string(workload.name) + ".in");
+        std::ofstream(input, std::ios::binary) << workload.input;
+    }
+
+    std::string xdg = "XDG_CONFIG_HOME=" + home.string();
+    std::vector<char*> env;
+    for (char** var = environ; *var; ++var) {
+        if (std::strncmp(*var, "XDG_CONFIG_HOME=", 16) != 0) {
+            env.push_back(*var);
+        }
+    }
+    env.push_back(xdg.data());
+    env.push_back(nullptr);
+
+    size_t failures = 0;
+    auto start = Clock::now();
+    for (int i = 0; i < workload.runs; ++i) {
+        if (workload.fresh_config) {
+            std::filesystem::remove(home / "lc" / "config.cache");
+        }
+        std::vector<std::string> args;
+        for (const std::string& arg : workload.args) {
+            args.push_back(expand(arg, i, home));
+        }
+        failures += !run_lc(binary, args, input, env.data());
+    }
+    std::printf("  %-24s %4d runs %7.2fs%s\n", workload.name, workload.runs,
+                std::chrono::duration<double>(Clock::now() - start).count(),
+                failures > 0 ? (" (" + std::to_string(failures) + " failed)").c_str() : "");
+    return workload.required ? failures : 0;
+}
+
+// 约16MB的构建日志，模拟`make 2>&1 | lc ...`的管道输入
+std::string make_log() {
+    std::string log;
+    for (size_t i = 0; log.size() < (16u << 20); ++i) {
+        log += "[" + std::to_string(i) + "/90000] Building CXX object src/CMakeFiles/lc_core.dir/module_" +
+            std::to_string(i % 97) + ".cpp.o\n";
+        if (i % 1000 == 999) {
+            log += "src/module.cpp:42:7: warning: unused variable 'x' [-Wunused-variable]\n";
+        }
+    }
+    return log;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string binary = argc > 1 ? argv[1] : LC_BINARY_PATH;
+
+    lc::bench::MockOptions short_mock;
+    short_mock.tokens = 48;
+    lc::bench::MockOptions long_mock;
+    long_mock.tokens = 20000;
+    long_mock.split_events = true;
+    lc::bench::MockOptions ollama_mock;
+    ollama_mock.tokens = 512;
+    ollama_mock.dialect = "ollama";
+    lc::bench::MockOptions anthropic_mock;
+    anthropic_mock.tokens = 512;
+    anthropic_mock.dialect = "anthropic";
+
+    lc::bench::MockServer short_server(short_mock);
+    lc::bench::MockServer long_server(long_mock);
+    lc::bench::MockServer ollama_server(ollama_mock);
+    lc::bench::MockServer anthropic_server(anthropic_mock);
+    if (!short_server.start() || !long_server.start() || !ollama_server.start() || !anthropic_server.start()) {
+        std::cerr << "Error: failed to start mock servers" << std::endl;
+        return 1;
+    }
+
+    std::string questions;
+    for (int i = 0; i < 20; ++i) {
+        questions += "how do I list open ports on linux, variant " + std::to_string(i) + "\n";
+    }
+
+    const std::vector<Workload> workloads = {
+        {"startup yaml", "plain", &short_server, {"how do I find large files"}, "", 20, true},
+        {"startup snapshot", "plain", &short_server, {"how do I find large files"}, "", 60},
+        {"piped input", "plain", &short_server, {"why did the build fail"}, make_log(), 6},
+        {"attachments", "plain", &short_server, {"-f", "{home}/lc/*.yaml", "-f", "{home}/piped input.in",
+                                                  "summarize these files"}, "", 6},
+        {"long stream", "plain", &long_server, {"explain systemd units"}, "", 6},
+        {"output file", "plain", &long_server, {"-o", "{home}/answer.txt", "explain systemd units"}, "", 3},
+        {"ndjson", "plain", &long_server, {"--format", "ndjson", "explain systemd units"}, "", 3},
+        {"stop condition", "plain", &long_server, {"--max-bytes", "4096", "explain systemd units"}, "", 3},
+        {"memory", "memory", &short_server, {"-m", "question {i} about iptables port forwarding"}, "", 30},
+        {"search memory", "memory", &short_server, {"--search-memory", "iptables forwarding"}, "", 10},
+        {"show memory", "memory", &short_server, {"--show-memory"}, "", 3},
+        {"interactive", "interactive", &short_server, {"-i"}, questions, 3},
+        {"ollama", "ollama", &ollama_server, {"how do I check disk usage"}, "", 10, false, true, "ollama"},
+        {"anthropic", "anthropic", &anthropic_server, {"how do I check disk usage"}, "", 10, false, true,
+         "anthropic"},
+        {"async engine", "async", &long_server, {"explain systemd units"}, "", 6, false, true, "openai", "async"},
+        {"build docs index", "docs", &short_server, {"--build-index"}, "", 1, false, false},
+        {"grounded query", "docs", &short_server, {"tar extract archive {i}"}, "", 20, false, false},
+        {"offline", "docs", &short_server, {"--offline", "tar extract archive"}, "", 5, false, false},
+    };
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() /
+        ("lc-pgo-train-" + std::to_string(getpid()));
+    std::printf("Training %s against local mock servers\n", binary.c_str());
+
+    size_t failures = 0;
+    for (const Workload& workload : workloads) {
+        failures += train(binary, dir, workload);
+    }
+    std::filesystem::remove_all(dir);
+
+    if (failures > 0) {
+        std::cerr << "Error: " << failures << " training runs failed; the profile would not be representative"
+                  << std::endl;
+        return 1;
+    }
+    return 0;
+}
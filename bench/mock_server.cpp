@@ -0,0 +1,405 @@
+#include "mock_server.h"
+
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <nlohmann/json.hpp>
+
+namespace lc {
+namespace bench {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+std::string sse_event(const char* type, const nlohmann::json& data) {
+    return std::string("event: ") + type + "\ndata: " + data.dump() + "\n\n";
+}
+
+std::string ollama_line(const std::string& content, bool done) {
+    nlohmann::json line = {
+        {"model", "mock"},
+        {"created_at", "2024-01-01T00:00:00Z"},
+        {"message", {{"role", "assistant"}, {"content", content}}},
+        {"done", done}
+    };
+    return line.dump() + "\n";
+}
+
+// 按各自协议的要求校验请求体，lc发出的请求格式不对时返回400
+bool check_request(const std::string& dialect, const httplib::Request& req, const nlohmann::json& body,
+                   std::string& error) {
+    if (!body.is_object() || !body.contains("model") || !body["model"].is_string() ||
+        !body.contains("messages") || !body["messages"].is_array()) {
+        error = "model and messages are required";
+        return false;
+    }
+    for (const auto& message : body["messages"]) {
+        if (!message.is_object() || !message.contains("role") || !message["role"].is_string() ||
+            !message.contains("content") || !message["content"].is_string()) {
+            error = "every message needs a string role and content";
+            return false;
+        }
+        std::string role = message["role"].get<std::string>();
+        if (role == "system" && dialect == "anthropic") {
+            error = "system prompts go in the top-level system field";
+            return false;
+        }
+        if (role != "system" && role != "user" && role != "assistant") {
+            error = "unknown role " + role;
+            return false;
+        }
+    }
+
+    if (dialect == "ollama" && !(body.contains("stream") && body["stream"].is_boolean())) {
+        error = "stream must be given explicitly";
+        return false;
+    }
+    if (dialect == "anthropic") {
+        if (!req.has_header("x-api-key") || !req.has_header("anthropic-version")) {
+            error = "x-api-key and anthropic-version headers are required";
+            return false;
+        }
+        if (!body.contains("max_tokens") || !body["max_tokens"].is_number_integer()) {
+            error = "max_tokens is required";
+            return false;
+        }
+        if (body.contains("system") && !body["system"].is_string()) {
+            error = "system must be a string";
+            return false;
+        }
+    }
+    return true;
+}
+
+// 按内容长度粗略估计提示token数，保证同样的请求得到同样的用量
+size_t prompt_tokens_of(const nlohmann::json& body) {
+    size_t bytes = body.contains("system") && body["system"].is_string() ? body["system"].get<std::string>().size() : 0;
+    for (const auto& message : body["messages"]) {
+        bytes += message["content"].get<std::string>().size();
+    }
+    return bytes / 4 + 1;
+}
+
+std::string error_body(const std::string& message, const std::string& type) {
+    nlohmann::json error = {{"error", {{"message", message}, {"type", type}}}};
+    return error.dump();
+}
+
+bool same_header(const std::string& a, const std::string& b) {
+    return a.size() == b.size() && strncasecmp(a.c_str(), b.c_str(), a.size()) == 0;
+}
+
+} // namespace
+
+std::string stream_prologue(const std::string& dialect, size_t prompt_tokens) {
+    if (dialect != "anthropic") {
+        return "";
+    }
+    nlohmann::json message = {
+        {"id", "msg_mock"},
+        {"type", "message"},
+        {"role", "assistant"},
+        {"content", nlohmann::json::array()},
+        {"usage", {{"input_tokens", prompt_tokens}, {"output_tokens", 1}}}
+    };
+    return sse_event("message_start", {{"type", "message_start"}, {"message", message}}) +
+           sse_event("content_block_start", {{"type", "content_block_start"}, {"index", 0},
+                                             {"content_block", {{"type", "text"}, {"text", ""}}}}) +
+           sse_event("ping", {{"type", "ping"}});
+}
+
+std::string stream_delta(const std::string& dialect, const std::string& content) {
+    if (dialect == "ollama") {
+        return ollama_line(content, false);
+    }
+    if (dialect == "anthropic") {
+        return sse_event("content_block_delta", {{"type", "content_block_delta"}, {"index", 0},
+                                                 {"delta", {{"type", "text_delta"}, {"text", content}}}});
+    }
+    nlohmann::json event = {
+        {"object", "chat.completion.chunk"},
+        {"choices", {{{"index", 0}, {"delta", {{"content", content}}}}}}
+    };
+    return "data: " + event.dump() + "\n\n";
+}
+
+std::string stream_epilogue(const std::string& dialect, size_t prompt_tokens, size_t completion_tokens,
+                            bool include_usage) {
+    if (dialect == "ollama") {
+        nlohmann::json line = nlohmann::json::parse(ollama_line("", true));
+        line["done_reason"] = "stop";
+        line["prompt_eval_count"] = prompt_tokens;
+        line["eval_count"] = completion_tokens;
+        return line.dump() + "\n";
+    }
+    if (dialect == "anthropic") {
+        return sse_event("content_block_stop", {{"type", "content_block_stop"}, {"index", 0}}) +
+               sse_event("message_delta", {{"type", "message_delta"},
+                                           {"delta", {{"stop_reason", "end_turn"}, {"stop_sequence", nullptr}}},
+                                           {"usage", {{"output_tokens", completion_tokens}}}}) +
+               sse_event("message_stop", {{"type", "message_stop"}});
+    }
+
+    std::string events;
+    if (include_usage) {
+        nlohmann::json usage = {
+            {"object", "chat.completion.chunk"},
+            {"choices", nlohmann::json::array()},
+            {"usage", {{"prompt_tokens", prompt_tokens}, {"completion_tokens", completion_tokens},
+                       {"total_tokens", prompt_tokens + completion_tokens}}}
+        };
+        events = "data: " + usage.dump() + "\n\n";
+    }
+    return events + "data: [DONE]\n\n";
+}
+
+MockServer::MockServer(const MockOptions& options) : options_(options) {
+    if (options_.chunk_tokens == 0) {
+        options_.chunk_tokens = 1;
+    }
+    install();
+}
+
+MockServer::~MockServer() {
+    stop();
+}
+
+void MockServer::install() {
+    // 关闭Nagle算法，拆分的事件才会真正分成多个包到达客户端
+    server_.set_tcp_nodelay(true);
+
+    // 只响应所模拟方言的路径，请求发错路径时得到404
+    auto handler = [this](const httplib::Request& req, httplib::Response& res) { handle(req, res); };
+    if (options_.dialect == "ollama") {
+        server_.Post("/api/chat", handler);
+    } else if (options_.dialect == "anthropic") {
+        server_.Post("/v1/messages", handler);
+        server_.Post("/messages", handler);
+    } else {
+        server_.Post("/v1/chat/completions", handler);
+        server_.Post("/chat/completions", handler);
+    }
+}
+
+void MockServer::handle(const httplib::Request& req, httplib::Response& res) {
+    size_t index = ++requests_;
+
+    if (options_.cassette && !options_.cassette->interactions.empty()) {
+        replay(index, res);
+        return;
+    }
+
+    if (options_.rate_limit_every > 0 && index % options_.rate_limit_every == 0) {
+        res.status = 429;
+        res.set_header("Retry-After", std::to_string(options_.retry_after));
+        res.set_content(error_body("Rate limit reached", "rate_limit_exceeded"), "application/json");
+        return;
+    }
+
+    if (options_.error_every > 0 && index % options_.error_every == 0) {
+        res.status = 500;
+        res.set_content(error_body("Mock server error", "server_error"), "application/json");
+        return;
+    }
+
+    const std::string& dialect = options_.dialect;
+    bool stream = false;
+    bool include_usage = false;
+    size_t prompt_tokens = 0;
+    try {
+        nlohmann::json body = nlohmann::json::parse(req.body);
+        std::string error;
+        if (!check_request(dialect, req, body, error)) {
+            res.status = 400;
+            res.set_content(error_body(error, "invalid_request_error"), "application/json");
+            return;
+        }
+        // Ollama不带stream字段时默认流式输出
+        stream = body.value("stream", dialect == "ollama");
+        include_usage = body.contains("stream_options") && body["stream_options"].value("include_usage", false);
+        prompt_tokens = prompt_tokens_of(body);
+    } catch (const std::exception&) {
+        res.status = 400;
+        res.set_content(error_body("Invalid JSON body", "invalid_request_error"), "application/json");
+        return;
+    }
+
+    if (options_.first_byte_delay_ms > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(options_.first_byte_delay_ms));
+    }
+
+    if (!stream) {
+        std::string content;
+        for (size_t i = 0; i < options_.tokens; ++i) {
+            content += options_.token;
+        }
+        nlohmann::json response;
+        if (dialect == "ollama") {
+            response = nlohmann::json::parse(ollama_line(content, true));
+            response["prompt_eval_count"] = prompt_tokens;
+            response["eval_count"] = options_.tokens;
+        } else if (dialect == "anthropic") {
+            response = {
+                {"type", "message"},
+                {"role", "assistant"},
+                {"content", {{{"type", "text"}, {"text", content}}}},
+                {"usage", {{"input_tokens", prompt_tokens}, {"output_tokens", options_.tokens}}}
+            };
+        } else {
+            response = {
+                {"object", "chat.completion"},
+                {"choices", {{{"index", 0}, {"message", {{"role", "assistant"}, {"content", content}}}}}},
+                {"usage", {{"prompt_tokens", prompt_tokens}, {"completion_tokens", options_.tokens}}}
+            };
+        }
+        res.set_content(response.dump(), "application/json");
+        return;
+    }
+
+    MockOptions options = options_;
+    const char* content_type = dialect == "ollama" ? "application/x-ndjson" : "text/event-stream";
+    res.set_chunked_content_provider(content_type, [options, prompt_tokens, include_usage](size_t, httplib::DataSink& sink) {
+        auto start = Clock::now();
+        size_t sent = 0;
+
+        std::string prologue = stream_prologue(options.dialect, prompt_tokens);
+        if (!prologue.empty() && !sink.write(prologue.data(), prologue.size())) {
+            return false;
+        }
+
+        while (sent < options.tokens) {
+            if (options.drop_after > 0 && sent >= options.drop_after) {
+                // 不发送结束块直接断开，模拟中途断线
+                return false;
+            }
+
+            size_t count = std::min(options.chunk_tokens, options.tokens - sent);
+            if (options.drop_after > 0) {
+                count = std::min(count, options.drop_after - sent);
+            }
+
+            // 按固定节奏输出，不让写入耗时累积成额外延迟
+            if (options.tokens_per_second > 0) {
+                auto due = start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(sent / options.tokens_per_second));
+                std::this_thread::sleep_until(due);
+            }
+
+            std::string content;
+            for (size_t i = 0; i < count; ++i) {
+                content += options.token;
+            }
+            std::string event = stream_delta(options.dialect, content);
+
+            if (options.split_events) {
+                size_t half = event.size() / 2;
+                if (!sink.write(event.data(), half) || !sink.write(event.data() + half, event.size() - half)) {
+                    return false;
+                }
+            } else if (!sink.write(event.data(), event.size())) {
+                return false;
+            }
+            sent += count;
+        }
+
+        std::string epilogue = stream_epilogue(options.dialect, prompt_tokens, options.tokens, include_usage);
+        sink.write(epilogue.data(), epilogue.size());
+        sink.done();
+        return true;
+    });
+}
+
+// 回放第index个请求对应的录制内容，按原始到达时间（除以倍速）输出每个响应块
+void MockServer::replay(size_t index, httplib::Response& res) {
+    const auto& interactions = options_.cassette->interactions;
+    const cassette::Interaction& interaction = interactions[(index - 1) % interactions.size()];
+
+    res.status = interaction.status;
+    std::string content_type = "text/event-stream";
+    for (const auto& header : interaction.response_headers) {
+        // 分块、长度与压缩由本地服务重新决定
+        if (same_header(header.first, "Content-Type")) {
+            content_type = header.second;
+        } else if (!same_header(header.first, "Content-Length") &&
+                   !same_header(header.first, "Transfer-Encoding") &&
+                   !same_header(header.first, "Content-Encoding") &&
+                   !same_header(header.first, "Connection")) {
+            res.set_header(header.first, header.second);
+        }
+    }
+
+    double speed = options_.replay_speed;
+    const cassette::Interaction* recorded = &interaction;
+    res.set_chunked_content_provider(content_type, [speed, recorded](size_t, httplib::DataSink& sink) {
+        auto start = Clock::now();
+        for (const auto& chunk : recorded->chunks) {
+            if (speed > 0) {
+                auto due = start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double, std::milli>(chunk.offset_ms / speed));
+                std::this_thread::sleep_until(due);
+            }
+            if (!sink.write(chunk.data.data(), chunk.data.size())) {
+                return false;
+            }
+        }
+
+        // 录制时连接中途断开，回放时同样断开
+        if (!recorded->error.empty()) {
+            return false;
+        }
+        sink.done();
+        return true;
+    });
+}
+
+bool MockServer::start(const std::string& host, int port) {
+    if (port == 0) {
+        port = server_.bind_to_any_port(host);
+    } else if (!server_.bind_to_port(host, port)) {
+        port = -1;
+    }
+
+    if (port < 0) {
+        return false;
+    }
+
+    base_url_ = "http://" + host + ":" + std::to_string(port) + (options_.dialect == "ollama" ? "/api" : "/v1");
+    thread_ = std::thread([this]() { server_.listen_after_bind(); });
+    server_.wait_until_ready();
+    return true;
+}
+
+bool MockServer::start_unix(const std::string& socket_path) {
+    ::unlink(socket_path.c_str());
+    server_.set_address_family(AF_UNIX);
+    if (!server_.bind_to_port(socket_path, 80)) {
+        return false;
+    }
+
+    socket_path_ = socket_path;
+    base_url_ = "unix://" + socket_path + (options_.dialect == "ollama" ? "/api" : "/v1");
+    thread_ = std::thread([this]() { server_.listen_after_bind(); });
+    server_.wait_until_ready();
+    return true;
+}
+
+void MockServer::wait() {
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+void MockServer::stop() {
+    server_.stop();
+    wait();
+
+    if (!socket_path_.empty()) {
+        ::unlink(socket_path_.c_str());
+    }
+}
+
+} // namespace bench
+} // namespace lc
@@ -0,0 +1,78 @@
+#ifndef LC_BENCH_MOCK_SERVER_H
+#define LC_BENCH_MOCK_SERVER_H
+
+#include <httplib.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "../include/cassette.h"
+
+// 本地模拟的OpenAI兼容服务（也可模拟Ollama与Anthropic的协议），供lc_mock_server与lc_bench共用
+// 所有行为都是确定的，同样的参数总能得到同样的流，便于对比性能数字
+namespace lc {
+namespace bench {
+
+struct MockOptions {
+    size_t tokens = 64;               // 每个回答的token数
+    double tokens_per_second = 0;     // 输出速率，0表示不限速
+    size_t chunk_tokens = 1;          // 每个SSE事件包含的token数
+    bool split_events = false;        // 把每个事件拆成两次写入，模拟事件跨越网络包
+    int first_byte_delay_ms = 0;      // 返回首个字节前的等待时间
+    size_t error_every = 0;           // 每N个请求返回一次500，0表示不出错
+    size_t rate_limit_every = 0;      // 每N个请求返回一次429，0表示不限流
+    int retry_after = 1;              // 429响应的Retry-After秒数
+    size_t drop_after = 0;            // 输出N个token后直接断开连接，0表示不断开
+    std::string token = "tok ";       // 每个token的内容
+    std::string dialect = "openai";   // 协议：openai、ollama 或 anthropic，只响应该方言的路径并校验请求格式
+
+    // 非空时按顺序回放录制的会话，忽略上面的生成参数
+    std::shared_ptr<const cassette::Cassette> cassette;
+    double replay_speed = 1.0;        // 回放倍速，0表示不等待直接输出
+};
+
+// 按方言生成流式响应的开头、单个增量事件与结尾，模拟服务与解析基准共用
+std::string stream_prologue(const std::string& dialect, size_t prompt_tokens);
+std::string stream_delta(const std::string& dialect, const std::string& content);
+std::string stream_epilogue(const std::string& dialect, size_t prompt_tokens, size_t completion_tokens,
+                            bool include_usage);
+
+class MockServer {
+public:
+    explicit MockServer(const MockOptions& options);
+    ~MockServer();
+
+    MockServer(const MockServer&) = delete;
+    MockServer& operator=(const MockServer&) = delete;
+
+    // 在后台线程监听，port为0时自动选择端口；返回是否启动成功
+    bool start(const std::string& host = "127.0.0.1", int port = 0);
+    bool start_unix(const std::string& socket_path);
+
+    // 阻塞直到服务停止
+    void wait();
+    void stop();
+
+    // 供lc使用的openai_base_url
+    const std::string& base_url() const { return base_url_; }
+    size_t requests() const { return requests_; }
+
+private:
+    void install();
+    void handle(const httplib::Request& req, httplib::Response& res);
+    void replay(size_t index, httplib::Response& res);
+
+    MockOptions options_;
+    httplib::Server server_;
+    std::thread thread_;
+    std::atomic<size_t> requests_{0};
+    std::string base_url_;
+    std::string socket_path_;
+};
+
+} // namespace bench
+} // namespace lc
+
+#endif // LC_BENCH_MOCK_SERVER_H
@@ -0,0 +1,68 @@
+#ifndef LC_ASYNC_CLIENT_H
+#define LC_ASYNC_CLIENT_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "openai.h"
+
+namespace lc {
+namespace openai {
+
+// 事件循环驱动的异步HTTP客户端
+// 每个循环线程通过epoll与非阻塞OpenSSL同时驱动任意数量的SSE流，
+// 不再需要每个请求一个阻塞的httplib::Client和一个线程
+class AsyncEngine {
+public:
+    using RequestId = uint64_t;
+    using CompletionHandler = std::function<void(const ChatCompletionResult& result)>;
+
+    explicit AsyncEngine(size_t threads = 1);
+    ~AsyncEngine();
+
+    AsyncEngine(const AsyncEngine&) = delete;
+    AsyncEngine& operator=(const AsyncEngine&) = delete;
+
+    // 提交流式请求，立即返回；增量回调与完成通知都在事件循环线程上执行
+    // 域名解析在调用线程中完成，失败时直接在调用线程上通知完成
+    RequestId submit(
+        const Config& config,
+        const std::vector<Message>& messages,
+        StreamCallback callback,
+        const std::string& model_override,
+        bool debug,
+        const StreamOptions& options,
+        CompletionHandler on_complete
+    );
+
+    // 取消请求：连接立即关闭，已收到的内容作为提前结束的结果返回
+    void cancel(RequestId id, const std::string& reason = "cancelled");
+
+    // 提交并等待完成，与chat_completion_stream的契约一致
+    ChatCompletionResult run(
+        const Config& config,
+        const std::vector<Message>& messages,
+        StreamCallback callback,
+        const std::string& model_override,
+        bool debug,
+        const StreamOptions& options
+    );
+
+    // 当前正在进行的请求数
+    size_t active_requests() const;
+
+private:
+    class Loop;
+
+    std::vector<std::unique_ptr<Loop>> loops_;
+    std::atomic<RequestId> next_id_{1};
+};
+
+} // namespace openai
+} // namespace lc
+
+#endif // LC_ASYNC_CLIENT_H
@@ -0,0 +1,71 @@
+#ifndef LC_ATTACH_H
+#define LC_ATTACH_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// --file附件：展开glob后由多个线程映射文件，跳过二进制文件与内容重复的文件，
+// 再把每个文件连同文件名与大小成帧，直接写入用户消息的存储
+//
+// 成帧格式：
+//   <file name="src/main.cpp" size="1523">
+//   ...文件内容...
+//   </file>
+// 内容与之前的附件相同的文件只保留一行：<file name="b.txt" size="12" same-as="a.txt"/>
+namespace lc {
+namespace attach {
+
+// 展开每个模式（支持*、?、[...]、{a,b}与~），结果按模式顺序排列并去掉指向同一文件的路径；
+// 没有匹配任何文件的模式视为错误，目录被跳过
+bool expand(const std::vector<std::string>& patterns, std::vector<std::string>& paths, std::string& error);
+
+struct Stats {
+    size_t files = 0;                  // 附加的文件数（不含重复的文件）
+    size_t duplicates = 0;             // 与之前的附件内容相同的文件
+    size_t bytes = 0;                  // 附加的文件内容字节数
+    unsigned threads = 0;
+    std::vector<std::string> binary;   // 跳过的二进制文件
+};
+
+class Attachments {
+public:
+    Attachments() = default;
+    ~Attachments();
+    Attachments(const Attachments&) = delete;
+    Attachments& operator=(const Attachments&) = delete;
+
+    // 并发映射全部文件并确定成帧后的布局；任一文件无法读取时返回false
+    bool open(const std::vector<std::string>& paths, std::string& error);
+
+    // 成帧后的总字节数，没有可附加的文件时为0
+    size_t size() const { return size_; }
+
+    // 由多个线程把各文件的帧写入dest中各自的位置，dest至少有size()字节
+    void write(char* dest) const;
+
+    const Stats& stats() const { return stats_; }
+
+private:
+    struct File {
+        std::string path;
+        const char* data = nullptr;
+        size_t size = 0;
+        void* mapping = nullptr;   // 普通文件的映射，管道等无法映射的文件读入owned
+        std::string owned;
+        bool binary = false;
+        std::string header;        // 帧的开头；重复文件的整个帧
+        std::string footer;
+        size_t offset = 0;         // 帧在输出中的位置
+        bool duplicate = false;
+    };
+
+    std::vector<File> files_;
+    Stats stats_;
+    size_t size_ = 0;
+};
+
+} // namespace attach
+} // namespace lc
+
+#endif // LC_ATTACH_H
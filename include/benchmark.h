@@ -0,0 +1,55 @@
+#ifndef LC_BENCHMARK_H
+#define LC_BENCHMARK_H
+
+#include <nlohmann/json.hpp>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "config.h"
+
+// lc bench：用现有配置与客户端重复发送流式请求，对比不同模型与端点的延迟和吞吐
+namespace lc {
+namespace benchmark {
+
+struct BenchOptions {
+    std::vector<std::string> models;  // model 或 model@endpoint
+    size_t requests = 50;             // 每个模型的请求数
+    size_t concurrency = 1;           // 同时进行的请求数
+    std::string prompt;
+    bool debug = false;
+};
+
+// 毫秒延迟样本
+struct Distribution {
+    std::vector<double> samples_ms;
+
+    double percentile(double p) const;
+    double mean() const;
+};
+
+struct ModelReport {
+    std::string model;                // 命令行给出的模型说明
+    std::string endpoint;             // 解析出的端点名
+    size_t requests = 0;
+    size_t errors = 0;
+    size_t rate_limited = 0;          // 其中HTTP 429的次数
+    std::string first_error;
+    Distribution ttft;                // 首token延迟
+    Distribution itl;                 // 相邻token间隔
+    Distribution total;               // 完整请求耗时
+    size_t tokens = 0;                // 成功请求收到的增量事件总数
+    double stream_tokens_per_second = 0;  // 单个流的平均输出速率
+    double wall_seconds = 0;          // 该模型全部请求的墙钟时间
+};
+
+// 依次对每个模型运行基准测试；遵守各端点的requests_per_minute
+std::vector<ModelReport> run(const Config& config, const BenchOptions& options);
+
+void print_table(const std::vector<ModelReport>& reports, std::ostream& out);
+nlohmann::json to_json(const std::vector<ModelReport>& reports);
+
+} // namespace benchmark
+} // namespace lc
+
+#endif // LC_BENCHMARK_H
@@ -0,0 +1,65 @@
+#ifndef LC_CASSETTE_H
+#define LC_CASSETTE_H
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "stream.h"
+
+// 录制与回放API会话：保存请求、响应头以及每个响应块的到达时间，
+// 回放时可以按原始节奏重现慢速会话，不需要访问网络
+namespace lc {
+namespace cassette {
+
+using Headers = std::vector<std::pair<std::string, std::string>>;
+
+// 一个响应块及其相对请求开始的到达时间
+struct Chunk {
+    double offset_ms = 0;
+    std::string data;
+};
+
+// 一次请求尝试；续传会产生多次尝试
+struct Interaction {
+    std::string method = "POST";
+    std::string path;
+    Headers request_headers;
+    std::string request_body;
+    int status = 0;
+    Headers response_headers;
+    std::vector<Chunk> chunks;
+    std::string error;  // 非空表示连接中途断开
+};
+
+struct Cassette {
+    std::vector<Interaction> interactions;
+};
+
+bool load(const std::filesystem::path& path, Cassette& cassette, std::string& error_message);
+bool save(const std::filesystem::path& path, const Cassette& cassette, std::string& error_message);
+
+// 在请求过程中记录会话，由两种HTTP引擎在各自的回调中调用
+class Recorder {
+public:
+    void begin_attempt(const openai::PreparedRequest& request);
+    void on_status(int status);
+    void on_header(const std::string& name, const std::string& value);
+    void on_chunk(const char* data, size_t len);
+    void on_error(const std::string& error);
+
+    const Cassette& cassette() const { return cassette_; }
+
+private:
+    Interaction* current();
+
+    Cassette cassette_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace cassette
+} // namespace lc
+
+#endif // LC_CASSETTE_H
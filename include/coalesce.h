@@ -0,0 +1,33 @@
+#ifndef LC_COALESCE_H
+#define LC_COALESCE_H
+
+#include <string>
+#include <vector>
+
+#include "openai.h"
+
+// 跨进程合并相同的并发请求（single-flight）
+// 同一请求的第一个进程成为leader，真正发送请求并把增量写入lc_dir()/inflight下的spool文件；
+// 其他进程作为follower实时读取spool，输出与leader完全相同的内容
+namespace lc {
+namespace coalesce {
+
+// 请求的稳定标识：端点、路径与请求体的SHA-256
+std::string request_key(const Config& config, const std::vector<openai::Message>& messages,
+                        const std::string& model_override);
+
+// 与openai::chat_completion_stream的契约一致；带有本地停止条件或录制的请求不参与合并
+// follower各自遵守options.deadline，超时后带着已输出的内容返回，不等待leader
+openai::ChatCompletionResult chat_completion_stream(
+    const Config& config,
+    const std::vector<openai::Message>& messages,
+    openai::StreamCallback callback,
+    const std::string& model_override = "",
+    bool debug = false,
+    const openai::StreamOptions& options = {}
+);
+
+} // namespace coalesce
+} // namespace lc
+
+#endif // LC_COALESCE_H
@@ -0,0 +1,46 @@
+#ifndef LC_COMPRESSION_H
+#define LC_COMPRESSION_H
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace lc {
+namespace compression {
+
+// 当前构建是否支持该压缩方式（gzip、zstd）
+bool is_supported(const std::string& encoding);
+
+// 按指定方式压缩数据，成功时写入output
+bool compress(const std::string& encoding, const std::string& input, std::string& output);
+
+// 异步引擎请求时发送的Accept-Encoding：gzip与deflate，以LC_ENABLE_ZSTD编译时还有zstd
+// （阻塞客户端由httplib协商并解压）
+const char* accept_encoding();
+
+// 边接收边解压响应体，每个读块解压后立即交给下游，不等待整个响应
+class Decoder {
+public:
+    // 返回false表示下游不再需要更多数据
+    using Sink = std::function<bool(const char* data, size_t len)>;
+
+    Decoder();
+    ~Decoder();
+    Decoder(const Decoder&) = delete;
+    Decoder& operator=(const Decoder&) = delete;
+
+    // 按响应的Content-Encoding开始解压；identity或为空时原样输出，不支持的编码返回false
+    bool begin(const std::string& encoding);
+
+    // 解压一块数据并交给sink，返回false表示数据损坏；sink要求停止时丢弃剩余的数据
+    bool feed(const char* data, size_t len, const Sink& sink);
+
+private:
+    struct State;
+    std::unique_ptr<State> state_;
+};
+
+} // namespace compression
+} // namespace lc
+
+#endif // LC_COMPRESSION_H
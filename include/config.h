@@ -3,6 +3,7 @@
 
 #include <string>
 #include <filesystem>
+#include <map>
 #include <optional>
 #include <yaml-cpp/yaml.h>
 
@@ -10,8 +11,20 @@ namespace lc {
 
 // 默认值常量
 constexpr int DEFAULT_MAX_HISTORY = 10;
+constexpr int DEFAULT_STREAM_RESUME_RETRIES = 2;
+constexpr size_t DEFAULT_COMPRESSION_THRESHOLD = 16 * 1024;
 extern const char* DEFAULT_SYSTEM_PROMPT;
 
+// API端点配置，额外的端点可通过 --model <model>@<name> 选用
+struct Endpoint {
+    std::string name;
+    std::string base_url;
+    std::string api_key;
+    std::string request_compression;  // none、gzip 或 zstd（需以LC_ENABLE_ZSTD编译）
+    int requests_per_minute = 0;      // 请求速率上限，0表示不限制
+    std::string dialect = "openai";   // 流式协议：openai（SSE）、ollama（NDJSON）或 anthropic（Messages事件流）
+};
+
 class Config {
 public:
     // 配置项
@@ -21,6 +34,17 @@ public:
     std::string system_prompt;
     int max_history;
     bool use_system_prompt;
+    int stream_resume_retries;
+    std::string request_compression;  // 默认端点的请求体压缩方式
+    size_t compression_threshold;     // 请求体超过该字节数才压缩
+    std::map<std::string, Endpoint> endpoints;
+    std::string http_engine;          // blocking（httplib）或 async（事件循环）
+    std::string http2;                // 异步引擎的HTTP/2：auto、off 或 prior-knowledge
+    int requests_per_minute;          // 默认端点的请求速率上限，0表示不限制
+    bool coalesce_requests;           // 多个进程同时发出相同请求时只发送一次
+    bool prefix_cache;                // 按提供方前缀缓存友好的方式组装请求，并请求usage统计
+    std::string dialect;              // 默认端点的协议：openai、ollama 或 anthropic
+    bool local_docs;                  // 建立了本地文档索引时，把检索到的man/tldr片段加入提示
 
     // 加载配置
     static std::optional<Config> load();
@@ -34,12 +58,24 @@ public:
     // 获取配置路径
     static std::filesystem::path config_path();
     
-    // 获取lc目录
+    // 获取lc目录（只计算路径，由写入文件的一方按需创建）
     static std::filesystem::path lc_dir();
     
+    // 获取二进制配置快照路径，快照随config.yaml的mtime与大小失效
+    static std::filesystem::path cache_path();
+    
     // 获取记忆文件路径
     static std::filesystem::path memory_path();
     
+    // 获取--race胜负统计文件路径
+    static std::filesystem::path race_stats_path();
+    
+    // 获取按模型与端点记录的延迟历史文件路径
+    static std::filesystem::path latency_stats_path();
+    
+    // 获取本地man/tldr文档索引目录（--build-index）
+    static std::filesystem::path docs_index_dir();
+    
     // 默认配置
     static Config default_config();
     
@@ -48,6 +84,9 @@ public:
     
     // 重置配置为默认值
     static bool reset_config();
+    
+    // 根据 model 或 model@endpoint 解析出端点与实际模型名
+    Endpoint resolve_endpoint(const std::string& model_spec, std::string& model) const;
 };
 
 } // namespace lc
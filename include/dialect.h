@@ -0,0 +1,424 @@
+#ifndef LC_DIALECT_H
+#define LC_DIALECT_H
+
+#include <charconv>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "openai.h"
+
+// 提供方协议（方言）：请求格式、响应分帧与增量提取都由编译期的策略类决定
+// 每个请求只在入口按端点配置选择一次实例化，逐token的路径上没有虚调用，也不构造JSON树
+namespace lc {
+namespace openai {
+
+enum class Dialect : uint8_t {
+    OpenAI,     // /chat/completions，SSE，data: [DONE]结束
+    Ollama,     // /api/chat，每行一个JSON对象（NDJSON），done为true结束
+    Anthropic   // /v1/messages，带event:类型的SSE，message_stop结束
+};
+
+// 解析配置中的方言名称，空字符串按openai处理
+bool parse_dialect(const std::string& name, Dialect& dialect);
+const char* dialect_name(Dialect dialect);
+
+// 从一个负载中取出的内容
+struct StreamEvent {
+    std::string delta;   // 内容增量
+    bool done = false;   // 流结束标记
+    std::string error;   // 服务端在流中报告的错误
+
+    void reset() {
+        delta.clear();
+        done = false;
+        error.clear();
+    }
+};
+
+// 只向前移动的JSON扫描器：调用方按已知的字段路径逐层进入，其余值只跳过不解析
+// 输入格式错误时ok()变为false，之后所有读取都返回false
+class JsonCursor {
+public:
+    explicit JsonCursor(std::string_view text) : text_(text) {}
+
+    // 当前值是对象或数组时进入并返回true，否则不移动
+    bool enter_object() { return enter('{'); }
+    bool enter_array() { return enter('['); }
+
+    // 读取对象的下一个键（原文，不解码转义）并停在对应的值上，对象结束时返回false
+    bool next_key(std::string_view& key) {
+        if (!ok_ || !separator('}')) {
+            return false;
+        }
+        if (!at('"')) {
+            return fail();
+        }
+        size_t start = ++pos_;
+        while (pos_ < text_.size() && text_[pos_] != '"') {
+            pos_ += text_[pos_] == '\\' ? 2 : 1;
+        }
+        if (pos_ >= text_.size()) {
+            return fail();
+        }
+        key = text_.substr(start, pos_++ - start);
+        skip_whitespace();
+        if (!at(':')) {
+            return fail();
+        }
+        ++pos_;
+        return true;
+    }
+
+    // 停在数组的下一个元素上，数组结束时返回false
+    bool next_element() {
+        return ok_ && separator(']');
+    }
+
+    // 读取字符串值并解码转义，追加到out；当前值不是字符串时跳过并返回false
+    bool read_string(std::string& out) {
+        skip_whitespace();
+        if (!ok_ || !at('"')) {
+            skip_value();
+            return false;
+        }
+        ++pos_;
+        while (pos_ < text_.size()) {
+            size_t run = pos_;
+            while (pos_ < text_.size() && text_[pos_] != '"' && text_[pos_] != '\\') {
+                ++pos_;
+            }
+            out.append(text_.data() + run, pos_ - run);
+            if (pos_ >= text_.size()) {
+                break;
+            }
+            if (text_[pos_++] == '"') {
+                return true;
+            }
+            if (!unescape(out)) {
+                return fail();
+            }
+        }
+        return fail();
+    }
+
+    // 读取整数值；当前值不是整数时跳过并返回false
+    bool read_integer(long& out) {
+        std::string_view value = skip_value();
+        auto result = std::from_chars(value.data(), value.data() + value.size(), out);
+        return ok_ && !value.empty() && result.ec == std::errc() && result.ptr == value.data() + value.size();
+    }
+
+    bool read_bool(bool& out) {
+        std::string_view value = skip_value();
+        if (value == "true" || value == "false") {
+            out = value == "true";
+            return true;
+        }
+        return false;
+    }
+
+    // 跳过当前值并返回其原文，供少见的字段交给完整的JSON解析器处理
+    std::string_view skip_value() {
+        skip_whitespace();
+        size_t start = pos_;
+        if (!ok_ || pos_ >= text_.size()) {
+            fail();
+            return {};
+        }
+
+        char c = text_[pos_];
+        if (c == '"') {
+            skip_string();
+        } else if (c == '{' || c == '[') {
+            int depth = 0;
+            while (pos_ < text_.size()) {
+                char ch = text_[pos_];
+                if (ch == '"') {
+                    skip_string();
+                    continue;
+                }
+                ++pos_;
+                if (ch == '{' || ch == '[') {
+                    ++depth;
+                } else if ((ch == '}' || ch == ']') && --depth == 0) {
+                    break;
+                }
+            }
+            if (depth != 0) {
+                fail();
+            }
+        } else {
+            while (pos_ < text_.size() && !is_delimiter(text_[pos_])) {
+                ++pos_;
+            }
+            if (pos_ == start) {
+                fail();
+            }
+        }
+        return text_.substr(start, pos_ - start);
+    }
+
+    bool ok() const { return ok_; }
+
+private:
+    static bool is_delimiter(char c) {
+        return c == ',' || c == '}' || c == ']' || c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    void skip_whitespace() {
+        while (pos_ < text_.size() &&
+               (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r')) {
+            ++pos_;
+        }
+    }
+
+    bool at(char c) const { return pos_ < text_.size() && text_[pos_] == c; }
+
+    bool enter(char open) {
+        skip_whitespace();
+        if (ok_ && at(open)) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    // 容器中元素之间的逗号；遇到结束符时消费它并返回false
+    bool separator(char close) {
+        skip_whitespace();
+        if (at(close)) {
+            ++pos_;
+            return false;
+        }
+        if (at(',')) {
+            ++pos_;
+            skip_whitespace();
+        }
+        if (pos_ >= text_.size()) {
+            return fail();
+        }
+        return true;
+    }
+
+    void skip_string() {
+        ++pos_;
+        while (pos_ < text_.size() && text_[pos_] != '"') {
+            pos_ += text_[pos_] == '\\' ? 2 : 1;
+        }
+        if (pos_ >= text_.size()) {
+            fail();
+            return;
+        }
+        ++pos_;
+    }
+
+    bool hex4(uint32_t& value) {
+        if (pos_ + 4 > text_.size()) {
+            return false;
+        }
+        value = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = text_[pos_++];
+            value <<= 4;
+            if (c >= '0' && c <= '9') {
+                value |= static_cast<uint32_t>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                value |= static_cast<uint32_t>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                value |= static_cast<uint32_t>(c - 'A' + 10);
+            } else {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // 解码反斜杠之后的转义序列
+    bool unescape(std::string& out) {
+        if (pos_ >= text_.size()) {
+            return false;
+        }
+        char c = text_[pos_++];
+        switch (c) {
+            case '"': out += '"'; return true;
+            case '\\': out += '\\'; return true;
+            case '/': out += '/'; return true;
+            case 'b': out += '\b'; return true;
+            case 'f': out += '\f'; return true;
+            case 'n': out += '\n'; return true;
+            case 'r': out += '\r'; return true;
+            case 't': out += '\t'; return true;
+            case 'u': break;
+            default: return false;
+        }
+
+        uint32_t code;
+        if (!hex4(code)) {
+            return false;
+        }
+        // UTF-16代理对
+        if (code >= 0xD800 && code <= 0xDBFF) {
+            uint32_t low;
+            if (text_.compare(pos_, 2, "\\u") != 0 || (pos_ += 2, !hex4(low)) || low < 0xDC00 || low > 0xDFFF) {
+                return false;
+            }
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        } else if (code >= 0xDC00 && code <= 0xDFFF) {
+            return false;
+        }
+
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+        return true;
+    }
+
+    bool fail() {
+        ok_ = false;
+        return false;
+    }
+
+    std::string_view text_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+// 分帧策略：从一行响应中取出负载，返回false表示该行不携带负载
+struct SseFraming {
+    // 只有data:行携带负载，event:行与注释行忽略（Anthropic的事件类型在负载中也有）
+    static bool payload(std::string_view line, std::string_view& payload) {
+        if (line.compare(0, 5, "data:") != 0) {
+            return false;
+        }
+        payload = line.substr(5);
+        size_t start = payload.find_first_not_of(" \t");
+        payload = start == std::string_view::npos ? std::string_view() : payload.substr(start);
+        return !payload.empty();
+    }
+};
+
+struct NdjsonFraming {
+    static bool payload(std::string_view line, std::string_view& payload) {
+        payload = line;
+        return !line.empty();
+    }
+};
+
+// 按行切分收到的字节，由分帧策略取出负载
+class LineParser {
+public:
+    // on_payload返回false表示调用方要求停止解析
+    template <typename Framing, typename OnPayload>
+    bool feed(const char* data, size_t len, OnPayload&& on_payload) {
+        buffer_.append(data, len);
+
+        size_t start = 0;
+        size_t newline;
+        while ((newline = buffer_.find('\n', start)) != std::string::npos) {
+            std::string_view line(buffer_.data() + start, newline - start);
+            start = newline + 1;
+
+            // 去掉首尾空白（包括\r）
+            size_t first = line.find_first_not_of(" \t\r");
+            if (first == std::string_view::npos) {
+                continue;
+            }
+            line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+
+            std::string_view payload;
+            if (Framing::payload(line, payload) && !on_payload(payload)) {
+                buffer_.erase(0, start);
+                return false;
+            }
+        }
+
+        buffer_.erase(0, start);
+        return true;
+    }
+
+private:
+    std::string buffer_;
+};
+
+// 构造请求体所需的参数
+struct BodyParams {
+    const std::vector<Message>& messages;
+    const std::string& model;
+    bool stream;
+    const std::string& assistant_prefix;  // 非空时作为续传前缀
+    bool prefix_cache;
+    bool debug;
+};
+
+using Headers = std::vector<std::pair<std::string, std::string>>;
+
+// 各方言的策略类，接口相同：
+//   path                    相对于base_url的请求路径
+//   Framing                 流式响应的分帧方式
+//   add_headers(...)        认证与Accept等请求头
+//   body(...)               序列化请求体
+//   parse(...)              从一个负载中提取增量、用量、结束标记与错误
+//   parse_response(...)     解析非流式响应
+struct OpenAIDialect {
+    static constexpr const char* path = "/chat/completions";
+    using Framing = SseFraming;
+
+    static void add_headers(const std::string& api_key, bool stream, Headers& headers);
+    static std::string body(const BodyParams& params);
+    static void parse(std::string_view payload, StreamEvent& event, Usage& usage);
+    static bool parse_response(const nlohmann::json& response, std::string& content, Usage& usage);
+};
+
+struct OllamaDialect {
+    static constexpr const char* path = "/chat";
+    using Framing = NdjsonFraming;
+
+    static void add_headers(const std::string& api_key, bool stream, Headers& headers);
+    static std::string body(const BodyParams& params);
+    static void parse(std::string_view payload, StreamEvent& event, Usage& usage);
+    static bool parse_response(const nlohmann::json& response, std::string& content, Usage& usage);
+};
+
+struct AnthropicDialect {
+    static constexpr const char* path = "/messages";
+    using Framing = SseFraming;
+
+    static void add_headers(const std::string& api_key, bool stream, Headers& headers);
+    static std::string body(const BodyParams& params);
+    static void parse(std::string_view payload, StreamEvent& event, Usage& usage);
+    static bool parse_response(const nlohmann::json& response, std::string& content, Usage& usage);
+};
+
+// 按运行时的方言调用f(策略对象)，每个分支都是独立的编译期实例化
+template <typename F>
+decltype(auto) visit_dialect(Dialect dialect, F&& f) {
+    switch (dialect) {
+        case Dialect::Ollama:
+            return f(OllamaDialect{});
+        case Dialect::Anthropic:
+            return f(AnthropicDialect{});
+        case Dialect::OpenAI:
+            break;
+    }
+    return f(OpenAIDialect{});
+}
+
+} // namespace openai
+} // namespace lc
+
+#endif // LC_DIALECT_H
@@ -0,0 +1,79 @@
+#ifndef LC_DOCS_H
+#define LC_DOCS_H
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "text_index.h"
+
+// 本地文档索引：man与tldr页面按小节切成片段，用text_index的BM25索引检索
+// 提问时把最相关的片段作为参考资料加入提示，--offline直接输出匹配的片段而不访问网络
+//
+// 索引目录（lc_dir()/docs/）中每个构建线程写出一对文件：
+//   store-N     片段内容，每条记录是三个长度（来源、小节、正文）加上对应的字节
+//   seg-N.lcix  片段的倒排索引，文档的ref是片段在store-N中的偏移
+namespace lc {
+namespace docs {
+
+// 每次提问加入提示的片段数与总长度上限
+constexpr size_t GROUNDING_SNIPPETS = 3;
+constexpr size_t GROUNDING_BYTES = 4096;
+// 加入提示的片段的最低BM25得分：在常见发行版的man与tldr索引上，命令相关的问题最佳片段约13~27分，
+// 闲聊与常识问题多在12分以下；低于此分的片段不作为参考资料，--offline仍然全部显示
+constexpr double GROUNDING_MIN_SCORE = 12.0;
+
+// 要扫描的目录：MANPATH（未设置时为常见的man目录）与tldr客户端的页面缓存
+std::vector<std::filesystem::path> default_man_dirs();
+std::vector<std::filesystem::path> default_tldr_dirs();
+
+struct BuildStats {
+    size_t files = 0;      // 解析的页面数
+    size_t skipped = 0;    // 无法读取或没有正文的页面
+    size_t snippets = 0;   // 写入索引的片段数
+    size_t bytes = 0;      // 片段正文的总字节数
+    unsigned threads = 0;
+    double seconds = 0;
+};
+
+// 并行解析全部页面并替换dir中的索引，threads为0时使用全部核心
+bool build(const std::filesystem::path& dir, const std::vector<std::filesystem::path>& man_dirs,
+           const std::vector<std::filesystem::path>& tldr_dirs, unsigned threads, BuildStats& stats,
+           std::string& error);
+
+struct Match {
+    double score = 0;
+    std::string source;   // 例如 tar(1) 或 tldr: tar
+    std::string section;  // man页面的小节标题，tldr为空
+    std::string text;
+};
+
+// 打开后只映射文件，查询不读取整个索引
+class Index {
+public:
+    // 索引不存在或损坏时返回false
+    bool open(const std::filesystem::path& dir, std::string& error);
+
+    // 得分最高的片段，只保留得分不低于最高分一半的结果
+    std::vector<Match> search(std::string_view query, size_t limit) const;
+
+private:
+    struct Part {
+        text_index::Segment segment;
+        void* store = nullptr;
+        size_t store_size = 0;
+        ~Part();
+    };
+    std::vector<std::unique_ptr<Part>> parts_;
+};
+
+// 加入提示的参考资料：说明来源并附上得分不低于GROUNDING_MIN_SCORE的片段，总长度不超过max_bytes；
+// 没有这样的片段时返回空字符串
+std::string grounding(const std::vector<Match>& matches, size_t max_bytes);
+
+} // namespace docs
+} // namespace lc
+
+#endif // LC_DOCS_H
@@ -0,0 +1,84 @@
+#ifndef LC_FANOUT_H
+#define LC_FANOUT_H
+
+#include <filesystem>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "openai.h"
+
+// 同一问题并发发给多个模型：--compare逐个对比输出，--race只采用最先输出的模型
+// 所有流由同一个异步引擎驱动，总耗时取决于最慢的模型而不是各模型之和
+namespace lc {
+namespace fanout {
+
+struct StreamReport {
+    std::string model;
+    openai::ChatCompletionResult result;
+    double ttft_ms = -1;   // 首个内容增量的延迟，-1表示没有收到内容
+    double total_ms = 0;
+};
+
+// index为模型在列表中的位置；回调在事件循环线程上依次执行
+using DeltaHandler = std::function<void(size_t index, const std::string& delta)>;
+
+// 并发请求所有模型，每个流独立应用停止条件，全部结束后返回
+std::vector<StreamReport> compare(
+    const Config& config,
+    const std::vector<openai::Message>& messages,
+    const std::vector<std::string>& models,
+    bool debug,
+    const openai::StreamOptions& options,
+    const DeltaHandler& on_delta
+);
+
+struct RaceOutcome {
+    int winner = -1;                      // 胜出模型在列表中的位置，-1表示没有模型产生内容
+    openai::ChatCompletionResult result;  // 胜者的结果；没有胜者时汇总各模型的错误
+    std::vector<StreamReport> reports;    // 各模型的结果，落败者以"lost race"提前结束
+};
+
+// 并发请求所有模型，第一个产生内容增量的模型胜出，其余请求立即取消
+// 只有胜者的增量会交给callback
+RaceOutcome race(
+    const Config& config,
+    const std::vector<openai::Message>& messages,
+    const std::vector<std::string>& models,
+    bool debug,
+    const openai::StreamOptions& options,
+    const openai::StreamCallback& callback
+);
+
+// 把本次竞速的参与者与胜者累加到统计文件，多个进程并发更新时以文件锁串行化
+bool record_race(const std::filesystem::path& path, const RaceOutcome& outcome);
+
+// 各模型的胜率与胜出时的平均首token延迟
+void show_race_stats(const std::filesystem::path& path, std::ostream& out);
+
+// 交错输出：按行缓冲各模型的增量，每行带上模型标签
+class InterleavedPrinter {
+public:
+    InterleavedPrinter(const std::vector<std::string>& models, std::ostream& out);
+
+    void write(size_t index, const std::string& delta);
+    // 输出各模型尚未换行的剩余内容
+    void flush();
+
+private:
+    std::vector<std::string> labels_;
+    std::vector<std::string> pending_;
+    std::ostream& out_;
+};
+
+// 全部结束后按终端宽度把各模型的回答并排输出
+void print_columns(const std::vector<StreamReport>& reports, std::ostream& out, size_t width);
+
+// 每个模型的耗时与结果摘要
+void print_timing(const std::vector<StreamReport>& reports, std::ostream& out);
+
+} // namespace fanout
+} // namespace lc
+
+#endif // LC_FANOUT_H
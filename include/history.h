@@ -0,0 +1,53 @@
+#ifndef LC_HISTORY_H
+#define LC_HISTORY_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "openai.h"
+
+// 对话历史的全文索引：记忆文件只保留最近max_history轮，每次保存时把新出现的消息追加到
+// 只追加的归档并写入一个小的索引段，较早轮次的内容也能按关键词找回
+//
+// 目录结构（记忆文件所在目录下的history/）：
+//   archive    每条消息一条记录：16字节记录头（长度、角色、时间）加上内容
+//   windows    最近几次保存的消息窗口（各消息的哈希），判断哪些消息是新的
+//   manifest   当前有效的索引段列表，整体替换
+//   seg-N.lcix text_index格式的索引段，每4个同层的段合并为一个
+namespace lc {
+namespace history {
+
+// 记忆文件对应的历史索引目录
+std::filesystem::path index_dir(const std::filesystem::path& memory_path);
+
+// 索引目录是否已经建立
+bool has_index(const std::filesystem::path& dir);
+
+// 把窗口中尚未归档的用户与助手消息（之前保存的窗口之后的新轮次）追加到归档并建立索引；在文件锁下进行，多个进程可以同时保存
+bool index_messages(const std::filesystem::path& dir, const std::vector<openai::Message>& messages,
+                    std::string& error);
+
+struct Result {
+    double score = 0;
+    int64_t time = 0;  // 归档时间，Unix秒
+    openai::Role role = openai::Role::User;
+    size_t bytes = 0;  // 消息内容的长度
+    std::string snippet;
+};
+
+struct Page {
+    std::vector<Result> results;
+    size_t total = 0;  // 匹配的消息总数
+};
+
+// 按BM25排序查询，返回第page页（从1开始）的结果，每条带有命中位置附近的摘要
+bool search(const std::filesystem::path& dir, std::string_view query, size_t page, size_t page_size, Page& out,
+            std::string& error);
+
+} // namespace history
+} // namespace lc
+
+#endif // LC_HISTORY_H
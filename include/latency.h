@@ -0,0 +1,93 @@
+#ifndef LC_LATENCY_H
+#define LC_LATENCY_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+
+// 请求的分阶段超时，以及按模型与端点记录的历史延迟
+// 首token与token间隔的超时由历史延迟推导：快模型的卡顿几秒内就能发现并把剩余预算留给重试，
+// 慢的推理模型也不会被固定的读超时切断
+namespace lc {
+namespace latency {
+
+using Clock = std::chrono::steady_clock;
+using Millis = std::chrono::milliseconds;
+
+// 各阶段的超时，0表示该阶段不限制
+struct Timeouts {
+    Millis connect{0};      // 建立连接、TLS握手与发送请求
+    Millis first_token{0};  // 每次尝试开始到收到首个内容增量
+    Millis inter_token{0};  // 收到内容后，相邻两块响应数据之间的最长间隔
+};
+
+// 没有历史样本时的超时，与以前httplib客户端固定的连接与读超时一致
+Timeouts default_timeouts();
+
+// 按截止时间切分：连接最多占剩余时间的1/4，首token与token间隔最多占一半，
+// 某个阶段卡住时至少还留下一半的预算用于重试
+Timeouts within_budget(Timeouts timeouts, Millis remaining);
+
+// 毫秒延迟的对数分桶直方图，每个桶的上界是前一个的√2倍（从10ms到约两小时），只记录次数
+class Histogram {
+public:
+    static constexpr size_t BUCKETS = 40;
+
+    void add(double ms);
+    void merge(const Histogram& other);
+    // 样本所在桶的上界，偏保守；没有样本时返回0
+    double percentile(double p) const;
+    uint64_t count() const;
+    // 所有计数减半，让较新的样本占主导
+    void decay();
+
+    static double upper_bound(size_t bucket);
+
+    std::array<uint32_t, BUCKETS> counts{};
+};
+
+// 一次请求的延迟样本
+struct Sample {
+    Histogram first_token;  // 通常只有一个样本；续传的尝试不计入
+    Histogram inter_token;  // 收到内容后相邻数据块的间隔
+};
+
+// 延迟历史的键：模型与解析出的端点名
+std::string key(const std::string& model, const std::string& endpoint);
+
+// 各模型与端点的延迟历史，保存在lc_dir()/latency.json
+// 进程内的样本先在内存中累加，save()时在文件锁下与文件中的内容合并
+class Store {
+public:
+    explicit Store(std::filesystem::path path);
+
+    Store(const Store&) = delete;
+    Store& operator=(const Store&) = delete;
+
+    // 按该键的历史推导首token与token间隔的超时；样本不足时使用default_timeouts()
+    Timeouts timeouts(const std::string& key);
+
+    // 记录一次成功请求的样本，可在任意线程调用
+    void add(const std::string& key, const Sample& sample);
+
+    // 把本进程新增的样本写回文件；没有新样本时不写
+    bool save();
+
+private:
+    void load_locked();
+
+    std::filesystem::path path_;
+    std::mutex mutex_;
+    bool loaded_ = false;
+    std::map<std::string, Sample> history_;  // 文件中的历史加上本进程的样本
+    std::map<std::string, Sample> added_;    // 本进程新增、尚未写回的样本
+};
+
+} // namespace latency
+} // namespace lc
+
+#endif // LC_LATENCY_H
@@ -1,15 +1,22 @@
 #ifndef LC_OPENAI_H
 #define LC_OPENAI_H
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <functional>
 #include <optional>
 #include <nlohmann/json.hpp>
 #include <filesystem>
+#include <map>
 #include <memory>
+#include <regex>
+#include <chrono>
+#include <limits>
 
 #include "config.h"
+#include "latency.h"
 
 // 前向声明httplib命名空间
 namespace httplib {
@@ -17,28 +24,114 @@ namespace httplib {
 }
 
 namespace lc {
+
+namespace cassette {
+class Recorder;
+}
+
 namespace openai {
 
+class AsyncEngine;
+class ConnectionPool;
+
+// 消息角色，序列化时使用驻留的字符串常量
+enum class Role : uint8_t {
+    System,
+    User,
+    Assistant
+};
+
+// 角色在请求与记忆文件中的名称
+const std::string& role_name(Role role);
+
+// 解析角色名称，未知角色返回false
+bool parse_role(std::string_view name, Role& role);
+
 // 消息结构体
+// 内容是指向只读存储的视图：单独构造的消息各自持有一份内容，从记忆文件加载的历史共用一块arena
+// 复制消息只增加存储的引用计数，不复制内容
 struct Message {
-    std::string role;
-    std::string content;
-    
+    Role role = Role::User;
+
+    Message() = default;
+    Message(Role role, std::string content);
+    Message(Role role, std::string_view content, std::shared_ptr<const void> storage);
+
+    std::string_view content() const { return content_; }
+
     // JSON序列化支持
     nlohmann::json to_json() const;
     static Message from_json(const nlohmann::json& j);
+
+    // 把消息的JSON对象直接追加到out，与to_json().dump()的输出逐字节一致
+    void append_json(std::string& out) const;
+
+private:
+    std::string_view content_;
+    std::shared_ptr<const void> storage_;
 };
 
+// 按JSON字符串规则转义text并追加到out（含两侧引号），无效的UTF-8字节替换为U+FFFD
+void append_json_string(std::string& out, std::string_view text);
+
+// 转义后的长度（含两侧引号，按合法UTF-8计算），用于一次性预留大段内容的空间
+size_t json_string_size(std::string_view text);
+
 // 流式回调函数类型
 using StreamCallback = std::function<void(const std::string& delta, bool is_done)>;
 
+// 流式输出的本地停止条件，满足任一条件即关闭连接
+struct StopConditions {
+    std::optional<std::regex> until;  // 输出匹配该正则时停止
+    size_t max_lines = 0;             // 0 表示不限制
+    size_t max_bytes = 0;             // 0 表示不限制
+
+    bool empty() const { return !until && max_lines == 0 && max_bytes == 0; }
+};
+
+// 流式请求选项
+struct StreamOptions {
+    StopConditions stop;
+    // 整个请求的截止时间，默认不限制；各阶段的超时按剩余时间切分，卡住时留出重试的预算
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+    // 连接、首token与token间隔的超时；latency非空时改用按延迟历史推导的值
+    latency::Timeouts timeouts = latency::default_timeouts();
+    // 非空时按模型与端点的延迟历史推导超时，并记录成功请求的延迟
+    latency::Store* latency = nullptr;
+    // 内存中最多保留的回答字节数，超出的部分只交给回调（--output），结果中的full_response只是开头的摘录；
+    // 续传需要完整的已输出内容，由reload_response读回，为空时不再续传
+    size_t retain_bytes = std::numeric_limits<size_t>::max();
+    std::function<std::string()> reload_response;
+    // 非空时由异步引擎的事件循环驱动，而不是阻塞的httplib客户端
+    AsyncEngine* engine = nullptr;
+    // 非空时录制请求与带时间戳的响应块，见--record
+    cassette::Recorder* recorder = nullptr;
+    // 非空时从中取用keep-alive客户端，多次请求复用同一条TCP/TLS连接
+    ConnectionPool* connections = nullptr;
+};
+
+// 响应中的token用量，-1表示服务端没有返回该项
+struct Usage {
+    long prompt_tokens = -1;
+    long completion_tokens = -1;
+    long cached_tokens = -1;     // 命中提供方前缀缓存的提示token数
+
+    bool present() const { return prompt_tokens >= 0 || completion_tokens >= 0; }
+};
+
 // 聊天完成结果
 struct ChatCompletionResult {
-    bool success;
+    bool success = false;
     std::string full_response;
     std::string error_message;
+    bool stopped_early = false;  // 因本地停止条件或中断而提前结束
+    std::string stop_reason;
+    Usage usage;
 };
 
+// 用于--debug输出的用量摘要，包含前缀缓存命中率
+std::string format_usage(const Usage& usage);
+
 // 请求聊天完成（非流式）
 ChatCompletionResult chat_completion(
     const Config& config, 
@@ -53,32 +146,73 @@ ChatCompletionResult chat_completion_stream(
     const std::vector<Message>& messages, 
     StreamCallback callback,
     const std::string& model_override = "",
-    bool debug = false
+    bool debug = false,
+    const StreamOptions& options = {}
 );
 
+// 请求取消当前的流式请求（可在信号处理函数中调用）
+void request_cancel();
+
+// 是否已请求取消
+bool cancel_requested();
+
+// 清除取消标记
+void reset_cancel();
+
+// 解析后的API地址
+struct ApiUrl {
+    std::string scheme;       // http、https 或 unix
+    std::string host;         // 主机名（可带端口），unix 时为 socket 文件路径
+    std::string path_prefix;  // 例如 /v1/
+    
+    bool use_https() const { return scheme == "https"; }
+    bool use_unix_socket() const { return scheme == "unix"; }
+    
+    // 用于日志输出的完整地址
+    std::string to_string() const;
+};
+
 // 规范化API URL
 std::string normalize_api_url(const std::string& base_url);
 
-// 创建HTTP客户端
-std::unique_ptr<httplib::Client> create_http_client(const std::string& host, bool use_https, bool debug);
+// 创建HTTP客户端（unix scheme 走 AF_UNIX 连接）
+std::unique_ptr<httplib::Client> create_http_client(const ApiUrl& api_url, bool debug);
+
+// 按API地址缓存的keep-alive客户端，供交互模式在整个会话中复用连接
+// 连接被取消或中断后，下一次请求由httplib自动重新建立
+class ConnectionPool {
+public:
+    ConnectionPool();
+    ~ConnectionPool();
+
+    ConnectionPool(const ConnectionPool&) = delete;
+    ConnectionPool& operator=(const ConnectionPool&) = delete;
+
+    // 同一地址总是返回同一个客户端，创建失败时返回nullptr
+    httplib::Client* acquire(const ApiUrl& api_url, bool debug);
+
+private:
+    std::map<std::string, std::unique_ptr<httplib::Client>> clients_;
+};
 
-// 解析API URL
-bool parse_api_url(const std::string& url_base, std::string& host, std::string& path_prefix, bool& use_https, bool debug);
+// 解析API URL，支持 http(s)://host[/path] 与 unix:///path/to.sock[/path]
+bool parse_api_url(const std::string& url_base, ApiUrl& api_url, bool debug);
 
 // 去除字符串首尾空白字符
 std::string trim(const std::string& str);
 
-// 加载消息历史
+// 加载消息历史：流式解析文件，所有内容放入同一块arena，消息只保存视图
 std::optional<std::vector<Message>> load_messages(const std::filesystem::path& path);
 
-// 保存消息历史
+// 保存消息历史：过滤系统消息，保留最近的max_history轮，直接写出JSON不构造中间对象
+// 窗口之外的较早消息不会丢失：新出现的消息同时追加到历史归档并建立全文索引（见history.h）
 bool save_messages(
     const std::vector<Message>& messages, 
     const std::filesystem::path& path, 
     int max_history
 );
 
-// 清除消息历史
+// 清除消息历史与历史归档（history/目录）
 bool clear_messages(const std::filesystem::path& path);
 
 // 显示消息历史
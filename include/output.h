@@ -0,0 +1,98 @@
+#ifndef LC_OUTPUT_H
+#define LC_OUTPUT_H
+
+#include <unistd.h>
+
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+#include "openai.h"
+
+// 回答的输出目标：--output把增量直接写入文件，内存占用与回答长度无关；
+// --format ndjson把请求过程逐个事件输出给下游程序
+namespace lc {
+namespace output {
+
+// 写入历史记录的回答摘录长度上限，完整内容只在输出文件中
+constexpr size_t HISTORY_EXCERPT_BYTES = 4096;
+
+// 按大块缓冲写入文件的增量输出，攒满缓冲区才调用一次write
+class FileWriter {
+public:
+    static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+    FileWriter() = default;
+    ~FileWriter();
+
+    FileWriter(const FileWriter&) = delete;
+    FileWriter& operator=(const FileWriter&) = delete;
+
+    // 截断或创建文件；sync为true时close()会在关闭前fsync，保证内容落盘
+    bool open(const std::filesystem::path& path, bool sync, std::string& error);
+
+    // 写入失败后后续调用直接返回false，原因见error()
+    bool write(std::string_view data);
+    bool flush();
+    bool close();
+
+    // 读回已写入的全部内容（续传时需要完整的已输出内容）
+    std::string read_back();
+
+    size_t bytes() const { return bytes_; }
+    const std::filesystem::path& path() const { return path_; }
+    const std::string& error() const { return error_; }
+
+private:
+    bool fail(const std::string& what);
+
+    int fd_ = -1;
+    bool sync_ = false;
+    std::filesystem::path path_;
+    std::string buffer_;
+    size_t bytes_ = 0;
+    std::string error_;
+};
+
+// 保存到历史记录中的内容：回答开头的摘录加上完整内容所在的文件
+std::string history_excerpt(const std::string& excerpt, const FileWriter& writer);
+
+// 每个事件一行JSON：start、delta、usage、timing与error，elapsed_ms从调用开始计时
+// 每行用一次write整行写出，下游逐行读取时延迟与终端输出相同；管道写满时阻塞等待，
+// 非阻塞的fd则poll到可写为止，读取端关闭（EPIPE）后不再写入
+class NdjsonWriter {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit NdjsonWriter(Clock::time_point start, int fd = STDOUT_FILENO);
+
+    void start(const std::string& model, const std::string& endpoint);
+    // offset为该段文本在完整回答中的字节偏移
+    void delta(const std::string& text);
+    void usage(const openai::Usage& usage);
+    // 首token延迟、总耗时、字节数与增量数，以及是否提前结束
+    void timing(const openai::ChatCompletionResult& result);
+    void error(const std::string& message);
+
+    // 下游已关闭管道或写入失败，之后的事件都被丢弃
+    bool broken() const { return broken_; }
+
+private:
+    void begin(const char* event);
+    void finish();
+    double elapsed_ms() const;
+
+    Clock::time_point start_;
+    int fd_;
+    std::string line_;
+    size_t offset_ = 0;
+    size_t deltas_ = 0;
+    double ttft_ms_ = -1;
+    bool broken_ = false;
+};
+
+} // namespace output
+} // namespace lc
+
+#endif // LC_OUTPUT_H
@@ -0,0 +1,90 @@
+#ifndef LC_REPL_H
+#define LC_REPL_H
+
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "openai.h"
+
+// 交互模式（lc -i）：整个会话保持配置、内存中的对话历史与keep-alive连接，
+// 追问的延迟只剩网络与模型本身
+namespace lc {
+namespace repl {
+
+// 终端行编辑：光标移动、历史记录、整行/整词删除，以及bracketed paste多行粘贴
+// 标准输入不是终端时退化为逐行读取
+class LineEditor {
+public:
+    enum class Status {
+        Line,         // 读到一行（可能包含粘贴或续行产生的换行）
+        Interrupted,  // Ctrl-C放弃当前输入
+        Eof           // Ctrl-D或输入结束
+    };
+
+    LineEditor();
+    ~LineEditor();
+
+    LineEditor(const LineEditor&) = delete;
+    LineEditor& operator=(const LineEditor&) = delete;
+
+    Status read_line(const std::string& prompt, std::string& line);
+    void add_history(const std::string& line);
+
+private:
+    bool enable_raw_mode();
+    void disable_raw_mode();
+    void refresh(const std::string& prompt, const std::string& buffer, size_t cursor);
+
+    bool interactive_;
+    bool raw_ = false;
+    std::vector<std::string> history_;
+    struct TermState;
+    std::unique_ptr<TermState> saved_;
+};
+
+// 写后持久化：由后台线程把最新的对话快照写入记忆文件，提问不必等待磁盘
+// 连续多次提交只写最后一份，析构时写完尚未落盘的快照
+class MemoryWriter {
+public:
+    MemoryWriter(std::filesystem::path path, int max_history);
+    ~MemoryWriter();
+
+    MemoryWriter(const MemoryWriter&) = delete;
+    MemoryWriter& operator=(const MemoryWriter&) = delete;
+
+    void save(std::vector<openai::Message> messages);
+
+private:
+    void run();
+
+    std::filesystem::path path_;
+    int max_history_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::optional<std::vector<openai::Message>> pending_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+struct Session {
+    std::string model_override;
+    bool use_system_prompt = true;
+    bool debug = false;
+    openai::StreamOptions options;  // 停止条件对每次回答分别生效
+    std::chrono::milliseconds deadline{0};  // 每次回答的时间预算（--deadline），0表示不限制
+};
+
+// 运行交互循环，直到Ctrl-D或/exit；返回进程退出码
+int run(const Config& config, const Session& session);
+
+} // namespace repl
+} // namespace lc
+
+#endif // LC_REPL_H
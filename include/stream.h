@@ -0,0 +1,146 @@
+#ifndef LC_STREAM_H
+#define LC_STREAM_H
+
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "dialect.h"
+#include "openai.h"
+
+// 流式请求的公共组件：请求构造、响应解析与增量处理
+// httplib阻塞客户端与异步引擎共用这些组件，保证两条路径行为一致
+namespace lc {
+namespace openai {
+
+// 与具体HTTP实现无关的请求描述
+struct PreparedRequest {
+    ApiUrl api_url;
+    std::string url_base;
+    std::string path;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+    Dialect dialect = Dialect::OpenAI;  // 响应按端点配置的方言解析
+    std::string latency_key;            // 延迟历史的键，见latency::key
+};
+
+// 构造聊天完成请求；assistant_prefix非空时作为续传前缀追加到消息末尾
+bool prepare_chat_request(
+    const Config& config,
+    const std::vector<Message>& messages,
+    const std::string& model_override,
+    bool stream,
+    const std::string& assistant_prefix,
+    PreparedRequest& request,
+    std::string& error_message,
+    bool debug
+);
+
+// 本次尝试各阶段的超时：按延迟历史（若有）推导，再按截止时间的剩余部分切分
+latency::Timeouts request_timeouts(const StreamOptions& options, const PreparedRequest& request, bool debug);
+
+// 从响应的usage对象中读取token用量，兼容OpenAI与DeepSeek的缓存命中字段
+Usage parse_usage(const nlohmann::json& usage);
+
+// 逐个增量检查本地停止条件
+class StopEvaluator {
+public:
+    explicit StopEvaluator(const StopConditions& conditions) : conditions_(conditions) {}
+
+    // 返回本次增量中允许输出的长度；触发停止时设置reason
+    size_t accept(const std::string& delta, std::string& reason);
+
+private:
+    const StopConditions& conditions_;
+    size_t bytes_ = 0;
+    size_t lines_ = 0;
+    std::string current_line_;
+};
+
+// 续传时过滤模型重放的已有内容，保证回调只收到新的增量
+class ResumeFilter {
+public:
+    explicit ResumeFilter(const std::string& prefix) : prefix_(prefix), passthrough_(prefix.empty()) {}
+
+    std::string filter(const std::string& delta);
+
+private:
+    std::string prefix_;
+    std::string pending_;
+    bool passthrough_;
+};
+
+// 处理一次流式请求的响应体：按方言分帧与提取增量、去重、检查停止条件并回调
+// 同一个处理器可跨越多次续传尝试，累计的内容保持连续
+class StreamProcessor {
+public:
+    StreamProcessor(const StreamCallback& callback, const StreamOptions& options, bool debug);
+
+    // 开始一次新的请求尝试（首次或续传），dialect取自该次的PreparedRequest
+    void begin_attempt(Dialect dialect = Dialect::OpenAI);
+
+    // 处理收到的响应体字节，返回false表示应立即断开连接
+    bool feed(const char* data, size_t len);
+
+    // 标记为提前结束（例如用户中断）
+    void stop(const std::string& reason);
+
+    bool done() const { return done_; }
+    bool stopped_early() const { return stopped_early_; }
+    const std::string& stop_reason() const { return stop_reason_; }
+    // 内存中保留的回答；超过options.retain_bytes时只有开头部分
+    const std::string& accumulated() const { return accumulated_; }
+    // 已输出的回答总字节数
+    size_t received_bytes() const { return received_bytes_; }
+    // 续传需要完整的已输出内容：全部保留在内存中，或者可以通过reload_response读回
+    bool can_resume() const;
+    std::string resume_prefix() const;
+    const Usage& usage() const { return usage_; }
+    // 服务端在流中报告的错误，非空时feed返回false，请求应按失败处理
+    const std::string& error() const { return error_; }
+
+    // 超时判断：本次尝试开始的时间、是否已收到响应数据、是否已收到内容增量、最近一次收到响应数据的时间
+    // 阻塞客户端的监视线程会并发读取，因此用原子变量保存
+    latency::Clock::time_point attempt_start() const;
+    bool has_response() const { return has_response_.load(std::memory_order_relaxed); }
+    bool has_content() const { return has_content_.load(std::memory_order_relaxed); }
+    latency::Clock::time_point last_activity() const;
+    // 本次请求的延迟样本，用于更新延迟历史
+    const latency::Sample& latency() const { return latency_; }
+
+private:
+    // 每个读块只按方言分派一次，块内逐行、逐token都是静态调用
+    template <typename Policy>
+    bool feed_as(const char* data, size_t len);
+    bool handle_event();
+    bool emit(std::string delta);
+    void append(const std::string& delta);
+
+    const StreamCallback& callback_;
+    const StreamOptions& options_;
+    bool debug_;
+    Dialect dialect_ = Dialect::OpenAI;
+    LineParser parser_;
+    StreamEvent event_;
+    StopEvaluator stop_evaluator_;
+    ResumeFilter resume_filter_;
+    std::string accumulated_;
+    size_t received_bytes_ = 0;
+    bool done_ = false;
+    bool stopped_early_ = false;
+    std::string stop_reason_;
+    Usage usage_;
+    std::string error_;
+    std::atomic<latency::Clock::rep> attempt_start_{0};
+    std::atomic<latency::Clock::rep> last_activity_{0};
+    std::atomic<bool> has_response_{false};
+    std::atomic<bool> has_content_{false};
+    bool first_token_recorded_ = false;
+    latency::Sample latency_;
+};
+
+} // namespace openai
+} // namespace lc
+
+#endif // LC_STREAM_H
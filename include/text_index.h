@@ -0,0 +1,125 @@
+#ifndef LC_TEXT_INDEX_H
+#define LC_TEXT_INDEX_H
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// 全文检索的公共部分：分词、只追加的倒排索引段（可直接mmap读取）与BM25排序
+// 对话历史检索（--search-memory）与本地man/tldr索引（--build-index）共用
+namespace lc {
+namespace text_index {
+
+// 分词：ASCII字母、数字与下划线组成的词转为小写，其他非ASCII字母并入所在的词；
+// 连续的中日韩字符按相邻两字切分（只有一个字时单独成词），标点与空白作为分隔
+class Tokenizer {
+public:
+    static constexpr size_t MAX_TERM_BYTES = 64;
+
+    explicit Tokenizer(std::string_view text) : text_(text) {}
+
+    // 取下一个词写入term（复用其空间），没有更多的词时返回false
+    bool next(std::string& term);
+    // 刚取出的词在原文中的起止字节位置
+    size_t begin() const { return begin_; }
+    size_t end() const { return end_; }
+
+private:
+    std::string_view text_;
+    size_t pos_ = 0;
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    bool in_cjk_run_ = false;
+};
+
+uint64_t term_hash(std::string_view term);
+
+// 段文件的各部分，按原生字节序写入，读取时直接映射
+struct DocEntry {
+    uint64_t ref;     // 由调用方解释：历史归档中的偏移、文档库中的位置等
+    uint32_t length;  // 文档的词数
+    uint32_t reserved;
+};
+
+struct TermEntry {
+    uint64_t hash;
+    uint64_t postings;  // 在倒排表数组中的起始位置
+    uint32_t df;
+    uint32_t reserved;
+};
+
+struct Posting {
+    uint32_t doc;
+    uint32_t tf;
+};
+
+// 只读的索引段：mmap映射，按词哈希二分查找倒排表
+class Segment {
+public:
+    Segment() = default;
+    ~Segment();
+
+    Segment(const Segment&) = delete;
+    Segment& operator=(const Segment&) = delete;
+
+    bool open(const std::filesystem::path& path, std::string& error);
+
+    uint32_t doc_count() const;
+    uint64_t total_length() const;
+    const DocEntry& doc(uint32_t index) const { return docs_[index]; }
+
+    uint32_t term_count() const;
+    const TermEntry& term(uint32_t index) const { return terms_[index]; }
+    const Posting* postings_at(const TermEntry& term) const { return postings_ + term.postings; }
+
+    // 词的倒排表，不存在时返回nullptr
+    const TermEntry* find(uint64_t hash) const;
+
+private:
+    void* data_ = nullptr;
+    size_t size_ = 0;
+    const DocEntry* docs_ = nullptr;
+    const TermEntry* terms_ = nullptr;
+    const Posting* postings_ = nullptr;
+};
+
+// 在内存中构造一个段，写出后即不再修改；增量索引通过追加新段并按层合并实现
+class SegmentBuilder {
+public:
+    // 添加一篇文档，返回它在段内的编号
+    uint32_t add(uint64_t ref, std::string_view text);
+    // 合并已有段的全部文档（编号顺延），用于把多个小段合并为一个
+    void add_segment(const Segment& segment);
+
+    size_t doc_count() const { return docs_.size(); }
+
+    // 先写临时文件再rename，读取方不会看到写了一半的段
+    bool write(const std::filesystem::path& path, std::string& error) const;
+
+private:
+    std::vector<DocEntry> docs_;
+    std::unordered_map<uint64_t, std::vector<Posting>> postings_;
+    uint64_t total_length_ = 0;
+};
+
+struct Hit {
+    size_t segment;  // 在传入的段列表中的位置
+    uint32_t doc;
+    double score;
+};
+
+// 在多个段上按BM25为查询排序（词之间是“或”的关系），返回得分最高的limit个结果；
+// 文档数、平均长度与文档频率按全部段合计；total非空时写入匹配的文档总数
+std::vector<Hit> search(const std::vector<const Segment*>& segments, std::string_view query, size_t limit,
+                        size_t* total = nullptr);
+
+// 在text中找到第一个查询词，截取其附近约width字节作为摘要（不拆开UTF-8字符，换行替换为空格）
+std::string snippet(std::string_view text, std::string_view query, size_t width);
+
+} // namespace text_index
+} // namespace lc
+
+#endif // LC_TEXT_INDEX_H
@@ -0,0 +1,1719 @@
+#include "../include/async_client.h"
+#include "../include/cassette.h"
+#include "../include/compression.h"
+#include "../include/stream.h"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#ifdef LC_HTTP2_SUPPORT
+#include <nghttp2/nghttp2.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+namespace lc {
+namespace openai {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// 与httplib的set_follow_location相同的重定向次数上限
+constexpr int MAX_REDIRECTS = 20;
+
+// 每个主机保留的空闲HTTP/1.1连接数，以及空闲连接的最长保留时间
+constexpr size_t MAX_IDLE_CONNECTIONS = 4;
+constexpr auto IDLE_CONNECTION_TIMEOUT = std::chrono::seconds(30);
+
+// 增量解码chunked传输编码
+class ChunkedDecoder {
+public:
+    // 返回false表示格式错误
+    template <typename OnData>
+    bool feed(const char* data, size_t len, OnData&& on_data) {
+        size_t pos = 0;
+        while (pos < len && state_ != State::Done) {
+            switch (state_) {
+            case State::Size:
+            case State::Trailer: {
+                const char* newline = static_cast<const char*>(std::memchr(data + pos, '\n', len - pos));
+                size_t end = newline ? static_cast<size_t>(newline - data) : len;
+                line_.append(data + pos, end - pos);
+                pos = end;
+                if (!newline) {
+                    break;
+                }
+                ++pos;
+                if (!line_.empty() && line_.back() == '\r') {
+                    line_.pop_back();
+                }
+                if (state_ == State::Size) {
+                    // 忽略chunk扩展参数
+                    std::string size_text = line_.substr(0, line_.find(';'));
+                    char* parse_end = nullptr;
+                    remaining_ = std::strtoull(size_text.c_str(), &parse_end, 16);
+                    if (size_text.empty() || parse_end == size_text.c_str()) {
+                        return false;
+                    }
+                    state_ = remaining_ == 0 ? State::Trailer : State::Data;
+                } else if (line_.empty()) {
+                    state_ = State::Done;
+                }
+                line_.clear();
+                break;
+            }
+            case State::Data: {
+                size_t take = static_cast<size_t>(std::min<uint64_t>(remaining_, len - pos));
+                if (!on_data(data + pos, take)) {
+                    return true;
+                }
+                pos += take;
+                remaining_ -= take;
+                if (remaining_ == 0) {
+                    state_ = State::DataEnd;
+                }
+                break;
+            }
+            case State::DataEnd:
+                // 跳过数据后的CRLF
+                if (data[pos] == '\n') {
+                    state_ = State::Size;
+                }
+                ++pos;
+                break;
+            case State::Done:
+                break;
+            }
+        }
+        return true;
+    }
+
+    bool done() const { return state_ == State::Done; }
+
+private:
+    enum class State { Size, Data, DataEnd, Trailer, Done };
+    State state_ = State::Size;
+    uint64_t remaining_ = 0;
+    std::string line_;
+};
+
+std::string lowercase(std::string value) {
+    std::transform(value.begin(), value.end(), value.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return value;
+}
+
+// 把Location解析为新的地址与路径：绝对URL可以换协议与主机，其余相对当前地址解析
+bool resolve_location(const std::string& location, const std::string& current_path, ApiUrl& url, std::string& path) {
+    if (location.empty()) {
+        return false;
+    }
+    std::string target = location.compare(0, 2, "//") == 0 ? (url.use_https() ? "https:" : "http:") + location
+                                                            : location;
+    size_t scheme_end = target.find("://");
+    if (scheme_end != std::string::npos) {
+        std::string scheme = lowercase(target.substr(0, scheme_end));
+        if (scheme != "http" && scheme != "https") {
+            return false;
+        }
+        size_t host_start = scheme_end + 3;
+        size_t path_start = target.find_first_of("/?", host_start);
+        url.scheme = scheme;
+        url.host = target.substr(host_start, path_start - host_start);
+        path = path_start == std::string::npos ? "/" : target.substr(path_start);
+        if (path[0] == '?') {
+            path = "/" + path;
+        }
+        return !url.host.empty();
+    }
+    if (target[0] == '/') {
+        path = target;
+    } else {
+        // 相对路径替换当前路径的最后一段
+        path = current_path.substr(0, current_path.rfind('/', current_path.find('?')) + 1) + target;
+    }
+    return true;
+}
+
+// 忽略大小写比较HTTP头名称
+bool header_equals(const std::string& a, const char* b) {
+    size_t len = std::strlen(b);
+    if (a.size() != len) {
+        return false;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+struct Http2Connection;
+
+// 单个异步请求的全部状态
+struct AsyncRequest {
+    enum class State { Connecting, Handshaking, Writing, ReadingHead, ReadingBody };
+
+    AsyncEngine::RequestId id = 0;
+
+    // 请求参数（续传时需要重新构造请求体）
+    Config config;
+    std::vector<Message> messages;
+    std::string model_override;
+    bool debug = false;
+    StreamOptions options;
+    StreamCallback callback;
+    AsyncEngine::CompletionHandler on_complete;
+    std::unique_ptr<StreamProcessor> processor;
+    PreparedRequest prepared;
+    int resumes_left = 0;
+    latency::Timeouts timeouts;  // 本次尝试各阶段的超时
+
+    // 目标地址
+    sockaddr_storage address{};
+    socklen_t address_len = 0;
+    std::string server_name;  // TLS SNI与Host头
+    bool use_tls = false;
+
+    // 连接状态
+    int fd = -1;
+    SSL* ssl = nullptr;
+    State state = State::Connecting;
+    uint32_t events = 0;
+    std::string output;
+    size_t output_offset = 0;
+
+    // 响应解析状态
+    std::string head;
+    int status = 0;
+    bool chunked = false;
+    int64_t content_length = -1;
+    int64_t body_received = 0;
+    ChunkedDecoder chunked_decoder;
+    compression::Decoder decoder;  // 按Content-Encoding解压响应体
+    bool decode_failed = false;
+    std::string error_body;
+    std::string location;          // 3xx响应的Location
+
+    // 重定向：目标在续传时同样生效
+    int redirects_left = MAX_REDIRECTS;
+    bool redirected = false;
+    ApiUrl redirect_url;
+    std::string redirect_path;
+
+    // HTTP/1.1 keep-alive：完整读完的响应且服务器没有要求关闭时，连接交还给空闲连接池
+    bool keep_alive = false;
+    bool reusable = false;
+    bool reused = false;           // 本次尝试使用的是空闲连接
+
+    // HTTP/2：请求作为共享连接上的一个流
+    Http2Connection* h2 = nullptr;
+    int32_t stream_id = -1;
+    size_t body_offset = 0;
+};
+
+#ifdef LC_HTTP2_SUPPORT
+// 同一主机的请求共享的HTTP/2连接，每个请求是其中的一个流
+struct Http2Connection {
+    enum class State { Connecting, Handshaking, Ready };
+
+    uint64_t tag = 0;         // epoll标识，最高位置1以区别于请求ID
+    std::string key;          // scheme://host
+    void* loop = nullptr;
+
+    int fd = -1;
+    SSL* ssl = nullptr;
+    uint32_t events = 0;
+    State state = State::Connecting;
+    bool use_tls = false;
+    std::string server_name;
+
+    nghttp2_session* session = nullptr;
+    std::vector<AsyncRequest*> waiting;          // 连接建立前排队的请求
+    std::map<int32_t, AsyncRequest*> streams;    // 进行中的流
+    std::vector<AsyncRequest*> retry_queue;      // 回调中出错、稍后续传的请求
+    std::string output;                          // 尚未写出的帧
+    size_t output_offset = 0;
+};
+
+constexpr uint64_t HTTP2_CONNECTION_TAG = 1ULL << 63;
+#endif
+
+// 完整读完响应后交还的HTTP/1.1连接
+struct IdleConnection {
+    int fd = -1;
+    SSL* ssl = nullptr;
+    Clock::time_point since;
+};
+
+static bool resolve_address(AsyncRequest& request, std::string& error);
+
+// 一个事件循环线程
+class AsyncEngine::Loop {
+public:
+    Loop() {
+        epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+        wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = 0;
+        epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+
+        thread_ = std::thread([this]() { run(); });
+    }
+
+    ~Loop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake();
+        thread_.join();
+
+        if (ssl_ctx_) {
+            SSL_CTX_free(ssl_ctx_);
+        }
+        close(wake_fd_);
+        close(epoll_fd_);
+    }
+
+    void submit(std::unique_ptr<AsyncRequest> request) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.push_back(std::move(request));
+            ++active_;
+        }
+        wake();
+    }
+
+    void cancel(RequestId id, const std::string& reason) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            cancellations_.emplace_back(id, reason);
+        }
+        wake();
+    }
+
+    size_t active() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return active_;
+    }
+
+private:
+    void wake() {
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd_, &one, sizeof(one));
+        (void)ignored;
+    }
+
+    void run() {
+        std::vector<epoll_event> events(64);
+
+        while (true) {
+            std::vector<std::unique_ptr<AsyncRequest>> incoming;
+            std::vector<std::pair<RequestId, std::string>> cancellations;
+            bool stopping;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                incoming.swap(pending_);
+                cancellations.swap(cancellations_);
+                stopping = stopping_;
+            }
+
+            for (auto& request : incoming) {
+                AsyncRequest* raw = request.get();
+                requests_[raw->id] = std::move(request);
+                if (!stopping) {
+                    start_attempt(*raw);
+                }
+            }
+
+            if (stopping) {
+                break;
+            }
+
+            for (const auto& cancellation : cancellations) {
+                auto it = requests_.find(cancellation.first);
+                if (it != requests_.end()) {
+                    it->second->processor->stop(cancellation.second);
+                    finish(*it->second);
+                }
+            }
+
+            // Ctrl-C对所有进行中的请求生效
+            if (cancel_requested()) {
+                cancel_all("interrupted");
+            }
+
+            expire_deadlines();
+
+#ifdef LC_HTTP2_SUPPORT
+            // 取消、截止等操作产生的RST_STREAM等帧统一在这里写出
+            flush_all_http2();
+#endif
+
+            int n = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), next_timeout_ms());
+            if (n < 0 && errno != EINTR) {
+                break;
+            }
+
+            for (int i = 0; i < n; ++i) {
+                RequestId id = events[i].data.u64;
+                if (id == 0) {
+                    uint64_t value;
+                    while (read(wake_fd_, &value, sizeof(value)) > 0) {
+                    }
+                    continue;
+                }
+
+#ifdef LC_HTTP2_SUPPORT
+                if (id & HTTP2_CONNECTION_TAG) {
+                    auto connection = h2_by_tag_.find(id);
+                    if (connection != h2_by_tag_.end()) {
+                        drive_http2(*connection->second);
+                    }
+                    continue;
+                }
+#endif
+
+                auto it = requests_.find(id);
+                if (it != requests_.end()) {
+                    drive(*it->second);
+                }
+            }
+        }
+
+        // 引擎析构时仍未完成的请求按取消处理
+        cancel_all("cancelled");
+        for (auto& entry : idle_) {
+            for (IdleConnection& connection : entry.second) {
+                close_idle(connection);
+            }
+        }
+        idle_.clear();
+#ifdef LC_HTTP2_SUPPORT
+        while (!h2_connections_.empty()) {
+            destroy_http2(*h2_connections_.begin()->second);
+        }
+#endif
+    }
+
+    void cancel_all(const std::string& reason) {
+        std::vector<AsyncRequest*> all;
+        for (auto& entry : requests_) {
+            all.push_back(entry.second.get());
+        }
+        for (AsyncRequest* request : all) {
+            request->processor->stop(reason);
+            finish(*request);
+        }
+    }
+
+    // 有进行中的请求时最多等待50ms，以便及时响应Ctrl-C与截止时间
+    int next_timeout_ms() const {
+        if (requests_.empty()) {
+            return -1;
+        }
+
+        auto now = Clock::now();
+        auto timeout = std::chrono::milliseconds(50);
+        for (const auto& entry : requests_) {
+            auto deadline = entry.second->options.deadline;
+            if (deadline != Clock::time_point::max()) {
+                auto left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now);
+                timeout = std::max(std::chrono::milliseconds(0), std::min(timeout, left));
+            }
+        }
+        return static_cast<int>(timeout.count());
+    }
+
+    void expire_deadlines() {
+        auto now = Clock::now();
+        std::vector<AsyncRequest*> expired;
+        std::vector<std::pair<AsyncRequest*, std::string>> stalled;
+        for (auto& entry : requests_) {
+            if (entry.second->options.deadline <= now) {
+                expired.push_back(entry.second.get());
+                continue;
+            }
+            std::string reason = stall_reason(*entry.second, now);
+            if (!reason.empty()) {
+                stalled.emplace_back(entry.second.get(), reason);
+            }
+        }
+        for (AsyncRequest* request : expired) {
+            fail(*request, "Request deadline exceeded");
+        }
+        for (auto& entry : stalled) {
+            retry_after_stall(*entry.first, entry.second);
+        }
+    }
+
+    // 当前阶段是否超时：HTTP/1.1的连接、握手与发送请求，或者等待下一块数据
+    // HTTP/2的流共享已建立的连接，只检查数据间隔
+    static std::string stall_reason(const AsyncRequest& request, Clock::time_point now) {
+        const latency::Timeouts& timeouts = request.timeouts;
+        const StreamProcessor& processor = *request.processor;
+        bool connecting = !request.h2 && (request.state == AsyncRequest::State::Connecting ||
+                                          request.state == AsyncRequest::State::Handshaking ||
+                                          request.state == AsyncRequest::State::Writing);
+        if (connecting) {
+            if (timeouts.connect.count() > 0 && now - processor.attempt_start() >= timeouts.connect) {
+                return "connect timed out after " + std::to_string(timeouts.connect.count()) + " ms";
+            }
+            return "";
+        }
+        // 首个内容之前的思考增量与心跳同样算作活动，按首token超时衡量数据间隔
+        latency::Millis limit = processor.has_content() ? timeouts.inter_token : timeouts.first_token;
+        if (limit.count() > 0 && now - processor.last_activity() >= limit) {
+            return (processor.has_response() ? "no data for " : "no response within ") +
+                std::to_string(limit.count()) + " ms";
+        }
+        return "";
+    }
+
+    SSL_CTX* ssl_context() {
+        if (!ssl_ctx_) {
+            ssl_ctx_ = SSL_CTX_new(TLS_client_method());
+            SSL_CTX_set_default_verify_paths(ssl_ctx_);
+            // 与阻塞客户端保持一致：不校验服务器证书，避免SSL证书问题
+            SSL_CTX_set_verify(ssl_ctx_, SSL_VERIFY_NONE, nullptr);
+        }
+        return ssl_ctx_;
+    }
+
+    void close_connection(AsyncRequest& request) {
+#ifdef LC_HTTP2_SUPPORT
+        if (request.h2) {
+            detach_http2(request);
+        }
+#endif
+        if (request.reusable && request.fd >= 0) {
+            release_idle(request);
+        }
+        if (request.ssl) {
+            SSL_free(request.ssl);
+            request.ssl = nullptr;
+        }
+        if (request.fd >= 0) {
+            close(request.fd);
+            request.fd = -1;
+        }
+        request.events = 0;
+    }
+
+    static std::string connection_key(const AsyncRequest& request) {
+        return request.prepared.api_url.scheme + "://" + request.prepared.api_url.host;
+    }
+
+    static void close_idle(IdleConnection& connection) {
+        if (connection.ssl) {
+            SSL_free(connection.ssl);
+        }
+        close(connection.fd);
+    }
+
+    // 把完整读完响应的连接交还空闲连接池，之后发往同一主机的请求不必重新握手
+    void release_idle(AsyncRequest& request) {
+        request.reusable = false;
+        auto& idle = idle_[connection_key(request)];
+        if (idle.size() >= MAX_IDLE_CONNECTIONS) {
+            return;
+        }
+        epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, request.fd, nullptr);
+        idle.push_back({request.fd, request.ssl, Clock::now()});
+        request.fd = -1;
+        request.ssl = nullptr;
+        request.events = 0;
+    }
+
+    // 取出一条仍可使用的空闲连接：空闲过久或已可读（服务器关闭了连接）的直接关闭
+    bool take_idle(AsyncRequest& request) {
+        auto it = idle_.find(connection_key(request));
+        if (it == idle_.end()) {
+            return false;
+        }
+        auto now = Clock::now();
+        while (!it->second.empty()) {
+            IdleConnection connection = it->second.back();
+            it->second.pop_back();
+            char byte;
+            bool alive = now - connection.since < IDLE_CONNECTION_TIMEOUT &&
+                         recv(connection.fd, &byte, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+                         (errno == EAGAIN || errno == EWOULDBLOCK);
+            if (alive) {
+                request.fd = connection.fd;
+                request.ssl = connection.ssl;
+                return true;
+            }
+            close_idle(connection);
+        }
+        return false;
+    }
+
+    // 建立一次连接尝试（首次或续传），重置响应解析状态
+    void start_attempt(AsyncRequest& request) {
+        request.timeouts = request_timeouts(request.options, request.prepared, request.debug);
+        request.processor->begin_attempt(request.prepared.dialect);
+        request.state = AsyncRequest::State::Connecting;
+        request.head.clear();
+        request.status = 0;
+        request.chunked = false;
+        request.content_length = -1;
+        request.body_received = 0;
+        request.chunked_decoder = ChunkedDecoder();
+        request.decoder.begin("");
+        request.decode_failed = false;
+        request.error_body.clear();
+        request.location.clear();
+        request.keep_alive = false;
+        request.reusable = false;
+        request.reused = false;
+
+        if (request.options.recorder) {
+            request.options.recorder->begin_attempt(request.prepared);
+        }
+
+#ifdef LC_HTTP2_SUPPORT
+        if (use_http2(request)) {
+            attach_http2(request);
+            return;
+        }
+#endif
+
+        build_http1_request(request);
+        if (take_idle(request)) {
+            request.reused = true;
+            request.state = AsyncRequest::State::Writing;
+            if (request.debug) {
+                std::cerr << "[async " << request.id << "] Reusing connection to " << connection_key(request) << std::endl;
+            }
+            watch(request, EPOLLOUT);
+            return;
+        }
+        open_connection(request);
+    }
+
+    // 组装HTTP/1.1请求；HTTP/1.1默认保持连接，完整读完响应后连接可以复用
+    static void build_http1_request(AsyncRequest& request) {
+        std::string host_header = request.prepared.api_url.use_unix_socket() ? "localhost" : request.prepared.api_url.host;
+        request.output = "POST " + request.prepared.path + " HTTP/1.1\r\n";
+        request.output += "Host: " + host_header + "\r\n";
+        for (const auto& header : request.prepared.headers) {
+            request.output += header.first + ": " + header.second + "\r\n";
+        }
+        request.output += std::string("Accept-Encoding: ") + compression::accept_encoding() + "\r\n";
+        request.output += "Content-Length: " + std::to_string(request.prepared.body.size()) + "\r\n\r\n";
+        request.output += request.prepared.body;
+        request.output_offset = 0;
+    }
+
+    void open_connection(AsyncRequest& request) {
+        request.state = AsyncRequest::State::Connecting;
+        request.fd = open_socket(request.address, request.address_len);
+        if (request.fd < 0) {
+            retry_or_fail(request, std::string("connect() failed: ") + std::strerror(errno));
+            return;
+        }
+
+        watch(request, EPOLLOUT);
+    }
+
+    // 创建非阻塞socket并发起连接
+    static int open_socket(const sockaddr_storage& address, socklen_t address_len) {
+        int family = address.ss_family;
+        int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return -1;
+        }
+
+        if (family != AF_UNIX) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        if (connect(fd, reinterpret_cast<const sockaddr*>(&address), address_len) < 0 && errno != EINPROGRESS) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return -1;
+        }
+        return fd;
+    }
+
+    void watch(AsyncRequest& request, uint32_t events) {
+        if (request.events == events) {
+            return;
+        }
+
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = request.id;
+        int op = request.events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        epoll_ctl(epoll_fd_, op, request.fd, &event);
+        request.events = events;
+    }
+
+    // 按SSL_get_error的结果决定等待读还是写，返回false表示发生错误
+    bool wait_for_ssl(AsyncRequest& request, int ret) {
+        int err = SSL_get_error(request.ssl, ret);
+        if (err == SSL_ERROR_WANT_READ) {
+            watch(request, EPOLLIN);
+            return true;
+        }
+        if (err == SSL_ERROR_WANT_WRITE) {
+            watch(request, EPOLLOUT);
+            return true;
+        }
+        return false;
+    }
+
+    // 状态机：尽可能推进请求，直到需要等待IO
+    void drive(AsyncRequest& request) {
+        if (request.state == AsyncRequest::State::Connecting) {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(request.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+            if (error != 0) {
+                retry_or_fail(request, std::string("connect() failed: ") + std::strerror(error));
+                return;
+            }
+
+            if (request.use_tls) {
+                request.ssl = SSL_new(ssl_context());
+                SSL_set_fd(request.ssl, request.fd);
+                SSL_set_tlsext_host_name(request.ssl, request.server_name.c_str());
+                SSL_set_connect_state(request.ssl);
+                request.state = AsyncRequest::State::Handshaking;
+            } else {
+                request.state = AsyncRequest::State::Writing;
+            }
+        }
+
+        if (request.state == AsyncRequest::State::Handshaking) {
+            int ret = SSL_do_handshake(request.ssl);
+            if (ret != 1) {
+                if (!wait_for_ssl(request, ret)) {
+                    retry_or_fail(request, "SSL handshake failed");
+                }
+                return;
+            }
+            request.state = AsyncRequest::State::Writing;
+        }
+
+        if (request.state == AsyncRequest::State::Writing) {
+            while (request.output_offset < request.output.size()) {
+                const char* data = request.output.data() + request.output_offset;
+                size_t len = request.output.size() - request.output_offset;
+                if (request.ssl) {
+                    int ret = SSL_write(request.ssl, data, static_cast<int>(len));
+                    if (ret <= 0) {
+                        if (!wait_for_ssl(request, ret)) {
+                            retry_or_fail(request, "Write failed");
+                        }
+                        return;
+                    }
+                    request.output_offset += ret;
+                } else {
+                    ssize_t ret = send(request.fd, data, len, MSG_NOSIGNAL);
+                    if (ret < 0) {
+                        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                            watch(request, EPOLLOUT);
+                        } else if (errno != EINTR) {
+                            retry_or_fail(request, std::string("Write failed: ") + std::strerror(errno));
+                        }
+                        return;
+                    }
+                    request.output_offset += ret;
+                }
+            }
+            request.output.clear();
+            request.output.shrink_to_fit();
+            request.state = AsyncRequest::State::ReadingHead;
+            watch(request, EPOLLIN);
+        }
+
+        // 读取响应
+        char buffer[16384];
+        while (true) {
+            ssize_t n;
+            if (request.ssl) {
+                int ret = SSL_read(request.ssl, buffer, sizeof(buffer));
+                if (ret <= 0) {
+                    int err = SSL_get_error(request.ssl, ret);
+                    if (err == SSL_ERROR_ZERO_RETURN) {
+                        n = 0;
+                    } else if (wait_for_ssl(request, ret)) {
+                        return;
+                    } else {
+                        n = -1;
+                    }
+                } else {
+                    n = ret;
+                }
+            } else {
+                n = recv(request.fd, buffer, sizeof(buffer), 0);
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    watch(request, EPOLLIN);
+                    return;
+                }
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+            }
+
+            if (n < 0) {
+                retry_or_fail(request, "Read failed");
+                return;
+            }
+
+            if (n == 0) {
+                on_eof(request);
+                return;
+            }
+
+            if (!on_data(request, buffer, static_cast<size_t>(n))) {
+                return;
+            }
+        }
+    }
+
+    // 处理收到的字节，返回false表示请求已结束
+    bool on_data(AsyncRequest& request, const char* data, size_t len) {
+        if (request.state == AsyncRequest::State::ReadingHead) {
+            request.head.append(data, len);
+            size_t end = request.head.find("\r\n\r\n");
+            if (end == std::string::npos) {
+                return true;
+            }
+
+            if (!parse_head(request, end)) {
+                fail(request, "Invalid HTTP response");
+                return false;
+            }
+            if (request.decode_failed) {
+                fail(request, "Unsupported response Content-Encoding");
+                return false;
+            }
+            if (is_redirect(request)) {
+                // 重定向响应没有正文时连接可以直接放回空闲池
+                request.reusable = request.keep_alive && !request.chunked && request.content_length == 0 &&
+                                   request.head.size() == end + 4;
+                follow_redirect(request);
+                return false;
+            }
+
+            std::string rest = request.head.substr(end + 4);
+            request.head.clear();
+            request.state = AsyncRequest::State::ReadingBody;
+            return rest.empty() || on_body(request, rest.data(), rest.size());
+        }
+
+        return on_body(request, data, len);
+    }
+
+    bool parse_head(AsyncRequest& request, size_t end) {
+        size_t line_end = request.head.find("\r\n");
+        std::string status_line = request.head.substr(0, line_end);
+        size_t space = status_line.find(' ');
+        if (space == std::string::npos) {
+            return false;
+        }
+        request.status = std::atoi(status_line.c_str() + space + 1);
+        request.keep_alive = status_line.compare(0, space, "HTTP/1.1") == 0;
+        if (request.options.recorder) {
+            request.options.recorder->on_status(request.status);
+        }
+
+        size_t pos = line_end + 2;
+        while (pos < end) {
+            size_t next = request.head.find("\r\n", pos);
+            std::string line = request.head.substr(pos, next - pos);
+            pos = next + 2;
+
+            size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            std::string name = line.substr(0, colon);
+            std::string value = trim(line.substr(colon + 1));
+            if (request.options.recorder) {
+                request.options.recorder->on_header(name, value);
+            }
+
+            if (header_equals(name, "Transfer-Encoding") && value.find("chunked") != std::string::npos) {
+                request.chunked = true;
+            } else if (header_equals(name, "Content-Length")) {
+                request.content_length = std::atoll(value.c_str());
+            } else if (header_equals(name, "Content-Encoding")) {
+                request.decode_failed = !request.decoder.begin(lowercase(value));
+            } else if (header_equals(name, "Connection") && lowercase(value).find("close") != std::string::npos) {
+                request.keep_alive = false;
+            } else if (header_equals(name, "Location")) {
+                request.location = value;
+            }
+        }
+
+        if (request.debug) {
+            std::cerr << "[async " << request.id << "] Response status: " << request.status << std::endl;
+        }
+        return request.status > 0;
+    }
+
+    // 解压后的响应体交给录制与SSE解析（与httplib一样，录制的是解压后的数据）；
+    // 返回false表示停止条件触发或数据无法解压
+    static bool deliver_body(AsyncRequest& request, const char* data, size_t len) {
+        if (request.decode_failed) {
+            return false;
+        }
+        bool keep_going = true;
+        bool decoded = request.decoder.feed(data, len, [&request, &keep_going](const char* chunk, size_t chunk_len) {
+            if (request.options.recorder) {
+                request.options.recorder->on_chunk(chunk, chunk_len);
+            }
+            if (request.status != 200) {
+                request.error_body.append(chunk, chunk_len);
+                return true;
+            }
+            keep_going = request.processor->feed(chunk, chunk_len);
+            return keep_going;
+        });
+        request.decode_failed = !decoded;
+        return decoded && keep_going;
+    }
+
+    bool on_body(AsyncRequest& request, const char* data, size_t len) {
+        bool keep_going = true;
+        auto deliver = [&](const char* chunk, size_t chunk_len) {
+            keep_going = deliver_body(request, chunk, chunk_len);
+            return keep_going;
+        };
+
+        bool complete = false;
+        if (request.chunked) {
+            if (!request.chunked_decoder.feed(data, len, deliver)) {
+                fail(request, "Invalid chunked encoding");
+                return false;
+            }
+            complete = request.chunked_decoder.done();
+        } else {
+            deliver(data, len);
+            request.body_received += len;
+            complete = request.content_length >= 0 && request.body_received >= request.content_length;
+        }
+
+        if (request.decode_failed) {
+            fail(request, "Invalid compressed response body");
+            return false;
+        }
+
+        // 停止条件触发或用户中断：立即断开；响应已完整读完时连接留给之后的请求
+        if (!keep_going || complete) {
+            request.reusable = complete && request.keep_alive;
+            finish(request);
+            return false;
+        }
+        return true;
+    }
+
+    void on_eof(AsyncRequest& request) {
+        bool complete = request.state == AsyncRequest::State::ReadingBody &&
+                        !request.chunked && request.content_length < 0;
+        if (complete || request.processor->done()) {
+            finish(request);
+        } else {
+            retry_or_fail(request, "Connection closed before the response was complete");
+        }
+    }
+
+    // 流已经开始后连接中断：在重试预算内带着已收到的内容续传
+    void retry_or_fail(AsyncRequest& request, const std::string& error) {
+        // 复用的空闲连接可能已被服务器关闭：还没收到响应就断开时换一条新连接重发，不占用续传次数
+        if (request.reused && request.status == 0 && request.head.empty()) {
+            if (request.debug) {
+                std::cerr << "[async " << request.id << "] Reused connection failed (" << error
+                          << "), reconnecting" << std::endl;
+            }
+            close_connection(request);
+            request.reused = false;
+            build_http1_request(request);
+            open_connection(request);
+            return;
+        }
+        if (request.options.recorder) {
+            request.options.recorder->on_error(error);
+        }
+        if (request.status == 200 && request.resumes_left > 0 && !request.processor->stopped_early() &&
+            request.processor->can_resume()) {
+            --request.resumes_left;
+            if (request.debug) {
+                std::cerr << "[async " << request.id << "] Stream interrupted (" << error << ") after "
+                          << request.processor->received_bytes() << " bytes, resuming ("
+                          << request.resumes_left << " retries left)" << std::endl;
+            }
+            if (restart(request)) {
+                return;
+            }
+        }
+        fail(request, "HTTP request failed: " + error);
+    }
+
+    // 流卡住：不论是否已收到响应头，都在重试预算内重新请求，截止时间剩下的预算留给这次重试
+    void retry_after_stall(AsyncRequest& request, const std::string& reason) {
+        if (request.options.recorder) {
+            request.options.recorder->on_error("stalled: " + reason);
+        }
+        if (request.resumes_left > 0 && !request.processor->stopped_early() && request.processor->can_resume()) {
+            --request.resumes_left;
+            if (request.debug) {
+                std::cerr << "[async " << request.id << "] Stream stalled (" << reason << ") after "
+                          << request.processor->received_bytes() << " bytes, retrying ("
+                          << request.resumes_left << " retries left)" << std::endl;
+            }
+            if (restart(request)) {
+                return;
+            }
+        }
+        fail(request, "Stream stalled: " + reason);
+    }
+
+    // 关闭当前连接，带着已收到的内容作为续传前缀重新构造请求并开始新的尝试
+    bool restart(AsyncRequest& request) {
+        close_connection(request);
+        std::string error_message;
+        if (!prepare_chat_request(request.config, request.messages, request.model_override, true,
+                                  request.processor->resume_prefix(), request.prepared, error_message, request.debug)) {
+            return false;
+        }
+        if (request.redirected) {
+            request.prepared.api_url = request.redirect_url;
+            request.prepared.path = request.redirect_path;
+        }
+        start_attempt(request);
+        return true;
+    }
+
+    static bool is_redirect(const AsyncRequest& request) {
+        int status = request.status;
+        return (status == 301 || status == 302 || status == 307 || status == 308) && !request.location.empty();
+    }
+
+    // 与阻塞客户端的set_follow_location一致，跟随重定向重新发送同一请求；之后的续传也发往新地址
+    // 目标主机不同时在循环线程中解析地址，只在重定向时发生一次
+    void follow_redirect(AsyncRequest& request) {
+        ApiUrl url = request.prepared.api_url;
+        std::string path;
+        if (request.redirects_left-- <= 0 || !resolve_location(request.location, request.prepared.path, url, path)) {
+            fail(request, "API request failed with status " + std::to_string(request.status) +
+                              ": cannot follow redirect to " + request.location);
+            return;
+        }
+        if (request.debug) {
+            std::cerr << "[async " << request.id << "] Redirected (" << request.status << ") to "
+                      << url.scheme << "://" << url.host << path << std::endl;
+        }
+
+        bool same_host = url.scheme == request.prepared.api_url.scheme && url.host == request.prepared.api_url.host;
+        close_connection(request);
+        request.redirected = true;
+        request.redirect_url = url;
+        request.redirect_path = path;
+        request.prepared.api_url = url;
+        request.prepared.path = path;
+        std::string error;
+        if (!same_host && !resolve_address(request, error)) {
+            fail(request, error);
+            return;
+        }
+        start_attempt(request);
+    }
+
+    void fail(AsyncRequest& request, const std::string& error) {
+        if (request.options.recorder) {
+            request.options.recorder->on_error(error);
+        }
+        ChatCompletionResult result;
+        result.error_message = error;
+        result.full_response = trim(request.processor->accumulated());
+        complete(request, result);
+    }
+
+    void finish(AsyncRequest& request) {
+        ChatCompletionResult result;
+        if (!request.processor->error().empty()) {
+            result.error_message = "Stream error: " + request.processor->error();
+        } else if (request.status != 200 && !(request.processor->stopped_early() && request.status == 0)) {
+            result.error_message = "API request failed with status " +
+                                 std::to_string(request.status) + ": " + request.error_body;
+        } else {
+            result.success = true;
+            if (request.options.latency) {
+                request.options.latency->add(request.prepared.latency_key, request.processor->latency());
+            }
+        }
+        result.full_response = trim(request.processor->accumulated());
+        result.stopped_early = request.processor->stopped_early();
+        result.stop_reason = request.processor->stop_reason();
+        result.usage = request.processor->usage();
+        complete(request, result);
+    }
+
+    void complete(AsyncRequest& request, const ChatCompletionResult& result) {
+        close_connection(request);
+        request.callback("", true);
+
+        // 先从表中移除再通知，完成回调中可以安全地提交新请求
+        std::unique_ptr<AsyncRequest> owned = std::move(requests_[request.id]);
+        requests_.erase(request.id);
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --active_;
+        }
+        if (owned->on_complete) {
+            owned->on_complete(result);
+        }
+    }
+
+#ifdef LC_HTTP2_SUPPORT
+    // 是否通过HTTP/2发送：TLS连接用ALPN协商，明文连接需显式配置prior-knowledge
+    bool use_http2(const AsyncRequest& request) const {
+        const std::string& mode = request.config.http2;
+        if (mode == "off" || h1_only_.count(connection_key(request))) {
+            return false;
+        }
+        return request.use_tls || mode == "prior-knowledge";
+    }
+
+    // 把请求挂到同一主机的共享连接上，没有可用连接时新建
+    void attach_http2(AsyncRequest& request) {
+        std::string key = connection_key(request);
+        auto it = h2_connections_.find(key);
+        if (it == h2_connections_.end()) {
+            auto connection = std::make_unique<Http2Connection>();
+            connection->tag = HTTP2_CONNECTION_TAG | next_connection_tag_++;
+            connection->key = key;
+            connection->loop = this;
+            connection->use_tls = request.use_tls;
+            connection->server_name = request.server_name;
+
+            connection->fd = open_socket(request.address, request.address_len);
+            if (connection->fd < 0) {
+                retry_or_fail(request, std::string("connect() failed: ") + std::strerror(errno));
+                return;
+            }
+
+            h2_by_tag_[connection->tag] = connection.get();
+            it = h2_connections_.emplace(key, std::move(connection)).first;
+            watch_http2(*it->second, EPOLLOUT);
+        }
+
+        Http2Connection& connection = *it->second;
+        request.h2 = &connection;
+        if (connection.state == Http2Connection::State::Ready) {
+            submit_stream(connection, request);
+        } else {
+            connection.waiting.push_back(&request);
+        }
+    }
+
+    void watch_http2(Http2Connection& connection, uint32_t events) {
+        if (connection.events == events) {
+            return;
+        }
+
+        epoll_event event{};
+        event.events = events;
+        event.data.u64 = connection.tag;
+        int op = connection.events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        epoll_ctl(epoll_fd_, op, connection.fd, &event);
+        connection.events = events;
+    }
+
+    bool wait_for_ssl(Http2Connection& connection, int ret) {
+        int err = SSL_get_error(connection.ssl, ret);
+        if (err == SSL_ERROR_WANT_READ) {
+            watch_http2(connection, EPOLLIN);
+            return true;
+        }
+        if (err == SSL_ERROR_WANT_WRITE) {
+            watch_http2(connection, EPOLLOUT);
+            return true;
+        }
+        return false;
+    }
+
+    void drive_http2(Http2Connection& connection) {
+        if (connection.state == Http2Connection::State::Connecting) {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(connection.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+            if (error != 0) {
+                fail_http2(connection, std::string("connect() failed: ") + std::strerror(error));
+                return;
+            }
+
+            if (!connection.use_tls) {
+                // 明文prior-knowledge：直接发送连接前言
+                start_http2_session(connection);
+                return;
+            }
+
+            static const unsigned char alpn[] = "\x02h2\x08http/1.1";
+            connection.ssl = SSL_new(ssl_context());
+            SSL_set_fd(connection.ssl, connection.fd);
+            SSL_set_tlsext_host_name(connection.ssl, connection.server_name.c_str());
+            SSL_set_alpn_protos(connection.ssl, alpn, sizeof(alpn) - 1);
+            SSL_set_connect_state(connection.ssl);
+            connection.state = Http2Connection::State::Handshaking;
+        }
+
+        if (connection.state == Http2Connection::State::Handshaking) {
+            int ret = SSL_do_handshake(connection.ssl);
+            if (ret != 1) {
+                if (!wait_for_ssl(connection, ret)) {
+                    fail_http2(connection, "SSL handshake failed");
+                }
+                return;
+            }
+
+            const unsigned char* selected = nullptr;
+            unsigned int selected_len = 0;
+            SSL_get0_alpn_selected(connection.ssl, &selected, &selected_len);
+            if (selected_len == 2 && std::memcmp(selected, "h2", 2) == 0) {
+                start_http2_session(connection);
+            } else {
+                fallback_to_http1(connection);
+            }
+            return;
+        }
+
+        // 读取帧并交给nghttp2处理
+        uint8_t buffer[16384];
+        while (true) {
+            ssize_t n;
+            if (connection.ssl) {
+                int ret = SSL_read(connection.ssl, buffer, sizeof(buffer));
+                if (ret <= 0) {
+                    int err = SSL_get_error(connection.ssl, ret);
+                    if (err == SSL_ERROR_ZERO_RETURN) {
+                        n = 0;
+                    } else if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+                        break;
+                    } else {
+                        n = -1;
+                    }
+                } else {
+                    n = ret;
+                }
+            } else {
+                n = recv(connection.fd, buffer, sizeof(buffer), 0);
+                if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                    break;
+                }
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+            }
+
+            if (n <= 0) {
+                fail_http2(connection, n == 0 ? "Connection closed by server" : "Read failed");
+                return;
+            }
+
+            ssize_t consumed = nghttp2_session_mem_recv(connection.session, buffer, static_cast<size_t>(n));
+            if (consumed < 0) {
+                fail_http2(connection, std::string("HTTP/2 protocol error: ") + nghttp2_strerror(static_cast<int>(consumed)));
+                return;
+            }
+        }
+
+        // 回调中出错的流在这里续传，避免在nghttp2回调内提交新流
+        std::vector<AsyncRequest*> retries;
+        retries.swap(connection.retry_queue);
+        for (AsyncRequest* request : retries) {
+            if (is_redirect(*request)) {
+                follow_redirect(*request);
+            } else {
+                retry_or_fail(*request, "HTTP/2 stream reset");
+            }
+        }
+
+        flush_http2(connection);
+    }
+
+    void start_http2_session(Http2Connection& connection) {
+        nghttp2_session_callbacks* callbacks;
+        nghttp2_session_callbacks_new(&callbacks);
+        nghttp2_session_callbacks_set_on_header_callback(callbacks, on_http2_header);
+        nghttp2_session_callbacks_set_on_data_chunk_recv_callback(callbacks, on_http2_data);
+        nghttp2_session_callbacks_set_on_stream_close_callback(callbacks, on_http2_stream_close);
+        nghttp2_session_client_new(&connection.session, callbacks, &connection);
+        nghttp2_session_callbacks_del(callbacks);
+
+        // 放大流级与连接级窗口，长回答不会因为流控而频繁等待WINDOW_UPDATE
+        nghttp2_settings_entry settings[] = {
+            {NGHTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, 256},
+            {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, 1 << 20},
+        };
+        nghttp2_submit_settings(connection.session, NGHTTP2_FLAG_NONE, settings, 2);
+        nghttp2_session_set_local_window_size(connection.session, NGHTTP2_FLAG_NONE, 0, 16 << 20);
+
+        connection.state = Http2Connection::State::Ready;
+
+        std::vector<AsyncRequest*> waiting;
+        waiting.swap(connection.waiting);
+        for (AsyncRequest* request : waiting) {
+            submit_stream(connection, *request);
+        }
+
+        flush_http2(connection);
+    }
+
+    // 服务器没有选择h2：记住该主机只支持HTTP/1.1，排队的请求各自走HTTP/1.1
+    void fallback_to_http1(Http2Connection& connection) {
+        h1_only_.insert(connection.key);
+
+        std::vector<AsyncRequest*> waiting;
+        waiting.swap(connection.waiting);
+        destroy_http2(connection);
+
+        for (AsyncRequest* request : waiting) {
+            request->h2 = nullptr;
+            start_attempt(*request);
+        }
+    }
+
+    void submit_stream(Http2Connection& connection, AsyncRequest& request) {
+        const ApiUrl& url = request.prepared.api_url;
+        std::string authority = url.use_unix_socket() ? "localhost" : url.host;
+        std::string scheme = request.use_tls ? "https" : "http";
+        std::string content_length = std::to_string(request.prepared.body.size());
+
+        // HTTP/2要求头名称小写
+        std::vector<std::pair<std::string, std::string>> headers = {
+            {":method", "POST"},
+            {":scheme", scheme},
+            {":authority", authority},
+            {":path", request.prepared.path},
+            {"content-length", content_length},
+            {"accept-encoding", compression::accept_encoding()},
+        };
+        for (const auto& header : request.prepared.headers) {
+            std::string name = header.first;
+            std::transform(name.begin(), name.end(), name.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            headers.emplace_back(name, header.second);
+        }
+
+        std::vector<nghttp2_nv> nva;
+        for (auto& header : headers) {
+            nva.push_back({reinterpret_cast<uint8_t*>(&header.first[0]),
+                           reinterpret_cast<uint8_t*>(&header.second[0]),
+                           header.first.size(), header.second.size(), NGHTTP2_NV_FLAG_NONE});
+        }
+
+        nghttp2_data_provider provider{};
+        provider.read_callback = read_http2_body;
+
+        request.body_offset = 0;
+        int32_t stream_id = nghttp2_submit_request(connection.session, nullptr, nva.data(), nva.size(), &provider, nullptr);
+        if (stream_id < 0) {
+            request.h2 = nullptr;
+            fail(request, std::string("HTTP/2 submit failed: ") + nghttp2_strerror(stream_id));
+            return;
+        }
+
+        request.stream_id = stream_id;
+        connection.streams[stream_id] = &request;
+    }
+
+    // 把nghttp2待发送的帧写到连接上
+    void flush_http2(Http2Connection& connection) {
+        if (connection.state != Http2Connection::State::Ready) {
+            return;
+        }
+
+        while (true) {
+            if (connection.output_offset >= connection.output.size()) {
+                connection.output.clear();
+                connection.output_offset = 0;
+
+                const uint8_t* data = nullptr;
+                ssize_t len = nghttp2_session_mem_send(connection.session, &data);
+                if (len < 0) {
+                    fail_http2(connection, std::string("HTTP/2 protocol error: ") + nghttp2_strerror(static_cast<int>(len)));
+                    return;
+                }
+                if (len == 0) {
+                    break;
+                }
+                connection.output.assign(reinterpret_cast<const char*>(data), static_cast<size_t>(len));
+            }
+
+            const char* data = connection.output.data() + connection.output_offset;
+            size_t len = connection.output.size() - connection.output_offset;
+            ssize_t written;
+            if (connection.ssl) {
+                int ret = SSL_write(connection.ssl, data, static_cast<int>(len));
+                if (ret <= 0) {
+                    if (!wait_for_ssl(connection, ret)) {
+                        fail_http2(connection, "Write failed");
+                    }
+                    return;
+                }
+                written = ret;
+            } else {
+                written = send(connection.fd, data, len, MSG_NOSIGNAL);
+                if (written < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                        watch_http2(connection, EPOLLIN | EPOLLOUT);
+                    } else if (errno != EINTR) {
+                        fail_http2(connection, std::string("Write failed: ") + std::strerror(errno));
+                    }
+                    return;
+                }
+            }
+            connection.output_offset += static_cast<size_t>(written);
+        }
+
+        // 对端发送GOAWAY且没有进行中的流时关闭连接
+        if (!nghttp2_session_want_read(connection.session) && !nghttp2_session_want_write(connection.session)) {
+            fail_http2(connection, "Connection closed by server");
+            return;
+        }
+
+        watch_http2(connection, EPOLLIN);
+    }
+
+    void flush_all_http2() {
+        std::vector<Http2Connection*> connections;
+        for (auto& entry : h2_connections_) {
+            connections.push_back(entry.second.get());
+        }
+        for (Http2Connection* connection : connections) {
+            flush_http2(*connection);
+        }
+    }
+
+    // 连接级错误：所有挂在连接上的请求分别续传或失败
+    void fail_http2(Http2Connection& connection, const std::string& error) {
+        std::vector<AsyncRequest*> affected = connection.waiting;
+        for (auto& entry : connection.streams) {
+            affected.push_back(entry.second);
+        }
+        for (AsyncRequest* request : connection.retry_queue) {
+            affected.push_back(request);
+        }
+        connection.waiting.clear();
+        connection.streams.clear();
+        connection.retry_queue.clear();
+
+        destroy_http2(connection);
+
+        for (AsyncRequest* request : affected) {
+            request->h2 = nullptr;
+            request->stream_id = -1;
+            retry_or_fail(*request, error);
+        }
+    }
+
+    void destroy_http2(Http2Connection& connection) {
+        if (connection.session) {
+            nghttp2_session_del(connection.session);
+        }
+        if (connection.ssl) {
+            SSL_free(connection.ssl);
+        }
+        if (connection.fd >= 0) {
+            close(connection.fd);
+        }
+        h2_by_tag_.erase(connection.tag);
+        h2_connections_.erase(connection.key);
+    }
+
+    // 请求结束时从共享连接上摘下；流未结束时发送RST_STREAM，连接本身保持可用
+    void detach_http2(AsyncRequest& request) {
+        Http2Connection& connection = *request.h2;
+        auto& waiting = connection.waiting;
+        waiting.erase(std::remove(waiting.begin(), waiting.end(), &request), waiting.end());
+        auto& retries = connection.retry_queue;
+        retries.erase(std::remove(retries.begin(), retries.end(), &request), retries.end());
+
+        if (request.stream_id >= 0 && connection.streams.erase(request.stream_id) && connection.session) {
+            nghttp2_submit_rst_stream(connection.session, NGHTTP2_FLAG_NONE, request.stream_id, NGHTTP2_CANCEL);
+        }
+        request.h2 = nullptr;
+        request.stream_id = -1;
+    }
+
+    static AsyncRequest* find_stream(Http2Connection& connection, int32_t stream_id) {
+        auto it = connection.streams.find(stream_id);
+        return it == connection.streams.end() ? nullptr : it->second;
+    }
+
+    static ssize_t read_http2_body(nghttp2_session*, int32_t stream_id, uint8_t* buf, size_t length,
+                                   uint32_t* data_flags, nghttp2_data_source*, void* user_data) {
+        auto& connection = *static_cast<Http2Connection*>(user_data);
+        AsyncRequest* request = find_stream(connection, stream_id);
+        if (!request) {
+            return NGHTTP2_ERR_TEMPORAL_CALLBACK_FAILURE;
+        }
+
+        const std::string& body = request->prepared.body;
+        size_t take = std::min(length, body.size() - request->body_offset);
+        std::memcpy(buf, body.data() + request->body_offset, take);
+        request->body_offset += take;
+        if (request->body_offset >= body.size()) {
+            *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+        }
+        return static_cast<ssize_t>(take);
+    }
+
+    static int on_http2_header(nghttp2_session*, const nghttp2_frame* frame, const uint8_t* name, size_t namelen,
+                               const uint8_t* value, size_t valuelen, uint8_t, void* user_data) {
+        auto& connection = *static_cast<Http2Connection*>(user_data);
+        if (frame->hd.type != NGHTTP2_HEADERS || frame->headers.cat != NGHTTP2_HCAT_RESPONSE) {
+            return 0;
+        }
+
+        AsyncRequest* request = find_stream(connection, frame->hd.stream_id);
+        if (request && request->options.recorder && (namelen == 0 || name[0] != ':')) {
+            request->options.recorder->on_header(std::string(reinterpret_cast<const char*>(name), namelen),
+                                                 std::string(reinterpret_cast<const char*>(value), valuelen));
+        }
+        if (request && namelen == 16 && std::memcmp(name, "content-encoding", 16) == 0) {
+            request->decode_failed = !request->decoder.begin(lowercase(std::string(reinterpret_cast<const char*>(value), valuelen)));
+        } else if (request && namelen == 8 && std::memcmp(name, "location", 8) == 0) {
+            request->location.assign(reinterpret_cast<const char*>(value), valuelen);
+        }
+        if (request && namelen == 7 && std::memcmp(name, ":status", 7) == 0) {
+            request->status = std::atoi(std::string(reinterpret_cast<const char*>(value), valuelen).c_str());
+            request->state = AsyncRequest::State::ReadingBody;
+            if (request->options.recorder) {
+                request->options.recorder->on_status(request->status);
+            }
+            if (request->debug) {
+                std::cerr << "[async " << request->id << "] HTTP/2 stream " << frame->hd.stream_id
+                          << " status: " << request->status << std::endl;
+            }
+        }
+        return 0;
+    }
+
+    static int on_http2_data(nghttp2_session*, uint8_t, int32_t stream_id, const uint8_t* data, size_t len, void* user_data) {
+        auto& connection = *static_cast<Http2Connection*>(user_data);
+        AsyncRequest* request = find_stream(connection, stream_id);
+        if (!request) {
+            return 0;
+        }
+
+        Loop* loop = static_cast<Loop*>(connection.loop);
+        if (!deliver_body(*request, reinterpret_cast<const char*>(data), len)) {
+            // 停止条件触发或无法解压：只取消这一个流，连接继续为其他请求服务
+            if (request->decode_failed) {
+                loop->fail(*request, "Invalid compressed response body");
+            } else {
+                loop->finish(*request);
+            }
+        }
+        return 0;
+    }
+
+    static int on_http2_stream_close(nghttp2_session*, int32_t stream_id, uint32_t error_code, void* user_data) {
+        auto& connection = *static_cast<Http2Connection*>(user_data);
+        AsyncRequest* request = find_stream(connection, stream_id);
+        if (!request) {
+            return 0;
+        }
+
+        connection.streams.erase(stream_id);
+        request->stream_id = -1;
+        if (is_redirect(*request)) {
+            // 在回调之外重新发送，与出错的流一样经由retry_queue
+            connection.retry_queue.push_back(request);
+        } else if (error_code == NGHTTP2_NO_ERROR || request->processor->done()) {
+            static_cast<Loop*>(connection.loop)->finish(*request);
+        } else {
+            connection.retry_queue.push_back(request);
+        }
+        return 0;
+    }
+#endif
+
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    SSL_CTX* ssl_ctx_ = nullptr;
+    std::thread thread_;
+
+    mutable std::mutex mutex_;
+    std::vector<std::unique_ptr<AsyncRequest>> pending_;
+    std::vector<std::pair<RequestId, std::string>> cancellations_;
+    size_t active_ = 0;
+    bool stopping_ = false;
+
+    // 仅由循环线程访问
+    std::map<RequestId, std::unique_ptr<AsyncRequest>> requests_;
+    std::map<std::string, std::vector<IdleConnection>> idle_;
+#ifdef LC_HTTP2_SUPPORT
+    std::map<std::string, std::unique_ptr<Http2Connection>> h2_connections_;
+    std::map<uint64_t, Http2Connection*> h2_by_tag_;
+    std::set<std::string> h1_only_;
+    uint64_t next_connection_tag_ = 1;
+#endif
+};
+
+AsyncEngine::AsyncEngine(size_t threads) {
+    for (size_t i = 0; i < std::max<size_t>(1, threads); ++i) {
+        loops_.push_back(std::make_unique<Loop>());
+    }
+}
+
+AsyncEngine::~AsyncEngine() = default;
+
+// 解析目标地址（阻塞的DNS查询放在调用线程中，避免卡住事件循环）
+static bool resolve_address(AsyncRequest& request, std::string& error) {
+    const ApiUrl& url = request.prepared.api_url;
+
+    if (url.use_unix_socket()) {
+        sockaddr_un addr{};
+        addr.sun_family = AF_UNIX;
+        if (url.host.size() >= sizeof(addr.sun_path)) {
+            error = "Unix socket path too long: " + url.host;
+            return false;
+        }
+        std::memcpy(addr.sun_path, url.host.c_str(), url.host.size() + 1);
+        std::memcpy(&request.address, &addr, sizeof(addr));
+        request.address_len = sizeof(addr);
+        return true;
+    }
+
+    // 拆分host与端口，支持[IPv6]:port
+    std::string host = url.host;
+    std::string port = url.use_https() ? "443" : "80";
+    if (!host.empty() && host[0] == '[') {
+        size_t close = host.find(']');
+        if (close != std::string::npos) {
+            if (close + 1 < host.size() && host[close + 1] == ':') {
+                port = host.substr(close + 2);
+            }
+            host = host.substr(1, close - 1);
+        }
+    } else {
+        size_t colon = host.rfind(':');
+        if (colon != std::string::npos) {
+            port = host.substr(colon + 1);
+            host = host.substr(0, colon);
+        }
+    }
+
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* result = nullptr;
+    int ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &result);
+    if (ret != 0 || !result) {
+        error = "Failed to resolve " + host + ": " + gai_strerror(ret);
+        return false;
+    }
+
+    std::memcpy(&request.address, result->ai_addr, result->ai_addrlen);
+    request.address_len = result->ai_addrlen;
+    freeaddrinfo(result);
+
+    request.server_name = host;
+    request.use_tls = url.use_https();
+    return true;
+}
+
+AsyncEngine::RequestId AsyncEngine::submit(
+    const Config& config,
+    const std::vector<Message>& messages,
+    StreamCallback callback,
+    const std::string& model_override,
+    bool debug,
+    const StreamOptions& options,
+    CompletionHandler on_complete
+) {
+    auto request = std::make_unique<AsyncRequest>();
+    request->id = next_id_++;
+    request->config = config;
+    request->messages = messages;
+    request->model_override = model_override;
+    request->debug = debug;
+    request->options = options;
+    request->options.engine = nullptr;
+    request->callback = std::move(callback);
+    request->on_complete = std::move(on_complete);
+    request->processor = std::make_unique<StreamProcessor>(request->callback, request->options, debug);
+    request->resumes_left = std::max(0, config.stream_resume_retries);
+
+    ChatCompletionResult result;
+    if (!prepare_chat_request(config, messages, model_override, true, "", request->prepared, result.error_message, debug) ||
+        !resolve_address(*request, result.error_message)) {
+        request->callback("", true);
+        if (request->on_complete) {
+            request->on_complete(result);
+        }
+        return request->id;
+    }
+
+    RequestId id = request->id;
+    loops_[id % loops_.size()]->submit(std::move(request));
+    return id;
+}
+
+void AsyncEngine::cancel(RequestId id, const std::string& reason) {
+    loops_[id % loops_.size()]->cancel(id, reason);
+}
+
+ChatCompletionResult AsyncEngine::run(
+    const Config& config,
+    const std::vector<Message>& messages,
+    StreamCallback callback,
+    const std::string& model_override,
+    bool debug,
+    const StreamOptions& options
+) {
+    std::promise<ChatCompletionResult> promise;
+    std::future<ChatCompletionResult> future = promise.get_future();
+
+    submit(config, messages, std::move(callback), model_override, debug, options,
+           [&promise](const ChatCompletionResult& result) { promise.set_value(result); });
+
+    return future.get();
+}
+
+size_t AsyncEngine::active_requests() const {
+    size_t total = 0;
+    for (const auto& loop : loops_) {
+        total += loop->active();
+    }
+    return total;
+}
+
+} // namespace openai
+} // namespace lc
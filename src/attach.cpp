@@ -0,0 +1,262 @@
+#include "../include/attach.h"
+
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <set>
+#include <thread>
+#include <unordered_map>
+
+#include "../include/text_index.h"
+
+namespace lc {
+namespace attach {
+
+namespace {
+
+// 与git、grep相同的判断：开头这么多字节中出现NUL即视为二进制文件，不必读完整个文件
+constexpr size_t BINARY_SNIFF_BYTES = 8000;
+
+// 重复判断的哈希只取开头与结尾这么多字节，相同时再逐字节比较确认
+constexpr size_t HASH_SAMPLE_BYTES = 4096;
+
+// 在最多hardware_concurrency个线程上为0..count-1调用fn，只有一项时直接在当前线程执行
+unsigned parallel_for(size_t count, const std::function<void(size_t)>& fn) {
+    unsigned threads = static_cast<unsigned>(
+        std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()), count));
+    if (threads <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            fn(i);
+        }
+        return 1;
+    }
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back([&]() {
+            for (size_t i = next++; i < count; i = next++) {
+                fn(i);
+            }
+        });
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+    return threads;
+}
+
+// 文件名放在帧的属性中，转义其中的引号与尖括号
+std::string escape_name(const std::string& name) {
+    std::string out;
+    for (char ch : name) {
+        switch (ch) {
+        case '"': out += "&quot;"; break;
+        case '<': out += "&lt;"; break;
+        case '>': out += "&gt;"; break;
+        case '&': out += "&amp;"; break;
+        default: out += ch;
+        }
+    }
+    return out;
+}
+
+// 大小相同的文件按开头与结尾的内容区分，不必为此读完整个文件
+uint64_t sample_hash(const char* data, size_t size) {
+    size_t sample = std::min(size, HASH_SAMPLE_BYTES);
+    uint64_t head = text_index::term_hash(std::string_view(data, sample));
+    uint64_t tail = text_index::term_hash(std::string_view(data + size - sample, sample));
+    return head ^ (tail * 0x9E3779B97F4A7C15ULL);
+}
+
+bool read_fd(int fd, std::string& out) {
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        out.append(buffer, static_cast<size_t>(n));
+    }
+    return true;
+}
+
+} // namespace
+
+bool expand(const std::vector<std::string>& patterns, std::vector<std::string>& paths, std::string& error) {
+    std::set<std::filesystem::path> seen;
+    for (const std::string& pattern : patterns) {
+        glob_t matches{};
+        int status = glob(pattern.c_str(), GLOB_TILDE | GLOB_BRACE | GLOB_MARK, nullptr, &matches);
+        if (status != 0 && status != GLOB_NOMATCH) {
+            globfree(&matches);
+            error = "Cannot expand " + pattern;
+            return false;
+        }
+        size_t added = 0;
+        for (size_t i = 0; i < matches.gl_pathc; ++i) {
+            std::string path = matches.gl_pathv[i];
+            if (!path.empty() && path.back() == '/') {
+                continue;  // GLOB_MARK给目录加上了结尾的斜杠
+            }
+            std::error_code ec;
+            std::filesystem::path canonical = std::filesystem::weakly_canonical(path, ec);
+            if (ec || seen.insert(canonical).second) {
+                paths.push_back(std::move(path));
+            }
+            ++added;
+        }
+        globfree(&matches);
+        if (added == 0) {
+            error = status == GLOB_NOMATCH ? "No files match " + pattern : pattern + " matches only directories";
+            return false;
+        }
+    }
+    return true;
+}
+
+Attachments::~Attachments() {
+    for (File& file : files_) {
+        if (file.mapping != nullptr) {
+            munmap(file.mapping, file.size);
+        }
+    }
+}
+
+bool Attachments::open(const std::vector<std::string>& paths, std::string& error) {
+    files_.resize(paths.size());
+    for (size_t i = 0; i < paths.size(); ++i) {
+        files_[i].path = paths[i];
+    }
+
+    // 各线程分别打开并映射文件，预读在各文件上同时进行；只检查开头判断是否为二进制文件
+    std::vector<std::string> errors(files_.size());
+    stats_.threads = parallel_for(files_.size(), [&](size_t i) {
+        File& file = files_[i];
+        int fd = ::open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            errors[i] = "Cannot open " + file.path + ": " + std::strerror(errno);
+            if (fd >= 0) {
+                close(fd);
+            }
+            return;
+        }
+        if (S_ISREG(st.st_mode) && st.st_size > 0) {
+            file.size = static_cast<size_t>(st.st_size);
+            void* mapping = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                madvise(mapping, file.size, MADV_SEQUENTIAL);
+                madvise(mapping, file.size, MADV_WILLNEED);
+                file.mapping = mapping;
+                file.data = static_cast<const char*>(mapping);
+            }
+        }
+        // 管道、进程替换（<(cmd)）以及/proc下大小为0的文件只能顺序读取
+        if (file.mapping == nullptr) {
+            file.size = 0;
+            if (!read_fd(fd, file.owned)) {
+                errors[i] = "Cannot read " + file.path + ": " + std::strerror(errno);
+            }
+            file.data = file.owned.data();
+            file.size = file.owned.size();
+        }
+        close(fd);
+        file.binary = std::memchr(file.data, 0, std::min(file.size, BINARY_SNIFF_BYTES)) != nullptr;
+    });
+    for (const std::string& message : errors) {
+        if (!message.empty()) {
+            error = message;
+            return false;
+        }
+    }
+
+    // 大小相同的文件才可能重复，只为这些文件计算抽样哈希；哈希相同时再逐字节确认
+    std::unordered_map<size_t, size_t> sizes;
+    for (const File& file : files_) {
+        if (!file.binary) {
+            ++sizes[file.size];
+        }
+    }
+    std::vector<uint64_t> hashes(files_.size(), 0);
+    auto shares_size = [&sizes](const File& file) {
+        auto it = sizes.find(file.size);
+        return !file.binary && it != sizes.end() && it->second > 1;
+    };
+    parallel_for(files_.size(), [&](size_t i) {
+        const File& file = files_[i];
+        if (shares_size(file)) {
+            hashes[i] = sample_hash(file.data, file.size);
+        }
+    });
+
+    std::unordered_multimap<uint64_t, size_t> kept;
+    for (size_t i = 0; i < files_.size(); ++i) {
+        File& file = files_[i];
+        if (file.binary) {
+            stats_.binary.push_back(file.path);
+            continue;
+        }
+        std::string name = escape_name(file.path);
+        std::string size = std::to_string(file.size);
+        if (shares_size(file)) {
+            auto range = kept.equal_range(hashes[i]);
+            for (auto it = range.first; it != range.second; ++it) {
+                const File& original = files_[it->second];
+                if (original.size == file.size && std::memcmp(original.data, file.data, file.size) == 0) {
+                    file.duplicate = true;
+                    file.header = "<file name=\"" + name + "\" size=\"" + size + "\" same-as=\"" +
+                        escape_name(original.path) + "\"/>\n";
+                    break;
+                }
+            }
+            if (!file.duplicate) {
+                kept.emplace(hashes[i], i);
+            }
+        }
+        if (file.duplicate) {
+            ++stats_.duplicates;
+        } else {
+            file.header = "<file name=\"" + name + "\" size=\"" + size + "\">\n";
+            file.footer = file.size == 0 || file.data[file.size - 1] == '\n' ? "</file>\n" : "\n</file>\n";
+            ++stats_.files;
+            stats_.bytes += file.size;
+        }
+        file.offset = size_;
+        size_ += file.header.size() + (file.duplicate ? 0 : file.size + file.footer.size());
+    }
+    return true;
+}
+
+void Attachments::write(char* dest) const {
+    parallel_for(files_.size(), [&](size_t i) {
+        const File& file = files_[i];
+        if (file.binary) {
+            return;
+        }
+        char* p = dest + file.offset;
+        std::memcpy(p, file.header.data(), file.header.size());
+        if (file.duplicate) {
+            return;
+        }
+        p += file.header.size();
+        if (file.size > 0) {
+            std::memcpy(p, file.data, file.size);
+        }
+        std::memcpy(p + file.size, file.footer.data(), file.footer.size());
+    });
+}
+
+} // namespace attach
+} // namespace lc
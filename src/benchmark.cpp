@@ -0,0 +1,279 @@
+#include "../include/benchmark.h"
+#include "../include/async_client.h"
+#include "../include/openai.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace lc {
+namespace benchmark {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double to_ms(Clock::duration d) {
+    return std::chrono::duration<double, std::milli>(d).count();
+}
+
+// 按requests_per_minute均匀发放请求时间片，多个工作线程共享
+class RateLimiter {
+public:
+    explicit RateLimiter(int requests_per_minute)
+        : interval_(requests_per_minute > 0
+              ? std::chrono::duration_cast<Clock::duration>(std::chrono::minutes(1)) / requests_per_minute
+              : Clock::duration::zero()) {}
+
+    void acquire() {
+        if (interval_ == Clock::duration::zero()) {
+            return;
+        }
+
+        Clock::time_point slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            slot = std::max(Clock::now(), next_);
+            next_ = slot + interval_;
+        }
+        std::this_thread::sleep_until(slot);
+    }
+
+private:
+    Clock::duration interval_;
+    Clock::time_point next_;
+    std::mutex mutex_;
+};
+
+// 单个请求的测量结果
+struct Sample {
+    bool success = false;
+    std::string error;
+    double ttft_ms = 0;
+    double total_ms = 0;
+    std::vector<double> gaps_ms;
+    size_t tokens = 0;
+};
+
+Sample measure_one(const Config& config, const std::vector<openai::Message>& messages,
+                   const std::string& model, const openai::StreamOptions& options, bool debug) {
+    Sample sample;
+    auto start = Clock::now();
+    Clock::time_point last;
+
+    auto result = openai::chat_completion_stream(config, messages,
+        [&](const std::string& delta, bool is_done) {
+            if (is_done || delta.empty()) {
+                return;
+            }
+            auto now = Clock::now();
+            if (sample.tokens == 0) {
+                sample.ttft_ms = to_ms(now - start);
+            } else {
+                sample.gaps_ms.push_back(to_ms(now - last));
+            }
+            last = now;
+            ++sample.tokens;
+        }, model, debug, options);
+
+    sample.total_ms = to_ms(Clock::now() - start);
+    sample.success = result.success && !(result.stopped_early && result.stop_reason == "interrupted");
+    sample.error = result.error_message;
+    return sample;
+}
+
+ModelReport run_model(const Config& config, const BenchOptions& options, const std::string& model,
+                      RateLimiter& limiter, openai::AsyncEngine* engine) {
+    ModelReport report;
+    report.model = model;
+    std::string resolved_model;
+    report.endpoint = config.resolve_endpoint(model, resolved_model).name;
+
+    std::vector<openai::Message> messages;
+    if (config.use_system_prompt) {
+        messages.emplace_back(openai::Role::System, config.system_prompt);
+    }
+    messages.emplace_back(openai::Role::User, options.prompt);
+
+    openai::StreamOptions stream_options;
+    stream_options.engine = engine;
+
+    std::atomic<size_t> next{0};
+    std::mutex mutex;
+    double rate_sum = 0;
+    size_t rate_count = 0;
+
+    auto worker = [&]() {
+        while (!openai::cancel_requested()) {
+            size_t index = next++;
+            if (index >= options.requests) {
+                break;
+            }
+
+            limiter.acquire();
+            Sample sample = measure_one(config, messages, model, stream_options, options.debug);
+
+            std::lock_guard<std::mutex> lock(mutex);
+            ++report.requests;
+            if (!sample.success) {
+                ++report.errors;
+                if (sample.error.find("status 429") != std::string::npos) {
+                    ++report.rate_limited;
+                }
+                if (report.first_error.empty()) {
+                    report.first_error = sample.error;
+                }
+                continue;
+            }
+
+            report.total.samples_ms.push_back(sample.total_ms);
+            if (sample.tokens > 0) {
+                report.ttft.samples_ms.push_back(sample.ttft_ms);
+                report.itl.samples_ms.insert(report.itl.samples_ms.end(), sample.gaps_ms.begin(), sample.gaps_ms.end());
+                rate_sum += sample.tokens / (sample.total_ms / 1000.0);
+                ++rate_count;
+            }
+            report.tokens += sample.tokens;
+        }
+    };
+
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    size_t concurrency = std::max<size_t>(1, std::min(options.concurrency, options.requests));
+    for (size_t i = 0; i < concurrency; ++i) {
+        workers.emplace_back(worker);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    report.wall_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    report.stream_tokens_per_second = rate_count > 0 ? rate_sum / rate_count : 0;
+    return report;
+}
+
+} // namespace
+
+double Distribution::percentile(double p) const {
+    if (samples_ms.empty()) {
+        return 0.0;
+    }
+    std::vector<double> sorted = samples_ms;
+    std::sort(sorted.begin(), sorted.end());
+    size_t index = static_cast<size_t>(p / 100.0 * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+double Distribution::mean() const {
+    double sum = 0.0;
+    for (double v : samples_ms) {
+        sum += v;
+    }
+    return samples_ms.empty() ? 0.0 : sum / samples_ms.size();
+}
+
+std::vector<ModelReport> run(const Config& config, const BenchOptions& options) {
+    // 同一端点上的限速在所有模型之间共享
+    std::map<std::string, std::unique_ptr<RateLimiter>> limiters;
+
+    std::unique_ptr<openai::AsyncEngine> engine;
+    if (config.http_engine == "async") {
+        engine = std::make_unique<openai::AsyncEngine>();
+    }
+
+    std::vector<ModelReport> reports;
+    for (const auto& model : options.models) {
+        if (openai::cancel_requested()) {
+            break;
+        }
+
+        std::string resolved_model;
+        Endpoint endpoint = config.resolve_endpoint(model, resolved_model);
+        auto& limiter = limiters[endpoint.name];
+        if (!limiter) {
+            limiter = std::make_unique<RateLimiter>(endpoint.requests_per_minute);
+        }
+
+        if (options.debug) {
+            std::cerr << "Benchmarking " << model << " on endpoint " << endpoint.name << std::endl;
+        }
+        reports.push_back(run_model(config, options, model, *limiter, engine.get()));
+    }
+    return reports;
+}
+
+void print_table(const std::vector<ModelReport>& reports, std::ostream& out) {
+    char line[512];
+    std::snprintf(line, sizeof(line), "%-28s %-10s %9s %6s  %-21s   %-14s   %-16s   %8s %9s\n",
+                  "MODEL", "ENDPOINT", "OK/N", "ERR%", "TTFT p50/p90/p99 ms", "ITL p50/p99 ms",
+                  "TOTAL p50/p99 ms", "TOK/S", "AGG TOK/S");
+    out << line;
+
+    for (const auto& report : reports) {
+        size_t ok = report.requests - report.errors;
+        double error_rate = report.requests > 0 ? 100.0 * report.errors / report.requests : 0.0;
+        double aggregate = report.wall_seconds > 0 ? report.tokens / report.wall_seconds : 0.0;
+        std::string counts = std::to_string(ok) + "/" + std::to_string(report.requests);
+
+        std::snprintf(line, sizeof(line),
+                      "%-28s %-10s %9s %5.1f%%  %6.0f/%6.0f/%7.0f   %6.1f/%7.1f   %7.0f/%8.0f   %8.1f %9.1f\n",
+                      report.model.c_str(), report.endpoint.c_str(), counts.c_str(), error_rate,
+                      report.ttft.percentile(50), report.ttft.percentile(90), report.ttft.percentile(99),
+                      report.itl.percentile(50), report.itl.percentile(99),
+                      report.total.percentile(50), report.total.percentile(99),
+                      report.stream_tokens_per_second, aggregate);
+        out << line;
+    }
+
+    for (const auto& report : reports) {
+        if (!report.first_error.empty()) {
+            out << report.model << ": " << report.errors << " errors (" << report.rate_limited
+                << " rate limited), first: " << report.first_error << std::endl;
+        }
+    }
+}
+
+static nlohmann::json distribution_json(const Distribution& distribution) {
+    return {
+        {"count", distribution.samples_ms.size()},
+        {"mean", distribution.mean()},
+        {"p50", distribution.percentile(50)},
+        {"p90", distribution.percentile(90)},
+        {"p99", distribution.percentile(99)}
+    };
+}
+
+nlohmann::json to_json(const std::vector<ModelReport>& reports) {
+    nlohmann::json results = nlohmann::json::array();
+    for (const auto& report : reports) {
+        nlohmann::json entry = {
+            {"model", report.model},
+            {"endpoint", report.endpoint},
+            {"requests", report.requests},
+            {"errors", report.errors},
+            {"rate_limited", report.rate_limited},
+            {"error_rate", report.requests > 0 ? static_cast<double>(report.errors) / report.requests : 0.0},
+            {"ttft_ms", distribution_json(report.ttft)},
+            {"itl_ms", distribution_json(report.itl)},
+            {"total_ms", distribution_json(report.total)},
+            {"tokens", report.tokens},
+            {"stream_tokens_per_second", report.stream_tokens_per_second},
+            {"aggregate_tokens_per_second", report.wall_seconds > 0 ? report.tokens / report.wall_seconds : 0.0},
+            {"wall_seconds", report.wall_seconds}
+        };
+        if (!report.first_error.empty()) {
+            entry["first_error"] = report.first_error;
+        }
+        results.push_back(std::move(entry));
+    }
+    return results;
+}
+
+} // namespace benchmark
+} // namespace lc
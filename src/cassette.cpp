@@ -0,0 +1,262 @@
+#include "../include/cassette.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <nlohmann/json.hpp>
+
+namespace lc {
+namespace cassette {
+
+namespace {
+
+// 携带凭据的请求头：Authorization、Anthropic的x-api-key以及各服务商自定义的*-key、*token*头，不区分大小写
+bool is_credential_header(std::string name) {
+    std::transform(name.begin(), name.end(), name.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    auto ends_with = [&name](const std::string& suffix) {
+        return name.size() >= suffix.size() && name.compare(name.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    return name == "authorization" || name == "proxy-authorization" || name == "cookie" ||
+        ends_with("-key") || name.find("token") != std::string::npos;
+}
+
+const char BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string base64_encode(const std::string& input) {
+    std::string output;
+    output.reserve((input.size() + 2) / 3 * 4);
+
+    size_t i = 0;
+    for (; i + 2 < input.size(); i += 3) {
+        uint32_t n = (static_cast<unsigned char>(input[i]) << 16) |
+                     (static_cast<unsigned char>(input[i + 1]) << 8) |
+                     static_cast<unsigned char>(input[i + 2]);
+        output += BASE64_CHARS[(n >> 18) & 63];
+        output += BASE64_CHARS[(n >> 12) & 63];
+        output += BASE64_CHARS[(n >> 6) & 63];
+        output += BASE64_CHARS[n & 63];
+    }
+
+    if (i < input.size()) {
+        uint32_t n = static_cast<unsigned char>(input[i]) << 16;
+        if (i + 1 < input.size()) {
+            n |= static_cast<unsigned char>(input[i + 1]) << 8;
+        }
+        output += BASE64_CHARS[(n >> 18) & 63];
+        output += BASE64_CHARS[(n >> 12) & 63];
+        output += i + 1 < input.size() ? BASE64_CHARS[(n >> 6) & 63] : '=';
+        output += '=';
+    }
+    return output;
+}
+
+std::string base64_decode(const std::string& input) {
+    std::string output;
+    uint32_t buffer = 0;
+    int bits = 0;
+
+    for (char c : input) {
+        const char* pos = std::strchr(BASE64_CHARS, c);
+        if (c == '=' || c == '\0' || !pos) {
+            continue;
+        }
+        buffer = (buffer << 6) | static_cast<uint32_t>(pos - BASE64_CHARS);
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            output += static_cast<char>((buffer >> bits) & 0xFF);
+        }
+    }
+    return output;
+}
+
+// 响应块可能在多字节字符中间被切开，这种块以base64保存
+bool is_valid_utf8(const std::string& text) {
+    size_t i = 0;
+    while (i < text.size()) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        size_t extra = c < 0x80 ? 0 : (c >> 5) == 0x6 ? 1 : (c >> 4) == 0xE ? 2 : (c >> 3) == 0x1E ? 3 : 4;
+        if (extra == 4 || (extra > 0 && i + extra >= text.size())) {
+            return false;
+        }
+        for (size_t k = 1; k <= extra; ++k) {
+            if ((static_cast<unsigned char>(text[i + k]) & 0xC0) != 0x80) {
+                return false;
+            }
+        }
+        i += extra + 1;
+    }
+    return true;
+}
+
+void put_bytes(nlohmann::json& node, const char* key, const std::string& data) {
+    if (is_valid_utf8(data)) {
+        node[key] = data;
+    } else {
+        node[std::string(key) + "_base64"] = base64_encode(data);
+    }
+}
+
+std::string get_bytes(const nlohmann::json& node, const char* key) {
+    std::string encoded_key = std::string(key) + "_base64";
+    if (node.contains(encoded_key)) {
+        return base64_decode(node[encoded_key].get<std::string>());
+    }
+    return node.value(key, "");
+}
+
+nlohmann::json headers_to_json(const Headers& headers) {
+    nlohmann::json node = nlohmann::json::array();
+    for (const auto& header : headers) {
+        node.push_back({header.first, header.second});
+    }
+    return node;
+}
+
+Headers headers_from_json(const nlohmann::json& node) {
+    Headers headers;
+    if (node.is_array()) {
+        for (const auto& header : node) {
+            headers.emplace_back(header.at(0).get<std::string>(), header.at(1).get<std::string>());
+        }
+    }
+    return headers;
+}
+
+} // namespace
+
+bool load(const std::filesystem::path& path, Cassette& cassette, std::string& error_message) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        error_message = "Cannot open cassette: " + path.string();
+        return false;
+    }
+
+    try {
+        nlohmann::json root;
+        file >> root;
+
+        cassette.interactions.clear();
+        for (const auto& node : root.at("interactions")) {
+            Interaction interaction;
+            const auto& request = node.at("request");
+            interaction.method = request.value("method", "POST");
+            interaction.path = request.value("path", "");
+            interaction.request_headers = headers_from_json(request.value("headers", nlohmann::json::array()));
+            interaction.request_body = get_bytes(request, "body");
+
+            const auto& response = node.at("response");
+            interaction.status = response.value("status", 0);
+            interaction.response_headers = headers_from_json(response.value("headers", nlohmann::json::array()));
+            interaction.error = response.value("error", "");
+            for (const auto& chunk_node : response.value("chunks", nlohmann::json::array())) {
+                Chunk chunk;
+                chunk.offset_ms = chunk_node.value("t_ms", 0.0);
+                chunk.data = get_bytes(chunk_node, "data");
+                interaction.chunks.push_back(std::move(chunk));
+            }
+            cassette.interactions.push_back(std::move(interaction));
+        }
+    } catch (const std::exception& e) {
+        error_message = "Invalid cassette " + path.string() + ": " + e.what();
+        return false;
+    }
+
+    return true;
+}
+
+bool save(const std::filesystem::path& path, const Cassette& cassette, std::string& error_message) {
+    nlohmann::json interactions = nlohmann::json::array();
+    for (const auto& interaction : cassette.interactions) {
+        nlohmann::json request = {
+            {"method", interaction.method},
+            {"path", interaction.path},
+            {"headers", headers_to_json(interaction.request_headers)}
+        };
+        put_bytes(request, "body", interaction.request_body);
+
+        nlohmann::json chunks = nlohmann::json::array();
+        for (const auto& chunk : interaction.chunks) {
+            nlohmann::json chunk_node = {{"t_ms", chunk.offset_ms}};
+            put_bytes(chunk_node, "data", chunk.data);
+            chunks.push_back(std::move(chunk_node));
+        }
+
+        nlohmann::json response = {
+            {"status", interaction.status},
+            {"headers", headers_to_json(interaction.response_headers)},
+            {"chunks", std::move(chunks)}
+        };
+        if (!interaction.error.empty()) {
+            response["error"] = interaction.error;
+        }
+
+        interactions.push_back({{"request", std::move(request)}, {"response", std::move(response)}});
+    }
+
+    std::ofstream file(path);
+    if (!file.is_open()) {
+        error_message = "Cannot write cassette: " + path.string();
+        return false;
+    }
+
+    nlohmann::json root = {{"version", 1}, {"interactions", std::move(interactions)}};
+    file << root.dump(2) << std::endl;
+    if (!file.good()) {
+        error_message = "Failed to write cassette: " + path.string();
+        return false;
+    }
+    return true;
+}
+
+void Recorder::begin_attempt(const openai::PreparedRequest& request) {
+    start_ = std::chrono::steady_clock::now();
+
+    Interaction interaction;
+    interaction.path = request.path;
+    for (const auto& header : request.headers) {
+        // 不把密钥写进录制文件，录制文件可以分享给他人离线回放
+        bool secret = is_credential_header(header.first);
+        interaction.request_headers.emplace_back(header.first, secret ? "<redacted>" : header.second);
+    }
+    interaction.request_body = request.body;
+    cassette_.interactions.push_back(std::move(interaction));
+}
+
+Interaction* Recorder::current() {
+    return cassette_.interactions.empty() ? nullptr : &cassette_.interactions.back();
+}
+
+void Recorder::on_status(int status) {
+    if (Interaction* interaction = current()) {
+        interaction->status = status;
+    }
+}
+
+void Recorder::on_header(const std::string& name, const std::string& value) {
+    if (Interaction* interaction = current()) {
+        interaction->response_headers.emplace_back(name, value);
+    }
+}
+
+void Recorder::on_chunk(const char* data, size_t len) {
+    if (Interaction* interaction = current()) {
+        Chunk chunk;
+        chunk.offset_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count();
+        chunk.data.assign(data, len);
+        interaction->chunks.push_back(std::move(chunk));
+    }
+}
+
+void Recorder::on_error(const std::string& error) {
+    Interaction* interaction = current();
+    if (interaction && interaction->error.empty()) {
+        interaction->error = error;
+    }
+}
+
+} // namespace cassette
+} // namespace lc
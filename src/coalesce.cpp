@@ -0,0 +1,374 @@
+#include "../include/coalesce.h"
+#include "../include/stream.h"
+
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+namespace lc {
+namespace coalesce {
+
+namespace {
+
+// spool记录：1字节类型 + 4字节小端长度 + 负载
+constexpr char RECORD_DELTA = 'd';
+constexpr char RECORD_RESULT = 'r';
+constexpr size_t RECORD_HEADER = 5;
+
+constexpr auto POLL_INTERVAL = std::chrono::milliseconds(10);
+
+std::string encode_record(char type, const std::string& payload) {
+    std::string record(RECORD_HEADER, '\0');
+    record[0] = type;
+    uint32_t len = static_cast<uint32_t>(payload.size());
+    for (int i = 0; i < 4; ++i) {
+        record[1 + i] = static_cast<char>((len >> (8 * i)) & 0xFF);
+    }
+    record += payload;
+    return record;
+}
+
+// 整条记录一次写入，follower不会读到交错的内容
+bool write_all(int fd, const std::string& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t n = write(fd, data.data() + offset, data.size() - offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        offset += static_cast<size_t>(n);
+    }
+    return true;
+}
+
+std::string read_lock_owner(int lock_fd) {
+    char buffer[256];
+    ssize_t n = pread(lock_fd, buffer, sizeof(buffer), 0);
+    return n > 0 ? std::string(buffer, static_cast<size_t>(n)) : "";
+}
+
+// fd对应的文件是否仍是path指向的文件；leader结束时会在持有锁的情况下删除锁文件
+bool same_file(int fd, const std::filesystem::path& path) {
+    struct stat opened, current;
+    return fstat(fd, &opened) == 0 && stat(path.c_str(), &current) == 0 &&
+        opened.st_dev == current.st_dev && opened.st_ino == current.st_ino;
+}
+
+std::string result_to_json(const openai::ChatCompletionResult& result) {
+    nlohmann::json node = {
+        {"success", result.success},
+        {"full_response", result.full_response},
+        {"error_message", result.error_message},
+        {"stopped_early", result.stopped_early},
+        {"stop_reason", result.stop_reason},
+        {"usage", {
+            {"prompt_tokens", result.usage.prompt_tokens},
+            {"completion_tokens", result.usage.completion_tokens},
+            {"cached_tokens", result.usage.cached_tokens}
+        }}
+    };
+    return node.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
+openai::ChatCompletionResult result_from_json(const std::string& payload) {
+    openai::ChatCompletionResult result;
+    nlohmann::json node = nlohmann::json::parse(payload);
+    result.success = node.value("success", false);
+    result.full_response = node.value("full_response", "");
+    result.error_message = node.value("error_message", "");
+    result.stopped_early = node.value("stopped_early", false);
+    result.stop_reason = node.value("stop_reason", "");
+    if (node.contains("usage") && node["usage"].is_object()) {
+        const nlohmann::json& usage = node["usage"];
+        result.usage.prompt_tokens = usage.value("prompt_tokens", -1L);
+        result.usage.completion_tokens = usage.value("completion_tokens", -1L);
+        result.usage.cached_tokens = usage.value("cached_tokens", -1L);
+    }
+    return result;
+}
+
+enum class FollowOutcome {
+    Completed,   // 读到了leader的结果
+    LeaderLost,  // leader退出且没有留下结果
+    Retry        // spool尚未就绪或已被清理，重新选举
+};
+
+// 本进程的--deadline已到：带着已输出的内容结束，不再等待leader
+void deadline_exceeded(openai::ChatCompletionResult& result, const std::string& delivered) {
+    result.success = false;
+    result.error_message = "Request deadline exceeded";
+    result.full_response = openai::trim(delivered);
+}
+
+// 作为follower读取leader的spool，直到读到结果、leader消失或本进程的截止时间已到
+FollowOutcome follow(int lock_fd, const std::filesystem::path& dir, const openai::StreamCallback& callback,
+                     openai::ChatCompletionResult& result, std::string& delivered,
+                     std::chrono::steady_clock::time_point deadline, bool debug) {
+    std::string owner = read_lock_owner(lock_fd);
+    if (owner.empty()) {
+        return FollowOutcome::Retry;
+    }
+
+    int spool_fd = open((dir / owner).c_str(), O_RDONLY | O_CLOEXEC);
+    if (spool_fd < 0) {
+        return FollowOutcome::Retry;
+    }
+
+    if (debug) {
+        std::cerr << "Coalescing with in-flight request " << owner << std::endl;
+    }
+
+    std::string buffer;
+    char chunk[8192];
+    while (true) {
+        // leader自己可能没有截止时间，持续输出时也要检查
+        if (std::chrono::steady_clock::now() >= deadline) {
+            close(spool_fd);
+            deadline_exceeded(result, delivered);
+            return FollowOutcome::Completed;
+        }
+
+        ssize_t n = read(spool_fd, chunk, sizeof(chunk));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n > 0) {
+            buffer.append(chunk, static_cast<size_t>(n));
+            size_t offset = 0;
+            while (buffer.size() - offset >= RECORD_HEADER) {
+                uint32_t len = 0;
+                for (int i = 0; i < 4; ++i) {
+                    len |= static_cast<uint32_t>(static_cast<unsigned char>(buffer[offset + 1 + i])) << (8 * i);
+                }
+                if (buffer.size() - offset < RECORD_HEADER + len) {
+                    break;
+                }
+
+                char type = buffer[offset];
+                std::string payload = buffer.substr(offset + RECORD_HEADER, len);
+                offset += RECORD_HEADER + len;
+
+                if (type == RECORD_DELTA) {
+                    delivered += payload;
+                    callback(payload, false);
+                } else if (type == RECORD_RESULT) {
+                    close(spool_fd);
+                    try {
+                        result = result_from_json(payload);
+                    } catch (const std::exception& e) {
+                        result.success = false;
+                        result.error_message = std::string("Invalid coalesced result: ") + e.what();
+                    }
+                    return FollowOutcome::Completed;
+                }
+            }
+            buffer.erase(0, offset);
+            continue;
+        }
+
+        if (openai::cancel_requested()) {
+            close(spool_fd);
+            result.success = true;
+            result.full_response = openai::trim(delivered);
+            result.stopped_early = true;
+            result.stop_reason = "interrupted";
+            return FollowOutcome::Completed;
+        }
+
+        // 没有新数据：能拿到共享锁说明leader已经退出（正常结束会先写入结果）；
+        // 公布的spool变了说明打开的是崩溃的leader留下的旧文件
+        bool leader_gone = read_lock_owner(lock_fd) != owner;
+        if (!leader_gone && flock(lock_fd, LOCK_SH | LOCK_NB) == 0) {
+            flock(lock_fd, LOCK_UN);
+            leader_gone = true;
+        }
+        if (leader_gone) {
+            // leader可能在我们上次读取之后写完结果才退出，再读一次
+            n = read(spool_fd, chunk, sizeof(chunk));
+            if (n > 0) {
+                buffer.append(chunk, static_cast<size_t>(n));
+                continue;
+            }
+            close(spool_fd);
+            return delivered.empty() ? FollowOutcome::Retry : FollowOutcome::LeaderLost;
+        }
+
+        std::this_thread::sleep_for(POLL_INTERVAL);
+    }
+}
+
+} // namespace
+
+std::string request_key(const Config& config, const std::vector<openai::Message>& messages,
+                        const std::string& model_override) {
+    openai::PreparedRequest prepared;
+    std::string error_message;
+    if (!openai::prepare_chat_request(config, messages, model_override, true, "", prepared, error_message, false)) {
+        return "";
+    }
+
+    std::string identity = prepared.url_base + "\n" + prepared.path + "\n" + prepared.body;
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    if (EVP_Digest(identity.data(), identity.size(), digest, &digest_len, EVP_sha256(), nullptr) != 1) {
+        return "";
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    std::string key;
+    for (unsigned int i = 0; i < digest_len; ++i) {
+        key += hex[digest[i] >> 4];
+        key += hex[digest[i] & 0xF];
+    }
+    return key;
+}
+
+openai::ChatCompletionResult chat_completion_stream(
+    const Config& config,
+    const std::vector<openai::Message>& messages,
+    openai::StreamCallback callback,
+    const std::string& model_override,
+    bool debug,
+    const openai::StreamOptions& options
+) {
+    // 停止条件与录制只属于发起它们的进程，这类请求不合并
+    std::string key = options.stop.empty() && !options.recorder
+        ? request_key(config, messages, model_override) : "";
+
+    std::filesystem::path dir;
+    std::filesystem::path lock_path;
+    int lock_fd = -1;
+    if (!key.empty()) {
+        std::error_code ec;
+        dir = Config::lc_dir() / "inflight";
+        std::filesystem::create_directories(dir, ec);
+        lock_path = dir / (key + ".lock");
+        lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    }
+
+    if (lock_fd < 0) {
+        return openai::chat_completion_stream(config, messages, callback, model_override, debug, options);
+    }
+
+    // 选举：拿到排它锁的进程成为leader；进程崩溃时内核自动释放锁
+    std::string delivered;
+    while (true) {
+        if (flock(lock_fd, LOCK_EX | LOCK_NB) == 0) {
+            if (same_file(lock_fd, lock_path)) {
+                break;
+            }
+            // 锁住的是上一个leader已删除的文件，改用路径上的新文件重新选举
+            close(lock_fd);
+            lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+            if (lock_fd < 0) {
+                return openai::chat_completion_stream(config, messages, callback, model_override, debug, options);
+            }
+            continue;
+        }
+        if (errno != EWOULDBLOCK && errno != EINTR) {
+            close(lock_fd);
+            return openai::chat_completion_stream(config, messages, callback, model_override, debug, options);
+        }
+
+        openai::ChatCompletionResult result;
+        FollowOutcome outcome = follow(lock_fd, dir, callback, result, delivered, options.deadline, debug);
+        if (outcome == FollowOutcome::Completed) {
+            close(lock_fd);
+            callback("", true);
+            return result;
+        }
+        if (outcome == FollowOutcome::LeaderLost) {
+            // 已经输出了部分内容，不能再从头请求
+            close(lock_fd);
+            result.success = false;
+            result.full_response = openai::trim(delivered);
+            result.error_message = "Coalesced request leader exited before completing";
+            callback("", true);
+            return result;
+        }
+        if (openai::cancel_requested()) {
+            close(lock_fd);
+            openai::ChatCompletionResult interrupted;
+            interrupted.success = true;
+            interrupted.stopped_early = true;
+            interrupted.stop_reason = "interrupted";
+            callback("", true);
+            return interrupted;
+        }
+        if (std::chrono::steady_clock::now() >= options.deadline) {
+            close(lock_fd);
+            deadline_exceeded(result, delivered);
+            callback("", true);
+            return result;
+        }
+        std::this_thread::sleep_for(POLL_INTERVAL);
+    }
+
+    // 成为leader：清理上一个崩溃的leader留下的spool，再公布自己的spool
+    std::string stale = read_lock_owner(lock_fd);
+    if (!stale.empty()) {
+        unlink((dir / stale).c_str());
+    }
+
+    std::string owner = key + "." + std::to_string(getpid()) + ".spool";
+    std::filesystem::path spool_path = dir / owner;
+    int spool_fd = open(spool_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if (spool_fd >= 0) {
+        if (ftruncate(lock_fd, 0) != 0 || pwrite(lock_fd, owner.data(), owner.size(), 0) < 0) {
+            close(spool_fd);
+            spool_fd = -1;
+        }
+    }
+
+    if (debug) {
+        std::cerr << "Leading coalesced request " << key << std::endl;
+    }
+
+    bool spool_ok = spool_fd >= 0;
+    auto result = openai::chat_completion_stream(config, messages,
+        [&](const std::string& delta, bool is_done) {
+            if (spool_ok && !is_done && !delta.empty()) {
+                spool_ok = write_all(spool_fd, encode_record(RECORD_DELTA, delta));
+            }
+            callback(delta, is_done);
+        }, model_override, debug, options);
+
+    // 中断与截止时间只属于leader自己：不留下结果，follower视为leader退出，
+    // 尚未收到内容的follower重新选举并自行请求
+    bool local_outcome = (result.stopped_early && result.stop_reason == "interrupted") ||
+        result.error_message == "Request deadline exceeded";
+
+    // 先写结果再撤销公布，最后释放锁；已打开spool的follower仍能读完
+    if (spool_fd >= 0) {
+        if (spool_ok && !local_outcome) {
+            write_all(spool_fd, encode_record(RECORD_RESULT, result_to_json(result)));
+        }
+        close(spool_fd);
+        unlink(spool_path.c_str());
+    }
+    // 持有排它锁时删除锁文件，inflight目录不随不同请求的数量增长；
+    // 仍持有旧文件的进程拿到锁后会发现它已被删除，转而使用新文件
+    if (ftruncate(lock_fd, 0) != 0 && debug) {
+        std::cerr << "Failed to clear coalescing lock " << key << std::endl;
+    }
+    unlink(lock_path.c_str());
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+
+    return result;
+}
+
+} // namespace coalesce
+} // namespace lc
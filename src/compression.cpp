@@ -0,0 +1,181 @@
+#include "../include/compression.h"
+#include <zlib.h>
+#ifdef LC_ZSTD_SUPPORT
+#include <zstd.h>
+#endif
+
+namespace lc {
+namespace compression {
+
+// gzip压缩，windowBits加16输出gzip头而不是zlib头
+static bool gzip_compress(const std::string& input, std::string& output) {
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    
+    output.resize(deflateBound(&stream, static_cast<uLong>(input.size())));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+    stream.avail_out = static_cast<uInt>(output.size());
+    
+    int ret = deflate(&stream, Z_FINISH);
+    output.resize(stream.total_out);
+    deflateEnd(&stream);
+    
+    return ret == Z_STREAM_END;
+}
+
+#ifdef LC_ZSTD_SUPPORT
+static bool zstd_compress(const std::string& input, std::string& output) {
+    output.resize(ZSTD_compressBound(input.size()));
+    size_t size = ZSTD_compress(&output[0], output.size(), input.data(), input.size(), 3);
+    if (ZSTD_isError(size)) {
+        return false;
+    }
+    output.resize(size);
+    return true;
+}
+#endif
+
+bool is_supported(const std::string& encoding) {
+    if (encoding == "gzip") {
+        return true;
+    }
+#ifdef LC_ZSTD_SUPPORT
+    if (encoding == "zstd") {
+        return true;
+    }
+#endif
+    return false;
+}
+
+bool compress(const std::string& encoding, const std::string& input, std::string& output) {
+    if (encoding == "gzip") {
+        return gzip_compress(input, output);
+    }
+#ifdef LC_ZSTD_SUPPORT
+    if (encoding == "zstd") {
+        return zstd_compress(input, output);
+    }
+#endif
+    return false;
+}
+
+const char* accept_encoding() {
+#ifdef LC_ZSTD_SUPPORT
+    return "gzip, deflate, zstd";
+#else
+    return "gzip, deflate";
+#endif
+}
+
+struct Decoder::State {
+    enum class Kind { Identity, Zlib, Zstd };
+    Kind kind = Kind::Identity;
+    z_stream zlib{};
+    bool zlib_open = false;
+#ifdef LC_ZSTD_SUPPORT
+    ZSTD_DStream* zstd = nullptr;
+#endif
+    char buffer[16384];
+
+    void close() {
+        if (zlib_open) {
+            inflateEnd(&zlib);
+            zlib_open = false;
+        }
+#ifdef LC_ZSTD_SUPPORT
+        if (zstd) {
+            ZSTD_freeDStream(zstd);
+            zstd = nullptr;
+        }
+#endif
+        kind = Kind::Identity;
+    }
+};
+
+Decoder::Decoder() : state_(std::make_unique<State>()) {}
+
+Decoder::~Decoder() {
+    state_->close();
+}
+
+bool Decoder::begin(const std::string& encoding) {
+    state_->close();
+    if (encoding.empty() || encoding == "identity") {
+        return true;
+    }
+    if (encoding == "gzip" || encoding == "x-gzip" || encoding == "deflate") {
+        // windowBits加32自动识别gzip头与zlib头
+        state_->zlib = z_stream{};
+        if (inflateInit2(&state_->zlib, 15 + 32) != Z_OK) {
+            return false;
+        }
+        state_->zlib_open = true;
+        state_->kind = State::Kind::Zlib;
+        return true;
+    }
+#ifdef LC_ZSTD_SUPPORT
+    if (encoding == "zstd") {
+        state_->zstd = ZSTD_createDStream();
+        if (!state_->zstd || ZSTD_isError(ZSTD_initDStream(state_->zstd))) {
+            return false;
+        }
+        state_->kind = State::Kind::Zstd;
+        return true;
+    }
+#endif
+    return false;
+}
+
+bool Decoder::feed(const char* data, size_t len, const Sink& sink) {
+    State& state = *state_;
+    if (state.kind == State::Kind::Identity) {
+        sink(data, len);
+        return true;
+    }
+
+#ifdef LC_ZSTD_SUPPORT
+    if (state.kind == State::Kind::Zstd) {
+        ZSTD_inBuffer input{data, len, 0};
+        while (input.pos < input.size) {
+            ZSTD_outBuffer output{state.buffer, sizeof(state.buffer), 0};
+            size_t ret = ZSTD_decompressStream(state.zstd, &output, &input);
+            if (ZSTD_isError(ret)) {
+                return false;
+            }
+            if (output.pos > 0 && !sink(state.buffer, output.pos)) {
+                return true;
+            }
+        }
+        return true;
+    }
+#endif
+
+    z_stream& stream = state.zlib;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = static_cast<uInt>(len);
+    // 输出缓冲区写满时zlib内部可能还有数据，继续取出，避免已到达的事件滞留到下一个读块
+    do {
+        stream.next_out = reinterpret_cast<Bytef*>(state.buffer);
+        stream.avail_out = sizeof(state.buffer);
+        int ret = inflate(&stream, Z_NO_FLUSH);
+        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+            return false;
+        }
+        size_t produced = sizeof(state.buffer) - stream.avail_out;
+        if (produced > 0 && !sink(state.buffer, produced)) {
+            return true;
+        }
+        // 压缩流已结束时忽略之后多余的字节
+        if (ret == Z_STREAM_END || produced == 0) {
+            break;
+        }
+    } while (stream.avail_in > 0 || stream.avail_out == 0);
+    return true;
+}
+
+} // namespace compression
+} // namespace lc
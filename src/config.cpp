@@ -1,7 +1,12 @@
 #include "../include/config.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <iostream>
 #include <fstream>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
 #include <string>
 #include <stdexcept>
 
@@ -24,6 +29,229 @@ const char* DEFAULT_SYSTEM_PROMPT = R"(You are a professional Linux command-line
 
   Remember, you must check the requirements in the received Query and the information in the Input, and your response will be displayed directly on the command-line interface, so keep the format simple and the content clear.)";
 
+static bool is_valid_compression(const std::string& value) {
+    return value == "none" || value == "gzip" || value == "zstd";
+}
+
+static bool is_valid_dialect(const std::string& value) {
+    return value == "openai" || value == "ollama" || value == "anthropic";
+}
+
+static std::map<std::string, Endpoint> endpoints_from_yaml(const YAML::Node& node) {
+    std::map<std::string, Endpoint> endpoints;
+    for (const auto& item : node) {
+        Endpoint endpoint;
+        endpoint.name = item.first.as<std::string>();
+        const YAML::Node& fields = item.second;
+        if (fields["base_url"]) {
+            endpoint.base_url = fields["base_url"].as<std::string>();
+        }
+        if (fields["api_key"]) {
+            endpoint.api_key = fields["api_key"].as<std::string>();
+        }
+        endpoint.request_compression = fields["request_compression"] ?
+            fields["request_compression"].as<std::string>() : "none";
+        endpoint.requests_per_minute = fields["requests_per_minute"] ?
+            fields["requests_per_minute"].as<int>() : 0;
+        endpoint.dialect = fields["dialect"] ? fields["dialect"].as<std::string>() : "openai";
+        endpoints[endpoint.name] = endpoint;
+    }
+    return endpoints;
+}
+
+static YAML::Node endpoints_to_yaml(const std::map<std::string, Endpoint>& endpoints) {
+    YAML::Node node;
+    for (const auto& [name, endpoint] : endpoints) {
+        node[name]["base_url"] = endpoint.base_url;
+        node[name]["api_key"] = endpoint.api_key;
+        node[name]["request_compression"] = endpoint.request_compression;
+        node[name]["requests_per_minute"] = endpoint.requests_per_minute;
+        node[name]["dialect"] = endpoint.dialect;
+    }
+    return node;
+}
+
+// 二进制配置快照：按字段顺序保存解析后的配置，启动时跳过YAML解析
+// 增删Config字段时必须同步修改下面的读写顺序并提升版本号
+static constexpr char SNAPSHOT_MAGIC[4] = {'L', 'C', 'C', 'S'};
+static constexpr uint32_t SNAPSHOT_VERSION = 4;
+
+// 快照对应的config.yaml状态，任何一项变化都说明YAML被修改过
+struct SnapshotStamp {
+    int64_t mtime_ns = 0;
+    uint64_t size = 0;
+    uint64_t inode = 0;
+
+    static bool of(const std::filesystem::path& path, SnapshotStamp& stamp) {
+        struct stat st {};
+        if (stat(path.c_str(), &st) != 0) {
+            return false;
+        }
+        stamp.mtime_ns = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+        stamp.size = static_cast<uint64_t>(st.st_size);
+        stamp.inode = static_cast<uint64_t>(st.st_ino);
+        return true;
+    }
+};
+
+class SnapshotWriter {
+public:
+    template <typename T>
+    void value(T v) {
+        data_.append(reinterpret_cast<const char*>(&v), sizeof(v));
+    }
+
+    void text(const std::string& v) {
+        value<uint32_t>(static_cast<uint32_t>(v.size()));
+        data_ += v;
+    }
+
+    const std::string& data() const { return data_; }
+
+private:
+    std::string data_;
+};
+
+class SnapshotReader {
+public:
+    explicit SnapshotReader(const std::string& data) : data_(data) {}
+
+    template <typename T>
+    T value() {
+        T v{};
+        if (ok_ && data_.size() - pos_ >= sizeof(T)) {
+            std::memcpy(&v, data_.data() + pos_, sizeof(T));
+            pos_ += sizeof(T);
+        } else {
+            ok_ = false;
+        }
+        return v;
+    }
+
+    std::string text() {
+        uint32_t len = value<uint32_t>();
+        if (!ok_ || data_.size() - pos_ < len) {
+            ok_ = false;
+            return "";
+        }
+        std::string v = data_.substr(pos_, len);
+        pos_ += len;
+        return v;
+    }
+
+    bool good() const { return ok_; }
+
+    // 全部读完且没有越界才算有效
+    bool ok() const { return ok_ && pos_ == data_.size(); }
+
+private:
+    const std::string& data_;
+    size_t pos_ = 0;
+    bool ok_ = true;
+};
+
+static void write_snapshot(const Config& config, const SnapshotStamp& stamp) {
+    SnapshotWriter out;
+    for (char c : SNAPSHOT_MAGIC) {
+        out.value(c);
+    }
+    out.value(SNAPSHOT_VERSION);
+    out.value(stamp.mtime_ns);
+    out.value(stamp.size);
+    out.value(stamp.inode);
+
+    out.text(config.openai_api_key);
+    out.text(config.openai_base_url);
+    out.text(config.default_model);
+    out.text(config.system_prompt);
+    out.value<int32_t>(config.max_history);
+    out.value<uint8_t>(config.use_system_prompt);
+    out.value<int32_t>(config.stream_resume_retries);
+    out.text(config.request_compression);
+    out.value<uint64_t>(config.compression_threshold);
+    out.value<uint32_t>(static_cast<uint32_t>(config.endpoints.size()));
+    for (const auto& [name, endpoint] : config.endpoints) {
+        out.text(name);
+        out.text(endpoint.base_url);
+        out.text(endpoint.api_key);
+        out.text(endpoint.request_compression);
+        out.value<int32_t>(endpoint.requests_per_minute);
+        out.text(endpoint.dialect);
+    }
+    out.text(config.http_engine);
+    out.text(config.http2);
+    out.value<int32_t>(config.requests_per_minute);
+    out.value<uint8_t>(config.coalesce_requests);
+    out.value<uint8_t>(config.prefix_cache);
+    out.text(config.dialect);
+    out.value<uint8_t>(config.local_docs);
+
+    // 先写临时文件再原子替换，并发启动的进程不会读到写了一半的快照；快照中有API密钥，仅本人可读
+    auto path = Config::cache_path();
+    auto temp = path;
+    temp += "." + std::to_string(getpid());
+    int fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return;
+    }
+    const std::string& data = out.data();
+    bool written = write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size());
+    close(fd);
+    if (!written || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+    }
+}
+
+static bool read_snapshot(const SnapshotStamp& stamp, Config& config) {
+    std::ifstream file(Config::cache_path(), std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    SnapshotReader in(data);
+    for (char c : SNAPSHOT_MAGIC) {
+        if (in.value<char>() != c) {
+            return false;
+        }
+    }
+    if (in.value<uint32_t>() != SNAPSHOT_VERSION || in.value<int64_t>() != stamp.mtime_ns ||
+        in.value<uint64_t>() != stamp.size || in.value<uint64_t>() != stamp.inode) {
+        return false;
+    }
+
+    config.openai_api_key = in.text();
+    config.openai_base_url = in.text();
+    config.default_model = in.text();
+    config.system_prompt = in.text();
+    config.max_history = in.value<int32_t>();
+    config.use_system_prompt = in.value<uint8_t>() != 0;
+    config.stream_resume_retries = in.value<int32_t>();
+    config.request_compression = in.text();
+    config.compression_threshold = in.value<uint64_t>();
+    uint32_t endpoint_count = in.value<uint32_t>();
+    config.endpoints.clear();
+    for (uint32_t i = 0; i < endpoint_count && in.good(); ++i) {
+        Endpoint endpoint;
+        endpoint.name = in.text();
+        endpoint.base_url = in.text();
+        endpoint.api_key = in.text();
+        endpoint.request_compression = in.text();
+        endpoint.requests_per_minute = in.value<int32_t>();
+        endpoint.dialect = in.text();
+        config.endpoints[endpoint.name] = endpoint;
+    }
+    config.http_engine = in.text();
+    config.http2 = in.text();
+    config.requests_per_minute = in.value<int32_t>();
+    config.coalesce_requests = in.value<uint8_t>() != 0;
+    config.prefix_cache = in.value<uint8_t>() != 0;
+    config.dialect = in.text();
+    config.local_docs = in.value<uint8_t>() != 0;
+
+    return in.ok();
+}
+
 std::filesystem::path Config::lc_dir() {
     std::filesystem::path config_dir;
     
@@ -49,26 +277,33 @@ std::filesystem::path Config::lc_dir() {
         throw std::runtime_error("Failed to determine config directory");
     }
     
-    std::filesystem::path lc_dir = config_dir / "lc";
-    
-    // 确保目录存在
-    std::error_code ec;
-    std::filesystem::create_directories(lc_dir, ec);
-    if (ec) {
-        throw std::runtime_error("Failed to create config directory: " + ec.message());
-    }
-    
-    return lc_dir;
+    return config_dir / "lc";
 }
 
 std::filesystem::path Config::config_path() {
     return lc_dir() / "config.yaml";
 }
 
+std::filesystem::path Config::cache_path() {
+    return lc_dir() / "config.cache";
+}
+
 std::filesystem::path Config::memory_path() {
     return lc_dir() / "conversation_memory.json";
 }
 
+std::filesystem::path Config::race_stats_path() {
+    return lc_dir() / "race_stats.json";
+}
+
+std::filesystem::path Config::latency_stats_path() {
+    return lc_dir() / "latency.json";
+}
+
+std::filesystem::path Config::docs_index_dir() {
+    return lc_dir() / "docs";
+}
+
 Config Config::default_config() {
     Config config;
     config.openai_api_key = "";
@@ -77,6 +312,16 @@ Config Config::default_config() {
     config.system_prompt = DEFAULT_SYSTEM_PROMPT;
     config.max_history = DEFAULT_MAX_HISTORY;
     config.use_system_prompt = true;
+    config.stream_resume_retries = DEFAULT_STREAM_RESUME_RETRIES;
+    config.request_compression = "none";
+    config.compression_threshold = DEFAULT_COMPRESSION_THRESHOLD;
+    config.http_engine = "blocking";
+    config.http2 = "auto";
+    config.requests_per_minute = 0;
+    config.coalesce_requests = false;
+    config.prefix_cache = false;
+    config.dialect = "openai";
+    config.local_docs = true;
     return config;
 }
 
@@ -84,10 +329,17 @@ std::optional<Config> Config::load() {
     auto path = config_path();
     
     // 检查文件是否存在
-    if (!std::filesystem::exists(path)) {
+    SnapshotStamp stamp;
+    if (!SnapshotStamp::of(path, stamp)) {
         return default_config();
     }
     
+    // YAML没有变化时直接使用上次解析的快照
+    Config cached;
+    if (read_snapshot(stamp, cached)) {
+        return cached;
+    }
+    
     try {
         YAML::Node config = YAML::LoadFile(path.string());
         Config result;
@@ -126,6 +378,71 @@ std::optional<Config> Config::load() {
             result.use_system_prompt = true;
         }
         
+        if (config["stream_resume_retries"]) {
+            result.stream_resume_retries = config["stream_resume_retries"].as<int>();
+        } else {
+            result.stream_resume_retries = DEFAULT_STREAM_RESUME_RETRIES;
+        }
+        
+        if (config["request_compression"]) {
+            result.request_compression = config["request_compression"].as<std::string>();
+        } else {
+            result.request_compression = "none";
+        }
+        
+        if (config["compression_threshold"]) {
+            result.compression_threshold = config["compression_threshold"].as<size_t>();
+        } else {
+            result.compression_threshold = DEFAULT_COMPRESSION_THRESHOLD;
+        }
+        
+        if (config["endpoints"]) {
+            result.endpoints = endpoints_from_yaml(config["endpoints"]);
+        }
+        
+        if (config["http_engine"]) {
+            result.http_engine = config["http_engine"].as<std::string>();
+        } else {
+            result.http_engine = "blocking";
+        }
+        
+        if (config["http2"]) {
+            result.http2 = config["http2"].as<std::string>();
+        } else {
+            result.http2 = "auto";
+        }
+        
+        if (config["requests_per_minute"]) {
+            result.requests_per_minute = config["requests_per_minute"].as<int>();
+        } else {
+            result.requests_per_minute = 0;
+        }
+        
+        if (config["coalesce_requests"]) {
+            result.coalesce_requests = config["coalesce_requests"].as<bool>();
+        } else {
+            result.coalesce_requests = false;
+        }
+        
+        if (config["prefix_cache"]) {
+            result.prefix_cache = config["prefix_cache"].as<bool>();
+        } else {
+            result.prefix_cache = false;
+        }
+        
+        if (config["dialect"]) {
+            result.dialect = config["dialect"].as<std::string>();
+        } else {
+            result.dialect = "openai";
+        }
+        
+        if (config["local_docs"]) {
+            result.local_docs = config["local_docs"].as<bool>();
+        } else {
+            result.local_docs = true;
+        }
+        
+        write_snapshot(result, stamp);
         return result;
     } catch (const std::exception& e) {
         std::cerr << "Error loading config: " << e.what() << std::endl;
@@ -148,6 +465,19 @@ bool Config::save() const {
         node["system_prompt"] = system_prompt;
         node["max_history"] = max_history;
         node["use_system_prompt"] = use_system_prompt;
+        node["stream_resume_retries"] = stream_resume_retries;
+        node["request_compression"] = request_compression;
+        node["compression_threshold"] = compression_threshold;
+        if (!endpoints.empty()) {
+            node["endpoints"] = endpoints_to_yaml(endpoints);
+        }
+        node["http_engine"] = http_engine;
+        node["http2"] = http2;
+        node["requests_per_minute"] = requests_per_minute;
+        node["coalesce_requests"] = coalesce_requests;
+        node["prefix_cache"] = prefix_cache;
+        node["dialect"] = dialect;
+        node["local_docs"] = local_docs;
         
         std::ofstream fout(path);
         if (!fout) {
@@ -156,7 +486,14 @@ bool Config::save() const {
         }
         
         fout << YAML::Dump(node);
-        return true;
+        fout.close();
+        
+        // 同时重新生成快照，下次启动无需解析YAML
+        SnapshotStamp stamp;
+        if (fout && SnapshotStamp::of(path, stamp)) {
+            write_snapshot(*this, stamp);
+        }
+        return static_cast<bool>(fout);
     } catch (const std::exception& e) {
         std::cerr << "Error saving config: " << e.what() << std::endl;
         return false;
@@ -186,6 +523,95 @@ bool Config::set_value(const std::string& key, const std::string& value) {
             } else {
                 throw std::invalid_argument("use_system_prompt must be true/false or 1/0");
             }
+        } else if (key == "coalesce_requests") {
+            if (value == "true" || value == "1") {
+                coalesce_requests = true;
+            } else if (value == "false" || value == "0") {
+                coalesce_requests = false;
+            } else {
+                throw std::invalid_argument("coalesce_requests must be true/false or 1/0");
+            }
+        } else if (key == "prefix_cache") {
+            if (value == "true" || value == "1") {
+                prefix_cache = true;
+            } else if (value == "false" || value == "0") {
+                prefix_cache = false;
+            } else {
+                throw std::invalid_argument("prefix_cache must be true/false or 1/0");
+            }
+        } else if (key == "local_docs") {
+            if (value == "true" || value == "1") {
+                local_docs = true;
+            } else if (value == "false" || value == "0") {
+                local_docs = false;
+            } else {
+                throw std::invalid_argument("local_docs must be true/false or 1/0");
+            }
+        } else if (key == "request_compression") {
+            if (!is_valid_compression(value)) {
+                throw std::invalid_argument("request_compression must be none, gzip or zstd");
+            }
+            request_compression = value;
+        } else if (key == "http_engine") {
+            if (value != "blocking" && value != "async") {
+                throw std::invalid_argument("http_engine must be blocking or async");
+            }
+            http_engine = value;
+        } else if (key == "http2") {
+            if (value != "auto" && value != "off" && value != "prior-knowledge") {
+                throw std::invalid_argument("http2 must be auto, off or prior-knowledge");
+            }
+            http2 = value;
+        } else if (key == "dialect") {
+            if (!is_valid_dialect(value)) {
+                throw std::invalid_argument("dialect must be openai, ollama or anthropic");
+            }
+            dialect = value;
+        } else if (key == "compression_threshold") {
+            compression_threshold = std::stoul(value);
+        } else if (key.compare(0, 10, "endpoints.") == 0) {
+            // endpoints.<name>.<field>=value
+            size_t dot = key.find('.', 10);
+            if (dot == std::string::npos || dot == 10) {
+                throw std::invalid_argument("use endpoints.<name>.<field>=value");
+            }
+            std::string name = key.substr(10, dot - 10);
+            std::string field = key.substr(dot + 1);
+            
+            Endpoint& endpoint = endpoints[name];
+            endpoint.name = name;
+            if (field == "base_url") {
+                endpoint.base_url = value;
+            } else if (field == "api_key") {
+                endpoint.api_key = value;
+            } else if (field == "request_compression") {
+                if (!is_valid_compression(value)) {
+                    throw std::invalid_argument("request_compression must be none, gzip or zstd");
+                }
+                endpoint.request_compression = value;
+            } else if (field == "dialect") {
+                if (!is_valid_dialect(value)) {
+                    throw std::invalid_argument("dialect must be openai, ollama or anthropic");
+                }
+                endpoint.dialect = value;
+            } else if (field == "requests_per_minute") {
+                endpoint.requests_per_minute = std::stoi(value);
+                if (endpoint.requests_per_minute < 0) {
+                    throw std::invalid_argument("requests_per_minute must be non-negative");
+                }
+            } else {
+                throw std::invalid_argument("Unknown endpoint field: " + field);
+            }
+        } else if (key == "requests_per_minute") {
+            requests_per_minute = std::stoi(value);
+            if (requests_per_minute < 0) {
+                throw std::invalid_argument("requests_per_minute must be non-negative");
+            }
+        } else if (key == "stream_resume_retries") {
+            stream_resume_retries = std::stoi(value);
+            if (stream_resume_retries < 0) {
+                throw std::invalid_argument("stream_resume_retries must be non-negative");
+            }
         } else {
             std::cerr << "Unknown config key: " << key << std::endl;
             return false;
@@ -205,9 +631,49 @@ void Config::show() const {
     std::cout << "  default_model: " << default_model << std::endl;
     std::cout << "  max_history: " << max_history << std::endl;
     std::cout << "  use_system_prompt: " << (use_system_prompt ? "true" : "false") << std::endl;
+    std::cout << "  stream_resume_retries: " << stream_resume_retries << std::endl;
+    std::cout << "  request_compression: " << request_compression << std::endl;
+    std::cout << "  compression_threshold: " << compression_threshold << std::endl;
+    std::cout << "  http_engine: " << http_engine << std::endl;
+    std::cout << "  http2: " << http2 << std::endl;
+    std::cout << "  requests_per_minute: " << requests_per_minute << std::endl;
+    std::cout << "  coalesce_requests: " << (coalesce_requests ? "true" : "false") << std::endl;
+    std::cout << "  prefix_cache: " << (prefix_cache ? "true" : "false") << std::endl;
+    std::cout << "  dialect: " << dialect << std::endl;
+    std::cout << "  local_docs: " << (local_docs ? "true" : "false") << std::endl;
+    for (const auto& [name, endpoint] : endpoints) {
+        std::cout << "  endpoints." << name << ": " << endpoint.base_url
+                  << " (api_key: " << (endpoint.api_key.empty() ? "[NOT SET]" : "[HIDDEN]")
+                  << ", request_compression: " << endpoint.request_compression
+                  << ", requests_per_minute: " << endpoint.requests_per_minute
+                  << ", dialect: " << endpoint.dialect << ")" << std::endl;
+    }
     std::cout << "  system_prompt: " << (system_prompt.length() > 50 ? system_prompt.substr(0, 47) + "..." : system_prompt) << std::endl;
 }
 
+Endpoint Config::resolve_endpoint(const std::string& model_spec, std::string& model) const {
+    model = model_spec.empty() ? default_model : model_spec;
+    
+    // model@endpoint：只有@后是已配置的端点名时才拆分，模型名本身可能含@
+    size_t at = model.rfind('@');
+    if (at != std::string::npos) {
+        auto it = endpoints.find(model.substr(at + 1));
+        if (it != endpoints.end()) {
+            model = model.substr(0, at);
+            return it->second;
+        }
+    }
+    
+    Endpoint endpoint;
+    endpoint.name = "default";
+    endpoint.base_url = openai_base_url;
+    endpoint.api_key = openai_api_key;
+    endpoint.request_compression = request_compression;
+    endpoint.requests_per_minute = requests_per_minute;
+    endpoint.dialect = dialect;
+    return endpoint;
+}
+
 bool Config::reset_config() {
     try {
         Config default_cfg = default_config();
@@ -231,6 +697,19 @@ Node convert<lc::Config>::encode(const lc::Config& config) {
     node["system_prompt"] = config.system_prompt;
     node["max_history"] = config.max_history;
     node["use_system_prompt"] = config.use_system_prompt;
+    node["stream_resume_retries"] = config.stream_resume_retries;
+    node["request_compression"] = config.request_compression;
+    node["compression_threshold"] = config.compression_threshold;
+    if (!config.endpoints.empty()) {
+        node["endpoints"] = lc::endpoints_to_yaml(config.endpoints);
+    }
+    node["http_engine"] = config.http_engine;
+    node["http2"] = config.http2;
+    node["requests_per_minute"] = config.requests_per_minute;
+    node["coalesce_requests"] = config.coalesce_requests;
+    node["prefix_cache"] = config.prefix_cache;
+    node["dialect"] = config.dialect;
+    node["local_docs"] = config.local_docs;
     return node;
 }
 
@@ -263,6 +742,50 @@ bool convert<lc::Config>::decode(const Node& node, lc::Config& config) {
         config.use_system_prompt = node["use_system_prompt"].as<bool>();
     }
     
+    if (node["stream_resume_retries"]) {
+        config.stream_resume_retries = node["stream_resume_retries"].as<int>();
+    }
+    
+    if (node["request_compression"]) {
+        config.request_compression = node["request_compression"].as<std::string>();
+    }
+    
+    if (node["compression_threshold"]) {
+        config.compression_threshold = node["compression_threshold"].as<size_t>();
+    }
+    
+    if (node["endpoints"]) {
+        config.endpoints = lc::endpoints_from_yaml(node["endpoints"]);
+    }
+    
+    if (node["http_engine"]) {
+        config.http_engine = node["http_engine"].as<std::string>();
+    }
+    
+    if (node["http2"]) {
+        config.http2 = node["http2"].as<std::string>();
+    }
+    
+    if (node["requests_per_minute"]) {
+        config.requests_per_minute = node["requests_per_minute"].as<int>();
+    }
+    
+    if (node["coalesce_requests"]) {
+        config.coalesce_requests = node["coalesce_requests"].as<bool>();
+    }
+    
+    if (node["prefix_cache"]) {
+        config.prefix_cache = node["prefix_cache"].as<bool>();
+    }
+    
+    if (node["dialect"]) {
+        config.dialect = node["dialect"].as<std::string>();
+    }
+    
+    if (node["local_docs"]) {
+        config.local_docs = node["local_docs"].as<bool>();
+    }
+    
     return true;
 }
 
@@ -0,0 +1,489 @@
+#include "../include/dialect.h"
+#include "../include/stream.h"
+#include <algorithm>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+
+namespace lc {
+namespace openai {
+
+namespace {
+
+// 已序列化的消息前缀：逗号分隔的消息JSON，不含外层方括号
+struct SerializedPrefix {
+    std::vector<Message> messages;
+    std::string json;
+};
+
+// 进程内的前缀序列化缓存，续传、交互模式的后续轮次以及--race/--compare/bench的并发请求
+// 都会重复发送同一段系统提示与历史，只需追加新消息的JSON
+// 按逐条消息的链式哈希查找，命中后再逐条比对内容，哈希碰撞不会拼出错误的请求
+class PrefixCache {
+public:
+    // 把messages序列化为JSON数组的内容追加到out；前prefix_count条视为稳定前缀并缓存
+    void serialize(const std::vector<Message>& messages, size_t prefix_count, size_t& reused, std::string& out) {
+        std::vector<size_t> chain(prefix_count + 1, 0);
+        for (size_t i = 0; i < prefix_count; ++i) {
+            size_t h = static_cast<size_t>(messages[i].role) * 31 + std::hash<std::string_view>()(messages[i].content());
+            chain[i + 1] = chain[i] ^ (h + 0x9e3779b97f4a7c15ULL + (chain[i] << 6) + (chain[i] >> 2));
+        }
+
+        std::shared_ptr<const SerializedPrefix> base;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (size_t count = prefix_count; count > 0 && !base; --count) {
+                for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+                    if (it->first == chain[count] && matches(*it->second, messages, count)) {
+                        base = it->second;
+                        entries_.splice(entries_.begin(), entries_, it);
+                        break;
+                    }
+                }
+            }
+        }
+
+        size_t start = out.size();
+        reused = base ? base->messages.size() : 0;
+        if (base) {
+            out += base->json;
+        }
+        for (size_t i = reused; i < prefix_count; ++i) {
+            append(out, start, messages[i]);
+        }
+
+        if (reused < prefix_count) {
+            // 缓存的消息与调用方共享内容存储，只复制序列化结果
+            auto entry = std::make_shared<SerializedPrefix>();
+            entry->messages.assign(messages.begin(), messages.begin() + static_cast<std::ptrdiff_t>(prefix_count));
+            entry->json = out.substr(start);
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            entries_.emplace_front(chain[prefix_count], std::move(entry));
+            if (entries_.size() > MAX_ENTRIES) {
+                entries_.pop_back();
+            }
+        }
+
+        for (size_t i = prefix_count; i < messages.size(); ++i) {
+            append(out, start, messages[i]);
+        }
+    }
+
+private:
+    static constexpr size_t MAX_ENTRIES = 8;
+
+    static bool matches(const SerializedPrefix& entry, const std::vector<Message>& messages, size_t count) {
+        if (entry.messages.size() != count) {
+            return false;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (entry.messages[i].role != messages[i].role || entry.messages[i].content() != messages[i].content()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void append(std::string& out, size_t start, const Message& message) {
+        if (out.size() > start) {
+            out += ',';
+        }
+        message.append_json(out);
+    }
+
+    std::mutex mutex_;
+    std::list<std::pair<size_t, std::shared_ptr<const SerializedPrefix>>> entries_;  // 最近使用的在前
+};
+
+PrefixCache& prefix_cache() {
+    static PrefixCache cache;
+    return cache;
+}
+
+// 序列化后请求体大小的上界，一次预留到位：std::string扩容会翻倍，大段输入超出预留就要多占一倍内存
+size_t body_size_bound(const std::vector<Message>& messages, const std::string& model,
+                       std::string_view assistant_prefix) {
+    size_t size = 128 + json_string_size(model) + json_string_size(assistant_prefix);
+    for (const auto& message : messages) {
+        size += json_string_size(message.content()) + 32;  // 键名、角色与分隔符
+    }
+    return size;
+}
+
+// 把消息数组的内容（不含方括号）追加到body，assistant_prefix非空时作为最后一条assistant消息
+// 消息直接写入请求体，不经过中间的json对象，大段输入只在转义时复制一次
+void append_messages(std::string& body, const std::vector<Message>& messages, std::string_view assistant_prefix,
+                     bool cache_prefix, bool debug) {
+    if (cache_prefix) {
+        // 最新的用户消息（以及续传前缀）之前的内容都属于稳定前缀
+        size_t prefix_count = messages.empty() ? 0 : messages.size() - 1;
+        size_t reused = 0;
+        prefix_cache().serialize(messages, prefix_count, reused, body);
+        if (debug) {
+            std::cerr << "Serialized prefix: reused " << reused << " of " << prefix_count << " messages" << std::endl;
+        }
+    } else {
+        for (size_t i = 0; i < messages.size(); ++i) {
+            if (i > 0) {
+                body += ',';
+            }
+            messages[i].append_json(body);
+        }
+    }
+
+    if (!assistant_prefix.empty()) {
+        if (!messages.empty()) {
+            body += ',';
+        }
+        Message(Role::Assistant, assistant_prefix, nullptr).append_json(body);
+    }
+}
+
+// 解析不在热路径上的JSON片段（用量、错误），格式错误时返回discarded
+nlohmann::json parse_fragment(std::string_view raw) {
+    return nlohmann::json::parse(raw.begin(), raw.end(), nullptr, false);
+}
+
+// 流中的错误可能是字符串，也可能是带message的对象
+std::string error_text(std::string_view raw) {
+    nlohmann::json error = parse_fragment(raw);
+    if (error.is_string()) {
+        return error.get<std::string>();
+    }
+    if (error.is_object() && error.contains("message") && error["message"].is_string()) {
+        return error["message"].get<std::string>();
+    }
+    return std::string(raw);
+}
+
+long number_field(const nlohmann::json& node, const char* key) {
+    return node.is_object() && node.contains(key) && node[key].is_number_integer() ? node[key].get<long>() : -1L;
+}
+
+void add_bearer(const std::string& api_key, Headers& headers) {
+    // unix socket等本地服务可以不配置密钥，依靠文件权限控制访问
+    if (!api_key.empty()) {
+        headers.emplace_back("Authorization", "Bearer " + api_key);
+    }
+}
+
+// Anthropic的input_tokens不含命中缓存的部分，换算成与OpenAI一致的口径
+void merge_anthropic_usage(const nlohmann::json& usage, Usage& result) {
+    long input = number_field(usage, "input_tokens");
+    long cache_read = number_field(usage, "cache_read_input_tokens");
+    long cache_creation = number_field(usage, "cache_creation_input_tokens");
+    if (input >= 0) {
+        result.prompt_tokens = input + std::max(0L, cache_read) + std::max(0L, cache_creation);
+        if (cache_read >= 0) {
+            result.cached_tokens = cache_read;
+        }
+    }
+    long output = number_field(usage, "output_tokens");
+    if (output >= 0) {
+        result.completion_tokens = output;
+    }
+}
+
+// Messages API要求显式给出max_tokens
+constexpr int ANTHROPIC_MAX_TOKENS = 4096;
+constexpr const char* ANTHROPIC_VERSION = "2023-06-01";
+
+} // namespace
+
+bool parse_dialect(const std::string& name, Dialect& dialect) {
+    if (name.empty() || name == "openai") {
+        dialect = Dialect::OpenAI;
+    } else if (name == "ollama") {
+        dialect = Dialect::Ollama;
+    } else if (name == "anthropic") {
+        dialect = Dialect::Anthropic;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* dialect_name(Dialect dialect) {
+    switch (dialect) {
+        case Dialect::Ollama: return "ollama";
+        case Dialect::Anthropic: return "anthropic";
+        case Dialect::OpenAI: break;
+    }
+    return "openai";
+}
+
+// OpenAI兼容接口 ---------------------------------------------------------
+
+void OpenAIDialect::add_headers(const std::string& api_key, bool stream, Headers& headers) {
+    add_bearer(api_key, headers);
+    if (stream) {
+        headers.emplace_back("Accept", "text/event-stream");
+    }
+}
+
+// 与nlohmann::json按键名排序后的输出逐字节一致：messages、model、stream、stream_options
+// 消息数组位于请求体最前面，重复请求的前缀保持字节稳定
+std::string OpenAIDialect::body(const BodyParams& params) {
+    std::string body;
+    body.reserve(body_size_bound(params.messages, params.model, params.assistant_prefix));
+    body += "{\"messages\":[";
+    append_messages(body, params.messages, params.assistant_prefix, params.prefix_cache, params.debug);
+    body += "],\"model\":" + nlohmann::json(params.model).dump();
+    if (params.stream) {
+        // prefix_cache开启时请求usage统计，用于报告缓存命中
+        body += params.prefix_cache ? ",\"stream\":true,\"stream_options\":{\"include_usage\":true}"
+                                    : ",\"stream\":true";
+    }
+    body += "}";
+    return body;
+}
+
+// {"choices":[{"delta":{"content":"..."}}]}，开启include_usage时最后一个事件携带usage
+void OpenAIDialect::parse(std::string_view payload, StreamEvent& event, Usage& usage) {
+    if (payload == "[DONE]") {
+        event.done = true;
+        return;
+    }
+
+    JsonCursor json(payload);
+    std::string_view key;
+    if (!json.enter_object()) {
+        return;
+    }
+    while (json.next_key(key)) {
+        if (key == "choices" && json.enter_array()) {
+            // 只取第一个候选，其余跳过
+            if (json.next_element()) {
+                if (json.enter_object()) {
+                    std::string_view field;
+                    while (json.next_key(field)) {
+                        if (field == "delta" && json.enter_object()) {
+                            std::string_view name;
+                            while (json.next_key(name)) {
+                                if (name == "content") {
+                                    json.read_string(event.delta);
+                                } else {
+                                    json.skip_value();
+                                }
+                            }
+                        } else {
+                            json.skip_value();
+                        }
+                    }
+                } else {
+                    json.skip_value();
+                }
+                while (json.next_element()) {
+                    json.skip_value();
+                }
+            }
+        } else if (key == "usage") {
+            nlohmann::json fragment = parse_fragment(json.skip_value());
+            if (fragment.is_object()) {
+                usage = parse_usage(fragment);
+            }
+        } else if (key == "error") {
+            event.error = error_text(json.skip_value());
+        } else {
+            json.skip_value();
+        }
+    }
+}
+
+bool OpenAIDialect::parse_response(const nlohmann::json& response, std::string& content, Usage& usage) {
+    if (!response.contains("choices") ||
+        !response["choices"].is_array() ||
+        response["choices"].empty() ||
+        !response["choices"][0].contains("message") ||
+        !response["choices"][0]["message"].contains("content")) {
+        return false;
+    }
+
+    content = response["choices"][0]["message"]["content"].get<std::string>();
+    if (response.contains("usage") && response["usage"].is_object()) {
+        usage = parse_usage(response["usage"]);
+    }
+    return true;
+}
+
+// Ollama原生接口 ---------------------------------------------------------
+
+void OllamaDialect::add_headers(const std::string& api_key, bool stream, Headers& headers) {
+    // 直连Ollama不需要密钥，放在反向代理后面时按Bearer转发
+    add_bearer(api_key, headers);
+    if (stream) {
+        headers.emplace_back("Accept", "application/x-ndjson");
+    }
+}
+
+// Ollama默认就是流式输出，stream字段必须显式给出
+std::string OllamaDialect::body(const BodyParams& params) {
+    std::string body;
+    body.reserve(body_size_bound(params.messages, params.model, params.assistant_prefix));
+    body += "{\"messages\":[";
+    append_messages(body, params.messages, params.assistant_prefix, params.prefix_cache, params.debug);
+    body += "],\"model\":" + nlohmann::json(params.model).dump();
+    body += params.stream ? ",\"stream\":true}" : ",\"stream\":false}";
+    return body;
+}
+
+// {"message":{"content":"..."},"done":false}，最后一行done为true并带有token计数
+void OllamaDialect::parse(std::string_view payload, StreamEvent& event, Usage& usage) {
+    JsonCursor json(payload);
+    std::string_view key;
+    if (!json.enter_object()) {
+        return;
+    }
+    while (json.next_key(key)) {
+        if (key == "message" && json.enter_object()) {
+            std::string_view field;
+            while (json.next_key(field)) {
+                if (field == "content") {
+                    json.read_string(event.delta);
+                } else {
+                    json.skip_value();
+                }
+            }
+        } else if (key == "done") {
+            json.read_bool(event.done);
+        } else if (key == "prompt_eval_count") {
+            json.read_integer(usage.prompt_tokens);
+        } else if (key == "eval_count") {
+            json.read_integer(usage.completion_tokens);
+        } else if (key == "error") {
+            event.error = error_text(json.skip_value());
+        } else {
+            json.skip_value();
+        }
+    }
+}
+
+bool OllamaDialect::parse_response(const nlohmann::json& response, std::string& content, Usage& usage) {
+    if (!response.contains("message") || !response["message"].is_object() ||
+        !response["message"].contains("content") || !response["message"]["content"].is_string()) {
+        return false;
+    }
+
+    content = response["message"]["content"].get<std::string>();
+    usage.prompt_tokens = number_field(response, "prompt_eval_count");
+    usage.completion_tokens = number_field(response, "eval_count");
+    return true;
+}
+
+// Anthropic Messages接口 -------------------------------------------------
+
+void AnthropicDialect::add_headers(const std::string& api_key, bool stream, Headers& headers) {
+    if (!api_key.empty()) {
+        headers.emplace_back("x-api-key", api_key);
+    }
+    headers.emplace_back("anthropic-version", ANTHROPIC_VERSION);
+    if (stream) {
+        headers.emplace_back("Accept", "text/event-stream");
+    }
+}
+
+// 系统提示是顶层的system字段，不在消息数组中；键仍按名称排序，消息数组之前只有固定的max_tokens
+std::string AnthropicDialect::body(const BodyParams& params) {
+    std::vector<Message> conversation;
+    conversation.reserve(params.messages.size());
+    std::string system;
+    for (const auto& message : params.messages) {
+        if (message.role == Role::System) {
+            if (!system.empty()) {
+                system += "\n\n";
+            }
+            system += message.content();
+        } else {
+            conversation.push_back(message);
+        }
+    }
+
+    // 续传前缀作为预填的assistant消息，接口不接受以空白结尾的预填内容
+    std::string_view prefix = params.assistant_prefix;
+    size_t end = prefix.find_last_not_of(" \t\r\n");
+    prefix = end == std::string_view::npos ? std::string_view() : prefix.substr(0, end + 1);
+
+    std::string body;
+    body.reserve(body_size_bound(params.messages, params.model, prefix));
+    body += "{\"max_tokens\":" + std::to_string(ANTHROPIC_MAX_TOKENS) + ",\"messages\":[";
+    append_messages(body, conversation, prefix, params.prefix_cache, params.debug);
+    body += "],\"model\":" + nlohmann::json(params.model).dump();
+    if (params.stream) {
+        body += ",\"stream\":true";
+    }
+    if (!system.empty()) {
+        body += ",\"system\":";
+        append_json_string(body, system);
+    }
+    body += "}";
+    return body;
+}
+
+// 事件类型在负载的type字段中：content_block_delta携带文本增量，
+// message_start与message_delta携带用量，message_stop结束，error报告错误
+void AnthropicDialect::parse(std::string_view payload, StreamEvent& event, Usage& usage) {
+    JsonCursor json(payload);
+    std::string_view key;
+    std::string type;
+    if (!json.enter_object()) {
+        return;
+    }
+    while (json.next_key(key)) {
+        if (key == "type") {
+            json.read_string(type);
+        } else if (key == "delta" && json.enter_object()) {
+            // 只取文本增量，thinking与工具参数的增量使用其他字段
+            std::string_view field;
+            while (json.next_key(field)) {
+                if (field == "text") {
+                    json.read_string(event.delta);
+                } else {
+                    json.skip_value();
+                }
+            }
+        } else if (key == "usage") {
+            merge_anthropic_usage(parse_fragment(json.skip_value()), usage);
+        } else if (key == "message" && json.enter_object()) {
+            std::string_view field;
+            while (json.next_key(field)) {
+                if (field == "usage") {
+                    merge_anthropic_usage(parse_fragment(json.skip_value()), usage);
+                } else {
+                    json.skip_value();
+                }
+            }
+        } else if (key == "error") {
+            event.error = error_text(json.skip_value());
+        } else {
+            json.skip_value();
+        }
+    }
+
+    if (type == "message_stop") {
+        event.done = true;
+    } else if (type == "error" && event.error.empty()) {
+        event.error = "unknown error";
+    }
+}
+
+bool AnthropicDialect::parse_response(const nlohmann::json& response, std::string& content, Usage& usage) {
+    if (!response.contains("content") || !response["content"].is_array()) {
+        return false;
+    }
+
+    content.clear();
+    for (const auto& block : response["content"]) {
+        if (block.is_object() && block.value("type", "") == "text" && block.contains("text") && block["text"].is_string()) {
+            content += block["text"].get<std::string>();
+        }
+    }
+    if (response.contains("usage")) {
+        merge_anthropic_usage(response["usage"], usage);
+    }
+    return true;
+}
+
+} // namespace openai
+} // namespace lc
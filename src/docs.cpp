@@ -0,0 +1,1025 @@
+#include "../include/docs.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <thread>
+
+namespace lc {
+namespace docs {
+
+namespace {
+
+// 片段长度：段落攒到TARGET字节后在下一个段落边界切开，超过MAX字节时立即切开
+constexpr size_t TARGET_SNIPPET_BYTES = 600;
+constexpr size_t MAX_SNIPPET_BYTES = 1500;
+
+// tldr页面很短，整页作为一个片段
+constexpr size_t MAX_TLDR_BYTES = 3000;
+
+// 命令名在索引文本中的重复次数
+constexpr int NAME_WEIGHT = 3;
+
+// 单个页面文件的上限，超过的多半不是普通的man页面
+constexpr size_t MAX_PAGE_BYTES = 8 << 20;
+
+struct StoreRecord {
+    uint32_t source_length;
+    uint32_t section_length;
+    uint32_t text_length;
+};
+
+struct Snippet {
+    std::string source;
+    std::string section;
+    std::string text;
+};
+
+struct Page {
+    std::filesystem::path path;
+    bool tldr = false;
+};
+
+std::string language() {
+    const char* names[] = {"LC_ALL", "LC_MESSAGES", "LANG"};
+    for (const char* name : names) {
+        const char* value = std::getenv(name);
+        if (value != nullptr && *value != '\0') {
+            std::string lang(value);
+            lang = lang.substr(0, lang.find('.'));
+            return lang == "C" || lang == "POSIX" ? "" : lang;
+        }
+    }
+    return "";
+}
+
+// 读取整个文件，gzip压缩的man页面由zlib透明解压（未压缩的文件原样读出）
+bool read_page(const std::filesystem::path& path, std::string& content) {
+    gzFile file = gzopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    content.clear();
+    char buffer[65536];
+    int n;
+    while ((n = gzread(file, buffer, sizeof(buffer))) > 0) {
+        content.append(buffer, static_cast<size_t>(n));
+        if (content.size() > MAX_PAGE_BYTES) {
+            gzclose(file);
+            return false;
+        }
+    }
+    gzclose(file);
+    return n == 0;
+}
+
+// roff特殊字符中常见的几个，其余的直接省略
+const char* special_char(std::string_view name) {
+    static const std::pair<const char*, const char*> table[] = {
+        {"em", "-"}, {"en", "-"}, {"hy", "-"}, {"mi", "-"}, {"aq", "'"}, {"oq", "'"}, {"cq", "'"},
+        {"dq", "\""}, {"lq", "\""}, {"rq", "\""}, {"Lq", "\""}, {"Rq", "\""}, {"bu", "*"},
+        {"co", "(c)"}, {"rg", "(R)"}, {"ti", "~"}, {"ha", "^"}, {"rs", "\\"}, {"pl", "+"},
+        {"mu", "x"}, {"ge", ">="}, {"le", "<="}, {"->", "->"}, {"<-", "<-"}, {"fo", "<"}, {"fc", ">"},
+        {"R", "(R)"},
+    };
+    for (const auto& entry : table) {
+        if (name == entry.first) {
+            return entry.second;
+        }
+    }
+    return "";
+}
+
+// 读取转义序列的名字：(xx、[name]或单个字符，返回名字并前移pos
+std::string_view escape_name(std::string_view line, size_t& pos) {
+    if (pos >= line.size()) {
+        return {};
+    }
+    if (line[pos] == '(') {
+        std::string_view name = line.substr(pos + 1, 2);
+        pos = std::min(line.size(), pos + 3);
+        return name;
+    }
+    if (line[pos] == '[') {
+        size_t end = line.find(']', pos);
+        end = end == std::string_view::npos ? line.size() : end;
+        std::string_view name = line.substr(pos + 1, end - pos - 1);
+        pos = std::min(line.size(), end + 1);
+        return name;
+    }
+    return line.substr(pos++, 1);
+}
+
+// 去掉roff转义，把一行正文追加到out；行尾的\c或\表示与下一行相连时返回true
+bool append_roff_text(std::string_view line, std::string& out) {
+    size_t pos = 0;
+    while (pos < line.size()) {
+        char c = line[pos++];
+        if (c != '\\') {
+            out.push_back(c);
+            continue;
+        }
+        if (pos >= line.size()) {
+            return true;
+        }
+        char e = line[pos++];
+        switch (e) {
+        case 'f':
+        case 'n':
+        case 'g':
+        case 'k':
+        case 'F':
+        case 'm':
+        case 'M':
+        case 'Y':
+            escape_name(line, pos);
+            break;
+        case '(':
+        case '[':
+            --pos;
+            out += special_char(escape_name(line, pos));
+            break;
+        case '*':
+            out += special_char(escape_name(line, pos));
+            break;
+        case 's':
+            if (pos < line.size() && (line[pos] == '+' || line[pos] == '-')) {
+                ++pos;
+            }
+            if (pos < line.size() && (line[pos] == '(' || line[pos] == '[')) {
+                escape_name(line, pos);
+            } else {
+                while (pos < line.size() && line[pos] >= '0' && line[pos] <= '9') {
+                    ++pos;
+                }
+            }
+            break;
+        case 'h':
+        case 'v':
+        case 'w':
+        case 'o':
+        case 'l':
+        case 'L':
+        case 'D':
+        case 'X':
+        case 'Z':
+        case 'b':
+        case 'x':
+        case 'N':
+        case 'R':
+        case 'C':
+        case 'A':
+        case 'B':
+            // 带分隔符参数的转义，例如 \h'2n'
+            if (pos < line.size()) {
+                char delimiter = line[pos];
+                size_t end = line.find(delimiter, pos + 1);
+                pos = end == std::string_view::npos ? line.size() : end + 1;
+            }
+            break;
+        case 'e':
+        case '\\':
+            out.push_back('\\');
+            break;
+        case '"':
+            return false;
+        case '#':
+            return true;
+        case 'c':
+            if (pos >= line.size()) {
+                return true;
+            }
+            break;
+        case ' ':
+        case '~':
+        case '0':
+        case 't':
+            out.push_back(' ');
+            break;
+        case '&':
+        case '|':
+        case '^':
+        case '%':
+        case ',':
+        case '/':
+        case ')':
+        case 'd':
+        case 'u':
+        case 'a':
+        case 'p':
+        case 'r':
+        case 'z':
+        case '{':
+        case '}':
+        case ':':
+            break;
+        default:
+            out.push_back(e);
+            break;
+        }
+    }
+    return false;
+}
+
+// 拆分宏的参数，支持双引号包围的参数（其中""表示一个引号）
+std::vector<std::string> macro_args(std::string_view rest) {
+    std::vector<std::string> args;
+    size_t pos = 0;
+    while (pos < rest.size()) {
+        while (pos < rest.size() && (rest[pos] == ' ' || rest[pos] == '\t')) {
+            ++pos;
+        }
+        if (pos >= rest.size()) {
+            break;
+        }
+        std::string arg;
+        if (rest[pos] == '"') {
+            ++pos;
+            while (pos < rest.size()) {
+                if (rest[pos] == '"') {
+                    if (pos + 1 < rest.size() && rest[pos + 1] == '"') {
+                        arg.push_back('"');
+                        pos += 2;
+                        continue;
+                    }
+                    ++pos;
+                    break;
+                }
+                arg.push_back(rest[pos++]);
+            }
+        } else {
+            while (pos < rest.size() && rest[pos] != ' ' && rest[pos] != '\t') {
+                arg.push_back(rest[pos++]);
+            }
+        }
+        if (arg.rfind("\\\"", 0) == 0) {
+            break;
+        }
+        args.push_back(std::move(arg));
+    }
+    return args;
+}
+
+// mdoc中可以出现在参数里的宏
+bool is_mdoc_callable(const std::string& word) {
+    static const std::set<std::string> callable = {
+        "Ar", "Cm", "Dv", "Em", "Er", "Ev", "Fa", "Fl", "Ic", "Li", "Nm", "Ns", "Op", "Pa", "Ql", "Sq",
+        "Dq", "Qq", "Sy", "Va", "Xr", "Oo", "Oc", "No", "Pq", "Po", "Pc", "Bq", "Bo", "Bc", "Ek", "Bk",
+        "Ad", "An", "Cd", "Ft", "Fn", "Lk", "Mt", "Tn", "Ux", "At", "Bx", "Bsx", "Fx", "Nx", "Ox",
+    };
+    return callable.count(word) > 0;
+}
+
+// 各小节中对检索没有帮助的部分
+bool skipped_section(const std::string& heading) {
+    static const char* skipped[] = {"SEE ALSO", "AUTHOR", "AUTHORS", "COPYRIGHT", "REPORTING BUGS", "HISTORY",
+                                    "COLOPHON", "LICENSE", "BUGS", "BUG REPORTS", "AVAILABILITY"};
+    for (const char* name : skipped) {
+        if (heading == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+class ManParser {
+public:
+    ManParser(std::string source, std::string name) : source_(std::move(source)), name_(std::move(name)) {}
+
+    std::vector<Snippet> parse(std::string_view content);
+
+private:
+    void text(std::string_view line);
+    void macro(std::string_view name, std::string_view rest);
+    void mdoc(const std::vector<std::string>& args, size_t first);
+    void paragraph();
+    void flush();
+    void append_words(const std::string& words);
+
+    std::string source_;
+    std::string name_;
+    std::string section_;
+    std::string subsection_;
+    bool skip_ = true;  // NAME之前的内容（例如.TH）不输出
+    bool nofill_ = false;
+    bool joined_ = false;
+    bool tag_ = false;
+    std::string current_;
+    std::vector<Snippet> snippets_;
+};
+
+std::vector<Snippet> ManParser::parse(std::string_view content) {
+    // 只有一行.so的页面是其他页面的别名
+    if (content.rfind(".so ", 0) == 0 && content.find('\n') >= content.size() - 1) {
+        return {};
+    }
+
+    bool ignoring = false;
+    size_t pos = 0;
+    while (pos < content.size()) {
+        size_t end = content.find('\n', pos);
+        end = end == std::string_view::npos ? content.size() : end;
+        std::string_view line = content.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (ignoring) {
+            if (line.rfind("..", 0) == 0) {
+                ignoring = false;
+            }
+            continue;
+        }
+        if (!line.empty() && (line[0] == '.' || line[0] == '\'')) {
+            size_t start = 1;
+            while (start < line.size() && (line[start] == ' ' || line[start] == '\t')) {
+                ++start;
+            }
+            size_t name_end = start;
+            while (name_end < line.size() && line[name_end] != ' ' && line[name_end] != '\t') {
+                ++name_end;
+            }
+            std::string_view name = line.substr(start, name_end - start);
+            if (name.rfind("\\\"", 0) == 0 || name.empty()) {
+                continue;
+            }
+            if (name == "de" || name == "de1" || name == "am" || name == "ig") {
+                ignoring = true;
+                continue;
+            }
+            macro(name, line.substr(name_end));
+            continue;
+        }
+        text(line);
+    }
+    flush();
+    return std::move(snippets_);
+}
+
+void ManParser::append_words(const std::string& words) {
+    if (skip_ || words.empty()) {
+        return;
+    }
+    if (!current_.empty() && !joined_ && current_.back() != '\n') {
+        current_.push_back(nofill_ ? '\n' : ' ');
+    }
+    current_ += words;
+    joined_ = false;
+    if (tag_) {
+        // .TP之后的第一行是选项名，正文另起一行
+        current_.push_back('\n');
+        tag_ = false;
+    }
+    if (current_.size() >= MAX_SNIPPET_BYTES) {
+        flush();
+    }
+}
+
+void ManParser::text(std::string_view line) {
+    if (skip_) {
+        return;
+    }
+    if (line.empty()) {
+        paragraph();
+        return;
+    }
+    std::string words;
+    bool join = append_roff_text(line, words);
+    append_words(words);
+    joined_ = join;
+}
+
+void ManParser::paragraph() {
+    if (current_.size() >= TARGET_SNIPPET_BYTES) {
+        flush();
+    } else if (!current_.empty() && current_.back() != '\n') {
+        current_.push_back('\n');
+    }
+    joined_ = false;
+}
+
+void ManParser::flush() {
+    size_t end = current_.find_last_not_of(" \n");
+    if (end != std::string::npos && !skip_) {
+        current_.resize(end + 1);
+        std::string section = subsection_.empty() ? section_ : section_ + ": " + subsection_;
+        snippets_.push_back(Snippet{source_, section, std::move(current_)});
+    }
+    current_.clear();
+    joined_ = false;
+}
+
+void ManParser::mdoc(const std::vector<std::string>& args, size_t first) {
+    std::string words;
+    bool space = false;
+    bool flag = false;
+    for (size_t i = first; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (is_mdoc_callable(arg)) {
+            if (arg == "Fl") {
+                if (space && !words.empty()) {
+                    words.push_back(' ');
+                }
+                words.push_back('-');
+                space = false;
+                flag = true;
+            } else if (arg == "Ns") {
+                space = false;
+            } else if (arg == "Nm" && (i + 1 >= args.size() || is_mdoc_callable(args[i + 1]))) {
+                if (space && !words.empty()) {
+                    words.push_back(' ');
+                }
+                words += name_;
+                space = true;
+            }
+            continue;
+        }
+        if (space && !flag && !words.empty()) {
+            words.push_back(' ');
+        }
+        append_roff_text(arg, words);
+        space = true;
+        flag = false;
+    }
+    append_words(words);
+}
+
+void ManParser::macro(std::string_view name, std::string_view rest) {
+    std::vector<std::string> args = macro_args(rest);
+
+    if (name == "SH" || name == "Sh" || name == "SS" || name == "Ss") {
+        flush();
+        std::string heading;
+        for (const std::string& arg : args) {
+            if (!heading.empty()) {
+                heading.push_back(' ');
+            }
+            append_roff_text(arg, heading);
+        }
+        if (name == "SH" || name == "Sh") {
+            section_ = heading;
+            subsection_.clear();
+            skip_ = skipped_section(heading);
+        } else {
+            subsection_ = heading;
+        }
+        return;
+    }
+
+    if (name == "TP" || name == "IP" || name == "PP" || name == "P" || name == "LP" || name == "HP" ||
+        name == "sp" || name == "Pp" || name == "Lp" || name == "It" || name == "TQ") {
+        paragraph();
+        tag_ = name == "TP" || name == "TQ";
+        if (name == "IP" && !args.empty()) {
+            std::string tag;
+            append_roff_text(args[0], tag);
+            append_words(tag);
+        } else if (name == "It") {
+            mdoc(args, 0);
+        }
+        return;
+    }
+    if (name == "nf" || name == "EX" || name == "Bd" || name == "Vb") {
+        nofill_ = true;
+        paragraph();
+        return;
+    }
+    if (name == "fi" || name == "EE" || name == "Ed" || name == "Ve") {
+        nofill_ = false;
+        paragraph();
+        return;
+    }
+    if (name == "br") {
+        if (!current_.empty() && current_.back() != '\n') {
+            current_.push_back('\n');
+        }
+        return;
+    }
+
+    // man的字体宏：单一字体的参数以空格分隔，交替字体的参数直接相连
+    if (name == "B" || name == "I" || name == "SM" || name == "SB") {
+        std::string words;
+        for (const std::string& arg : args) {
+            if (!words.empty()) {
+                words.push_back(' ');
+            }
+            append_roff_text(arg, words);
+        }
+        append_words(words);
+        return;
+    }
+    if (name == "BR" || name == "RB" || name == "BI" || name == "IB" || name == "IR" || name == "RI") {
+        std::string words;
+        for (const std::string& arg : args) {
+            append_roff_text(arg, words);
+        }
+        append_words(words);
+        return;
+    }
+    if (name == "OP") {
+        std::string words = "[";
+        for (size_t i = 0; i < args.size(); ++i) {
+            if (i > 0) {
+                words.push_back(' ');
+            }
+            append_roff_text(args[i], words);
+        }
+        append_words(words + "]");
+        return;
+    }
+    if (name == "Nd") {
+        std::string words = "-";
+        for (const std::string& arg : args) {
+            words.push_back(' ');
+            append_roff_text(arg, words);
+        }
+        append_words(words);
+        return;
+    }
+    if (name == "Xr" && !args.empty()) {
+        append_words(args[0] + (args.size() > 1 ? "(" + args[1] + ")" : ""));
+        return;
+    }
+
+    // 其余大写开头的宏按mdoc处理并输出参数；小写的排版请求（.TH、.ft、.if等）没有正文
+    static const std::set<std::string> headers = {"TH", "Dd", "Dt", "Os", "UE", "ME", "RS", "RE", "Bl", "El",
+                                                  "PD", "UC", "DT", "Ek", "Bk", "Ed", "IX"};
+    if (name.empty() || name[0] < 'A' || name[0] > 'Z' || headers.count(std::string(name)) > 0) {
+        return;
+    }
+    std::vector<std::string> all;
+    all.reserve(args.size() + 1);
+    all.emplace_back(name);
+    all.insert(all.end(), args.begin(), args.end());
+    mdoc(all, 0);
+}
+
+// tldr页面：# 命令名、> 说明、- 示例说明与`命令`；{{占位符}}只保留其中的文字
+std::vector<Snippet> parse_tldr(std::string_view content) {
+    Snippet snippet;
+    size_t pos = 0;
+    while (pos < content.size()) {
+        size_t end = content.find('\n', pos);
+        end = end == std::string_view::npos ? content.size() : end;
+        std::string_view line = content.substr(pos, end - pos);
+        pos = end + 1;
+
+        if (line.rfind("# ", 0) == 0) {
+            snippet.source = "tldr: " + std::string(line.substr(2));
+            continue;
+        }
+        if (line.rfind("> ", 0) == 0) {
+            line.remove_prefix(2);
+            if (line.rfind("More information:", 0) == 0) {
+                continue;
+            }
+        } else if (line.size() > 2 && line.front() == '`' && line.back() == '`') {
+            line = line.substr(1, line.size() - 2);
+            snippet.text += "  ";
+        } else if (line.empty()) {
+            continue;
+        }
+        // 示例说明中用[x]标出助记字母（E[x]tract），去掉括号后才能按词检索
+        bool description = line.rfind("- ", 0) == 0;
+        for (size_t i = 0; i < line.size(); ++i) {
+            if (line.compare(i, 2, "{{") == 0 || line.compare(i, 2, "}}") == 0) {
+                ++i;
+                continue;
+            }
+            if (description && (line[i] == '[' || line[i] == ']')) {
+                continue;
+            }
+            snippet.text.push_back(line[i]);
+        }
+        snippet.text.push_back('\n');
+    }
+    if (snippet.source.empty() || snippet.text.empty()) {
+        return {};
+    }
+    if (snippet.text.size() > MAX_TLDR_BYTES) {
+        size_t cut = snippet.text.rfind('\n', MAX_TLDR_BYTES);
+        snippet.text.resize(cut == std::string::npos ? MAX_TLDR_BYTES : cut);
+    }
+    while (!snippet.text.empty() && snippet.text.back() == '\n') {
+        snippet.text.pop_back();
+    }
+    return {std::move(snippet)};
+}
+
+// man页面文件名形如 tar.1.gz 或 CA.pl.1ssl.gz，来源显示为 tar(1)
+bool man_source(const std::filesystem::path& path, std::string& source, std::string& name) {
+    std::string file = path.filename().string();
+    if (file.size() > 3 && file.compare(file.size() - 3, 3, ".gz") == 0) {
+        file.resize(file.size() - 3);
+    } else if (file.find(".bz2") != std::string::npos || file.find(".xz") != std::string::npos ||
+               file.find(".zst") != std::string::npos || file.find(".lzma") != std::string::npos) {
+        return false;
+    }
+    size_t dot = file.rfind('.');
+    if (dot == std::string::npos || dot == 0 || dot + 1 >= file.size() || file[dot + 1] < '0' ||
+        file[dot + 1] > '9') {
+        return false;
+    }
+    name = file.substr(0, dot);
+    source = name + "(" + file.substr(dot + 1) + ")";
+    return true;
+}
+
+void collect_man(const std::filesystem::path& dir, std::vector<Page>& pages) {
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("man", 0) != 0 || !entry.is_directory(ec)) {
+            continue;
+        }
+        for (const auto& file : std::filesystem::directory_iterator(entry.path(), ec)) {
+            if (file.is_regular_file(ec)) {
+                pages.push_back(Page{file.path(), false});
+            }
+        }
+    }
+}
+
+// tldr客户端的缓存中找出pages与当前语言的pages.<lang>下common与linux平台的页面
+void collect_tldr(const std::filesystem::path& dir, const std::string& lang, std::vector<Page>& pages) {
+    std::error_code ec;
+    auto options = std::filesystem::directory_options::skip_permission_denied;
+    for (auto it = std::filesystem::recursive_directory_iterator(dir, options, ec);
+         it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+        if (ec) {
+            break;
+        }
+        const std::filesystem::path& path = it->path();
+        if (path.extension() != ".md" || !it->is_regular_file(ec)) {
+            continue;
+        }
+        std::string platform = path.parent_path().filename().string();
+        std::string root = path.parent_path().parent_path().filename().string();
+        bool wanted_root = root == "pages" || (!lang.empty() && (root == "pages." + lang ||
+                                                                 root == "pages." + lang.substr(0, 2)));
+        if (wanted_root && (platform == "common" || platform == "linux")) {
+            pages.push_back(Page{path, true});
+        }
+    }
+}
+
+bool write_file(const std::filesystem::path& path, const std::string& data, std::string& error) {
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = "Cannot create " + path.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t n = ::write(fd, data.data() + offset, data.size() - offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            error = "Failed to write " + path.string() + ": " + std::strerror(errno);
+            ::close(fd);
+            return false;
+        }
+        offset += static_cast<size_t>(n);
+    }
+    return ::close(fd) == 0;
+}
+
+// 每个线程的构建结果
+struct Worker {
+    text_index::SegmentBuilder builder;
+    std::string store;
+    size_t files = 0;
+    size_t skipped = 0;
+    size_t bytes = 0;
+};
+
+void index_page(const Page& page, Worker& worker, std::string& content, std::string& indexed) {
+    std::vector<Snippet> snippets;
+    std::string source;
+    std::string name;
+    if (!read_page(page.path, content)) {
+        ++worker.skipped;
+        return;
+    }
+    if (page.tldr) {
+        snippets = parse_tldr(content);
+    } else if (man_source(page.path, source, name)) {
+        snippets = ManParser(source, name).parse(content);
+    }
+    if (snippets.empty()) {
+        ++worker.skipped;
+        return;
+    }
+    ++worker.files;
+
+    for (const Snippet& snippet : snippets) {
+        StoreRecord record{static_cast<uint32_t>(snippet.source.size()), static_cast<uint32_t>(snippet.section.size()),
+                           static_cast<uint32_t>(snippet.text.size())};
+        uint64_t ref = worker.store.size();
+        worker.store.append(reinterpret_cast<const char*>(&record), sizeof(record));
+        worker.store += snippet.source;
+        worker.store += snippet.section;
+        worker.store += snippet.text;
+
+        // 来源与小节标题也参与检索；命令名重复几次，问题里提到命令名时优先命中该命令的页面
+        indexed.clear();
+        for (int i = 0; i < NAME_WEIGHT; ++i) {
+            indexed += snippet.source;
+            indexed.push_back(' ');
+        }
+        indexed += snippet.section;
+        indexed.push_back(' ');
+        indexed += snippet.text;
+        worker.builder.add(ref, indexed);
+        worker.bytes += snippet.text.size();
+    }
+}
+
+} // namespace
+
+std::vector<std::filesystem::path> default_man_dirs() {
+    std::vector<std::filesystem::path> dirs;
+    const std::vector<std::filesystem::path> defaults = {"/usr/share/man", "/usr/local/share/man", "/usr/local/man"};
+    const char* manpath = std::getenv("MANPATH");
+    std::string value = manpath != nullptr ? manpath : "";
+    if (value.empty()) {
+        dirs = defaults;
+    } else {
+        // 空的条目（例如开头或结尾的冒号）表示系统默认目录
+        size_t pos = 0;
+        while (pos <= value.size()) {
+            size_t end = value.find(':', pos);
+            end = end == std::string::npos ? value.size() : end;
+            if (end == pos) {
+                dirs.insert(dirs.end(), defaults.begin(), defaults.end());
+            } else {
+                dirs.emplace_back(value.substr(pos, end - pos));
+            }
+            pos = end + 1;
+        }
+    }
+
+    // 当前语言的翻译页面，例如 /usr/share/man/zh_CN
+    std::string lang = language();
+    std::vector<std::filesystem::path> localized;
+    std::error_code ec;
+    for (const auto& dir : dirs) {
+        for (const std::string& variant : {lang, lang.substr(0, 2)}) {
+            if (!variant.empty() && std::filesystem::is_directory(dir / variant, ec)) {
+                localized.push_back(dir / variant);
+            }
+            if (lang.size() <= 2) {
+                break;
+            }
+        }
+    }
+    dirs.insert(dirs.end(), localized.begin(), localized.end());
+    return dirs;
+}
+
+std::vector<std::filesystem::path> default_tldr_dirs() {
+    std::vector<std::filesystem::path> dirs;
+    const char* home = std::getenv("HOME");
+    const char* xdg = std::getenv("XDG_CACHE_HOME");
+    std::filesystem::path cache = xdg != nullptr && *xdg != '\0' ? std::filesystem::path(xdg)
+                                  : home != nullptr ? std::filesystem::path(home) / ".cache"
+                                                    : std::filesystem::path();
+    if (const char* custom = std::getenv("TLDR_CACHE_DIR")) {
+        dirs.emplace_back(custom);
+    }
+    if (!cache.empty()) {
+        dirs.push_back(cache / "tealdeer");
+        dirs.push_back(cache / "tldr");
+    }
+    if (home != nullptr) {
+        dirs.push_back(std::filesystem::path(home) / ".tldr");
+        dirs.push_back(std::filesystem::path(home) / ".tldrc");
+        dirs.push_back(std::filesystem::path(home) / ".local/share/tldr");
+    }
+    dirs.emplace_back("/usr/share/tldr");
+    dirs.emplace_back("/usr/local/share/tldr");
+    return dirs;
+}
+
+bool build(const std::filesystem::path& dir, const std::vector<std::filesystem::path>& man_dirs,
+           const std::vector<std::filesystem::path>& tldr_dirs, unsigned threads, BuildStats& stats,
+           std::string& error) {
+    auto start = std::chrono::steady_clock::now();
+    stats = BuildStats();
+
+    // 先列出全部页面，同一文件经由不同路径（符号链接、重复的MANPATH条目）只解析一次
+    std::vector<Page> candidates;
+    std::error_code ec;
+    for (const auto& man_dir : man_dirs) {
+        collect_man(man_dir, candidates);
+    }
+    std::string lang = language();
+    for (const auto& tldr_dir : tldr_dirs) {
+        if (std::filesystem::is_directory(tldr_dir, ec)) {
+            collect_tldr(tldr_dir, lang, candidates);
+        }
+    }
+    std::vector<Page> pages;
+    std::set<std::filesystem::path> seen;
+    for (Page& page : candidates) {
+        std::filesystem::path canonical = std::filesystem::canonical(page.path, ec);
+        if (!ec && seen.insert(canonical).second) {
+            pages.push_back(std::move(page));
+        }
+    }
+    if (pages.empty()) {
+        error = "No man or tldr pages found";
+        return false;
+    }
+
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    threads = static_cast<unsigned>(std::min<size_t>(threads, pages.size()));
+    stats.threads = threads;
+
+    // 各线程从共享的计数器领取页面，分别构建自己的段与内容文件，互不加锁
+    std::vector<Worker> workers(threads);
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> pool;
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t]() {
+            std::string content;
+            std::string indexed;
+            for (size_t i = next++; i < pages.size(); i = next++) {
+                index_page(pages[i], workers[t], content, indexed);
+            }
+        });
+    }
+    for (auto& thread : pool) {
+        thread.join();
+    }
+
+    // 写入临时目录后整体替换，查询方要么看到旧索引，要么看到完整的新索引
+    std::filesystem::path temp = dir;
+    temp += ".tmp-" + std::to_string(getpid());
+    std::filesystem::remove_all(temp, ec);
+    std::filesystem::create_directories(temp, ec);
+    if (ec) {
+        error = "Cannot create " + temp.string() + ": " + ec.message();
+        return false;
+    }
+    for (unsigned t = 0; t < threads; ++t) {
+        Worker& worker = workers[t];
+        stats.files += worker.files;
+        stats.skipped += worker.skipped;
+        stats.snippets += worker.builder.doc_count();
+        stats.bytes += worker.bytes;
+        if (worker.builder.doc_count() == 0) {
+            continue;
+        }
+        if (!write_file(temp / ("store-" + std::to_string(t)), worker.store, error) ||
+            !worker.builder.write(temp / ("seg-" + std::to_string(t) + ".lcix"), error)) {
+            std::filesystem::remove_all(temp, ec);
+            return false;
+        }
+    }
+
+    std::filesystem::path old = dir;
+    old += ".old-" + std::to_string(getpid());
+    bool had_index = std::filesystem::exists(dir, ec);
+    if (had_index && std::rename(dir.c_str(), old.c_str()) != 0) {
+        error = "Cannot replace " + dir.string() + ": " + std::strerror(errno);
+        std::filesystem::remove_all(temp, ec);
+        return false;
+    }
+    if (std::rename(temp.c_str(), dir.c_str()) != 0) {
+        error = "Cannot rename " + temp.string() + ": " + std::strerror(errno);
+        std::filesystem::remove_all(temp, ec);
+        return false;
+    }
+    if (had_index) {
+        std::filesystem::remove_all(old, ec);
+    }
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+Index::Part::~Part() {
+    if (store != nullptr) {
+        munmap(store, store_size);
+    }
+}
+
+bool Index::open(const std::filesystem::path& dir, std::string& error) {
+    parts_.clear();
+    std::error_code ec;
+    std::vector<std::string> names;
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.rfind("seg-", 0) == 0 && entry.path().extension() == ".lcix") {
+            names.push_back(name.substr(4, name.size() - 4 - 5));
+        }
+    }
+    if (ec || names.empty()) {
+        error = "No local documentation index in " + dir.string() + " (run lc --build-index)";
+        return false;
+    }
+    std::sort(names.begin(), names.end());
+
+    for (const std::string& id : names) {
+        auto part = std::make_unique<Part>();
+        if (!part->segment.open(dir / ("seg-" + id + ".lcix"), error)) {
+            parts_.clear();
+            return false;
+        }
+        std::filesystem::path store = dir / ("store-" + id);
+        int fd = ::open(store.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+            error = "Cannot open " + store.string();
+            if (fd >= 0) {
+                ::close(fd);
+            }
+            parts_.clear();
+            return false;
+        }
+        part->store_size = static_cast<size_t>(st.st_size);
+        void* data = mmap(nullptr, part->store_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            error = "Cannot map " + store.string() + ": " + std::strerror(errno);
+            parts_.clear();
+            return false;
+        }
+        part->store = data;
+        parts_.push_back(std::move(part));
+    }
+    return true;
+}
+
+std::vector<Match> Index::search(std::string_view query, size_t limit) const {
+    std::vector<const text_index::Segment*> segments;
+    segments.reserve(parts_.size());
+    for (const auto& part : parts_) {
+        segments.push_back(&part->segment);
+    }
+
+    std::vector<Match> matches;
+    for (const text_index::Hit& hit : text_index::search(segments, query, limit)) {
+        if (!matches.empty() && hit.score < matches.front().score / 2) {
+            break;
+        }
+        const Part& part = *parts_[hit.segment];
+        uint64_t ref = part.segment.doc(hit.doc).ref;
+        const char* store = static_cast<const char*>(part.store);
+        if (ref + sizeof(StoreRecord) > part.store_size) {
+            continue;
+        }
+        StoreRecord record;
+        std::memcpy(&record, store + ref, sizeof(record));
+        uint64_t end = ref + sizeof(record) + uint64_t(record.source_length) + record.section_length + record.text_length;
+        if (end > part.store_size) {
+            continue;
+        }
+        const char* p = store + ref + sizeof(record);
+        Match match;
+        match.score = hit.score;
+        match.source.assign(p, record.source_length);
+        match.section.assign(p + record.source_length, record.section_length);
+        match.text.assign(p + record.source_length + record.section_length, record.text_length);
+        matches.push_back(std::move(match));
+    }
+    return matches;
+}
+
+std::string grounding(const std::vector<Match>& matches, size_t max_bytes) {
+    if (matches.empty()) {
+        return "";
+    }
+    std::string text =
+        "Excerpts from the local documentation (man and tldr pages) installed on this system. "
+        "Prefer the commands and options shown here and do not suggest options they do not document.\n";
+    size_t header = text.size();
+    for (const Match& match : matches) {
+        // 结果按得分排序：得分不够时与问题关系不大，最高分也不够时不加入参考资料
+        if (match.score < GROUNDING_MIN_SCORE) {
+            break;
+        }
+        std::string entry = "\n[" + match.source + (match.section.empty() ? "" : " " + match.section) + "]\n" +
+                            match.text + "\n";
+        if (text.size() + entry.size() > max_bytes) {
+            break;
+        }
+        text += entry;
+    }
+    return text.size() > header ? text : "";
+}
+
+} // namespace docs
+} // namespace lc
@@ -0,0 +1,392 @@
+#include "../include/fanout.h"
+#include "../include/async_client.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+
+namespace lc {
+namespace fanout {
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double elapsed_ms(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+// 按显示宽度切分一行（CJK等宽字符按2列计），不拆开UTF-8字符
+std::vector<std::string> wrap_line(const std::string& line, size_t width) {
+    std::vector<std::string> rows;
+    std::string row;
+    size_t columns = 0;
+
+    for (size_t i = 0; i < line.size();) {
+        unsigned char c = static_cast<unsigned char>(line[i]);
+        size_t len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : 4;
+        len = std::min(len, line.size() - i);
+        size_t cells = len >= 3 ? 2 : 1;
+
+        if (columns + cells > width) {
+            rows.push_back(row);
+            row.clear();
+            columns = 0;
+        }
+        row.append(line, i, len);
+        columns += cells;
+        i += len;
+    }
+
+    rows.push_back(row);
+    return rows;
+}
+
+size_t display_width(const std::string& text) {
+    size_t columns = 0;
+    for (size_t i = 0; i < text.size();) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        size_t len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : 4;
+        columns += len >= 3 ? 2 : 1;
+        i += len;
+    }
+    return columns;
+}
+
+std::vector<std::string> wrap_text(const std::string& text, size_t width) {
+    std::vector<std::string> rows;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t end = text.find('\n', start);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        auto wrapped = wrap_line(text.substr(start, end - start), width);
+        rows.insert(rows.end(), wrapped.begin(), wrapped.end());
+        start = end + 1;
+    }
+    return rows;
+}
+
+} // namespace
+
+std::vector<StreamReport> compare(
+    const Config& config,
+    const std::vector<openai::Message>& messages,
+    const std::vector<std::string>& models,
+    bool debug,
+    const openai::StreamOptions& options,
+    const DeltaHandler& on_delta
+) {
+    std::vector<StreamReport> reports(models.size());
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t remaining = models.size();
+
+    openai::AsyncEngine engine;
+    auto start = Clock::now();
+
+    for (size_t i = 0; i < models.size(); ++i) {
+        reports[i].model = models[i];
+
+        engine.submit(config, messages,
+            [&, i](const std::string& delta, bool is_done) {
+                if (is_done || delta.empty()) {
+                    return;
+                }
+                if (reports[i].ttft_ms < 0) {
+                    reports[i].ttft_ms = elapsed_ms(start);
+                }
+                on_delta(i, delta);
+            },
+            models[i], debug, options,
+            [&, i](const openai::ChatCompletionResult& result) {
+                std::lock_guard<std::mutex> lock(mutex);
+                reports[i].result = result;
+                reports[i].total_ms = elapsed_ms(start);
+                if (--remaining == 0) {
+                    done.notify_all();
+                }
+            });
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&remaining]() { return remaining == 0; });
+    return reports;
+}
+
+RaceOutcome race(
+    const Config& config,
+    const std::vector<openai::Message>& messages,
+    const std::vector<std::string>& models,
+    bool debug,
+    const openai::StreamOptions& options,
+    const openai::StreamCallback& callback
+) {
+    RaceOutcome outcome;
+    outcome.reports.resize(models.size());
+
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t remaining = models.size();
+    std::vector<openai::AsyncEngine::RequestId> ids(models.size(), 0);
+
+    // 竞速总是由自己的事件循环驱动，录制只适用于单个请求
+    openai::StreamOptions race_options = options;
+    race_options.engine = nullptr;
+    race_options.recorder = nullptr;
+
+    openai::AsyncEngine engine;
+    auto start = Clock::now();
+
+    for (size_t i = 0; i < models.size(); ++i) {
+        outcome.reports[i].model = models[i];
+
+        auto id = engine.submit(config, messages,
+            [&, i](const std::string& delta, bool is_done) {
+                if (is_done || delta.empty()) {
+                    return;
+                }
+
+                std::vector<openai::AsyncEngine::RequestId> losers;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (outcome.winner < 0) {
+                        outcome.winner = static_cast<int>(i);
+                        outcome.reports[i].ttft_ms = elapsed_ms(start);
+                        for (size_t j = 0; j < ids.size(); ++j) {
+                            if (j != i && ids[j] != 0) {
+                                losers.push_back(ids[j]);
+                            }
+                        }
+                    } else if (outcome.winner != static_cast<int>(i)) {
+                        // 取消生效前落败者可能还会送来增量
+                        return;
+                    }
+                }
+
+                for (auto loser : losers) {
+                    engine.cancel(loser, "lost race");
+                }
+                callback(delta, false);
+            },
+            models[i], debug, race_options,
+            [&, i](const openai::ChatCompletionResult& result) {
+                std::lock_guard<std::mutex> lock(mutex);
+                outcome.reports[i].result = result;
+                outcome.reports[i].total_ms = elapsed_ms(start);
+                if (--remaining == 0) {
+                    done.notify_all();
+                }
+            });
+
+        // 提交期间已经决出胜者时，后提交的请求直接取消
+        bool lost;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            ids[i] = id;
+            lost = outcome.winner >= 0 && outcome.winner != static_cast<int>(i);
+        }
+        if (lost) {
+            engine.cancel(id, "lost race");
+        }
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&remaining]() { return remaining == 0; });
+    }
+
+    if (outcome.winner >= 0) {
+        outcome.result = outcome.reports[outcome.winner].result;
+    } else if (openai::cancel_requested()) {
+        outcome.result.success = true;
+        outcome.result.stopped_early = true;
+        outcome.result.stop_reason = "interrupted";
+    } else {
+        outcome.result.success = false;
+        outcome.result.error_message = "No model produced output";
+        for (const auto& report : outcome.reports) {
+            std::string reason = report.result.success ? "empty response" : report.result.error_message;
+            outcome.result.error_message += "; " + report.model + ": " + reason;
+        }
+    }
+
+    callback("", true);
+    return outcome;
+}
+
+bool record_race(const std::filesystem::path& path, const RaceOutcome& outcome) {
+    std::error_code ec;
+    std::filesystem::create_directories(path.parent_path(), ec);
+
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    if (flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        return false;
+    }
+
+    std::string content;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        content.append(buffer, static_cast<size_t>(n));
+    }
+
+    nlohmann::json stats = nlohmann::json::parse(content, nullptr, false);
+    if (!stats.is_object()) {
+        stats = nlohmann::json::object();
+    }
+
+    for (size_t i = 0; i < outcome.reports.size(); ++i) {
+        auto& entry = stats[outcome.reports[i].model];
+        if (!entry.is_object()) {
+            entry = nlohmann::json::object();
+        }
+        entry["races"] = entry.value("races", 0) + 1;
+        if (static_cast<int>(i) == outcome.winner) {
+            entry["wins"] = entry.value("wins", 0) + 1;
+            entry["win_ttft_ms_total"] = entry.value("win_ttft_ms_total", 0.0) + outcome.reports[i].ttft_ms;
+        }
+    }
+
+    std::string data = stats.dump(2);
+    bool ok = ftruncate(fd, 0) == 0 && pwrite(fd, data.data(), data.size(), 0) == static_cast<ssize_t>(data.size());
+    flock(fd, LOCK_UN);
+    close(fd);
+    return ok;
+}
+
+void show_race_stats(const std::filesystem::path& path, std::ostream& out) {
+    std::ifstream file(path);
+    nlohmann::json stats = file.is_open() ? nlohmann::json::parse(file, nullptr, false) : nlohmann::json();
+    if (!stats.is_object() || stats.empty()) {
+        out << "No race statistics found." << std::endl;
+        return;
+    }
+
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-32s %10s %6s %14s\n", "MODEL", "WINS/RACES", "WIN%", "AVG TTFT ms");
+    out << line;
+    for (const auto& item : stats.items()) {
+        if (!item.value().is_object()) {
+            continue;
+        }
+        int races = item.value().value("races", 0);
+        int wins = item.value().value("wins", 0);
+        double ttft = wins > 0 ? item.value().value("win_ttft_ms_total", 0.0) / wins : 0.0;
+        std::string counts = std::to_string(wins) + "/" + std::to_string(races);
+        std::snprintf(line, sizeof(line), "%-32s %10s %5.1f%% %14.0f\n", item.key().c_str(), counts.c_str(),
+                      races > 0 ? 100.0 * wins / races : 0.0, ttft);
+        out << line;
+    }
+}
+
+InterleavedPrinter::InterleavedPrinter(const std::vector<std::string>& models, std::ostream& out)
+    : pending_(models.size()), out_(out) {
+    size_t width = 0;
+    for (const auto& model : models) {
+        width = std::max(width, model.size());
+    }
+    for (const auto& model : models) {
+        labels_.push_back("[" + model + "]" + std::string(width - model.size() + 1, ' '));
+    }
+}
+
+void InterleavedPrinter::write(size_t index, const std::string& delta) {
+    std::string& pending = pending_[index];
+    pending += delta;
+
+    size_t start = 0;
+    size_t newline;
+    while ((newline = pending.find('\n', start)) != std::string::npos) {
+        out_ << labels_[index] << pending.substr(start, newline - start) << '\n';
+        start = newline + 1;
+    }
+    pending.erase(0, start);
+    out_ << std::flush;
+}
+
+void InterleavedPrinter::flush() {
+    for (size_t i = 0; i < pending_.size(); ++i) {
+        if (!pending_[i].empty()) {
+            out_ << labels_[i] << pending_[i] << '\n';
+            pending_[i].clear();
+        }
+    }
+    out_ << std::flush;
+}
+
+void print_columns(const std::vector<StreamReport>& reports, std::ostream& out, size_t width) {
+    if (reports.empty()) {
+        return;
+    }
+
+    const std::string separator = " │ ";
+    size_t gaps = (reports.size() - 1) * 3;
+    size_t column = width > gaps ? (width - gaps) / reports.size() : 20;
+    column = std::max<size_t>(column, 10);
+
+    std::vector<std::vector<std::string>> rows;
+    size_t height = 0;
+    for (const auto& report : reports) {
+        std::string text = report.result.success || !report.result.full_response.empty()
+            ? report.result.full_response : "(error: " + report.result.error_message + ")";
+        rows.push_back(wrap_text(text, column));
+        height = std::max(height, rows.back().size());
+    }
+
+    auto pad = [column](const std::string& cell) {
+        size_t cell_width = display_width(cell);
+        return cell + std::string(cell_width < column ? column - cell_width : 0, ' ');
+    };
+
+    for (size_t r = 0; r < reports.size(); ++r) {
+        out << (r > 0 ? separator : "") << pad(wrap_line(reports[r].model, column).front());
+    }
+    out << '\n';
+    std::string rule;
+    for (size_t i = 0; i < column; ++i) {
+        rule += "─";
+    }
+    for (size_t r = 0; r < reports.size(); ++r) {
+        out << (r > 0 ? "─┼─" : "") << rule;
+    }
+    out << '\n';
+
+    for (size_t line = 0; line < height; ++line) {
+        std::string row;
+        for (size_t r = 0; r < reports.size(); ++r) {
+            row += (r > 0 ? separator : "") + pad(line < rows[r].size() ? rows[r][line] : "");
+        }
+        // 去掉行尾多余的空格
+        row.erase(row.find_last_not_of(' ') + 1);
+        out << row << '\n';
+    }
+    out << std::flush;
+}
+
+void print_timing(const std::vector<StreamReport>& reports, std::ostream& out) {
+    char line[256];
+    for (const auto& report : reports) {
+        std::string status = !report.result.success ? "error: " + report.result.error_message
+            : report.result.stopped_early ? "stopped: " + report.result.stop_reason : "ok";
+        std::string ttft = report.ttft_ms < 0 ? "-" : std::to_string(static_cast<long>(report.ttft_ms)) + " ms";
+        std::snprintf(line, sizeof(line), "%s: first token %s, total %.0f ms, %zu bytes, ",
+                      report.model.c_str(), ttft.c_str(), report.total_ms, report.result.full_response.size());
+        out << line << status << std::endl;
+    }
+}
+
+} // namespace fanout
+} // namespace lc
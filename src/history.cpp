@@ -0,0 +1,393 @@
+#include "../include/history.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <memory>
+
+#include "../include/text_index.h"
+
+namespace lc {
+namespace history {
+
+namespace {
+
+// 同一层的段攒到这么多个时合并为一个，段数随消息总数对数增长
+constexpr size_t MERGE_FACTOR = 4;
+// 达到这一层（约4000条消息）的段不再合并，避免某次保存时重写整个索引
+constexpr size_t MAX_MERGE_TIER = 6;
+
+// 保留最近这么多次保存的消息窗口，容纳其他进程基于较早的记忆文件保存
+constexpr size_t RECENT_WINDOWS = 8;
+
+// 摘要的字节数
+constexpr size_t SNIPPET_BYTES = 160;
+
+struct Record {
+    uint32_t length;
+    uint8_t role;
+    uint8_t reserved[3];
+    int64_t time;
+};
+static_assert(sizeof(Record) == 16, "archive record header must stay 16 bytes");
+
+struct Manifest {
+    uint64_t next = 0;  // 下一个段文件的编号
+    std::vector<std::string> segments;
+};
+
+// 持有目录锁文件的flock，析构时释放
+class DirLock {
+public:
+    DirLock(const std::filesystem::path& dir, int operation) {
+        fd_ = open((dir / "lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        locked_ = fd_ >= 0 && flock(fd_, operation) == 0;
+    }
+    ~DirLock() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+    bool locked() const { return locked_; }
+
+private:
+    int fd_ = -1;
+    bool locked_ = false;
+};
+
+uint64_t message_hash(const openai::Message& message) {
+    uint64_t hash = text_index::term_hash(message.content());
+    return hash ^ (static_cast<uint64_t>(message.role) + 1) * 0x9E3779B97F4A7C15ULL;
+}
+
+bool write_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+// windows文件：每个窗口为消息数加上各消息的哈希，按保存顺序排列
+std::vector<std::vector<uint64_t>> read_windows(const std::filesystem::path& dir) {
+    std::vector<std::vector<uint64_t>> windows;
+    std::ifstream file(dir / "windows", std::ios::binary);
+    uint64_t count;
+    while (file.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+        std::vector<uint64_t> window(static_cast<size_t>(count));
+        if (!file.read(reinterpret_cast<char*>(window.data()), static_cast<std::streamsize>(count * sizeof(uint64_t)))) {
+            break;
+        }
+        windows.push_back(std::move(window));
+    }
+    return windows;
+}
+
+bool write_windows(const std::filesystem::path& dir, const std::vector<std::vector<uint64_t>>& windows,
+                   std::string& error) {
+    std::filesystem::path path = dir / "windows";
+    std::filesystem::path temp = dir / "windows.tmp";
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+        for (const std::vector<uint64_t>& window : windows) {
+            uint64_t count = window.size();
+            file.write(reinterpret_cast<const char*>(&count), sizeof(count));
+            file.write(reinterpret_cast<const char*>(window.data()),
+                       static_cast<std::streamsize>(window.size() * sizeof(uint64_t)));
+        }
+        if (!file.good()) {
+            error = "Failed to write " + temp.string();
+            return false;
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        error = "Cannot rename " + temp.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+// 新窗口开头有多少条消息与某个旧窗口的结尾相同：这些是上次保存过、随窗口滑动保留下来的消息
+size_t saved_prefix(const std::vector<std::vector<uint64_t>>& windows, const std::vector<uint64_t>& current) {
+    size_t best = 0;
+    for (const std::vector<uint64_t>& window : windows) {
+        for (size_t length = std::min(window.size(), current.size()); length > best; --length) {
+            if (std::equal(current.begin(), current.begin() + static_cast<std::ptrdiff_t>(length),
+                           window.end() - static_cast<std::ptrdiff_t>(length))) {
+                best = length;
+                break;
+            }
+        }
+    }
+    return best;
+}
+
+bool read_manifest(const std::filesystem::path& dir, Manifest& manifest) {
+    std::ifstream file(dir / "manifest");
+    if (!file.is_open()) {
+        return false;
+    }
+    std::string word;
+    if (!(file >> word) || word != "next" || !(file >> manifest.next)) {
+        return false;
+    }
+    while (file >> word) {
+        manifest.segments.push_back(word);
+    }
+    return true;
+}
+
+bool write_manifest(const std::filesystem::path& dir, const Manifest& manifest, std::string& error) {
+    std::filesystem::path path = dir / "manifest";
+    std::filesystem::path temp = dir / "manifest.tmp";
+    {
+        std::ofstream file(temp, std::ios::trunc);
+        file << "next " << manifest.next << "\n";
+        for (const std::string& segment : manifest.segments) {
+            file << segment << "\n";
+        }
+        if (!file.good()) {
+            error = "Failed to write " + temp.string();
+            return false;
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        error = "Cannot rename " + temp.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+size_t tier(uint32_t doc_count) {
+    size_t level = 0;
+    while (doc_count >= MERGE_FACTOR) {
+        doc_count /= MERGE_FACTOR;
+        ++level;
+    }
+    return level;
+}
+
+// 末尾MERGE_FACTOR个段处于同一层时合并，合并结果可能与前面的段再次构成一组
+bool compact(const std::filesystem::path& dir, Manifest& manifest, std::string& error) {
+    while (manifest.segments.size() >= MERGE_FACTOR) {
+        size_t first = manifest.segments.size() - MERGE_FACTOR;
+        std::vector<std::unique_ptr<text_index::Segment>> segments;
+        for (size_t i = first; i < manifest.segments.size(); ++i) {
+            segments.push_back(std::make_unique<text_index::Segment>());
+            if (!segments.back()->open(dir / manifest.segments[i], error)) {
+                return false;
+            }
+        }
+        size_t level = tier(segments.front()->doc_count());
+        if (level >= MAX_MERGE_TIER) {
+            return true;
+        }
+        for (const auto& segment : segments) {
+            if (tier(segment->doc_count()) != level) {
+                return true;
+            }
+        }
+
+        text_index::SegmentBuilder builder;
+        for (const auto& segment : segments) {
+            builder.add_segment(*segment);
+        }
+        std::string name = "seg-" + std::to_string(manifest.next++) + ".lcix";
+        if (!builder.write(dir / name, error)) {
+            return false;
+        }
+
+        std::vector<std::string> merged(manifest.segments.begin() + first, manifest.segments.end());
+        manifest.segments.resize(first);
+        manifest.segments.push_back(name);
+        if (!write_manifest(dir, manifest, error)) {
+            return false;
+        }
+        // 已打开这些段的读取方仍持有映射，删除文件不影响正在进行的查询
+        for (const std::string& old : merged) {
+            unlink((dir / old).c_str());
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+std::filesystem::path index_dir(const std::filesystem::path& memory_path) {
+    return memory_path.parent_path() / "history";
+}
+
+bool has_index(const std::filesystem::path& dir) {
+    std::error_code ec;
+    return std::filesystem::exists(dir / "manifest", ec);
+}
+
+bool index_messages(const std::filesystem::path& dir, const std::vector<openai::Message>& messages,
+                    std::string& error) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    DirLock lock(dir, LOCK_EX);
+    if (!lock.locked()) {
+        error = "Cannot lock " + (dir / "lock").string() + ": " + std::strerror(errno);
+        return false;
+    }
+
+    // 记忆文件每次保存整个窗口：只有开头与之前某次保存的窗口结尾重合的部分已经归档，
+    // 其余消息即使内容与更早的消息相同（如再次说"谢谢"）也是新的一轮，需要归档
+    std::vector<const openai::Message*> window;
+    std::vector<uint64_t> hashes;
+    for (const openai::Message& message : messages) {
+        if (message.role == openai::Role::System || message.content().empty()) {
+            continue;
+        }
+        window.push_back(&message);
+        hashes.push_back(message_hash(message));
+    }
+    std::vector<std::vector<uint64_t>> windows = read_windows(dir);
+    size_t saved = saved_prefix(windows, hashes);
+    std::vector<const openai::Message*> pending(window.begin() + static_cast<std::ptrdiff_t>(saved), window.end());
+    windows.push_back(hashes);
+    if (windows.size() > RECENT_WINDOWS) {
+        windows.erase(windows.begin(), windows.end() - RECENT_WINDOWS);
+    }
+    if (pending.empty()) {
+        return hashes.empty() || write_windows(dir, windows, error);
+    }
+
+    std::filesystem::path archive_path = dir / "archive";
+    int archive_fd = open(archive_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    if (archive_fd < 0) {
+        error = "Cannot open " + archive_path.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    off_t offset = lseek(archive_fd, 0, SEEK_END);
+
+    text_index::SegmentBuilder builder;
+    int64_t now = static_cast<int64_t>(std::time(nullptr));
+    bool ok = offset >= 0;
+    for (const openai::Message* message : pending) {
+        if (!ok) {
+            break;
+        }
+        std::string_view content = message->content();
+        Record record{};
+        record.length = static_cast<uint32_t>(content.size());
+        record.role = static_cast<uint8_t>(message->role);
+        record.time = now;
+        ok = write_all(archive_fd, &record, sizeof(record)) && write_all(archive_fd, content.data(), content.size());
+        builder.add(static_cast<uint64_t>(offset), content);
+        offset += static_cast<off_t>(sizeof(record) + content.size());
+    }
+    close(archive_fd);
+    if (!ok) {
+        error = "Failed to write " + archive_path.string() + ": " + std::strerror(errno);
+        return false;
+    }
+
+    // 先让新段生效再记录窗口：中途失败最多在下次保存时重复归档，而不会漏掉消息
+    Manifest manifest;
+    read_manifest(dir, manifest);
+    std::string name = "seg-" + std::to_string(manifest.next++) + ".lcix";
+    ok = builder.write(dir / name, error);
+    if (ok) {
+        manifest.segments.push_back(name);
+        ok = write_manifest(dir, manifest, error) && compact(dir, manifest, error);
+    }
+    return ok && write_windows(dir, windows, error);
+}
+
+bool search(const std::filesystem::path& dir, std::string_view query, size_t page, size_t page_size, Page& out,
+            std::string& error) {
+    out = Page();
+    if (!has_index(dir) || page == 0 || page_size == 0) {
+        return true;
+    }
+
+    // 只在打开段时持有共享锁：映射建立后合并删除旧文件也不影响本次查询
+    std::vector<std::unique_ptr<text_index::Segment>> segments;
+    {
+        DirLock lock(dir, LOCK_SH);
+        Manifest manifest;
+        if (!lock.locked() || !read_manifest(dir, manifest)) {
+            error = "Cannot read history index in " + dir.string();
+            return false;
+        }
+        for (const std::string& name : manifest.segments) {
+            segments.push_back(std::make_unique<text_index::Segment>());
+            if (!segments.back()->open(dir / name, error)) {
+                return false;
+            }
+        }
+    }
+    std::vector<const text_index::Segment*> view;
+    for (const auto& segment : segments) {
+        view.push_back(segment.get());
+    }
+
+    std::vector<text_index::Hit> hits = text_index::search(view, query, page * page_size, &out.total);
+    size_t first = (page - 1) * page_size;
+    if (first >= hits.size()) {
+        return true;
+    }
+
+    std::filesystem::path archive_path = dir / "archive";
+    int fd = open(archive_path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        error = "Cannot open " + archive_path.string() + ": " + std::strerror(errno);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        error = "Cannot map " + archive_path.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    const char* archive = static_cast<const char*>(data);
+
+    for (size_t i = first; i < hits.size(); ++i) {
+        uint64_t ref = view[hits[i].segment]->doc(hits[i].doc).ref;
+        if (ref + sizeof(Record) > size) {
+            continue;
+        }
+        Record record;
+        std::memcpy(&record, archive + ref, sizeof(record));
+        if (ref + sizeof(Record) + record.length > size) {
+            continue;
+        }
+        std::string_view content(archive + ref + sizeof(Record), record.length);
+
+        Result result;
+        result.score = hits[i].score;
+        result.time = record.time;
+        result.role = static_cast<openai::Role>(record.role);
+        result.bytes = record.length;
+        result.snippet = text_index::snippet(content, query, SNIPPET_BYTES);
+        out.results.push_back(std::move(result));
+    }
+    munmap(data, size);
+    return true;
+}
+
+} // namespace history
+} // namespace lc
@@ -0,0 +1,260 @@
+#include "../include/latency.h"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <nlohmann/json.hpp>
+
+namespace lc {
+namespace latency {
+
+namespace {
+
+// 推导超时所需的最少样本数，不足时使用默认值
+constexpr uint64_t MIN_FIRST_TOKEN_SAMPLES = 5;
+constexpr uint64_t MIN_INTER_TOKEN_SAMPLES = 100;
+
+// 超过这些样本数时计数减半，直方图跟随模型与端点近期的表现
+constexpr uint64_t MAX_FIRST_TOKEN_SAMPLES = 500;
+constexpr uint64_t MAX_INTER_TOKEN_SAMPLES = 50000;
+
+// 历史p99的倍数，以及推导结果的上下限
+constexpr double FIRST_TOKEN_FACTOR = 2.0;
+constexpr double INTER_TOKEN_FACTOR = 4.0;
+constexpr Millis MIN_FIRST_TOKEN{5000};
+constexpr Millis MAX_FIRST_TOKEN{600000};
+constexpr Millis MIN_INTER_TOKEN{2000};
+constexpr Millis MAX_INTER_TOKEN{300000};
+
+Millis derive(const Histogram& histogram, uint64_t min_samples, double factor, Millis floor, Millis ceiling,
+              Millis fallback) {
+    if (histogram.count() < min_samples) {
+        return fallback;
+    }
+    Millis derived(static_cast<Millis::rep>(histogram.percentile(99) * factor));
+    return std::clamp(derived, floor, ceiling);
+}
+
+nlohmann::json to_json(const Histogram& histogram) {
+    return nlohmann::json(histogram.counts);
+}
+
+Histogram from_json(const nlohmann::json& node) {
+    Histogram histogram;
+    if (!node.is_array()) {
+        return histogram;
+    }
+    for (size_t i = 0; i < std::min(node.size(), Histogram::BUCKETS); ++i) {
+        if (node[i].is_number_unsigned()) {
+            histogram.counts[i] = node[i].get<uint32_t>();
+        }
+    }
+    return histogram;
+}
+
+void parse_history(const std::string& content, std::map<std::string, Sample>& history) {
+    nlohmann::json data = nlohmann::json::parse(content, nullptr, false);
+    if (!data.is_object()) {
+        return;
+    }
+    for (const auto& item : data.items()) {
+        if (!item.value().is_object()) {
+            continue;
+        }
+        Sample& sample = history[item.key()];
+        sample.first_token = from_json(item.value().value("first_token", nlohmann::json()));
+        sample.inter_token = from_json(item.value().value("inter_token", nlohmann::json()));
+    }
+}
+
+void merge(Sample& into, const Sample& sample) {
+    into.first_token.merge(sample.first_token);
+    into.inter_token.merge(sample.inter_token);
+    if (into.first_token.count() > MAX_FIRST_TOKEN_SAMPLES) {
+        into.first_token.decay();
+    }
+    if (into.inter_token.count() > MAX_INTER_TOKEN_SAMPLES) {
+        into.inter_token.decay();
+    }
+}
+
+} // namespace
+
+Timeouts default_timeouts() {
+    Timeouts timeouts;
+    timeouts.connect = Millis(30000);
+    timeouts.first_token = Millis(120000);
+    timeouts.inter_token = Millis(120000);
+    return timeouts;
+}
+
+Timeouts within_budget(Timeouts timeouts, Millis remaining) {
+    if (remaining <= Millis(0)) {
+        return timeouts;
+    }
+    auto cap = [](Millis value, Millis limit) {
+        limit = std::max(limit, Millis(1));
+        return value == Millis(0) ? limit : std::min(value, limit);
+    };
+    timeouts.connect = cap(timeouts.connect, remaining / 4);
+    timeouts.first_token = cap(timeouts.first_token, remaining / 2);
+    timeouts.inter_token = cap(timeouts.inter_token, remaining / 2);
+    return timeouts;
+}
+
+double Histogram::upper_bound(size_t bucket) {
+    return 10.0 * std::pow(2.0, bucket / 2.0);
+}
+
+void Histogram::add(double ms) {
+    size_t bucket = 0;
+    if (ms > 10.0) {
+        bucket = static_cast<size_t>(std::ceil(2.0 * std::log2(ms / 10.0)));
+    }
+    ++counts[std::min(bucket, BUCKETS - 1)];
+}
+
+void Histogram::merge(const Histogram& other) {
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        counts[i] += other.counts[i];
+    }
+}
+
+double Histogram::percentile(double p) const {
+    uint64_t total = count();
+    if (total == 0) {
+        return 0.0;
+    }
+    uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0 * total));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= std::max<uint64_t>(rank, 1)) {
+            return upper_bound(i);
+        }
+    }
+    return upper_bound(BUCKETS - 1);
+}
+
+uint64_t Histogram::count() const {
+    uint64_t total = 0;
+    for (uint32_t c : counts) {
+        total += c;
+    }
+    return total;
+}
+
+void Histogram::decay() {
+    for (uint32_t& c : counts) {
+        c /= 2;
+    }
+}
+
+std::string key(const std::string& model, const std::string& endpoint) {
+    return model + "@" + endpoint;
+}
+
+Store::Store(std::filesystem::path path) : path_(std::move(path)) {}
+
+void Store::load_locked() {
+    if (loaded_) {
+        return;
+    }
+    loaded_ = true;
+
+    int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    std::string content;
+    char buffer[4096];
+    ssize_t n;
+    if (flock(fd, LOCK_SH) == 0) {
+        while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+            content.append(buffer, static_cast<size_t>(n));
+        }
+        flock(fd, LOCK_UN);
+    }
+    close(fd);
+    parse_history(content, history_);
+}
+
+Timeouts Store::timeouts(const std::string& key) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    load_locked();
+
+    Timeouts timeouts = default_timeouts();
+    auto it = history_.find(key);
+    if (it == history_.end()) {
+        return timeouts;
+    }
+    timeouts.first_token = derive(it->second.first_token, MIN_FIRST_TOKEN_SAMPLES, FIRST_TOKEN_FACTOR,
+                                  MIN_FIRST_TOKEN, MAX_FIRST_TOKEN, timeouts.first_token);
+    timeouts.inter_token = derive(it->second.inter_token, MIN_INTER_TOKEN_SAMPLES, INTER_TOKEN_FACTOR,
+                                  MIN_INTER_TOKEN, MAX_INTER_TOKEN, timeouts.inter_token);
+    return timeouts;
+}
+
+void Store::add(const std::string& key, const Sample& sample) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    load_locked();
+    merge(history_[key], sample);
+    merge(added_[key], sample);
+}
+
+bool Store::save() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (added_.empty()) {
+        return true;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(path_.parent_path(), ec);
+
+    // 与其他进程的更新串行化：在锁内重新读取文件，只合并本进程新增的样本
+    int fd = open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        return false;
+    }
+    if (flock(fd, LOCK_EX) != 0) {
+        close(fd);
+        return false;
+    }
+
+    std::string content;
+    char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+        content.append(buffer, static_cast<size_t>(n));
+    }
+
+    std::map<std::string, Sample> history;
+    parse_history(content, history);
+    for (const auto& entry : added_) {
+        merge(history[entry.first], entry.second);
+    }
+
+    nlohmann::json data = nlohmann::json::object();
+    for (const auto& entry : history) {
+        data[entry.first] = {
+            {"first_token", to_json(entry.second.first_token)},
+            {"inter_token", to_json(entry.second.inter_token)}
+        };
+    }
+
+    std::string output = data.dump();
+    bool ok = ftruncate(fd, 0) == 0 && pwrite(fd, output.data(), output.size(), 0) == static_cast<ssize_t>(output.size());
+    flock(fd, LOCK_UN);
+    close(fd);
+
+    if (ok) {
+        added_.clear();
+    }
+    return ok;
+}
+
+} // namespace latency
+} // namespace lc
@@ -3,11 +3,32 @@
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <regex>
+#include <csignal>
+#include <cstdio>
+#include <iterator>
+#include <chrono>
+#include <ctime>
+#include <algorithm>
+#include <cstring>
+#include <memory>
 #include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
 #include <cxxopts.hpp>
 
 #include "../include/config.h"
 #include "../include/openai.h"
+#include "../include/async_client.h"
+#include "../include/cassette.h"
+#include "../include/benchmark.h"
+#include "../include/coalesce.h"
+#include "../include/fanout.h"
+#include "../include/repl.h"
+#include "../include/output.h"
+#include "../include/history.h"
+#include "../include/docs.h"
+#include "../include/attach.h"
 
 // 检查是否是终端输入
 bool is_terminal_input() {
@@ -15,17 +36,27 @@ bool is_terminal_input() {
 }
 
 // 从stdin读取所有内容
+// 普通文件按大小预留空间，逐块读入同一个字符串，不经过stringstream的二次复制
 std::string read_from_stdin() {
-    std::stringstream buffer;
-    buffer << std::cin.rdbuf();
-    return buffer.str();
+    std::string content;
+    struct stat st;
+    if (fstat(fileno(stdin), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        content.reserve(static_cast<size_t>(st.st_size));
+    }
+
+    char buffer[65536];
+    size_t n;
+    while ((n = std::fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+        content.append(buffer, n);
+    }
+    return content;
 }
 
-// 获取查询内容
-std::string get_query(const cxxopts::ParseResult& args) {
+// 获取用户的问题原文，检索本地文档时使用
+std::string get_question(const cxxopts::ParseResult& args) {
     // 首先检查-q/--query选项
     if (args.count("query")) {
-        return "Query: " + args["query"].as<std::string>();
+        return args["query"].as<std::string>();
     }
     
     // 然后检查位置参数
@@ -37,7 +68,7 @@ std::string get_query(const cxxopts::ParseResult& args) {
                 if (i > 0) combined += " ";
                 combined += positional[i];
             }
-            return "Query: " + combined;
+            return combined;
         }
     }
     
@@ -55,6 +86,25 @@ std::string get_query(const cxxopts::ParseResult& args) {
     return "";
 }
 
+// 获取查询内容：发给模型的问题带有"Query: "前缀
+std::string get_query(const cxxopts::ParseResult& args) {
+    std::string question = get_question(args);
+    return question.empty() && !args.count("query") ? "" : "Query: " + question;
+}
+
+// Ctrl-C：第一次中断当前流式请求并保留已收到的内容，第二次恢复默认行为
+void handle_interrupt(int) {
+    lc::openai::request_cancel();
+}
+
+void install_interrupt_handler() {
+    struct sigaction action {};
+    action.sa_handler = handle_interrupt;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESETHAND;
+    sigaction(SIGINT, &action, nullptr);
+}
+
 // 获取输入内容
 std::string get_input() {
     if (!is_terminal_input()) {
@@ -66,20 +116,306 @@ std::string get_input() {
     return "";
 }
 
+// 按逗号拆分列表参数
+std::vector<std::string> split_list(const std::string& value) {
+    std::vector<std::string> items;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        item = lc::openai::trim(item);
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// 终端宽度，非终端时使用默认值
+size_t terminal_width() {
+    struct winsize size {};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+        return size.ws_col;
+    }
+    return 120;
+}
+
+int run_compare(
+    const lc::Config& config,
+    const std::vector<lc::openai::Message>& messages,
+    const std::vector<std::string>& models,
+    const std::string& layout,
+    bool debug,
+    const lc::openai::StreamOptions& options
+) {
+    lc::fanout::InterleavedPrinter printer(models, std::cout);
+    bool live = layout == "interleaved";
+    
+    install_interrupt_handler();
+    auto reports = lc::fanout::compare(config, messages, models, debug, options,
+        [&printer, live](size_t index, const std::string& delta) {
+            if (live) {
+                printer.write(index, delta);
+            }
+        });
+    
+    if (live) {
+        printer.flush();
+    } else {
+        lc::fanout::print_columns(reports, std::cout, terminal_width());
+    }
+    
+    std::cerr << std::endl;
+    lc::fanout::print_timing(reports, std::cerr);
+    
+    if (lc::openai::cancel_requested()) {
+        return 130;
+    }
+    for (const auto& report : reports) {
+        if (report.result.success) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// 扫描本机的man与tldr页面，建立本地文档索引
+int build_docs_index(bool debug) {
+    auto man_dirs = lc::docs::default_man_dirs();
+    auto tldr_dirs = lc::docs::default_tldr_dirs();
+    if (debug) {
+        for (const auto& dir : man_dirs) {
+            std::cerr << "man: " << dir.string() << std::endl;
+        }
+        for (const auto& dir : tldr_dirs) {
+            std::cerr << "tldr: " << dir.string() << std::endl;
+        }
+    }
+
+    lc::docs::BuildStats stats;
+    std::string error;
+    auto dir = lc::Config::docs_index_dir();
+    if (!lc::docs::build(dir, man_dirs, tldr_dirs, 0, stats, error)) {
+        std::cerr << "Failed to build the documentation index: " << error << std::endl;
+        return 1;
+    }
+    char summary[160];
+    std::snprintf(summary, sizeof(summary), "Indexed %zu snippets (%.1f MB) from %zu pages in %.2fs using %u threads",
+                  stats.snippets, stats.bytes / 1048576.0, stats.files, stats.seconds, stats.threads);
+    std::cout << summary << std::endl;
+    if (debug && stats.skipped > 0) {
+        std::cerr << "Skipped " << stats.skipped << " unreadable, aliased or empty pages" << std::endl;
+    }
+    return 0;
+}
+
+// --offline：不访问网络，直接输出与问题最相关的本地文档片段
+int print_local_docs(const std::string& question) {
+    constexpr size_t MAX_MATCHES = 5;
+    lc::docs::Index index;
+    std::string error;
+    if (!index.open(lc::Config::docs_index_dir(), error)) {
+        std::cerr << "Error: " << error << std::endl;
+        return 1;
+    }
+    auto matches = index.search(question, MAX_MATCHES);
+    if (matches.empty()) {
+        std::cout << "No local documentation matches \"" << question << "\"." << std::endl;
+        return 1;
+    }
+    for (size_t i = 0; i < matches.size(); ++i) {
+        const lc::docs::Match& match = matches[i];
+        char score[32];
+        std::snprintf(score, sizeof(score), "%.2f", match.score);
+        std::cout << "[" << i + 1 << "] " << match.source << (match.section.empty() ? "" : "  " + match.section)
+                  << "  score " << score << std::endl;
+        size_t pos = 0;
+        while (pos < match.text.size()) {
+            size_t end = match.text.find('\n', pos);
+            end = end == std::string::npos ? match.text.size() : end;
+            std::cout << "    " << std::string_view(match.text).substr(pos, end - pos) << std::endl;
+            pos = end + 1;
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+// 全文检索保存过的全部对话，按相关度分页输出
+int search_memory(const std::filesystem::path& memory_path, const std::string& query, size_t page, bool debug) {
+    constexpr size_t PAGE_SIZE = 10;
+    page = std::max<size_t>(page, 1);
+    auto dir = lc::history::index_dir(memory_path);
+    std::string error;
+
+    // 索引建立之前保存的记忆先补建一次
+    if (!lc::history::has_index(dir)) {
+        if (auto messages = lc::openai::load_messages(memory_path)) {
+            if (!lc::history::index_messages(dir, *messages, error)) {
+                std::cerr << "Failed to index conversation memory: " << error << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    lc::history::Page results;
+    if (!lc::history::search(dir, query, page, PAGE_SIZE, results, error)) {
+        std::cerr << "Search failed: " << error << std::endl;
+        return 1;
+    }
+    if (debug) {
+        std::cerr << "Search took "
+                  << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count()
+                  << " ms" << std::endl;
+    }
+
+    if (results.total == 0) {
+        std::cout << "No matches for \"" << query << "\"." << std::endl;
+        return 0;
+    }
+    size_t pages = (results.total + PAGE_SIZE - 1) / PAGE_SIZE;
+    size_t first = (page - 1) * PAGE_SIZE;
+    if (results.results.empty()) {
+        std::cout << "Page " << page << " is past the last page (" << pages << ")." << std::endl;
+        return 0;
+    }
+
+    for (size_t i = 0; i < results.results.size(); ++i) {
+        const lc::history::Result& result = results.results[i];
+        char when[32] = "";
+        std::time_t time = static_cast<std::time_t>(result.time);
+        std::tm local{};
+        if (localtime_r(&time, &local) != nullptr) {
+            std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M", &local);
+        }
+        char score[32];
+        std::snprintf(score, sizeof(score), "%.2f", result.score);
+        std::cout << "[" << first + i + 1 << "] " << when << "  " << lc::openai::role_name(result.role)
+                  << "  score " << score << "  " << result.bytes << " bytes" << std::endl;
+        std::cout << "    " << result.snippet << std::endl << std::endl;
+    }
+
+    std::cout << "Results " << first + 1 << "-" << first + results.results.size() << " of " << results.total
+              << " (page " << page << " of " << pages << ")";
+    if (page < pages) {
+        std::cout << "; use --page " << page + 1 << " for more";
+    }
+    std::cout << std::endl;
+    return 0;
+}
+
+// lc bench子命令：对比模型与端点的延迟和吞吐
+int run_bench(int argc, char** argv) {
+    cxxopts::Options options("lc bench", "Compare latency and throughput of models and endpoints");
+    
+    options.add_options()
+        ("models", "Comma-separated models (model or model@endpoint)", cxxopts::value<std::string>())
+        ("n", "Requests per model", cxxopts::value<size_t>()->default_value("50"))
+        ("concurrency", "Concurrent requests", cxxopts::value<size_t>()->default_value("1"))
+        ("prompt", "Prompt to send", cxxopts::value<std::string>()->default_value("Say hello in one sentence."))
+        ("prompt-file", "Read the prompt from a file", cxxopts::value<std::string>())
+        ("json", "Print the results as JSON instead of a table")
+        ("debug", "Enable debug mode")
+        ("h,help", "Print usage")
+    ;
+    
+    cxxopts::ParseResult args;
+    try {
+        args = options.parse(argc, argv);
+    } catch (const std::exception& e) {
+        std::cerr << "Error parsing arguments: " << e.what() << std::endl;
+        std::cout << options.help() << std::endl;
+        return 1;
+    }
+    
+    if (args.count("help")) {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+    
+    std::optional<lc::Config> config_opt = lc::Config::load();
+    if (!config_opt) {
+        std::cerr << "Failed to load configuration" << std::endl;
+        return 1;
+    }
+    lc::Config config = *config_opt;
+    
+    lc::benchmark::BenchOptions bench_options;
+    bench_options.models = args.count("models") ? split_list(args["models"].as<std::string>())
+                                                : std::vector<std::string>{config.default_model};
+    bench_options.requests = args["n"].as<size_t>();
+    bench_options.concurrency = args["concurrency"].as<size_t>();
+    bench_options.prompt = args["prompt"].as<std::string>();
+    bench_options.debug = args.count("debug");
+    
+    if (args.count("prompt-file")) {
+        std::ifstream file(args["prompt-file"].as<std::string>());
+        if (!file.is_open()) {
+            std::cerr << "Error: cannot read prompt file " << args["prompt-file"].as<std::string>() << std::endl;
+            return 1;
+        }
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        bench_options.prompt = buffer.str();
+    }
+    
+    if (bench_options.models.empty() || bench_options.requests == 0) {
+        std::cerr << "Error: nothing to benchmark" << std::endl;
+        return 1;
+    }
+    
+    // Ctrl-C停止发起新请求，已完成的结果照常输出
+    install_interrupt_handler();
+    auto reports = lc::benchmark::run(config, bench_options);
+    
+    if (args.count("json")) {
+        std::cout << lc::benchmark::to_json(reports).dump(2) << std::endl;
+    } else {
+        lc::benchmark::print_table(reports, std::cout);
+    }
+    
+    return lc::openai::cancel_requested() ? 130 : 0;
+}
+
 int main(int argc, char** argv) {
+    // --deadline的预算从进程启动算起，包括读取配置与管道输入的时间
+    auto invocation_start = std::chrono::steady_clock::now();
+    
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        return run_bench(argc - 1, argv + 1);
+    }
+    
     // 定义命令行参数
     cxxopts::Options options("lc", "Linux command-line AI assistant");
     
     options.add_options()
         ("q,query", "Specify the query for the AI", cxxopts::value<std::string>())
         ("m,memory", "Enable conversation memory")
-        ("clear-memory", "Clear the conversation memory")
+        ("i,interactive", "Start an interactive session that keeps history and connections open")
+        ("f,file", "Attach a file to the prompt (repeatable, glob patterns allowed)", cxxopts::value<std::vector<std::string>>())
+        ("clear-memory", "Clear the conversation memory and delete the searchable history archive")
         ("show-memory", "Show the conversation memory")
+        ("search-memory", "Search all saved conversations, including turns beyond the memory window (kept until --clear-memory)", cxxopts::value<std::string>())
+        ("page", "Result page for --search-memory", cxxopts::value<size_t>()->default_value("1"))
+        ("build-index", "Index local man and tldr pages for offline lookup and prompt grounding")
+        ("offline", "Print the best matching local documentation instead of asking the model")
         ("set", "Set a configuration value (key=value)", cxxopts::value<std::string>())
         ("show-config", "Show the current configuration")
         ("reset-config", "Reset the configuration to default values")
         ("model", "Override the default model for this request", cxxopts::value<std::string>())
         ("no-system-prompt", "Disable the system prompt for this request")
+        ("until", "Stop streaming once the output matches this regex (per line)", cxxopts::value<std::string>())
+        ("max-lines", "Stop streaming after N lines of output", cxxopts::value<size_t>())
+        ("max-bytes", "Stop streaming after N bytes of output", cxxopts::value<size_t>())
+        ("o,output", "Stream the response into a file instead of stdout", cxxopts::value<std::string>())
+        ("fsync", "fsync the --output file before exiting")
+        ("format", "Output format: text or ndjson (one JSON event per line)", cxxopts::value<std::string>()->default_value("text"))
+        ("deadline", "Time budget in seconds for the whole invocation, split across connect, first token and streaming", cxxopts::value<double>())
+        ("compare", "Stream several models concurrently and compare (comma-separated)", cxxopts::value<std::string>())
+        ("compare-layout", "Compare output: interleaved (live) or columns", cxxopts::value<std::string>()->default_value("interleaved"))
+        ("race", "Race several models, keep the first to produce output (comma-separated)", cxxopts::value<std::string>())
+        ("show-race-stats", "Show how often each model won --race")
+        ("record", "Record the API session (request, headers, timed chunks) to a file", cxxopts::value<std::string>())
         ("debug", "Enable debug mode")
         ("h,help", "Print usage")
         ("positional", "Positional arguments", cxxopts::value<std::vector<std::string>>())
@@ -155,12 +491,21 @@ int main(int argc, char** argv) {
         return 0;
     }
     
+    if (args.count("build-index")) {
+        return build_docs_index(debug);
+    }
+    
+    if (args.count("show-race-stats")) {
+        lc::fanout::show_race_stats(lc::Config::race_stats_path(), std::cout);
+        return 0;
+    }
+    
     // 处理记忆相关命令
     auto memory_path = lc::Config::memory_path();
     
     if (args.count("clear-memory")) {
         if (lc::openai::clear_messages(memory_path)) {
-            std::cout << "Conversation memory has been cleared." << std::endl;
+            std::cout << "Conversation memory and history archive have been cleared." << std::endl;
         } else {
             std::cerr << "Failed to clear conversation memory." << std::endl;
             return 1;
@@ -173,7 +518,91 @@ int main(int argc, char** argv) {
         return 0;
     }
     
+    if (args.count("search-memory")) {
+        return search_memory(memory_path, args["search-memory"].as<std::string>(), args["page"].as<size_t>(), debug);
+    }
+    
+    // 获取模型覆盖（如果指定）
+    std::string model_override;
+    if (args.count("model")) {
+        model_override = args["model"].as<std::string>();
+        if (debug) {
+            std::cerr << "Model override: " << model_override << std::endl;
+        }
+    }
+    
+    // 本地停止条件
+    lc::openai::StreamOptions stream_options;
+    if (args.count("until")) {
+        try {
+            stream_options.stop.until = std::regex(args["until"].as<std::string>());
+        } catch (const std::regex_error& e) {
+            std::cerr << "Invalid --until pattern: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    if (args.count("max-lines")) {
+        stream_options.stop.max_lines = args["max-lines"].as<size_t>();
+    }
+    if (args.count("max-bytes")) {
+        stream_options.stop.max_bytes = args["max-bytes"].as<size_t>();
+    }
+    
+    // 截止时间与按模型和端点的延迟历史：卡住的流几秒内被发现，剩余预算用于重试
+    std::chrono::milliseconds deadline_budget(0);
+    if (args.count("deadline")) {
+        double seconds = args["deadline"].as<double>();
+        if (!(seconds > 0)) {
+            std::cerr << "Error: --deadline must be a positive number of seconds" << std::endl;
+            return 1;
+        }
+        deadline_budget = std::chrono::milliseconds(static_cast<long long>(seconds * 1000));
+        stream_options.deadline = invocation_start + deadline_budget;
+    }
+    lc::latency::Store latency(lc::Config::latency_stats_path());
+    stream_options.latency = &latency;
+    auto save_latency = [&latency, debug]() {
+        if (!latency.save() && debug) {
+            std::cerr << "Warning: Failed to update latency history" << std::endl;
+        }
+    };
+    
+    if (args.count("file") && args.count("interactive")) {
+        std::cerr << "Error: --file cannot be combined with --interactive" << std::endl;
+        return 1;
+    }
+    
+    if (args.count("output") && (args.count("interactive") || args.count("compare"))) {
+        std::cerr << "Error: --output cannot be combined with --interactive or --compare" << std::endl;
+        return 1;
+    }
+    
+    std::string format = args["format"].as<std::string>();
+    bool ndjson = format == "ndjson";
+    if (format != "text" && !ndjson) {
+        std::cerr << "Error: --format must be text or ndjson" << std::endl;
+        return 1;
+    }
+    if (ndjson && (args.count("interactive") || args.count("compare") || args.count("race") || args.count("output"))) {
+        std::cerr << "Error: --format ndjson cannot be combined with --interactive, --compare, --race or --output" << std::endl;
+        return 1;
+    }
+    
+    // 交互模式：整个会话复用配置、对话历史与连接
+    if (args.count("interactive")) {
+        lc::repl::Session session;
+        session.model_override = model_override;
+        session.use_system_prompt = !args.count("no-system-prompt");
+        session.debug = debug;
+        session.options = stream_options;
+        session.deadline = deadline_budget;
+        int status = lc::repl::run(config, session);
+        save_latency();
+        return status;
+    }
+    
     // 获取查询和输入
+    std::string question = get_question(args);
     std::string query = get_query(args);
     std::string input = get_input();
     
@@ -182,25 +611,74 @@ int main(int argc, char** argv) {
         std::cerr << "Input: " << input << std::endl;
     }
     
+    // --file：并发映射全部附件，成帧后的内容在组装用户消息时直接写入消息的存储
+    lc::attach::Attachments attachments;
+    if (args.count("file")) {
+        auto attach_start = std::chrono::steady_clock::now();
+        std::vector<std::string> paths;
+        std::string attach_error;
+        if (!lc::attach::expand(args["file"].as<std::vector<std::string>>(), paths, attach_error) ||
+            !attachments.open(paths, attach_error)) {
+            std::cerr << "Error: " << attach_error << std::endl;
+            return 1;
+        }
+        const lc::attach::Stats& attach_stats = attachments.stats();
+        for (const std::string& path : attach_stats.binary) {
+            std::cerr << "Skipping binary file " << path << std::endl;
+        }
+        if (debug) {
+            std::cerr << "Attached " << attach_stats.files << " files (" << attach_stats.bytes << " bytes, "
+                      << attach_stats.duplicates << " duplicates) using " << attach_stats.threads << " threads in "
+                      << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - attach_start).count()
+                      << " ms" << std::endl;
+        }
+    }
+    
     // 如果没有输入和查询，并且不是记忆模式，显示帮助
-    if (query.empty() && input.empty() && !args.count("memory")) {
+    if (query.empty() && input.empty() && attachments.size() == 0 && !args.count("memory")) {
         std::cout << options.help() << std::endl;
         return 0;
     }
     
+    if (args.count("offline")) {
+        return print_local_docs(question.empty() ? input : question);
+    }
+    
+    // 本地文档中与问题最相关的片段，作为参考资料放在用户消息之前
+    std::string grounding;
+    if (config.local_docs && !query.empty()) {
+        auto lookup_start = std::chrono::steady_clock::now();
+        lc::docs::Index index;
+        std::string docs_error;
+        if (index.open(lc::Config::docs_index_dir(), docs_error)) {
+            auto matches = index.search(question, lc::docs::GROUNDING_SNIPPETS);
+            grounding = lc::docs::grounding(matches, lc::docs::GROUNDING_BYTES);
+            if (debug) {
+                std::cerr << "Local docs: " << matches.size() << " snippets in "
+                          << std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - lookup_start).count()
+                          << " us";
+                for (const auto& match : matches) {
+                    std::cerr << ", " << match.source << " " << match.section;
+                }
+                std::cerr << std::endl;
+            }
+        }
+    }
+    
     // 准备消息
     std::vector<lc::openai::Message> messages;
     
     // 添加系统提示
     if (!args.count("no-system-prompt") && config.use_system_prompt) {
-        messages.push_back({"system", config.system_prompt});
+        messages.emplace_back(lc::openai::Role::System, config.system_prompt);
     }
     
     // 加载历史消息
     if (args.count("memory")) {
         auto prev_messages = lc::openai::load_messages(memory_path);
         if (prev_messages) {
-            messages.insert(messages.end(), prev_messages->begin(), prev_messages->end());
+            messages.insert(messages.end(), std::make_move_iterator(prev_messages->begin()),
+                            std::make_move_iterator(prev_messages->end()));
             
             if (debug) {
                 std::cerr << "Loaded " << prev_messages->size() << " previous messages" << std::endl;
@@ -208,54 +686,206 @@ int main(int argc, char** argv) {
         }
     }
     
-    // 添加当前用户消息
-    if (!query.empty() || !input.empty()) {
-        std::string message_content = query;
-        if (!input.empty()) {
+    // 参考资料是系统消息，不写入会话记忆
+    if (!grounding.empty()) {
+        messages.emplace_back(lc::openai::Role::System, std::move(grounding));
+    }
+    
+    // 添加当前用户消息；开启prefix_cache时把相对稳定的管道输入放在易变的问题之前
+    if (attachments.size() > 0) {
+        // 附件与管道输入一样属于稳定的部分；整条消息一次分配，附件由多个线程直接写入，
+        // 序列化时只在转义时再复制一次
+        std::string_view head = config.prefix_cache ? std::string_view() : std::string_view(query);
+        std::string_view tail = config.prefix_cache ? std::string_view(query) : std::string_view();
+        size_t total = (head.empty() ? 0 : head.size() + 2) + attachments.size() + input.size() +
+            (tail.empty() ? 0 : tail.size() + 2);
+        std::shared_ptr<char[]> buffer(new char[total]);
+        char* p = buffer.get();
+        if (!head.empty()) {
+            std::memcpy(p, head.data(), head.size());
+            std::memcpy(p + head.size(), "\n\n", 2);
+            p += head.size() + 2;
+        }
+        attachments.write(p);
+        p += attachments.size();
+        std::memcpy(p, input.data(), input.size());
+        p += input.size();
+        if (!tail.empty()) {
+            std::memcpy(p, "\n\n", 2);
+            std::memcpy(p + 2, tail.data(), tail.size());
+        }
+        std::string_view content(buffer.get(), total);
+        messages.emplace_back(lc::openai::Role::User, content, std::move(buffer));
+    } else if (!query.empty() || !input.empty()) {
+        // 之后不再使用query与input，直接移入消息，大段管道输入不会被复制
+        std::string& first = config.prefix_cache ? input : query;
+        const std::string& second = config.prefix_cache ? query : input;
+        std::string message_content = std::move(first);
+        if (!second.empty()) {
             if (!message_content.empty()) {
                 message_content += "\n\n";
             }
-            message_content += input;
+            message_content += second;
         }
         
-        messages.push_back({"user", message_content});
+        messages.emplace_back(lc::openai::Role::User, std::move(message_content));
     }
     
     if (debug) {
         std::cerr << "Total messages to send: " << messages.size() << std::endl;
     }
     
-    // 获取模型覆盖（如果指定）
-    std::string model_override;
-    if (args.count("model")) {
-        model_override = args["model"].as<std::string>();
-        if (debug) {
-            std::cerr << "Model override: " << model_override << std::endl;
+    // --output：增量直接写入文件，内存中只保留写入历史的开头摘录，续传时从文件读回已输出的内容
+    lc::output::FileWriter writer;
+    bool to_file = args.count("output");
+    if (to_file) {
+        std::string open_error;
+        if (!writer.open(args["output"].as<std::string>(), args.count("fsync"), open_error)) {
+            std::cerr << "Error: " << open_error << std::endl;
+            return 1;
         }
+        stream_options.retain_bytes = lc::output::HISTORY_EXCERPT_BYTES;
+        stream_options.reload_response = [&writer]() { return writer.read_back(); };
+    }
+    
+    // --format ndjson：下游关闭管道时write返回EPIPE而不是让进程被SIGPIPE杀死，随后结束请求
+    lc::output::NdjsonWriter events(invocation_start);
+    if (ndjson) {
+        std::signal(SIGPIPE, SIG_IGN);
+        std::string model;
+        lc::Endpoint endpoint = config.resolve_endpoint(model_override, model);
+        events.start(model, endpoint.name);
     }
     
     // 流式输出回调
-    std::string accumulated_response;
     bool need_newline_at_end = false;
-    auto stream_callback = [&accumulated_response, &need_newline_at_end, debug](const std::string& delta, bool is_done) {
-        if (!is_done && !delta.empty()) {
-            // 处理换行符，确保内容格式正确
-            accumulated_response += delta;
-            std::cout << delta << std::flush;
-            
-            // 如果消息不是以换行符结尾，那么最后需要添加一个换行符
-            need_newline_at_end = (delta.back() != '\n');
+    auto stream_callback = [&need_newline_at_end, &writer, to_file, &events, ndjson](const std::string& delta, bool is_done) {
+        if (is_done || delta.empty()) {
+            return;
+        }
+        if (ndjson) {
+            events.delta(delta);
+            if (events.broken()) {
+                lc::openai::request_cancel();
+            }
+            return;
+        }
+        if (to_file) {
+            // 写入失败（例如磁盘已满）时立即结束请求，不再接收无处存放的内容
+            if (!writer.write(delta)) {
+                lc::openai::request_cancel();
+            }
+            return;
         }
+        std::cout << delta << std::flush;
+        
+        // 如果消息不是以换行符结尾，那么最后需要添加一个换行符
+        need_newline_at_end = (delta.back() != '\n');
     };
     
-    // 调用API进行聊天完成（流式）
-    lc::openai::ChatCompletionResult result = lc::openai::chat_completion_stream(
-        config,
-        messages,
-        stream_callback,
-        model_override,
-        debug
-    );
+    // 对比模式：并发请求多个模型，每个流独立停止，结束后报告各自耗时
+    if (args.count("compare")) {
+        std::vector<std::string> models = split_list(args["compare"].as<std::string>());
+        std::string layout = args["compare-layout"].as<std::string>();
+        if (models.empty() || (layout != "interleaved" && layout != "columns")) {
+            std::cerr << "Error: --compare needs a model list and --compare-layout interleaved or columns" << std::endl;
+            return 1;
+        }
+        int status = run_compare(config, messages, models, layout, debug, stream_options);
+        save_latency();
+        return status;
+    }
+    
+    // 竞速模式：最先输出内容的模型胜出，其余请求立即取消
+    std::vector<std::string> race_models;
+    if (args.count("race")) {
+        race_models = split_list(args["race"].as<std::string>());
+        if (race_models.size() < 2 || args.count("record")) {
+            std::cerr << "Error: --race needs at least two models and cannot be combined with --record" << std::endl;
+            return 1;
+        }
+    }
+    
+    // 录制会话，可用lc_mock_server --replay按原始节奏回放
+    lc::cassette::Recorder recorder;
+    if (args.count("record")) {
+        stream_options.recorder = &recorder;
+    }
+    
+    // 配置为异步引擎时由事件循环驱动请求
+    std::unique_ptr<lc::openai::AsyncEngine> engine;
+    if (config.http_engine == "async" && race_models.empty()) {
+        engine = std::make_unique<lc::openai::AsyncEngine>();
+        stream_options.engine = engine.get();
+    }
+    
+    install_interrupt_handler();
+    
+    // 调用API进行聊天完成（流式）；开启合并时相同的并发请求只有一个进程真正发送
+    lc::openai::ChatCompletionResult result;
+    if (!race_models.empty()) {
+        auto outcome = lc::fanout::race(config, messages, race_models, debug, stream_options, stream_callback);
+        result = outcome.result;
+        
+        if (outcome.winner >= 0) {
+            if (!lc::fanout::record_race(lc::Config::race_stats_path(), outcome) && debug) {
+                std::cerr << "Warning: Failed to update race statistics" << std::endl;
+            }
+            if (debug) {
+                std::cerr << "Race won by " << race_models[outcome.winner] << std::endl;
+                lc::fanout::print_timing(outcome.reports, std::cerr);
+            }
+        }
+    } else {
+        auto complete = config.coalesce_requests ? lc::coalesce::chat_completion_stream
+                                                 : lc::openai::chat_completion_stream;
+        result = complete(
+            config,
+            messages,
+            stream_callback,
+            model_override,
+            debug,
+            stream_options
+        );
+    }
+    
+    save_latency();
+    
+    // 失败的会话同样保存，便于复现
+    if (args.count("record")) {
+        std::string record_error;
+        std::string record_path = args["record"].as<std::string>();
+        if (!lc::cassette::save(record_path, recorder.cassette(), record_error)) {
+            std::cerr << "Warning: " << record_error << std::endl;
+        } else if (debug) {
+            std::cerr << "Session recorded to " << record_path << std::endl;
+        }
+    }
+    
+    if (to_file) {
+        if (!writer.close()) {
+            std::cerr << "Error: " << writer.error() << std::endl;
+            return 1;
+        }
+        if (debug) {
+            std::cerr << "Wrote " << writer.bytes() << " bytes to " << writer.path().string() << std::endl;
+        }
+    }
+    
+    if (ndjson) {
+        // 读取端已关闭：与被SIGPIPE结束的进程一样返回141，不再输出也不保存记忆
+        if (events.broken()) {
+            return 141;
+        }
+        if (!result.success) {
+            events.error(result.error_message);
+        } else {
+            if (result.usage.present()) {
+                events.usage(result.usage);
+            }
+            events.timing(result);
+        }
+    }
     
     // 处理结果
     if (!result.success) {
@@ -268,9 +898,17 @@ int main(int argc, char** argv) {
         std::cout << std::endl;
     }
     
-    // 保存对话历史
-    if (args.count("memory") && result.success) {
-        messages.push_back({"assistant", result.full_response});
+    if (debug) {
+        std::cerr << "Usage: " << lc::openai::format_usage(result.usage) << std::endl;
+    }
+    
+    // 保存对话历史（提前结束时保存截断后的回答）
+    bool interrupted = result.stopped_early && result.stop_reason == "interrupted";
+    if (args.count("memory") && result.success && !(interrupted && result.full_response.empty())) {
+        if (to_file) {
+            result.full_response = lc::output::history_excerpt(result.full_response, writer);
+        }
+        messages.emplace_back(lc::openai::Role::Assistant, std::move(result.full_response));
         
         if (!lc::openai::save_messages(messages, memory_path, config.max_history)) {
             std::cerr << "Warning: Failed to save conversation history" << std::endl;
@@ -279,5 +917,5 @@ int main(int argc, char** argv) {
         }
     }
     
-    return 0;
+    return interrupted ? 130 : 0;
 }
\ No newline at end of file
@@ -1,10 +1,27 @@
 
 #include "../include/openai.h"
+#include "../include/stream.h"
+#include "../include/async_client.h"
+#include "../include/cassette.h"
+#include "../include/history.h"
 #include <httplib.h>
+#include <sys/socket.h>
 #include <regex>
 #include <fstream>
 #include <iostream>
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory_resource>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 
 namespace lc {
 namespace openai {
@@ -22,20 +39,147 @@ std::string trim(const std::string& str) {
     return (start < end) ? std::string(start, end) : std::string();
 }
 
+const std::string& role_name(Role role) {
+    static const std::string names[] = {"system", "user", "assistant"};
+    return names[static_cast<size_t>(role)];
+}
+
+bool parse_role(std::string_view name, Role& role) {
+    for (Role candidate : {Role::System, Role::User, Role::Assistant}) {
+        if (name == role_name(candidate)) {
+            role = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+Message::Message(Role role, std::string content) : role(role) {
+    if (!content.empty()) {
+        auto owned = std::make_shared<const std::string>(std::move(content));
+        content_ = *owned;
+        storage_ = std::move(owned);
+    }
+}
+
+// storage为空时由调用方保证content在消息使用期间有效
+Message::Message(Role role, std::string_view content, std::shared_ptr<const void> storage)
+    : role(role), content_(content), storage_(std::move(storage)) {}
+
 // Message 转为 JSON
 nlohmann::json Message::to_json() const {
     nlohmann::json j;
-    j["role"] = role;
-    j["content"] = content;
+    j["role"] = role_name(role);
+    j["content"] = std::string(content_);
     return j;
 }
 
 // 从JSON创建Message
 Message Message::from_json(const nlohmann::json& j) {
-    Message msg;
-    msg.role = j["role"].get<std::string>();
-    msg.content = j["content"].get<std::string>();
-    return msg;
+    std::string name = j["role"].get<std::string>();
+    Role role;
+    if (!parse_role(name, role)) {
+        throw std::runtime_error("Unknown message role: " + name);
+    }
+    return Message(role, j["content"].get<std::string>());
+}
+
+// 键按名称排序，与nlohmann::json的输出一致
+void Message::append_json(std::string& out) const {
+    out += "{\"content\":";
+    append_json_string(out, content_);
+    out += ",\"role\":\"";
+    out += role_name(role);
+    out += "\"}";
+}
+
+// 返回从pos开始的合法UTF-8序列长度，非法时返回0
+static size_t utf8_sequence_length(std::string_view text, size_t pos) {
+    auto byte = [&](size_t i) { return static_cast<unsigned char>(text[i]); };
+    unsigned char lead = byte(pos);
+    size_t length;
+    unsigned char low = 0x80, high = 0xBF;  // 第二个字节的合法范围，排除过长编码与代理区
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        length = 2;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        length = 3;
+        if (lead == 0xE0) low = 0xA0;
+        if (lead == 0xED) high = 0x9F;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        length = 4;
+        if (lead == 0xF0) low = 0x90;
+        if (lead == 0xF4) high = 0x8F;
+    } else {
+        return 0;
+    }
+
+    if (pos + length > text.size() || byte(pos + 1) < low || byte(pos + 1) > high) {
+        return 0;
+    }
+    for (size_t i = 2; i < length; ++i) {
+        if ((byte(pos + i) & 0xC0) != 0x80) {
+            return 0;
+        }
+    }
+    return length;
+}
+
+size_t json_string_size(std::string_view text) {
+    size_t size = text.size() + 2;
+    for (char ch : text) {
+        unsigned char c = static_cast<unsigned char>(ch);
+        if (c == '"' || c == '\\' || c == '\b' || c == '\f' || c == '\n' || c == '\r' || c == '\t') {
+            size += 1;
+        } else if (c < 0x20) {
+            size += 5;
+        }
+    }
+    return size;
+}
+
+// 与nlohmann::json::dump()相同的转义规则：只转义引号、反斜杠与控制字符，其余UTF-8原样输出
+void append_json_string(std::string& out, std::string_view text) {
+    out += '"';
+
+    size_t run = 0;  // 无需转义的连续字节从run开始，整段追加
+    size_t i = 0;
+    while (i < text.size()) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c >= 0x20 && c != '"' && c != '\\' && c < 0x80) {
+            ++i;
+            continue;
+        }
+        if (c >= 0x80) {
+            size_t length = utf8_sequence_length(text, i);
+            if (length > 0) {
+                i += length;
+                continue;
+            }
+        }
+
+        out.append(text.data() + run, i - run);
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (c < 0x20) {
+                    char escaped[7];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += "\xEF\xBF\xBD";  // 非法UTF-8字节
+                }
+        }
+        run = ++i;
+    }
+
+    out.append(text.data() + run, text.size() - run);
+    out += '"';
 }
 
 // 规范化API URL - 修复：保留尾部斜杠，避免308重定向问题
@@ -50,13 +194,21 @@ std::string normalize_api_url(const std::string& base_url) {
     return url;
 }
 
+std::string ApiUrl::to_string() const {
+    if (use_unix_socket()) {
+        return "unix://" + host + path_prefix;
+    }
+    return scheme + "://" + host + path_prefix;
+}
+
 // 创建HTTP客户端
-std::unique_ptr<httplib::Client> create_http_client(const std::string& host, bool use_https, bool debug) {
+std::unique_ptr<httplib::Client> create_http_client(const ApiUrl& api_url, bool debug) {
     std::unique_ptr<httplib::Client> client;
     
-    if (use_https) {
+    if (api_url.use_https()) {
 #ifdef CPPHTTPLIB_OPENSSL_SUPPORT
-        client = std::make_unique<httplib::Client>(host);
+        // 显式带上scheme，否则httplib会先以明文HTTP连接80端口再被重定向
+        client = std::make_unique<httplib::Client>("https://" + api_url.host);
         client->set_ca_cert_path("/etc/ssl/certs");
         // 禁用SSL证书验证，避免SSL证书问题
         client->enable_server_certificate_verification(false);
@@ -69,10 +221,19 @@ std::unique_ptr<httplib::Client> create_http_client(const std::string& host, boo
         }
         return nullptr;
 #endif
+    } else if (api_url.use_unix_socket()) {
+        // 本地推理服务：通过unix domain socket连接，不经过TCP回环
+        client = std::make_unique<httplib::Client>(api_url.host, 80);
+        client->set_address_family(AF_UNIX);
+        client->set_default_headers({{"Host", "localhost"}});
+        if (debug) {
+            std::cerr << "Using unix domain socket: " << api_url.host << std::endl;
+        }
     } else {
-        client = std::make_unique<httplib::Client>(host);
+        client = std::make_unique<httplib::Client>("http://" + api_url.host);
     }
     
+    // 默认超时；流式请求每次尝试前按latency::Timeouts重新设置
     client->set_connection_timeout(30);
     client->set_read_timeout(120);
     client->set_write_timeout(30);
@@ -81,21 +242,100 @@ std::unique_ptr<httplib::Client> create_http_client(const std::string& host, boo
     return client;
 }
 
+ConnectionPool::ConnectionPool() = default;
+
+ConnectionPool::~ConnectionPool() = default;
+
+httplib::Client* ConnectionPool::acquire(const ApiUrl& api_url, bool debug) {
+    auto& client = clients_[api_url.to_string()];
+    if (!client) {
+        client = create_http_client(api_url, debug);
+        if (!client) {
+            clients_.erase(api_url.to_string());
+            return nullptr;
+        }
+        client->set_keep_alive(true);
+    }
+    return client.get();
+}
+
+// 在unix socket URL的路径中找出socket文件与API路径的分界
+static bool split_unix_socket_path(const std::string& full_path, std::string& socket_path, std::string& path_prefix) {
+    // 优先选择磁盘上真实存在的socket文件
+    size_t pos = 0;
+    size_t suffix_split = std::string::npos;
+    while (pos != std::string::npos && pos < full_path.size()) {
+        size_t next = full_path.find('/', pos + 1);
+        std::string candidate = full_path.substr(0, next);
+        
+        std::error_code ec;
+        if (std::filesystem::is_socket(candidate, ec)) {
+            socket_path = candidate;
+            path_prefix = next == std::string::npos ? "" : full_path.substr(next);
+            return true;
+        }
+        
+        // 其次按 .sock 后缀划分
+        if (suffix_split == std::string::npos && candidate.size() > 5 &&
+            candidate.compare(candidate.size() - 5, 5, ".sock") == 0) {
+            suffix_split = candidate.size();
+        }
+        pos = next;
+    }
+    
+    if (suffix_split == std::string::npos) {
+        return false;
+    }
+    
+    socket_path = full_path.substr(0, suffix_split);
+    path_prefix = full_path.substr(suffix_split);
+    return true;
+}
+
 // 解析API URL
-bool parse_api_url(const std::string& url_base, std::string& host, std::string& path_prefix, bool& use_https, bool debug) {
+bool parse_api_url(const std::string& url_base, ApiUrl& api_url, bool debug) {
+    static const std::string unix_scheme = "unix://";
+    if (url_base.compare(0, unix_scheme.size(), unix_scheme) == 0) {
+        std::string full_path = url_base.substr(unix_scheme.size());
+        if (full_path.empty() || full_path[0] != '/') {
+            return false;
+        }
+        
+        // 去掉规范化时添加的尾部斜杠再查找socket文件
+        std::string trimmed_path = full_path;
+        while (trimmed_path.size() > 1 && trimmed_path.back() == '/') {
+            trimmed_path.pop_back();
+        }
+        
+        std::string path_prefix;
+        if (!split_unix_socket_path(trimmed_path, api_url.host, path_prefix)) {
+            return false;
+        }
+        
+        api_url.scheme = "unix";
+        api_url.path_prefix = path_prefix.empty() ? "/" : path_prefix + "/";
+        
+        if (debug) {
+            std::cerr << "URL parsed - Protocol: unix"
+                      << ", Socket: " << api_url.host
+                      << ", Path prefix: " << api_url.path_prefix << std::endl;
+        }
+        
+        return true;
+    }
+    
     std::regex url_regex(R"(^(https?)://([^/]+)(/.*)?$)");
     std::smatch url_match;
     
     if (std::regex_match(url_base, url_match, url_regex)) {
-        std::string protocol = url_match[1].str();
-        host = url_match[2].str();
-        path_prefix = url_match[3].matched ? url_match[3].str() : "";
-        use_https = (protocol == "https");
+        api_url.scheme = url_match[1].str();
+        api_url.host = url_match[2].str();
+        api_url.path_prefix = url_match[3].matched ? url_match[3].str() : "";
         
         if (debug) {
-            std::cerr << "URL parsed - Protocol: " << protocol 
-                      << ", Host: " << host 
-                      << ", Path prefix: " << path_prefix << std::endl;
+            std::cerr << "URL parsed - Protocol: " << api_url.scheme 
+                      << ", Host: " << api_url.host 
+                      << ", Path prefix: " << api_url.path_prefix << std::endl;
         }
         
         return true;
@@ -104,6 +344,18 @@ bool parse_api_url(const std::string& url_base, std::string& host, std::string&
     return false;
 }
 
+// 转换为httplib请求
+static httplib::Request to_httplib_request(PreparedRequest&& prepared) {
+    httplib::Request request;
+    request.method = "POST";
+    request.path = prepared.path;
+    for (auto& header : prepared.headers) {
+        request.headers.emplace(header.first, header.second);
+    }
+    request.body = std::move(prepared.body);
+    return request;
+}
+
 // 执行非流式聊天完成请求
 ChatCompletionResult chat_completion(
     const Config& config, 
@@ -114,56 +366,22 @@ ChatCompletionResult chat_completion(
     ChatCompletionResult result;
     result.success = false;
     
-    // 准备请求URL
-    std::string url_base = normalize_api_url(config.openai_base_url);
-    std::string host;
-    std::string path_prefix;
-    bool use_https;
-    
-    if (!parse_api_url(url_base, host, path_prefix, use_https, debug)) {
-        result.error_message = "Invalid base URL: " + url_base;
+    // 准备请求
+    PreparedRequest prepared;
+    if (!prepare_chat_request(config, messages, model_override, false, "", prepared, result.error_message, debug)) {
         return result;
     }
     
-    // 构建完整路径，移除末尾的斜杠，避免路径中有双斜杠
-    if (!path_prefix.empty() && path_prefix.back() == '/') {
-        path_prefix.pop_back();
-    }
-    std::string path = path_prefix + "/chat/completions";
-    
-    // 准备请求体
-    nlohmann::json request_body;
-    request_body["model"] = model_override.empty() ? config.default_model : model_override;
-    
-    nlohmann::json messages_json = nlohmann::json::array();
-    for (const auto& msg : messages) {
-        messages_json.push_back(msg.to_json());
-    }
-    
-    request_body["messages"] = messages_json;
-    
-    std::string request_body_str = request_body.dump();
-    
-    if (debug) {
-        std::cerr << "Request URL: " << (use_https ? "https://" : "http://") << host << path << std::endl;
-        std::cerr << "Request body: " << request_body_str << std::endl;
-    }
-    
     // 创建HTTP客户端
-    auto client = create_http_client(host, use_https, debug);
+    auto client = create_http_client(prepared.api_url, debug);
     if (!client) {
         result.error_message = "Failed to create HTTP client";
         return result;
     }
     
-    // 设置请求头
-    httplib::Headers headers = {
-        {"Content-Type", "application/json"},
-        {"Authorization", "Bearer " + config.openai_api_key}
-    };
-    
     // 发送请求
-    auto http_result = client->Post(path, headers, request_body_str, "application/json");
+    Dialect dialect = prepared.dialect;
+    auto http_result = client->send(to_httplib_request(std::move(prepared)));
     
     if (!http_result) {
         result.error_message = "HTTP request failed: " + 
@@ -186,17 +404,16 @@ ChatCompletionResult chat_completion(
     try {
         nlohmann::json response_json = nlohmann::json::parse(http_result->body);
         
-        if (!response_json.contains("choices") || 
-            response_json["choices"].empty() ||
-            !response_json["choices"][0].contains("message") ||
-            !response_json["choices"][0]["message"].contains("content")) {
-            
+        // 响应格式由端点的方言决定
+        std::string content;
+        bool parsed = visit_dialect(dialect, [&](auto policy) {
+            return decltype(policy)::parse_response(response_json, content, result.usage);
+        });
+        if (!parsed) {
             result.error_message = "Invalid API response format";
             return result;
         }
         
-        std::string content = response_json["choices"][0]["message"]["content"].get<std::string>();
-        
         result.full_response = trim(content);
         result.success = true;
         
@@ -207,198 +424,476 @@ ChatCompletionResult chat_completion(
     }
 }
 
-// 执行流式聊天完成请求 - 由于cpp-httplib的限制，我们需要简化实现方式
+std::string format_usage(const Usage& usage) {
+    if (!usage.present()) {
+        return "not reported";
+    }
+    std::string text = "prompt " + std::to_string(usage.prompt_tokens) + " tokens";
+    if (usage.cached_tokens >= 0 && usage.prompt_tokens > 0) {
+        char rate[32];
+        std::snprintf(rate, sizeof(rate), "%.1f%%", 100.0 * usage.cached_tokens / usage.prompt_tokens);
+        text += " (" + std::to_string(usage.cached_tokens) + " cached, " + rate + ")";
+    }
+    return text + ", completion " + std::to_string(usage.completion_tokens) + " tokens";
+}
+
+// 取消标记，信号处理函数中只做原子写入
+static std::atomic<bool> g_cancel_requested{false};
+
+void request_cancel() {
+    g_cancel_requested.store(true);
+}
+
+bool cancel_requested() {
+    return g_cancel_requested.load();
+}
+
+void reset_cancel() {
+    g_cancel_requested.store(false);
+}
+
+namespace {
+
+// 在后台等待取消请求、截止时间或流卡住（首token或下一块数据迟迟不来），
+// 必要时主动关闭连接，避免阻塞在读取上；连接超时由httplib自己处理
+class CancelWatcher {
+public:
+    CancelWatcher(httplib::Client& client, std::chrono::steady_clock::time_point deadline,
+                  const StreamProcessor& processor, const latency::Timeouts& timeouts)
+        : client_(client), deadline_(deadline), processor_(processor), timeouts_(timeouts) {
+        thread_ = std::thread([this]() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!finished_) {
+                if (cancel_requested()) {
+                    client_.stop();
+                    break;
+                }
+                auto now = std::chrono::steady_clock::now();
+                if (now >= deadline_) {
+                    expired_ = true;
+                    client_.stop();
+                    break;
+                }
+                std::string stall = stall_reason(now);
+                if (!stall.empty()) {
+                    stalled_ = stall;
+                    client_.stop();
+                    break;
+                }
+                cv_.wait_for(lock, std::chrono::milliseconds(50));
+            }
+        });
+    }
+    
+    ~CancelWatcher() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finished_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+    
+    bool expired() const { return expired_; }
+    // 非空表示因流卡住而断开，内容为原因；监视线程在mutex_下写入，这里同样加锁读取
+    std::string stalled() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stalled_;
+    }
+
+private:
+    // 只在没有数据到达时判定卡住：推理模型在首个内容之前持续发送思考增量或心跳，
+    // 这段时间按首token超时衡量数据间隔，收到内容之后改用token间隔超时
+    std::string stall_reason(std::chrono::steady_clock::time_point now) const {
+        latency::Millis limit = processor_.has_content() ? timeouts_.inter_token : timeouts_.first_token;
+        if (limit.count() <= 0 || now - processor_.last_activity() < limit) {
+            return "";
+        }
+        return (processor_.has_response() ? "no data for " : "no response within ") +
+            std::to_string(limit.count()) + " ms";
+    }
+
+    httplib::Client& client_;
+    std::chrono::steady_clock::time_point deadline_;
+    const StreamProcessor& processor_;
+    latency::Timeouts timeouts_;
+    std::string stalled_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    bool finished_ = false;
+    std::atomic<bool> expired_{false};
+    std::thread thread_;
+};
+
+} // namespace
+
+// 执行流式聊天完成请求，边接收边解析SSE事件
 ChatCompletionResult chat_completion_stream(
     const Config& config, 
     const std::vector<Message>& messages, 
     StreamCallback callback,
     const std::string& model_override,
-    bool debug
+    bool debug,
+    const StreamOptions& options
 ) {
+    // 指定了异步引擎时交由事件循环驱动
+    if (options.engine) {
+        return options.engine->run(config, messages, callback, model_override, debug, options);
+    }
+    
     ChatCompletionResult result;
     result.success = false;
     result.full_response = "";
     
-    // 准备请求URL
-    std::string url_base = normalize_api_url(config.openai_base_url);
-    std::string host;
-    std::string path_prefix;
-    bool use_https;
-    
-    if (!parse_api_url(url_base, host, path_prefix, use_https, debug)) {
-        result.error_message = "Invalid base URL: " + url_base;
+    // 准备请求
+    PreparedRequest prepared;
+    if (!prepare_chat_request(config, messages, model_override, true, "", prepared, result.error_message, debug)) {
         callback("", true); // 通知完成
         return result;
     }
     
-    // 构建完整路径，移除末尾的斜杠，避免路径中有双斜杠
-    if (!path_prefix.empty() && path_prefix.back() == '/') {
-        path_prefix.pop_back();
-    }
-    std::string path = path_prefix + "/chat/completions";
-    
-    // 准备请求体
-    nlohmann::json request_body;
-    request_body["model"] = model_override.empty() ? config.default_model : model_override;
-    request_body["stream"] = true;
-    
-    nlohmann::json messages_json = nlohmann::json::array();
-    for (const auto& msg : messages) {
-        messages_json.push_back(msg.to_json());
-    }
-    
-    request_body["messages"] = messages_json;
-    
-    std::string request_body_str = request_body.dump();
-    
-    if (debug) {
-        std::cerr << "Request URL: " << (use_https ? "https://" : "http://") << host << path << std::endl;
-        std::cerr << "Request body: " << request_body_str << std::endl;
+    // 创建HTTP客户端，交互模式下复用会话中保持的连接
+    std::unique_ptr<httplib::Client> owned_client;
+    httplib::Client* client = nullptr;
+    if (options.connections) {
+        client = options.connections->acquire(prepared.api_url, debug);
+    } else {
+        owned_client = create_http_client(prepared.api_url, debug);
+        client = owned_client.get();
     }
-    
-    // 创建HTTP客户端
-    auto client = create_http_client(host, use_https, debug);
     if (!client) {
         result.error_message = "Failed to create HTTP client";
         callback("", true); // 通知完成
         return result;
     }
     
-    // 设置请求头
-    httplib::Headers headers = {
-        {"Content-Type", "application/json"},
-        {"Authorization", "Bearer " + config.openai_api_key},
-        {"Accept", "text/event-stream"}
-    };
-    
-    // 发送请求 - 由于cpp-httplib的限制，我们不使用回调方式，而是获取完整响应后手动解析
-    auto http_result = client->Post(path, headers, request_body_str, "application/json");
-    
-    if (!http_result) {
-        result.error_message = "HTTP request failed: " + 
-                             httplib::to_string(http_result.error());
-        callback("", true);  // 通知完成
-        return result;
-    }
+    std::string url_base = prepared.url_base;
+    std::string latency_key;
+    StreamProcessor processor(callback, options, debug);
+    int resumes_left = std::max(0, config.stream_resume_retries);
     
-    if (http_result->status == 308) {  // 永久重定向
-        // 解析重定向位置
-        if (http_result->has_header("Location")) {
-            std::string new_location = http_result->get_header_value("Location");
-            
-            if (debug) {
-                std::cerr << "Got 308 redirect to: " << new_location << std::endl;
+    for (bool first_attempt = true; ; first_attempt = false) {
+        // 续传时把已收到的内容作为assistant前缀重新构造请求
+        if (!first_attempt &&
+            !prepare_chat_request(config, messages, model_override, true, processor.resume_prefix(), prepared, result.error_message, debug)) {
+            callback("", true);
+            return result;
+        }
+        
+        if (options.recorder) {
+            options.recorder->begin_attempt(prepared);
+        }
+        
+        // 各阶段的超时随剩余预算逐次收紧；首token与token间隔由监视线程判断，
+        // httplib的读超时只作为兜底，不会先于它们触发
+        latency::Timeouts timeouts = request_timeouts(options, prepared, debug);
+        client->set_connection_timeout(timeouts.connect);
+        client->set_read_timeout(std::max(timeouts.first_token, timeouts.inter_token) + latency::Millis(1000));
+        
+        // 构造请求，响应体通过content_receiver增量处理
+        processor.begin_attempt(prepared.dialect);
+        latency_key = prepared.latency_key;
+        httplib::Request request = to_httplib_request(std::move(prepared));
+        
+        int status = 0;
+        std::string error_body;
+        
+        request.response_handler = [&status, &options](const httplib::Response& response) {
+            status = response.status;
+            if (options.recorder) {
+                options.recorder->on_status(status);
+                for (const auto& header : response.headers) {
+                    options.recorder->on_header(header.first, header.second);
+                }
             }
-            
-            // 尝试解析新位置
-            std::string redirect_host;
-            std::string redirect_path_prefix;
-            bool redirect_use_https;
-            
-            if (parse_api_url(new_location, redirect_host, redirect_path_prefix, redirect_use_https, debug)) {
+            return true;
+        };
+        
+        request.content_receiver = [&](const char* data, size_t len, uint64_t, uint64_t) {
+            if (options.recorder) {
+                options.recorder->on_chunk(data, len);
+            }
+            if (status != 200) {
+                error_body.append(data, len);
+                return true;
+            }
+            return processor.feed(data, len);
+        };
+        
+        httplib::Response response;
+        httplib::Error error = httplib::Error::Success;
+        bool deadline_exceeded;
+        std::string stalled;
+        {
+            CancelWatcher watcher(*client, options.deadline, processor, timeouts);
+            client->send(request, response, error);
+            deadline_exceeded = watcher.expired();
+            stalled = watcher.stalled();
+        }
+        
+        if (deadline_exceeded && !processor.done()) {
+            result.error_message = "Request deadline exceeded";
+            result.full_response = trim(processor.accumulated());
+            callback("", true);  // 通知完成
+            return result;
+        }
+        
+        // 流卡住：不等固定的读超时，立即在重试预算内重新请求（已有内容作为续传前缀）
+        if (!stalled.empty() && !processor.done() && !processor.stopped_early() && processor.error().empty()) {
+            if (options.recorder) {
+                options.recorder->on_error("stalled: " + stalled);
+            }
+            if (resumes_left > 0 && processor.can_resume()) {
+                --resumes_left;
                 if (debug) {
-                    std::cerr << "Redirect parsed - New host: " << redirect_host << ", New path: " << redirect_path_prefix << std::endl;
+                    std::cerr << "Stream stalled (" << stalled << ") after " << processor.received_bytes()
+                              << " bytes, retrying (" << resumes_left << " retries left)" << std::endl;
                 }
+                continue;
             }
+            result.error_message = "Stream stalled: " + stalled;
+            result.full_response = trim(processor.accumulated());
+            callback("", true);  // 通知完成
+            return result;
         }
         
-        result.error_message = "API request failed with status 308 (Permanent Redirect). "
-                             "Please check your openai_base_url setting. "
-                             "Try adding a trailing slash: " + url_base;
-        callback("", true);  // 通知完成
-        return result;
-    }
-    
-    if (http_result->status != 200) {
-        result.error_message = "API request failed with status " + 
-                             std::to_string(http_result->status) + ": " + 
-                             http_result->body;
-        callback("", true);  // 通知完成
-        return result;
-    }
-    
-    // 手动解析SSE响应
-    std::string accumulated_response;
-    std::istringstream response_stream(http_result->body);
-    std::string line;
-    
-    while (std::getline(response_stream, line)) {
-        line = trim(line);
+        // 服务端在流中报告错误（例如Anthropic的overloaded_error），不再续传
+        if (!processor.error().empty()) {
+            result.error_message = "Stream error: " + processor.error();
+            result.full_response = trim(processor.accumulated());
+            callback("", true);  // 通知完成
+            return result;
+        }
         
-        // 跳过空行和注释
-        if (line.empty() || line.find(":") == 0) {
-            continue;
+        // 用户中断（Ctrl-C）时，监视线程会关闭连接，读取错误视为提前结束
+        if (cancel_requested() && !processor.done()) {
+            processor.stop("interrupted");
+        }
+        
+        if (debug && processor.stopped_early()) {
+            std::cerr << "Stream stopped early: " << processor.stop_reason() << std::endl;
         }
         
-        // 检查是否是data前缀
-        if (line.find("data: ") == 0) {
-            std::string data = line.substr(6);
+        if (error != httplib::Error::Success && !processor.done() && !processor.stopped_early()) {
+            if (options.recorder) {
+                options.recorder->on_error(httplib::to_string(error));
+            }
             
-            // 处理流结束标记
-            if (data == "[DONE]") {
-                callback("", true);  // 通知流结束
-                break;
+            // 流已经开始后连接中断：在重试预算内带着已收到的内容续传
+            if (status == 200 && resumes_left > 0 && processor.can_resume()) {
+                --resumes_left;
+                if (debug) {
+                    std::cerr << "Stream interrupted (" << httplib::to_string(error) << ") after "
+                              << processor.received_bytes() << " bytes, resuming ("
+                              << resumes_left << " retries left)" << std::endl;
+                }
+                continue;
             }
             
-            try {
-                nlohmann::json data_json = nlohmann::json::parse(data);
+            result.error_message = "HTTP request failed: " + 
+                                 httplib::to_string(error);
+            callback("", true);  // 通知完成
+            return result;
+        }
+        
+        if (status == 308) {  // 永久重定向
+            // 解析重定向位置
+            if (response.has_header("Location")) {
+                std::string new_location = response.get_header_value("Location");
                 
-                // 提取内容增量
-                if (data_json.contains("choices") && 
-                    !data_json["choices"].empty() && 
-                    data_json["choices"][0].contains("delta") && 
-                    data_json["choices"][0]["delta"].contains("content")) {
-                    
-                    std::string content_delta = data_json["choices"][0]["delta"]["content"].get<std::string>();
-                    
-                    if (!content_delta.empty()) {
-                        accumulated_response += content_delta;
-                        callback(content_delta, false);
-                    }
-                }
-            } catch (const std::exception& e) {
                 if (debug) {
-                    std::cerr << "Error parsing data: " << e.what() << std::endl;
+                    std::cerr << "Got 308 redirect to: " << new_location << std::endl;
+                }
+                
+                // 尝试解析新位置
+                ApiUrl redirect_url;
+                
+                if (parse_api_url(new_location, redirect_url, debug)) {
+                    if (debug) {
+                        std::cerr << "Redirect parsed - New host: " << redirect_url.host << ", New path: " << redirect_url.path_prefix << std::endl;
+                    }
                 }
             }
+            
+            result.error_message = "API request failed with status 308 (Permanent Redirect). "
+                                 "Please check your openai_base_url setting. "
+                                 "Try adding a trailing slash: " + url_base;
+            callback("", true);  // 通知完成
+            return result;
         }
+        
+        if (status != 200 && !(processor.stopped_early() && status == 0)) {
+            result.error_message = "API request failed with status " + 
+                                 std::to_string(status) + ": " + 
+                                 error_body;
+            callback("", true);  // 通知完成
+            return result;
+        }
+        
+        break;
     }
     
+    callback("", true);  // 通知流结束
+    
     result.success = true;
-    result.full_response = trim(accumulated_response);
+    result.full_response = trim(processor.accumulated());
+    result.stopped_early = processor.stopped_early();
+    result.stop_reason = processor.stop_reason();
+    result.usage = processor.usage();
+    if (options.latency) {
+        options.latency->add(latency_key, processor.latency());
+    }
     
     return result;
 }
 
+namespace {
+
+// 流式读取记忆文件：内容字符串逐条复制进arena，不构造整棵JSON树
+class HistoryReader : public nlohmann::json_sax<nlohmann::json> {
+public:
+    explicit HistoryReader(size_t size_hint)
+        : arena_(std::make_shared<std::pmr::monotonic_buffer_resource>(std::max<size_t>(size_hint, 64))) {}
+
+    std::vector<Message> messages;
+    std::string error;
+    bool not_array = false;  // 顶层不是数组，按没有历史处理
+
+    bool null() override { return scalar(); }
+    bool boolean(bool) override { return scalar(); }
+    bool number_integer(number_integer_t) override { return scalar(); }
+    bool number_unsigned(number_unsigned_t) override { return scalar(); }
+    bool number_float(number_float_t, const string_t&) override { return scalar(); }
+    bool binary(binary_t&) override { return scalar(); }
+
+    bool string(string_t& value) override {
+        if (depth_ != 2) {
+            return scalar();
+        }
+        if (key_ == "content") {
+            char* data = static_cast<char*>(arena_->allocate(value.size(), 1));
+            std::memcpy(data, value.data(), value.size());
+            content_ = std::string_view(data, value.size());
+            has_content_ = true;
+        } else if (key_ == "role") {
+            has_role_ = true;
+            known_role_ = parse_role(value, role_);
+        }
+        return true;
+    }
+
+    bool start_object(std::size_t) override {
+        if (++depth_ == 1) {
+            not_array = true;
+            return false;
+        }
+        if (depth_ == 2) {
+            has_role_ = has_content_ = false;
+        }
+        return true;
+    }
+
+    bool key(string_t& value) override {
+        if (depth_ == 2) {
+            key_ = std::move(value);
+        }
+        return true;
+    }
+
+    bool end_object() override {
+        if (depth_-- == 2) {
+            if (!has_role_ || !has_content_) {
+                error = "message without role or content";
+                return false;
+            }
+            // 跳过lc不会产生的角色（例如工具调用），其余历史照常使用
+            if (known_role_) {
+                messages.emplace_back(role_, content_, arena_);
+            }
+        }
+        return true;
+    }
+
+    bool start_array(std::size_t) override {
+        ++depth_;
+        return true;
+    }
+
+    bool end_array() override {
+        --depth_;
+        return true;
+    }
+
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception& e) override {
+        error = e.what();
+        return false;
+    }
+
+private:
+    bool scalar() {
+        if (depth_ == 0) {
+            not_array = true;
+            return false;
+        }
+        if (depth_ == 2 && (key_ == "role" || key_ == "content")) {
+            error = "message " + key_ + " is not a string";
+            return false;
+        }
+        if (depth_ == 1) {
+            error = "message is not an object";
+            return false;
+        }
+        return true;
+    }
+
+    std::shared_ptr<std::pmr::monotonic_buffer_resource> arena_;
+    int depth_ = 0;
+    std::string key_;
+    Role role_ = Role::User;
+    bool known_role_ = false;
+    bool has_role_ = false;
+    bool has_content_ = false;
+    std::string_view content_;
+};
+
+} // namespace
+
 // 加载消息历史
 std::optional<std::vector<Message>> load_messages(const std::filesystem::path& path) {
-    if (!std::filesystem::exists(path)) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
         return std::nullopt;
     }
-    
-    try {
-        std::ifstream file(path);
-        if (!file.is_open()) {
-            return std::nullopt;
-        }
-        
-        nlohmann::json json_data;
-        file >> json_data;
-        
-        if (!json_data.is_array()) {
-            return std::nullopt;
-        }
-        
-        std::vector<Message> messages;
-        for (const auto& msg_json : json_data) {
-            messages.push_back(Message::from_json(msg_json));
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return std::nullopt;
+    }
+
+    // 映射整个文件解析，内容复制进arena后立即解除映射，保存时截断文件不影响已加载的消息
+    size_t size = static_cast<size_t>(st.st_size);
+    void* mapped = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        std::cerr << "Error loading messages: " << std::strerror(errno) << std::endl;
+        return std::nullopt;
+    }
+
+    const char* begin = static_cast<const char*>(mapped);
+    HistoryReader reader(size);
+    bool ok = nlohmann::json::sax_parse(begin, begin + size, &reader);
+    if (mapped) {
+        munmap(mapped, size);
+    }
+
+    if (!ok) {
+        if (!reader.not_array) {
+            std::cerr << "Error loading messages: " << reader.error << std::endl;
         }
-        
-        return messages;
-    } catch (const std::exception& e) {
-        std::cerr << "Error loading messages: " << e.what() << std::endl;
         return std::nullopt;
     }
+    return std::move(reader.messages);
 }
 
 // 保存消息历史
@@ -411,25 +906,16 @@ bool save_messages(
         // 创建父目录(如果不存在)
         std::filesystem::create_directories(path.parent_path());
         
-        // 筛选消息
-        std::vector<Message> filtered_messages;
-        
-        // 过滤系统消息，保留最近的max_history条用户/助手消息
-        for (auto it = messages.rbegin(); it != messages.rend() && filtered_messages.size() < (size_t)max_history * 2; ++it) {
-            if (it->role != "system") {
-                filtered_messages.push_back(*it);
+        // 过滤系统消息，保留最近的max_history条用户/助手消息，只记录起点而不复制
+        size_t limit = static_cast<size_t>(std::max(max_history, 0)) * 2;
+        size_t kept = 0;
+        size_t first = messages.size();
+        while (first > 0 && kept < limit) {
+            if (messages[--first].role != Role::System) {
+                ++kept;
             }
         }
         
-        // 恢复正确顺序
-        std::reverse(filtered_messages.begin(), filtered_messages.end());
-        
-        // 序列化为JSON
-        nlohmann::json json_array = nlohmann::json::array();
-        for (const auto& msg : filtered_messages) {
-            json_array.push_back(msg.to_json());
-        }
-        
         // 写入文件
         std::ofstream file(path);
         if (!file.is_open()) {
@@ -437,7 +923,34 @@ bool save_messages(
             return false;
         }
         
-        file << json_array.dump(2);
+        // 与json.dump(2)的格式一致，逐条写出
+        std::string buffer;
+        bool empty = true;
+        for (size_t i = first; i < messages.size(); ++i) {
+            const Message& msg = messages[i];
+            if (msg.role == Role::System) {
+                continue;
+            }
+            buffer.assign(empty ? "[\n" : ",\n");
+            buffer += "  {\n    \"content\": ";
+            append_json_string(buffer, msg.content());
+            buffer += ",\n    \"role\": \"";
+            buffer += role_name(msg.role);
+            buffer += "\"\n  }";
+            file << buffer;
+            empty = false;
+        }
+        file << (empty ? "[]" : "\n]");
+        file.close();
+        if (!file) {
+            return false;
+        }
+
+        // 新出现的消息写入历史归档与全文索引；索引失败不影响记忆文件本身
+        std::string error;
+        if (!history::index_messages(history::index_dir(path), messages, error)) {
+            std::cerr << "Warning: Failed to update history index: " << error << std::endl;
+        }
         return true;
     } catch (const std::exception& e) {
         std::cerr << "Error saving messages: " << e.what() << std::endl;
@@ -445,14 +958,12 @@ bool save_messages(
     }
 }
 
-// 清除消息历史
+// 清除消息历史，连同由记忆文件派生的历史归档与全文索引
 bool clear_messages(const std::filesystem::path& path) {
     try {
-        if (std::filesystem::exists(path)) {
-            std::filesystem::remove(path);
-            return true;
-        }
-        return true; // 文件不存在也算成功
+        std::filesystem::remove(path);
+        std::filesystem::remove_all(history::index_dir(path)); // 不存在也算成功
+        return true;
     } catch (const std::exception& e) {
         std::cerr << "Error clearing messages: " << e.what() << std::endl;
         return false;
@@ -475,20 +986,18 @@ void show_messages(const std::filesystem::path& path) {
     
     int msg_count = 0;
     for (const auto& msg : messages) {
-        std::string role_display = msg.role;
-        if (role_display == "user") {
-            role_display = "User";
-        } else if (role_display == "assistant") {
-            role_display = "Assistant";
-        } else if (role_display == "system") {
-            role_display = "System";
+        std::string role_display;
+        switch (msg.role) {
+            case Role::User: role_display = "User"; break;
+            case Role::Assistant: role_display = "Assistant"; break;
+            case Role::System: role_display = "System"; break;
         }
         
         std::cout << "[" << role_display << "]:" << std::endl;
         
         // 截断显示过长的消息
         constexpr size_t max_display_length = 500;
-        std::string content = msg.content;
+        std::string_view content = msg.content();
         bool truncated = false;
         
         if (content.length() > max_display_length) {
@@ -0,0 +1,218 @@
+#include "../include/output.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+namespace lc {
+namespace output {
+
+FileWriter::~FileWriter() {
+    close();
+}
+
+bool FileWriter::open(const std::filesystem::path& path, bool sync, std::string& error) {
+    path_ = std::filesystem::absolute(path);
+    sync_ = sync;
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_ < 0) {
+        error = "Cannot open " + path_.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    buffer_.reserve(BUFFER_SIZE);
+    return true;
+}
+
+bool FileWriter::fail(const std::string& what) {
+    if (error_.empty()) {
+        error_ = what + " " + path_.string() + ": " + std::strerror(errno);
+    }
+    return false;
+}
+
+bool FileWriter::write(std::string_view data) {
+    if (fd_ < 0 || !error_.empty()) {
+        return false;
+    }
+    bytes_ += data.size();
+
+    // 放不进缓冲区时先写出已有内容；超过缓冲区大小的增量直接写入，不再复制
+    if (buffer_.size() + data.size() > BUFFER_SIZE && !flush()) {
+        return false;
+    }
+    if (data.size() >= BUFFER_SIZE) {
+        while (!data.empty()) {
+            ssize_t n = ::write(fd_, data.data(), data.size());
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return fail("Failed to write");
+            }
+            data.remove_prefix(static_cast<size_t>(n));
+        }
+        return true;
+    }
+    buffer_.append(data);
+    return true;
+}
+
+bool FileWriter::flush() {
+    if (fd_ < 0 || !error_.empty()) {
+        return false;
+    }
+    size_t offset = 0;
+    while (offset < buffer_.size()) {
+        ssize_t n = ::write(fd_, buffer_.data() + offset, buffer_.size() - offset);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return fail("Failed to write");
+        }
+        offset += static_cast<size_t>(n);
+    }
+    buffer_.clear();
+    return true;
+}
+
+bool FileWriter::close() {
+    if (fd_ < 0) {
+        return error_.empty();
+    }
+    bool ok = flush();
+    if (ok && sync_ && fsync(fd_) != 0) {
+        ok = fail("Failed to fsync");
+    }
+    if (::close(fd_) != 0 && ok) {
+        ok = fail("Failed to close");
+    }
+    fd_ = -1;
+    return ok;
+}
+
+std::string FileWriter::read_back() {
+    std::string content;
+    if (!flush()) {
+        return content;
+    }
+    content.resize(bytes_);
+    size_t offset = 0;
+    int fd = ::open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        content.clear();
+        return content;
+    }
+    while (offset < content.size()) {
+        ssize_t n = pread(fd, &content[offset], content.size() - offset, static_cast<off_t>(offset));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        offset += static_cast<size_t>(n);
+    }
+    ::close(fd);
+    content.resize(offset);
+    return content;
+}
+
+std::string history_excerpt(const std::string& excerpt, const FileWriter& writer) {
+    std::string content = excerpt;
+    if (writer.bytes() > excerpt.size()) {
+        content += "\n[...]";
+    }
+    content += "\n\n[Full response (" + std::to_string(writer.bytes()) + " bytes) written to " +
+               writer.path().string() + "]";
+    return content;
+}
+
+NdjsonWriter::NdjsonWriter(Clock::time_point start, int fd) : start_(start), fd_(fd) {}
+
+double NdjsonWriter::elapsed_ms() const {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start_).count();
+}
+
+// 事件名与时间放在行首，其余字段由各事件追加
+void NdjsonWriter::begin(const char* event) {
+    char prefix[96];
+    std::snprintf(prefix, sizeof(prefix), "{\"event\":\"%s\",\"elapsed_ms\":%.3f", event, elapsed_ms());
+    line_.assign(prefix);
+}
+
+void NdjsonWriter::finish() {
+    line_ += "}\n";
+    if (broken_) {
+        return;
+    }
+
+    size_t offset = 0;
+    while (offset < line_.size()) {
+        ssize_t n = ::write(fd_, line_.data() + offset, line_.size() - offset);
+        if (n >= 0) {
+            offset += static_cast<size_t>(n);
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            // 下游读得慢：等到管道可写，不丢弃也不无限缓存事件
+            pollfd pfd{fd_, POLLOUT, 0};
+            poll(&pfd, 1, -1);
+        } else if (errno != EINTR) {
+            broken_ = true;
+            return;
+        }
+    }
+}
+
+void NdjsonWriter::start(const std::string& model, const std::string& endpoint) {
+    begin("start");
+    line_ += ",\"model\":";
+    openai::append_json_string(line_, model);
+    line_ += ",\"endpoint\":";
+    openai::append_json_string(line_, endpoint);
+    finish();
+}
+
+void NdjsonWriter::delta(const std::string& text) {
+    if (ttft_ms_ < 0) {
+        ttft_ms_ = elapsed_ms();
+    }
+    begin("delta");
+    line_ += ",\"offset\":" + std::to_string(offset_) + ",\"text\":";
+    openai::append_json_string(line_, text);
+    finish();
+    offset_ += text.size();
+    ++deltas_;
+}
+
+void NdjsonWriter::usage(const openai::Usage& usage) {
+    begin("usage");
+    line_ += ",\"prompt_tokens\":" + std::to_string(usage.prompt_tokens) +
+             ",\"completion_tokens\":" + std::to_string(usage.completion_tokens) +
+             ",\"cached_tokens\":" + std::to_string(usage.cached_tokens);
+    finish();
+}
+
+void NdjsonWriter::timing(const openai::ChatCompletionResult& result) {
+    char fields[128];
+    std::snprintf(fields, sizeof(fields), ",\"ttft_ms\":%.3f,\"total_ms\":%.3f", ttft_ms_, elapsed_ms());
+    begin("timing");
+    line_ += fields;
+    line_ += ",\"bytes\":" + std::to_string(offset_) + ",\"deltas\":" + std::to_string(deltas_) +
+             ",\"stopped_early\":" + (result.stopped_early ? "true" : "false") + ",\"stop_reason\":";
+    openai::append_json_string(line_, result.stop_reason);
+    finish();
+}
+
+void NdjsonWriter::error(const std::string& message) {
+    begin("error");
+    line_ += ",\"message\":";
+    openai::append_json_string(line_, message);
+    finish();
+}
+
+} // namespace output
+} // namespace lc
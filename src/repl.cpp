@@ -0,0 +1,582 @@
+#include "../include/repl.h"
+#include "../include/async_client.h"
+#include "../include/docs.h"
+
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <iostream>
+
+namespace lc {
+namespace repl {
+
+namespace {
+
+constexpr char CTRL_A = 0x01;
+constexpr char CTRL_B = 0x02;
+constexpr char CTRL_C = 0x03;
+constexpr char CTRL_D = 0x04;
+constexpr char CTRL_E = 0x05;
+constexpr char CTRL_F = 0x06;
+constexpr char CTRL_K = 0x0B;
+constexpr char CTRL_L = 0x0C;
+constexpr char CTRL_N = 0x0E;
+constexpr char CTRL_P = 0x10;
+constexpr char CTRL_U = 0x15;
+constexpr char CTRL_W = 0x17;
+constexpr char ESC = 0x1B;
+constexpr char BACKSPACE = 0x7F;
+
+const std::string PASTE_END = "\x1b[201~";
+
+// 用户消息在历史中的前缀，与单次调用时get_query的格式一致
+const std::string QUERY_PREFIX = "Query: ";
+
+size_t utf8_length(unsigned char lead) {
+    return lead < 0x80 ? 1 : (lead >> 5) == 0x6 ? 2 : (lead >> 4) == 0xE ? 3 : 4;
+}
+
+// 从pos向前找到上一个字符的起始字节
+size_t previous_char(const std::string& text, size_t pos) {
+    if (pos == 0) {
+        return 0;
+    }
+    --pos;
+    while (pos > 0 && (static_cast<unsigned char>(text[pos]) & 0xC0) == 0x80) {
+        --pos;
+    }
+    return pos;
+}
+
+size_t next_char(const std::string& text, size_t pos) {
+    if (pos >= text.size()) {
+        return text.size();
+    }
+    return std::min(text.size(), pos + utf8_length(static_cast<unsigned char>(text[pos])));
+}
+
+// 一个显示单元：换行显示为↵，CJK等宽字符占2列
+struct Cell {
+    std::string glyph;
+    size_t width;
+};
+
+std::vector<Cell> to_cells(const std::string& text, size_t begin, size_t end) {
+    std::vector<Cell> cells;
+    for (size_t i = begin; i < end;) {
+        size_t next = next_char(text, i);
+        if (text[i] == '\n') {
+            cells.push_back({"↵", 1});
+        } else if (static_cast<unsigned char>(text[i]) < 0x20) {
+            cells.push_back({"?", 1});
+        } else {
+            cells.push_back({text.substr(i, next - i), next - i >= 3 ? 2u : 1u});
+        }
+        i = next;
+    }
+    return cells;
+}
+
+size_t terminal_columns() {
+    struct winsize size {};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+        return size.ws_col;
+    }
+    return 80;
+}
+
+bool read_byte(char& c) {
+    while (true) {
+        ssize_t n = read(STDIN_FILENO, &c, 1);
+        if (n == 1) {
+            return true;
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        return false;
+    }
+}
+
+void write_out(const std::string& data) {
+    size_t offset = 0;
+    while (offset < data.size()) {
+        ssize_t n = write(STDOUT_FILENO, data.data() + offset, data.size() - offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return;
+        }
+        offset += static_cast<size_t>(n);
+    }
+}
+
+// 会话期间Ctrl-C只取消进行中的请求，不退出进程；提示符下由行编辑器处理
+void handle_interrupt(int) {
+    openai::request_cancel();
+}
+
+} // namespace
+
+struct LineEditor::TermState {
+    termios original;
+};
+
+LineEditor::LineEditor()
+    : interactive_(isatty(STDIN_FILENO) && isatty(STDOUT_FILENO)), saved_(std::make_unique<TermState>()) {}
+
+LineEditor::~LineEditor() {
+    disable_raw_mode();
+}
+
+bool LineEditor::enable_raw_mode() {
+    if (tcgetattr(STDIN_FILENO, &saved_->original) != 0) {
+        return false;
+    }
+
+    termios raw = saved_->original;
+    raw.c_iflag &= ~static_cast<tcflag_t>(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+    raw.c_cflag |= CS8;
+    raw.c_lflag &= ~static_cast<tcflag_t>(ECHO | ICANON | IEXTEN | ISIG);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) != 0) {
+        return false;
+    }
+
+    // 开启bracketed paste，粘贴的内容整体作为输入，其中的换行不会提交
+    write_out("\x1b[?2004h");
+    raw_ = true;
+    return true;
+}
+
+void LineEditor::disable_raw_mode() {
+    if (raw_) {
+        write_out("\x1b[?2004l");
+        tcsetattr(STDIN_FILENO, TCSAFLUSH, &saved_->original);
+        raw_ = false;
+    }
+}
+
+void LineEditor::add_history(const std::string& line) {
+    if (!line.empty() && (history_.empty() || history_.back() != line)) {
+        history_.push_back(line);
+    }
+}
+
+// 单行显示：内容超出终端宽度时水平滚动，保证光标可见
+void LineEditor::refresh(const std::string& prompt, const std::string& buffer, size_t cursor) {
+    size_t columns = terminal_columns();
+    size_t available = columns > prompt.size() + 1 ? columns - prompt.size() - 1 : 1;
+
+    std::vector<Cell> before = to_cells(buffer, 0, cursor);
+    std::vector<Cell> after = to_cells(buffer, cursor, buffer.size());
+
+    size_t first = before.size();
+    size_t cursor_width = 0;
+    while (first > 0 && cursor_width + before[first - 1].width <= available) {
+        cursor_width += before[--first].width;
+    }
+
+    std::string line = "\r" + prompt;
+    for (size_t i = first; i < before.size(); ++i) {
+        line += before[i].glyph;
+    }
+    size_t used = cursor_width;
+    for (const auto& cell : after) {
+        if (used + cell.width > available) {
+            break;
+        }
+        line += cell.glyph;
+        used += cell.width;
+    }
+    line += "\x1b[K\r";
+    size_t offset = prompt.size() + cursor_width;
+    if (offset > 0) {
+        line += "\x1b[" + std::to_string(offset) + "C";
+    }
+    write_out(line);
+}
+
+LineEditor::Status LineEditor::read_line(const std::string& prompt, std::string& line) {
+    line.clear();
+
+    if (!interactive_ || !enable_raw_mode()) {
+        if (interactive_) {
+            std::cout << prompt << std::flush;
+        }
+        return std::getline(std::cin, line) ? Status::Line : Status::Eof;
+    }
+
+    std::string buffer;
+    size_t cursor = 0;
+    size_t history_index = history_.size();
+    std::string editing;  // 浏览历史前正在编辑的内容
+
+    auto finish = [&](Status status) {
+        disable_raw_mode();
+        write_out("\n");
+        line = buffer;
+        return status;
+    };
+
+    auto insert = [&](const std::string& text) {
+        buffer.insert(cursor, text);
+        cursor += text.size();
+    };
+
+    auto recall = [&](size_t index) {
+        if (history_index == history_.size()) {
+            editing = buffer;
+        }
+        history_index = index;
+        buffer = history_index == history_.size() ? editing : history_[history_index];
+        cursor = buffer.size();
+    };
+
+    refresh(prompt, buffer, cursor);
+
+    char c;
+    while (read_byte(c)) {
+        switch (c) {
+        case '\r':
+        case '\n':
+            // 行尾的反斜杠表示续行
+            if (cursor == buffer.size() && !buffer.empty() && buffer.back() == '\\') {
+                buffer.back() = '\n';
+                break;
+            }
+            return finish(Status::Line);
+        case CTRL_C:
+            write_out("^C");
+            buffer.clear();
+            return finish(Status::Interrupted);
+        case CTRL_D:
+            if (buffer.empty()) {
+                return finish(Status::Eof);
+            }
+            buffer.erase(cursor, next_char(buffer, cursor) - cursor);
+            break;
+        case BACKSPACE:
+        case '\b':
+            if (cursor > 0) {
+                size_t start = previous_char(buffer, cursor);
+                buffer.erase(start, cursor - start);
+                cursor = start;
+            }
+            break;
+        case CTRL_A:
+            cursor = 0;
+            break;
+        case CTRL_E:
+            cursor = buffer.size();
+            break;
+        case CTRL_B:
+            cursor = previous_char(buffer, cursor);
+            break;
+        case CTRL_F:
+            cursor = next_char(buffer, cursor);
+            break;
+        case CTRL_P:
+            if (history_index > 0) {
+                recall(history_index - 1);
+            }
+            break;
+        case CTRL_N:
+            if (history_index < history_.size()) {
+                recall(history_index + 1);
+            }
+            break;
+        case CTRL_U:
+            buffer.erase(0, cursor);
+            cursor = 0;
+            break;
+        case CTRL_K:
+            buffer.erase(cursor);
+            break;
+        case CTRL_W: {
+            size_t start = cursor;
+            while (start > 0 && buffer[start - 1] == ' ') {
+                --start;
+            }
+            while (start > 0 && buffer[start - 1] != ' ') {
+                --start;
+            }
+            buffer.erase(start, cursor - start);
+            cursor = start;
+            break;
+        }
+        case CTRL_L:
+            write_out("\x1b[H\x1b[2J");
+            break;
+        case ESC: {
+            char kind, key;
+            if (!read_byte(kind) || !read_byte(key)) {
+                return finish(Status::Eof);
+            }
+            if (kind == 'O') {
+                cursor = key == 'H' ? 0 : key == 'F' ? buffer.size() : cursor;
+                break;
+            }
+            if (kind != '[') {
+                break;
+            }
+
+            std::string code;
+            while (key >= '0' && key <= '9') {
+                code += key;
+                if (!read_byte(key)) {
+                    return finish(Status::Eof);
+                }
+            }
+
+            if (key == '~') {
+                if (code == "200") {
+                    // 粘贴内容原样插入，直到结束标记
+                    std::string pasted;
+                    while (read_byte(c)) {
+                        pasted += c;
+                        if (pasted.size() >= PASTE_END.size() &&
+                            pasted.compare(pasted.size() - PASTE_END.size(), PASTE_END.size(), PASTE_END) == 0) {
+                            pasted.erase(pasted.size() - PASTE_END.size());
+                            break;
+                        }
+                    }
+                    for (char& ch : pasted) {
+                        if (ch == '\r') {
+                            ch = '\n';
+                        }
+                    }
+                    insert(pasted);
+                } else if (code == "3") {
+                    buffer.erase(cursor, next_char(buffer, cursor) - cursor);
+                } else if (code == "1" || code == "7") {
+                    cursor = 0;
+                } else if (code == "4" || code == "8") {
+                    cursor = buffer.size();
+                }
+                break;
+            }
+
+            switch (key) {
+            case 'A':
+                if (history_index > 0) {
+                    recall(history_index - 1);
+                }
+                break;
+            case 'B':
+                if (history_index < history_.size()) {
+                    recall(history_index + 1);
+                }
+                break;
+            case 'C':
+                cursor = next_char(buffer, cursor);
+                break;
+            case 'D':
+                cursor = previous_char(buffer, cursor);
+                break;
+            case 'H':
+                cursor = 0;
+                break;
+            case 'F':
+                cursor = buffer.size();
+                break;
+            default:
+                break;
+            }
+            break;
+        }
+        default:
+            if (static_cast<unsigned char>(c) >= 0x20 || c == '\t') {
+                // 多字节字符一次读完整再插入
+                std::string text(1, c);
+                size_t len = utf8_length(static_cast<unsigned char>(c));
+                for (size_t i = 1; i < len && read_byte(c); ++i) {
+                    text += c;
+                }
+                insert(text);
+            }
+            break;
+        }
+        refresh(prompt, buffer, cursor);
+    }
+
+    return finish(Status::Eof);
+}
+
+MemoryWriter::MemoryWriter(std::filesystem::path path, int max_history)
+    : path_(std::move(path)), max_history_(max_history), thread_([this]() { run(); }) {}
+
+MemoryWriter::~MemoryWriter() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+void MemoryWriter::save(std::vector<openai::Message> messages) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_ = std::move(messages);
+    }
+    cv_.notify_one();
+}
+
+void MemoryWriter::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this]() { return pending_ || stopping_; });
+        if (!pending_) {
+            return;
+        }
+
+        std::vector<openai::Message> messages = std::move(*pending_);
+        pending_.reset();
+        lock.unlock();
+        if (!openai::save_messages(messages, path_, max_history_)) {
+            std::cerr << "Warning: Failed to save conversation history" << std::endl;
+        }
+        lock.lock();
+    }
+}
+
+int run(const Config& config, const Session& session) {
+    auto memory_path = Config::memory_path();
+
+    // 会话从记忆文件继续，历史只在启动时解析一次
+    std::vector<openai::Message> history;
+    if (auto previous = openai::load_messages(memory_path)) {
+        history = std::move(*previous);
+    }
+    MemoryWriter writer(memory_path, config.max_history);
+
+    // 两种引擎都在会话内复用连接：阻塞客户端通过连接池，异步引擎通过空闲连接池保持HTTP/1.1 keep-alive，协商到HTTP/2时共享同一条连接
+    openai::ConnectionPool connections;
+    std::unique_ptr<openai::AsyncEngine> engine;
+    openai::StreamOptions options = session.options;
+    if (config.http_engine == "async") {
+        engine = std::make_unique<openai::AsyncEngine>();
+        options.engine = engine.get();
+    } else {
+        options.connections = &connections;
+    }
+
+    struct sigaction action {};
+    action.sa_handler = handle_interrupt;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+
+    openai::Message system_prompt(openai::Role::System, config.system_prompt);
+
+    // 本地文档索引在会话开始时映射一次，每次提问只做一次检索
+    docs::Index local_docs;
+    std::string docs_error;
+    bool grounded = config.local_docs && local_docs.open(Config::docs_index_dir(), docs_error);
+
+    LineEditor editor;
+    for (const auto& message : history) {
+        std::string_view content = message.content();
+        if (message.role == openai::Role::User && content.substr(0, QUERY_PREFIX.size()) == QUERY_PREFIX) {
+            editor.add_history(std::string(content.substr(QUERY_PREFIX.size())));
+        }
+    }
+
+    std::string line;
+    while (true) {
+        auto status = editor.read_line("lc> ", line);
+        if (status == LineEditor::Status::Eof) {
+            break;
+        }
+        if (status == LineEditor::Status::Interrupted) {
+            continue;
+        }
+
+        std::string query = openai::trim(line);
+        if (query.empty()) {
+            continue;
+        }
+        if (query == "/exit" || query == "/quit") {
+            break;
+        }
+        editor.add_history(query);
+        if (query == "/clear") {
+            history.clear();
+            writer.save(history);
+            std::cout << "Conversation memory has been cleared." << std::endl;
+            continue;
+        }
+
+        // 历史消息与系统提示共享内容存储，组装请求只复制引用
+        std::vector<openai::Message> messages;
+        messages.reserve(history.size() + 3);
+        if (session.use_system_prompt && config.use_system_prompt) {
+            messages.push_back(system_prompt);
+        }
+        messages.insert(messages.end(), history.begin(), history.end());
+        if (grounded) {
+            auto matches = local_docs.search(query, docs::GROUNDING_SNIPPETS);
+            std::string grounding = docs::grounding(matches, docs::GROUNDING_BYTES);
+            if (!grounding.empty()) {
+                messages.emplace_back(openai::Role::System, std::move(grounding));
+            }
+        }
+        messages.emplace_back(openai::Role::User, QUERY_PREFIX + query);
+
+        bool need_newline_at_end = false;
+        auto start = std::chrono::steady_clock::now();
+        if (session.deadline.count() > 0) {
+            options.deadline = start + session.deadline;
+        }
+        openai::reset_cancel();
+        auto result = openai::chat_completion_stream(config, messages,
+            [&need_newline_at_end](const std::string& delta, bool is_done) {
+                if (!is_done && !delta.empty()) {
+                    std::cout << delta << std::flush;
+                    need_newline_at_end = delta.back() != '\n';
+                }
+            }, session.model_override, session.debug, options);
+
+        if (need_newline_at_end) {
+            std::cout << std::endl;
+        }
+        if (session.debug) {
+            std::cerr << "Answered in " << std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start).count() << " ms, usage: "
+                      << openai::format_usage(result.usage) << std::endl;
+        }
+
+        // 失败的提问不进入历史，可以直接重试
+        if (!result.success) {
+            std::cerr << "Error: " << result.error_message << std::endl;
+            continue;
+        }
+        bool interrupted = result.stopped_early && result.stop_reason == "interrupted";
+        if (interrupted && result.full_response.empty()) {
+            continue;
+        }
+
+        history.push_back(std::move(messages.back()));
+        history.emplace_back(openai::Role::Assistant, std::move(result.full_response));
+
+        // 与save_messages保留的窗口一致，请求体不会随会话无限增长
+        size_t keep = static_cast<size_t>(std::max(0, config.max_history)) * 2;
+        if (history.size() > keep) {
+            history.erase(history.begin(), history.end() - static_cast<std::ptrdiff_t>(keep));
+        }
+        writer.save(history);
+    }
+
+    openai::reset_cancel();
+    return 0;
+}
+
+} // namespace repl
+} // namespace lc
@@ -0,0 +1,343 @@
+#include "../include/stream.h"
+#include "../include/compression.h"
+#include <algorithm>
+#include <iostream>
+#include <string_view>
+
+namespace lc {
+namespace openai {
+
+// 构造聊天完成请求：解析端点、拼接路径、序列化并按需压缩请求体
+bool prepare_chat_request(
+    const Config& config,
+    const std::vector<Message>& messages,
+    const std::string& model_override,
+    bool stream,
+    const std::string& assistant_prefix,
+    PreparedRequest& request,
+    std::string& error_message,
+    bool debug
+) {
+    // 准备请求URL
+    std::string model;
+    Endpoint endpoint = config.resolve_endpoint(model_override, model);
+    request.url_base = normalize_api_url(endpoint.base_url);
+    request.latency_key = latency::key(model, endpoint.name);
+
+    if (!parse_api_url(request.url_base, request.api_url, debug)) {
+        error_message = "Invalid base URL: " + request.url_base;
+        return false;
+    }
+
+    if (!parse_dialect(endpoint.dialect, request.dialect)) {
+        error_message = "Unknown dialect: " + endpoint.dialect;
+        return false;
+    }
+
+    // 移除前缀末尾的斜杠，避免路径中有双斜杠
+    std::string path_prefix = request.api_url.path_prefix;
+    if (!path_prefix.empty() && path_prefix.back() == '/') {
+        path_prefix.pop_back();
+    }
+
+    // 路径、请求头与请求体的格式由方言决定
+    request.headers = {
+        {"Content-Type", "application/json"}
+    };
+    BodyParams params{messages, model, stream, assistant_prefix, config.prefix_cache, debug};
+    std::string body = visit_dialect(request.dialect, [&](auto policy) {
+        using Policy = decltype(policy);
+        request.path = path_prefix + Policy::path;
+        Policy::add_headers(endpoint.api_key, stream, request.headers);
+        return Policy::body(params);
+    });
+
+    if (debug) {
+        std::cerr << "Request URL: " << request.api_url.scheme << "://" << request.api_url.host << request.path
+                  << " (" << dialect_name(request.dialect) << ")" << std::endl;
+        std::cerr << "Request body: " << body << std::endl;
+    }
+
+    // 按端点配置压缩较大的请求体
+    const std::string& encoding = endpoint.request_compression;
+    if (encoding != "none" && !encoding.empty() && body.size() >= config.compression_threshold) {
+        std::string compressed;
+        if (compression::is_supported(encoding) && compression::compress(encoding, body, compressed)) {
+            if (debug) {
+                std::cerr << "Request body compressed with " << encoding << ": "
+                          << body.size() << " -> " << compressed.size() << " bytes" << std::endl;
+            }
+            request.headers.emplace_back("Content-Encoding", encoding);
+            request.body = std::move(compressed);
+            return true;
+        }
+
+        if (debug) {
+            std::cerr << "Request compression '" << encoding << "' unavailable, sending uncompressed" << std::endl;
+        }
+    }
+
+    request.body = std::move(body);
+    return true;
+}
+
+latency::Timeouts request_timeouts(const StreamOptions& options, const PreparedRequest& request, bool debug) {
+    latency::Timeouts timeouts = options.latency ? options.latency->timeouts(request.latency_key) : options.timeouts;
+    if (options.deadline != latency::Clock::time_point::max()) {
+        timeouts = latency::within_budget(timeouts, std::chrono::duration_cast<latency::Millis>(
+            options.deadline - latency::Clock::now()));
+    }
+
+    if (debug) {
+        std::cerr << "Timeouts for " << request.latency_key << ": connect " << timeouts.connect.count()
+                  << " ms, first token " << timeouts.first_token.count()
+                  << " ms, inter-token " << timeouts.inter_token.count() << " ms" << std::endl;
+    }
+    return timeouts;
+}
+
+Usage parse_usage(const nlohmann::json& usage) {
+    Usage result;
+    auto number = [](const nlohmann::json& node, const char* key) {
+        return node.contains(key) && node[key].is_number_integer() ? node[key].get<long>() : -1L;
+    };
+
+    result.prompt_tokens = number(usage, "prompt_tokens");
+    result.completion_tokens = number(usage, "completion_tokens");
+    if (usage.contains("prompt_tokens_details") && usage["prompt_tokens_details"].is_object()) {
+        result.cached_tokens = number(usage["prompt_tokens_details"], "cached_tokens");
+    }
+    if (result.cached_tokens < 0) {
+        result.cached_tokens = number(usage, "prompt_cache_hit_tokens");
+    }
+    return result;
+}
+
+// 回退到UTF-8字符边界，避免截断出半个字符
+static size_t utf8_boundary(const std::string& text, size_t pos) {
+    while (pos > 0 && pos < text.size() && (static_cast<unsigned char>(text[pos]) & 0xC0) == 0x80) {
+        --pos;
+    }
+    return pos;
+}
+
+size_t StopEvaluator::accept(const std::string& delta, std::string& reason) {
+    size_t allowed = delta.size();
+
+    if (conditions_.max_bytes > 0) {
+        size_t remaining = conditions_.max_bytes - std::min(conditions_.max_bytes, bytes_);
+        if (delta.size() >= remaining) {
+            allowed = utf8_boundary(delta, remaining);
+            reason = "max-bytes";
+        }
+    }
+
+    if (conditions_.max_lines > 0) {
+        size_t lines = lines_;
+        for (size_t i = 0; i < allowed; ++i) {
+            if (delta[i] == '\n' && ++lines >= conditions_.max_lines) {
+                allowed = i;
+                reason = "max-lines";
+                break;
+            }
+        }
+    }
+
+    if (conditions_.until) {
+        // 只在当前行内匹配，已输出的行不会再被扫描
+        std::string candidate = current_line_ + delta.substr(0, allowed);
+        size_t line_start = 0;
+        while (line_start <= candidate.size()) {
+            size_t line_end = candidate.find('\n', line_start);
+            if (line_end == std::string::npos) {
+                line_end = candidate.size();
+            }
+
+            std::smatch match;
+            auto begin = candidate.cbegin() + line_start;
+            auto end = candidate.cbegin() + line_end;
+            if (std::regex_search(begin, end, match, *conditions_.until)) {
+                size_t match_end = line_start + match.position(0) + match.length(0);
+                allowed = match_end > current_line_.size() ? match_end - current_line_.size() : 0;
+                reason = "until";
+                break;
+            }
+            line_start = line_end + 1;
+        }
+    }
+
+    // 更新已输出的统计
+    for (size_t i = 0; i < allowed; ++i) {
+        if (delta[i] == '\n') {
+            ++lines_;
+            current_line_.clear();
+        } else {
+            current_line_ += delta[i];
+        }
+    }
+    bytes_ += allowed;
+
+    return allowed;
+}
+
+std::string ResumeFilter::filter(const std::string& delta) {
+    if (passthrough_) {
+        return delta;
+    }
+
+    pending_ += delta;
+    size_t common = std::min(pending_.size(), prefix_.size());
+    if (prefix_.compare(0, common, pending_, 0, common) != 0) {
+        // 与已有内容不同，说明模型是在接着写
+        passthrough_ = true;
+        return std::move(pending_);
+    }
+
+    if (pending_.size() < prefix_.size()) {
+        // 仍可能是在重放已有内容，先暂存
+        return "";
+    }
+
+    // 完整重放了已有内容，只输出其后的部分
+    passthrough_ = true;
+    return pending_.substr(prefix_.size());
+}
+
+StreamProcessor::StreamProcessor(const StreamCallback& callback, const StreamOptions& options, bool debug)
+    : callback_(callback),
+      options_(options),
+      debug_(debug),
+      stop_evaluator_(options.stop),
+      resume_filter_("") {}
+
+void StreamProcessor::begin_attempt(Dialect dialect) {
+    dialect_ = dialect;
+    parser_ = LineParser();
+    resume_filter_ = ResumeFilter(resume_prefix());
+    done_ = false;
+
+    auto now = latency::Clock::now().time_since_epoch().count();
+    attempt_start_.store(now, std::memory_order_relaxed);
+    last_activity_.store(now, std::memory_order_relaxed);
+    has_response_.store(false, std::memory_order_relaxed);
+    has_content_.store(false, std::memory_order_relaxed);
+}
+
+latency::Clock::time_point StreamProcessor::attempt_start() const {
+    return latency::Clock::time_point(latency::Clock::duration(attempt_start_.load(std::memory_order_relaxed)));
+}
+
+latency::Clock::time_point StreamProcessor::last_activity() const {
+    return latency::Clock::time_point(latency::Clock::duration(last_activity_.load(std::memory_order_relaxed)));
+}
+
+bool StreamProcessor::feed(const char* data, size_t len) {
+    if (cancel_requested()) {
+        stop("interrupted");
+        return false;
+    }
+
+    // 收到内容之后的数据块间隔计入token间隔；首个内容之前的等待由首token延迟衡量
+    auto now = latency::Clock::now();
+    if (has_content()) {
+        latency_.inter_token.add(std::chrono::duration<double, std::milli>(now - last_activity()).count());
+    }
+    last_activity_.store(now.time_since_epoch().count(), std::memory_order_relaxed);
+    has_response_.store(true, std::memory_order_relaxed);
+
+    return visit_dialect(dialect_, [&](auto policy) {
+        return feed_as<decltype(policy)>(data, len);
+    });
+}
+
+template <typename Policy>
+bool StreamProcessor::feed_as(const char* data, size_t len) {
+    return parser_.feed<typename Policy::Framing>(data, len, [this](std::string_view payload) {
+        event_.reset();
+        Policy::parse(payload, event_, usage_);
+        return handle_event();
+    });
+}
+
+void StreamProcessor::stop(const std::string& reason) {
+    if (!stopped_early_) {
+        stopped_early_ = true;
+        stop_reason_ = reason;
+    }
+}
+
+bool StreamProcessor::handle_event() {
+    if (!event_.error.empty()) {
+        error_ = event_.error;
+        if (debug_) {
+            std::cerr << "Stream error: " << error_ << std::endl;
+        }
+        return false;
+    }
+
+    if (!event_.delta.empty()) {
+        if (!has_content()) {
+            has_content_.store(true, std::memory_order_relaxed);
+            // 只记录第一次收到内容的尝试；续传重放已有内容不代表模型的首token延迟
+            if (!first_token_recorded_) {
+                first_token_recorded_ = true;
+                latency_.first_token.add(std::chrono::duration<double, std::milli>(
+                    last_activity() - attempt_start()).count());
+            }
+        }
+        std::string content_delta = resume_filter_.filter(event_.delta);
+        if (!content_delta.empty() && !emit(std::move(content_delta))) {
+            return false;
+        }
+    }
+
+    // 处理流结束标记
+    if (event_.done) {
+        done_ = true;
+    }
+    return true;
+}
+
+// 输出一段经过去重的新内容，返回false表示触发了停止条件
+bool StreamProcessor::emit(std::string delta) {
+    if (!options_.stop.empty()) {
+        std::string reason;
+        size_t allowed = stop_evaluator_.accept(delta, reason);
+        if (!reason.empty()) {
+            delta.resize(allowed);
+            if (!delta.empty()) {
+                append(delta);
+            }
+            stop(reason);
+            return false;
+        }
+    }
+
+    append(delta);
+    return true;
+}
+
+void StreamProcessor::append(const std::string& delta) {
+    size_t room = options_.retain_bytes - std::min(options_.retain_bytes, accumulated_.size());
+    if (delta.size() <= room) {
+        accumulated_ += delta;
+    } else if (room > 0) {
+        accumulated_.append(delta, 0, utf8_boundary(delta, room));
+    }
+    received_bytes_ += delta.size();
+    callback_(delta, false);
+}
+
+bool StreamProcessor::can_resume() const {
+    return received_bytes_ == accumulated_.size() || options_.reload_response;
+}
+
+std::string StreamProcessor::resume_prefix() const {
+    if (received_bytes_ == accumulated_.size()) {
+        return accumulated_;
+    }
+    return options_.reload_response ? options_.reload_response() : accumulated_;
+}
+
+} // namespace openai
+} // namespace lc
@@ -0,0 +1,497 @@
+#include "../include/text_index.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+
+namespace lc {
+namespace text_index {
+
+namespace {
+
+constexpr char MAGIC[4] = {'L', 'C', 'I', 'X'};
+constexpr uint32_t VERSION = 1;
+
+// BM25参数
+constexpr double K1 = 1.2;
+constexpr double B = 0.75;
+
+// 文档频率超过总文档数的这一比例（1/N）时视为常见词
+constexpr uint64_t COMMON_TERM_DIVISOR = 4;
+
+struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t doc_count;
+    uint32_t term_count;
+    uint64_t total_length;
+    uint64_t posting_count;
+    uint64_t docs_offset;
+    uint64_t terms_offset;
+    uint64_t postings_offset;
+};
+
+enum class CharClass { Separator, Word, Cjk };
+
+// 解码一个UTF-8字符，返回其字节数；非法字节按单字节分隔符处理
+size_t decode(std::string_view text, size_t pos, uint32_t& cp) {
+    unsigned char c = static_cast<unsigned char>(text[pos]);
+    size_t length = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+    if (length == 0 || pos + length > text.size()) {
+        cp = 0xFFFD;
+        return 1;
+    }
+    if (length == 1) {
+        cp = c;
+        return 1;
+    }
+    cp = c & (0x7F >> length);
+    for (size_t i = 1; i < length; ++i) {
+        unsigned char next = static_cast<unsigned char>(text[pos + i]);
+        if ((next & 0xC0) != 0x80) {
+            cp = 0xFFFD;
+            return 1;
+        }
+        cp = (cp << 6) | (next & 0x3F);
+    }
+    return length;
+}
+
+CharClass classify(uint32_t cp) {
+    if (cp < 0x80) {
+        bool word = (cp >= 'a' && cp <= 'z') || (cp >= 'A' && cp <= 'Z') || (cp >= '0' && cp <= '9') || cp == '_';
+        return word ? CharClass::Word : CharClass::Separator;
+    }
+    if ((cp >= 0x3040 && cp <= 0x30FF) || (cp >= 0x3400 && cp <= 0x4DBF) || (cp >= 0x4E00 && cp <= 0x9FFF) ||
+        (cp >= 0xAC00 && cp <= 0xD7AF) || (cp >= 0xF900 && cp <= 0xFAFF) || (cp >= 0x20000 && cp <= 0x2FFFF)) {
+        return CharClass::Cjk;
+    }
+    // 拉丁补充中的标点、通用标点、中日韩标点与全角符号，以及非法字节
+    if (cp <= 0xBF || (cp >= 0x2000 && cp <= 0x206F) || (cp >= 0x3000 && cp <= 0x303F) ||
+        (cp >= 0xFF00 && cp <= 0xFFEF) || cp == 0xFFFD) {
+        return CharClass::Separator;
+    }
+    return CharClass::Word;
+}
+
+bool write_all(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = ::write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += n;
+        size -= static_cast<size_t>(n);
+    }
+    return true;
+}
+
+} // namespace
+
+bool Tokenizer::next(std::string& term) {
+    term.clear();
+    while (pos_ < text_.size()) {
+        uint32_t cp;
+        size_t length = decode(text_, pos_, cp);
+        CharClass cls = classify(cp);
+
+        if (cls == CharClass::Cjk) {
+            // 与下一个字组成双字词，只前进一个字，相邻的词互相重叠
+            size_t next_pos = pos_ + length;
+            uint32_t next_cp = 0;
+            size_t next_length = next_pos < text_.size() ? decode(text_, next_pos, next_cp) : 0;
+            bool pair = next_length > 0 && classify(next_cp) == CharClass::Cjk;
+            bool single = !pair && !in_cjk_run_;
+            begin_ = pos_;
+            end_ = pair ? next_pos + next_length : next_pos;
+            pos_ = next_pos;
+            in_cjk_run_ = pair;
+            if (pair || single) {
+                term.assign(text_.data() + begin_, end_ - begin_);
+                return true;
+            }
+            continue;
+        }
+        in_cjk_run_ = false;
+
+        if (cls == CharClass::Separator) {
+            pos_ += length;
+            continue;
+        }
+
+        begin_ = pos_;
+        while (pos_ < text_.size()) {
+            length = decode(text_, pos_, cp);
+            if (classify(cp) != CharClass::Word) {
+                break;
+            }
+            if (term.size() + length <= MAX_TERM_BYTES) {
+                for (size_t i = 0; i < length; ++i) {
+                    char c = text_[pos_ + i];
+                    term.push_back(c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c);
+                }
+            }
+            pos_ += length;
+        }
+        end_ = pos_;
+        return true;
+    }
+    return false;
+}
+
+uint64_t term_hash(std::string_view term) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (char c : term) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+Segment::~Segment() {
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+}
+
+bool Segment::open(const std::filesystem::path& path, std::string& error) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = "Cannot open " + path.string() + ": " + std::strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header)) {
+        ::close(fd);
+        error = "Invalid index segment " + path.string();
+        return false;
+    }
+    size_t size = static_cast<size_t>(st.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        error = "Cannot map " + path.string() + ": " + std::strerror(errno);
+        return false;
+    }
+
+    const Header* header = static_cast<const Header*>(data);
+    bool valid = std::memcmp(header->magic, MAGIC, sizeof(MAGIC)) == 0 && header->version == VERSION &&
+                 header->docs_offset + header->doc_count * sizeof(DocEntry) <= size &&
+                 header->terms_offset + header->term_count * sizeof(TermEntry) <= size &&
+                 header->postings_offset + header->posting_count * sizeof(Posting) <= size;
+    if (!valid) {
+        munmap(data, size);
+        error = "Invalid index segment " + path.string();
+        return false;
+    }
+
+    data_ = data;
+    size_ = size;
+    const char* base = static_cast<const char*>(data);
+    docs_ = reinterpret_cast<const DocEntry*>(base + header->docs_offset);
+    terms_ = reinterpret_cast<const TermEntry*>(base + header->terms_offset);
+    postings_ = reinterpret_cast<const Posting*>(base + header->postings_offset);
+    return true;
+}
+
+uint32_t Segment::doc_count() const {
+    return static_cast<const Header*>(data_)->doc_count;
+}
+
+uint64_t Segment::total_length() const {
+    return static_cast<const Header*>(data_)->total_length;
+}
+
+uint32_t Segment::term_count() const {
+    return static_cast<const Header*>(data_)->term_count;
+}
+
+const TermEntry* Segment::find(uint64_t hash) const {
+    const TermEntry* end = terms_ + term_count();
+    const TermEntry* it = std::lower_bound(terms_, end, hash,
+                                           [](const TermEntry& entry, uint64_t h) { return entry.hash < h; });
+    return it != end && it->hash == hash ? it : nullptr;
+}
+
+uint32_t SegmentBuilder::add(uint64_t ref, std::string_view text) {
+    uint32_t doc = static_cast<uint32_t>(docs_.size());
+    uint32_t length = 0;
+
+    Tokenizer tokenizer(text);
+    std::string term;
+    while (tokenizer.next(term)) {
+        std::vector<Posting>& list = postings_[term_hash(term)];
+        // 同一文档的词连续出现在倒排表末尾
+        if (!list.empty() && list.back().doc == doc) {
+            ++list.back().tf;
+        } else {
+            list.push_back(Posting{doc, 1});
+        }
+        ++length;
+    }
+
+    docs_.push_back(DocEntry{ref, length, 0});
+    total_length_ += length;
+    return doc;
+}
+
+void SegmentBuilder::add_segment(const Segment& segment) {
+    uint32_t base = static_cast<uint32_t>(docs_.size());
+    for (uint32_t i = 0; i < segment.doc_count(); ++i) {
+        docs_.push_back(segment.doc(i));
+    }
+    total_length_ += segment.total_length();
+
+    for (uint32_t i = 0; i < segment.term_count(); ++i) {
+        const TermEntry& entry = segment.term(i);
+        const Posting* postings = segment.postings_at(entry);
+        std::vector<Posting>& list = postings_[entry.hash];
+        list.reserve(list.size() + entry.df);
+        for (uint32_t j = 0; j < entry.df; ++j) {
+            list.push_back(Posting{base + postings[j].doc, postings[j].tf});
+        }
+    }
+}
+
+bool SegmentBuilder::write(const std::filesystem::path& path, std::string& error) const {
+    std::vector<TermEntry> terms;
+    terms.reserve(postings_.size());
+    uint64_t posting_count = 0;
+    for (const auto& entry : postings_) {
+        terms.push_back(TermEntry{entry.first, 0, static_cast<uint32_t>(entry.second.size()), 0});
+        posting_count += entry.second.size();
+    }
+    std::sort(terms.begin(), terms.end(), [](const TermEntry& a, const TermEntry& b) { return a.hash < b.hash; });
+
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.doc_count = static_cast<uint32_t>(docs_.size());
+    header.term_count = static_cast<uint32_t>(terms.size());
+    header.total_length = total_length_;
+    header.posting_count = posting_count;
+    header.docs_offset = sizeof(Header);
+    header.terms_offset = header.docs_offset + docs_.size() * sizeof(DocEntry);
+    header.postings_offset = header.terms_offset + terms.size() * sizeof(TermEntry);
+
+    uint64_t offset = 0;
+    for (TermEntry& entry : terms) {
+        entry.postings = offset;
+        offset += entry.df;
+    }
+
+    std::filesystem::path temp = path;
+    temp += ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        error = "Cannot create " + temp.string() + ": " + std::strerror(errno);
+        return false;
+    }
+
+    bool ok = write_all(fd, &header, sizeof(header)) &&
+              write_all(fd, docs_.data(), docs_.size() * sizeof(DocEntry)) &&
+              write_all(fd, terms.data(), terms.size() * sizeof(TermEntry));
+    for (size_t i = 0; ok && i < terms.size(); ++i) {
+        const std::vector<Posting>& list = postings_.at(terms[i].hash);
+        ok = write_all(fd, list.data(), list.size() * sizeof(Posting));
+    }
+    if (!ok) {
+        error = "Failed to write " + temp.string() + ": " + std::strerror(errno);
+    }
+    if (::close(fd) != 0 && ok) {
+        error = "Failed to write " + temp.string() + ": " + std::strerror(errno);
+        ok = false;
+    }
+    if (ok && std::rename(temp.c_str(), path.c_str()) != 0) {
+        error = "Cannot rename " + temp.string() + ": " + std::strerror(errno);
+        ok = false;
+    }
+    if (!ok) {
+        ::unlink(temp.c_str());
+    }
+    return ok;
+}
+
+std::vector<Hit> search(const std::vector<const Segment*>& segments, std::string_view query, size_t limit,
+                        size_t* total) {
+    std::vector<uint64_t> hashes;
+    Tokenizer tokenizer(query);
+    std::string term;
+    while (tokenizer.next(term)) {
+        uint64_t hash = term_hash(term);
+        if (std::find(hashes.begin(), hashes.end(), hash) == hashes.end()) {
+            hashes.push_back(hash);
+        }
+    }
+
+    uint64_t doc_count = 0;
+    uint64_t total_length = 0;
+    for (const Segment* segment : segments) {
+        doc_count += segment->doc_count();
+        total_length += segment->total_length();
+    }
+    if (total != nullptr) {
+        *total = 0;
+    }
+    if (hashes.empty() || doc_count == 0) {
+        return {};
+    }
+    double average_length = std::max(1.0, static_cast<double>(total_length) / doc_count);
+
+    // 各查询词在全部段中的倒排表与文档频率
+    std::vector<std::vector<const TermEntry*>> entries(hashes.size(), std::vector<const TermEntry*>(segments.size()));
+    std::vector<uint64_t> dfs(hashes.size(), 0);
+    for (size_t t = 0; t < hashes.size(); ++t) {
+        for (size_t s = 0; s < segments.size(); ++s) {
+            entries[t][s] = segments[s]->find(hashes[t]);
+            dfs[t] += entries[t][s] != nullptr ? entries[t][s]->df : 0;
+        }
+    }
+
+    // 出现在大部分文档中的词（the、how等）对排序几乎没有贡献，却要遍历最长的倒排表；
+    // 查询中还有更具区分度的词时跳过它们
+    uint64_t common = doc_count / COMMON_TERM_DIVISOR;
+    bool has_rare = std::any_of(dfs.begin(), dfs.end(), [common](uint64_t df) { return df > 0 && df <= common; });
+
+    // 每个段一个按文档编号索引的得分数组，只有被查询词命中的段才分配
+    std::vector<std::vector<float>> scores(segments.size());
+    std::vector<std::pair<size_t, uint32_t>> matched;
+    for (size_t t = 0; t < hashes.size(); ++t) {
+        uint64_t df = dfs[t];
+        if (df == 0 || (has_rare && df > common)) {
+            continue;
+        }
+        double idf = std::log(1.0 + (doc_count - df + 0.5) / (df + 0.5));
+
+        for (size_t s = 0; s < segments.size(); ++s) {
+            const TermEntry* entry = entries[t][s];
+            if (entry == nullptr) {
+                continue;
+            }
+            const Segment& segment = *segments[s];
+            std::vector<float>& segment_scores = scores[s];
+            if (segment_scores.empty()) {
+                segment_scores.assign(segment.doc_count(), 0.0f);
+            }
+            const Posting* postings = segment.postings_at(*entry);
+            for (uint32_t i = 0; i < entry->df; ++i) {
+                const Posting& posting = postings[i];
+                double tf = posting.tf;
+                double norm = K1 * (1.0 - B + B * segment.doc(posting.doc).length / average_length);
+                if (segment_scores[posting.doc] == 0.0f) {
+                    matched.emplace_back(s, posting.doc);
+                }
+                segment_scores[posting.doc] += static_cast<float>(idf * tf * (K1 + 1.0) / (tf + norm));
+            }
+        }
+    }
+
+    std::vector<Hit> hits;
+    hits.reserve(matched.size());
+    for (const auto& m : matched) {
+        hits.push_back(Hit{m.first, m.second, scores[m.first][m.second]});
+    }
+    if (total != nullptr) {
+        *total = hits.size();
+    }
+
+    // 得分相同时较新的段与文档在前
+    auto better = [](const Hit& a, const Hit& b) {
+        if (a.score != b.score) {
+            return a.score > b.score;
+        }
+        return a.segment != b.segment ? a.segment > b.segment : a.doc > b.doc;
+    };
+    size_t keep = std::min(limit, hits.size());
+    std::partial_sort(hits.begin(), hits.begin() + keep, hits.end(), better);
+    hits.resize(keep);
+    return hits;
+}
+
+std::string snippet(std::string_view text, std::string_view query, size_t width) {
+    std::vector<std::string> terms;
+    Tokenizer query_tokenizer(query);
+    std::string term;
+    while (query_tokenizer.next(term)) {
+        if (std::find(terms.begin(), terms.end(), term) == terms.end()) {
+            terms.push_back(term);
+        }
+    }
+
+    // 在宽度为width的窗口内包含最多不同查询词的位置，相同时取最靠前的
+    std::vector<std::pair<size_t, size_t>> matches;
+    Tokenizer tokenizer(text);
+    while (tokenizer.next(term) && matches.size() < 4096) {
+        auto it = std::find(terms.begin(), terms.end(), term);
+        if (it != terms.end()) {
+            matches.emplace_back(tokenizer.begin(), static_cast<size_t>(it - terms.begin()));
+        }
+    }
+    size_t match = 0;
+    size_t best = 0;
+    std::vector<size_t> counts(terms.size(), 0);
+    size_t distinct = 0;
+    for (size_t lo = 0, hi = 0; hi < matches.size(); ++hi) {
+        if (counts[matches[hi].second]++ == 0) {
+            ++distinct;
+        }
+        while (matches[hi].first - matches[lo].first > width * 2 / 3) {
+            if (--counts[matches[lo].second] == 0) {
+                --distinct;
+            }
+            ++lo;
+        }
+        if (distinct > best) {
+            best = distinct;
+            match = matches[lo].first;
+        }
+    }
+
+    // 命中位置之前留出约三分之一的宽度，起止位置退到UTF-8字符边界
+    size_t begin = match > width / 3 ? match - width / 3 : 0;
+    size_t end = std::min(text.size(), begin + width);
+    auto continuation = [&](size_t pos) {
+        return pos < text.size() && (static_cast<unsigned char>(text[pos]) & 0xC0) == 0x80;
+    };
+    while (begin > 0 && continuation(begin)) {
+        --begin;
+    }
+    while (end > begin && continuation(end)) {
+        --end;
+    }
+
+    std::string result;
+    if (begin > 0) {
+        result += "...";
+    }
+    bool space = false;
+    for (size_t i = begin; i < end; ++i) {
+        char c = text[i];
+        if (c == '\n' || c == '\r' || c == '\t' || c == ' ') {
+            space = true;
+            continue;
+        }
+        if (space && !result.empty() && result != "...") {
+            result.push_back(' ');
+        }
+        space = false;
+        result.push_back(c);
+    }
+    if (end < text.size()) {
+        result += "...";
+    }
+    return result;
+}
+
+} // namespace text_index
+} // namespace lc